@@ -0,0 +1,361 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// POSIX
+#include <unistd.h>
+
+// STL
+#include <string>
+#include <vector>
+
+// Treadstone
+#include <treadstone.h>
+
+// Bench
+#include "bench/corpus.h"
+
+// Time each operation against each corpus and print one JSON object per
+// line: the operation, the corpus, ns/op, MB/s of document processed, and
+// how many allocations each operation made through the library's allocator.
+
+namespace
+{
+
+struct counts
+{
+    uint64_t allocs;
+};
+
+counts g_counts = {0};
+
+void*
+counting_alloc(void*, size_t sz)
+{
+    ++g_counts.allocs;
+    return malloc(sz);
+}
+
+void*
+counting_realloc(void*, void* ptr, size_t, size_t new_sz)
+{
+    ++g_counts.allocs;
+    return realloc(ptr, new_sz);
+}
+
+void
+counting_free(void*, void* ptr, size_t)
+{
+    free(ptr);
+}
+
+const treadstone_allocator counting = {counting_alloc, counting_realloc, counting_free, NULL};
+
+double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return double(ts.tv_sec) + double(ts.tv_nsec) / 1e9;
+}
+
+// one corpus, prepared in both forms
+struct prepared
+{
+    prepared() : c(NULL), binary(), value() {}
+
+    const corpus* c;
+    std::vector<std::string> binary;
+    std::string value;
+
+    private:
+        prepared(const prepared&);
+        prepared& operator = (const prepared&);
+};
+
+const unsigned char*
+bytes(const std::string& s)
+{
+    return reinterpret_cast<const unsigned char*>(s.data());
+}
+
+bool
+bench_json_to_binary(const prepared& p, size_t i, treadstone_transformer*, size_t* sz)
+{
+    const std::string& json(p.c->json[i]);
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    bool ok = treadstone_json_sz_to_binary_alloc(&counting, json.c_str(), json.size(),
+                                                 &binary, &binary_sz) == 0;
+    free(binary);
+    *sz = json.size();
+    return ok;
+}
+
+bool
+bench_binary_to_json(const prepared& p, size_t i, treadstone_transformer*, size_t* sz)
+{
+    char* json = NULL;
+    bool ok = treadstone_binary_to_json_alloc(&counting, bytes(p.binary[i]),
+                                              p.binary[i].size(), &json) == 0;
+    free(json);
+    *sz = p.binary[i].size();
+    return ok;
+}
+
+bool
+bench_validate(const prepared& p, size_t i, treadstone_transformer*, size_t* sz)
+{
+    *sz = p.binary[i].size();
+    return treadstone_binary_validate(bytes(p.binary[i]), p.binary[i].size()) == 0;
+}
+
+bool
+bench_extract(const prepared& p, size_t i, treadstone_transformer* t, size_t* sz)
+{
+    unsigned char* value = NULL;
+    size_t value_sz = 0;
+    *sz = p.binary[i].size();
+    bool ok = treadstone_transformer_reset(t, bytes(p.binary[i]), p.binary[i].size()) == 0 &&
+              treadstone_transformer_extract_value(t, p.c->path.c_str(), &value, &value_sz) == 0;
+    free(value);
+    return ok;
+}
+
+bool
+bench_set(const prepared& p, size_t i, treadstone_transformer* t, size_t* sz)
+{
+    *sz = p.binary[i].size();
+    return treadstone_transformer_reset(t, bytes(p.binary[i]), p.binary[i].size()) == 0 &&
+           treadstone_transformer_set_value(t, p.c->path.c_str(),
+                                            bytes(p.value), p.value.size()) == 0;
+}
+
+bool
+bench_unset(const prepared& p, size_t i, treadstone_transformer* t, size_t* sz)
+{
+    *sz = p.binary[i].size();
+    return treadstone_transformer_reset(t, bytes(p.binary[i]), p.binary[i].size()) == 0 &&
+           treadstone_transformer_unset_value(t, p.c->path.c_str()) == 0;
+}
+
+bool
+bench_append(const prepared& p, size_t i, treadstone_transformer* t, size_t* sz)
+{
+    *sz = p.binary[i].size();
+    return treadstone_transformer_reset(t, bytes(p.binary[i]), p.binary[i].size()) == 0 &&
+           treadstone_transformer_array_append_value(t, p.c->array_path.c_str(),
+                                                     bytes(p.value), p.value.size()) == 0;
+}
+
+struct operation
+{
+    const char* name;
+    bool (*fn)(const prepared& p, size_t i, treadstone_transformer* t, size_t* sz);
+};
+
+const operation operations[] = {
+    {"json_to_binary", bench_json_to_binary},
+    {"binary_to_json", bench_binary_to_json},
+    {"validate", bench_validate},
+    {"extract", bench_extract},
+    {"set", bench_set},
+    {"unset", bench_unset},
+    {"append", bench_append},
+};
+
+bool
+prepare(const corpus& c, prepared* p)
+{
+    p->c = &c;
+
+    for (size_t i = 0; i < c.json.size(); ++i)
+    {
+        unsigned char* binary = NULL;
+        size_t binary_sz = 0;
+
+        if (treadstone_json_sz_to_binary(c.json[i].c_str(), c.json[i].size(),
+                                         &binary, &binary_sz) < 0)
+        {
+            return false;
+        }
+
+        p->binary.push_back(std::string(reinterpret_cast<char*>(binary), binary_sz));
+        free(binary);
+    }
+
+    unsigned char* value = NULL;
+    size_t value_sz = 0;
+
+    if (treadstone_integer_to_binary(42, &value, &value_sz) < 0)
+    {
+        return false;
+    }
+
+    p->value.assign(reinterpret_cast<char*>(value), value_sz);
+    free(value);
+    return true;
+}
+
+void
+usage()
+{
+    fprintf(stderr, "usage: treadstone-bench [-t seconds] [-o operation] [-c corpus] [-g params]\n"
+                    "  -g  run against one generated corpus instead; see treadstone-corpus\n");
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    double min_time = 0.25;
+    const char* only_op = NULL;
+    const char* only_corpus = NULL;
+    const char* generate = NULL;
+    int o;
+
+    while ((o = getopt(argc, argv, "t:o:c:g:h")) != -1)
+    {
+        switch (o)
+        {
+            case 't':
+                min_time = atof(optarg);
+                break;
+            case 'o':
+                only_op = optarg;
+                break;
+            case 'c':
+                only_corpus = optarg;
+                break;
+            case 'g':
+                generate = optarg;
+                break;
+            default:
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<corpus> corpora;
+
+    if (generate)
+    {
+        corpus_params params;
+
+        if (!parse_corpus_params(generate, &params))
+        {
+            fprintf(stderr, "bad corpus parameters: %s\n", generate);
+            return EXIT_FAILURE;
+        }
+
+        corpora.push_back(corpus());
+        generate_corpus(params, &corpora.back());
+    }
+    else
+    {
+        standard_corpora(&corpora);
+    }
+    // reset onto each document in turn; this is just somewhere to start
+    const unsigned char empty[] = {0x40, 0x00};
+    treadstone_transformer* t = treadstone_transformer_create_alloc(&counting, empty, sizeof(empty));
+
+    if (!t)
+    {
+        fprintf(stderr, "could not create a transformer\n");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t c = 0; c < corpora.size(); ++c)
+    {
+        if (only_corpus && corpora[c].name != only_corpus)
+        {
+            continue;
+        }
+
+        prepared p;
+
+        if (!prepare(corpora[c], &p))
+        {
+            fprintf(stderr, "corpus %s is not valid JSON\n", corpora[c].name.c_str());
+            return EXIT_FAILURE;
+        }
+
+        for (size_t op = 0; op < sizeof(operations) / sizeof(operations[0]); ++op)
+        {
+            if (only_op && strcmp(operations[op].name, only_op) != 0)
+            {
+                continue;
+            }
+
+            uint64_t ops = 0;
+            uint64_t processed = 0;
+            g_counts.allocs = 0;
+            const double start = now();
+            double elapsed = 0;
+
+            // whole passes over the corpus, so that every document counts
+            do
+            {
+                for (size_t i = 0; i < p.binary.size(); ++i)
+                {
+                    size_t sz = 0;
+
+                    if (!operations[op].fn(p, i, t, &sz))
+                    {
+                        fprintf(stderr, "%s failed on %s document %zu\n",
+                                operations[op].name, corpora[c].name.c_str(), i);
+                        return EXIT_FAILURE;
+                    }
+
+                    ++ops;
+                    processed += sz;
+                }
+
+                elapsed = now() - start;
+            } while (elapsed < min_time);
+
+            printf("{\"op\": \"%s\", \"corpus\": \"%s\", \"ops\": %llu, "
+                   "\"ns_per_op\": %.1f, \"mb_per_s\": %.1f, \"allocs_per_op\": %.2f}\n",
+                   operations[op].name, corpora[c].name.c_str(),
+                   static_cast<unsigned long long>(ops),
+                   elapsed * 1e9 / double(ops), double(processed) / 1e6 / elapsed,
+                   double(g_counts.allocs) / double(ops));
+            fflush(stdout);
+        }
+    }
+
+    treadstone_transformer_destroy(t);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,559 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Bench
+#include "bench/corpus.h"
+
+namespace
+{
+
+// xorshift64*, so that every run and every platform sees the same corpora
+class prng
+{
+    public:
+        prng(uint64_t seed) : m_state(seed ? seed : 1) {}
+
+    public:
+        uint64_t next()
+        {
+            m_state ^= m_state >> 12;
+            m_state ^= m_state << 25;
+            m_state ^= m_state >> 27;
+            return m_state * 2685821657736338717ULL;
+        }
+        uint64_t below(uint64_t n) { return next() % n; }
+
+    private:
+        uint64_t m_state;
+};
+
+void
+append_integer(std::string* json, prng* r)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lld", static_cast<long long>(r->next() >> (r->below(60) + 1)) *
+                                      (r->below(4) == 0 ? -1 : 1));
+    *json += buf;
+}
+
+void
+append_double(std::string* json, prng* r)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.6g", double(r->next() >> 11) / double(1ULL << 40));
+    *json += buf;
+}
+
+void
+append_number(std::string* json, prng* r)
+{
+    if (r->below(2) == 0)
+    {
+        append_integer(json, r);
+    }
+    else
+    {
+        append_double(json, r);
+    }
+}
+
+void
+append_string(std::string* json, prng* r, size_t length)
+{
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    *json += '"';
+
+    for (size_t i = 0; i < length; ++i)
+    {
+        // an occasional escape, as real text has
+        if (r->below(64) == 0)
+        {
+            *json += r->below(2) ? "\\n" : "\\\"";
+        }
+        else
+        {
+            *json += alphabet[r->below(sizeof(alphabet) - 1)];
+        }
+    }
+
+    *json += '"';
+}
+
+void
+small_flat(corpus* c, prng* r)
+{
+    c->name = "small_flat";
+    c->path = "name";
+    c->array_path = "tags";
+
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        std::string json("{\"id\": ");
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%zu", i);
+        json += buf;
+        json += ", \"name\": ";
+        append_string(&json, r, 8 + r->below(16));
+        json += ", \"active\": ";
+        json += r->below(2) ? "true" : "false";
+        json += ", \"score\": ";
+        append_number(&json, r);
+        json += ", \"parent\": null, \"tags\": [\"a\", \"b\"]}";
+        c->json.push_back(json);
+    }
+}
+
+void
+wide_objects(corpus* c, prng* r)
+{
+    c->name = "wide_objects";
+    c->path = "k250";
+    c->array_path = "list";
+
+    for (size_t i = 0; i < 50; ++i)
+    {
+        std::string json("{");
+
+        for (size_t k = 0; k < 500; ++k)
+        {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "\"k%zu\": ", k);
+            json += buf;
+
+            if (k % 2)
+            {
+                append_number(&json, r);
+            }
+            else
+            {
+                append_string(&json, r, 4 + r->below(8));
+            }
+
+            json += ", ";
+        }
+
+        json += "\"list\": []}";
+        c->json.push_back(json);
+    }
+}
+
+void
+deep_nesting(corpus* c, prng* r)
+{
+    const size_t depth = 64;
+    c->name = "deep_nesting";
+    c->path.clear();
+
+    for (size_t d = 0; d < depth; ++d)
+    {
+        c->path += "a.";
+    }
+
+    c->array_path = c->path + "l";
+    c->path += "v";
+
+    for (size_t i = 0; i < 200; ++i)
+    {
+        std::string json;
+
+        for (size_t d = 0; d < depth; ++d)
+        {
+            json += "{\"x\": ";
+            append_number(&json, r);
+            json += ", \"a\": ";
+        }
+
+        json += "{\"v\": 1, \"l\": [1]}";
+        json += std::string(depth, '}');
+        c->json.push_back(json);
+    }
+}
+
+void
+numeric_heavy(corpus* c, prng* r)
+{
+    c->name = "numeric_heavy";
+    c->path = "sum";
+    c->array_path = "values";
+
+    for (size_t i = 0; i < 100; ++i)
+    {
+        std::string json("{\"sum\": 0, \"values\": [");
+
+        for (size_t v = 0; v < 500; ++v)
+        {
+            json += v ? ", " : "";
+            append_number(&json, r);
+        }
+
+        json += "]}";
+        c->json.push_back(json);
+    }
+}
+
+void
+string_heavy(corpus* c, prng* r)
+{
+    c->name = "string_heavy";
+    c->path = "title";
+    c->array_path = "lines";
+
+    for (size_t i = 0; i < 100; ++i)
+    {
+        std::string json("{\"title\": ");
+        append_string(&json, r, 40);
+        json += ", \"body\": ";
+        append_string(&json, r, 2000 + r->below(2000));
+        json += ", \"lines\": [";
+
+        for (size_t l = 0; l < 20; ++l)
+        {
+            json += l ? ", " : "";
+            append_string(&json, r, 80);
+        }
+
+        json += "]}";
+        c->json.push_back(json);
+    }
+}
+
+void
+large_arrays(corpus* c, prng* r)
+{
+    c->name = "large_arrays";
+    c->path = "items[50000]";
+    c->array_path = "items";
+    std::string json("{\"items\": [");
+
+    for (size_t i = 0; i < 100000; ++i)
+    {
+        json += i ? ", " : "";
+
+        if (i % 3 == 0)
+        {
+            append_string(&json, r, 6);
+        }
+        else
+        {
+            append_number(&json, r);
+        }
+    }
+
+    json += "]}";
+    c->json.push_back(json);
+}
+
+class generator
+{
+    public:
+        generator(const corpus_params& p) : m_p(p), m_r(p.seed), m_json(NULL) {}
+
+    public:
+        void document(size_t id, std::string* json);
+
+    private:
+        void value(size_t level);
+        void members(size_t level);
+        void elements(size_t level);
+        void scalar();
+
+    private:
+        const corpus_params& m_p;
+        prng m_r;
+        std::string* m_json;
+};
+
+void
+generator :: document(size_t id, std::string* json)
+{
+    m_json = json;
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%zu", id);
+    *m_json += "{\"id\": ";
+    *m_json += buf;
+    *m_json += ", \"items\": [";
+    elements(1);
+    *m_json += "], ";
+    members(0);
+    *m_json += "}";
+}
+
+void
+generator :: value(size_t level)
+{
+    if (level <= m_p.depth && m_r.below(100) < m_p.containers)
+    {
+        if (m_r.below(2))
+        {
+            *m_json += "{";
+            members(level);
+            *m_json += "}";
+        }
+        else
+        {
+            *m_json += "[";
+            elements(level);
+            *m_json += "]";
+        }
+    }
+    else
+    {
+        scalar();
+    }
+}
+
+void
+generator :: members(size_t level)
+{
+    size_t n = 1 + m_r.below(2 * m_p.fanout - 1);
+    n = n < m_p.keys ? n : m_p.keys;
+    std::vector<uint64_t> chosen;
+
+    while (chosen.size() < n)
+    {
+        uint64_t k = m_r.below(m_p.keys);
+        bool dup = false;
+
+        for (size_t i = 0; i < chosen.size(); ++i)
+        {
+            dup = dup || chosen[i] == k;
+        }
+
+        if (dup)
+        {
+            continue;
+        }
+
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%s\"k%llu\": ", chosen.empty() ? "" : ", ",
+                 static_cast<unsigned long long>(k));
+        *m_json += buf;
+        chosen.push_back(k);
+        value(level + 1);
+    }
+}
+
+void
+generator :: elements(size_t level)
+{
+    size_t n = m_p.array_min + m_r.below(m_p.array_max - m_p.array_min + 1);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        *m_json += i ? ", " : "";
+        value(level + 1);
+    }
+}
+
+void
+generator :: scalar()
+{
+    uint64_t pick = m_r.below(m_p.integers + m_p.doubles + m_p.strings + m_p.literals);
+
+    if (pick < m_p.integers)
+    {
+        append_integer(m_json, &m_r);
+    }
+    else if ((pick -= m_p.integers) < m_p.doubles)
+    {
+        append_double(m_json, &m_r);
+    }
+    else if ((pick -= m_p.doubles) < m_p.strings)
+    {
+        size_t length = m_p.string_min;
+
+        while (length < m_p.string_max && m_r.below(m_p.string_mean + 1) != 0)
+        {
+            ++length;
+        }
+
+        append_string(m_json, &m_r, length);
+    }
+    else
+    {
+        static const char* literals[] = {"true", "false", "null"};
+        *m_json += literals[m_r.below(3)];
+    }
+}
+
+} // namespace
+
+corpus :: corpus(const corpus& other)
+    : name(other.name)
+    , json(other.json)
+    , path(other.path)
+    , array_path(other.array_path)
+{
+}
+
+corpus :: ~corpus() throw ()
+{
+}
+
+corpus_params :: corpus_params()
+    : seed(1)
+    , documents(1000)
+    , depth(3)
+    , fanout(8)
+    , keys(64)
+    , string_min(0)
+    , string_mean(16)
+    , string_max(256)
+    , integers(40)
+    , doubles(20)
+    , strings(30)
+    , literals(10)
+    , array_min(0)
+    , array_max(16)
+    , containers(30)
+{
+}
+
+bool
+parse_corpus_params(const char* spec, corpus_params* params)
+{
+    struct field
+    {
+        const char* name;
+        uint64_t corpus_params::* u64;
+        size_t corpus_params::* sz;
+    };
+    static const field fields[] = {
+        {"seed", &corpus_params::seed, NULL},
+        {"documents", NULL, &corpus_params::documents},
+        {"depth", NULL, &corpus_params::depth},
+        {"fanout", NULL, &corpus_params::fanout},
+        {"keys", NULL, &corpus_params::keys},
+        {"string_min", NULL, &corpus_params::string_min},
+        {"string_mean", NULL, &corpus_params::string_mean},
+        {"string_max", NULL, &corpus_params::string_max},
+        {"integers", NULL, &corpus_params::integers},
+        {"doubles", NULL, &corpus_params::doubles},
+        {"strings", NULL, &corpus_params::strings},
+        {"literals", NULL, &corpus_params::literals},
+        {"array_min", NULL, &corpus_params::array_min},
+        {"array_max", NULL, &corpus_params::array_max},
+        {"containers", NULL, &corpus_params::containers},
+    };
+    std::string s(spec);
+    size_t start = 0;
+
+    while (start < s.size())
+    {
+        size_t end = s.find(',', start);
+        end = end == std::string::npos ? s.size() : end;
+        std::string item(s.substr(start, end - start));
+        start = end + 1;
+        size_t eq = item.find('=');
+
+        if (eq == std::string::npos)
+        {
+            return false;
+        }
+
+        std::string name(item.substr(0, eq));
+        const char* value = item.c_str() + eq + 1;
+        char* value_end = NULL;
+        unsigned long long x = strtoull(value, &value_end, 10);
+        bool found = false;
+
+        if (*value == '\0' || *value_end != '\0')
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i)
+        {
+            if (name == fields[i].name)
+            {
+                if (fields[i].u64)
+                {
+                    params->*fields[i].u64 = x;
+                }
+                else
+                {
+                    params->*fields[i].sz = x;
+                }
+
+                found = true;
+            }
+        }
+
+        if (!found)
+        {
+            return false;
+        }
+    }
+
+    return params->fanout > 0 && params->keys > 0 &&
+           params->string_min <= params->string_max &&
+           params->array_min <= params->array_max &&
+           params->integers + params->doubles + params->strings + params->literals > 0;
+}
+
+void
+generate_corpus(const corpus_params& params, corpus* c)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "generated_%llu", static_cast<unsigned long long>(params.seed));
+    c->name = buf;
+    c->path = "id";
+    c->array_path = "items";
+    generator g(params);
+
+    for (size_t i = 0; i < params.documents; ++i)
+    {
+        c->json.push_back(std::string());
+        g.document(i, &c->json.back());
+    }
+}
+
+void
+standard_corpora(std::vector<corpus>* corpora)
+{
+    void (*generators[])(corpus*, prng*) = {
+        small_flat, wide_objects, deep_nesting,
+        numeric_heavy, string_heavy, large_arrays
+    };
+
+    for (size_t i = 0; i < sizeof(generators) / sizeof(generators[0]); ++i)
+    {
+        prng r(i + 1);
+        corpora->push_back(corpus());
+        generators[i](&corpora->back(), &r);
+    }
+
+    corpora->push_back(corpus());
+    generate_corpus(corpus_params(), &corpora->back());
+    corpora->back().name = "mixed";
+}
@@ -0,0 +1,99 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef treadstone_bench_corpus_h_
+#define treadstone_bench_corpus_h_
+
+// C
+#include <stdint.h>
+#include <stdlib.h>
+
+// STL
+#include <string>
+#include <vector>
+
+// A named set of JSON documents of one shape.  Every document holds a scalar
+// at path and an array at array_path, for the transformer benchmarks.
+struct corpus
+{
+    corpus() : name(), json(), path(), array_path() {}
+    corpus(const corpus& other);
+    ~corpus() throw ();
+
+    std::string name;
+    std::vector<std::string> json;
+    std::string path;
+    std::string array_path;
+};
+
+// The shape of a generated corpus.  Every document is an object with an
+// integer "id" and an array "items", so that the transformer benchmarks have
+// something to work on, plus members drawn from these distributions.  Equal
+// parameters always generate the same documents.
+struct corpus_params
+{
+    corpus_params();
+
+    uint64_t seed;
+    size_t documents;
+    // containers nest at most this far below the root
+    size_t depth;
+    // members per object, uniform in [1, 2 * fanout - 1]
+    size_t fanout;
+    // keys are drawn from this many distinct names
+    size_t keys;
+    // string lengths: string_min plus a geometric variate with this mean,
+    // capped at string_max
+    size_t string_min;
+    size_t string_mean;
+    size_t string_max;
+    // relative weights of the scalar types
+    size_t integers;
+    size_t doubles;
+    size_t strings;
+    size_t literals;
+    // elements per array, uniform in [array_min, array_max]
+    size_t array_min;
+    size_t array_max;
+    // percent chance that a value above the depth limit is a container
+    size_t containers;
+};
+
+// Set the parameters named in spec, a comma-separated list of name=value
+// such as "seed=7,depth=5".  Returns false on an unknown name or bad value.
+bool
+parse_corpus_params(const char* spec, corpus_params* params);
+
+void
+generate_corpus(const corpus_params& params, corpus* c);
+
+// the corpora every benchmark runs against, the same on every run
+void
+standard_corpora(std::vector<corpus>* corpora);
+
+#endif // treadstone_bench_corpus_h_
@@ -0,0 +1,194 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// e
+#include <e/varint.h>
+
+// Treadstone
+#include <treadstone.h>
+
+// Bench
+#include "bench/corpus.h"
+
+// Write a generated corpus as newline-delimited JSON, as binary records (a
+// varint length before each document, as treadstone-convert writes them), or
+// as a container file.  The parameters are those of parse_corpus_params.
+
+static void
+usage()
+{
+    fprintf(stderr, "usage: treadstone-corpus [-f json|records|container] [-o output] [params]\n"
+                    "  params is a comma-separated list of name=value; the names are\n"
+                    "  seed documents depth fanout keys string_min string_mean string_max\n"
+                    "  integers doubles strings literals array_min array_max containers\n");
+}
+
+static bool
+write_all(int fd, const void* data, size_t data_sz)
+{
+    const char* ptr = static_cast<const char*>(data);
+
+    while (data_sz > 0)
+    {
+        ssize_t amt = write(fd, ptr, data_sz);
+
+        if (amt < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (amt < 0)
+        {
+            return false;
+        }
+
+        ptr += amt;
+        data_sz -= amt;
+    }
+
+    return true;
+}
+
+int
+main(int argc, char* argv[])
+{
+    const char* fmt = "json";
+    const char* out_path = NULL;
+    int o;
+
+    while ((o = getopt(argc, argv, "f:o:h")) != -1)
+    {
+        switch (o)
+        {
+            case 'f':
+                fmt = optarg;
+                break;
+            case 'o':
+                out_path = optarg;
+                break;
+            default:
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+
+    corpus_params params;
+
+    if (argc - optind > 1 ||
+        (optind < argc && !parse_corpus_params(argv[optind], &params)) ||
+        (strcmp(fmt, "json") != 0 && strcmp(fmt, "records") != 0 && strcmp(fmt, "container") != 0))
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    int fd = out_path ? open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0666) : STDOUT_FILENO;
+
+    if (fd < 0)
+    {
+        fprintf(stderr, "could not open %s: %s\n", out_path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    corpus c;
+    generate_corpus(params, &c);
+    treadstone_container_writer* w = NULL;
+
+    if (strcmp(fmt, "container") == 0 &&
+        !(w = treadstone_container_writer_create(fd, TREADSTONE_CONTAINER_HASHES)))
+    {
+        fprintf(stderr, "could not write a container: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    bool ok = true;
+
+    for (size_t i = 0; ok && i < c.json.size(); ++i)
+    {
+        if (strcmp(fmt, "json") == 0)
+        {
+            ok = write_all(fd, c.json[i].data(), c.json[i].size()) &&
+                 write_all(fd, "\n", 1);
+            continue;
+        }
+
+        unsigned char* binary = NULL;
+        size_t binary_sz = 0;
+
+        if (treadstone_json_sz_to_binary(c.json[i].c_str(), c.json[i].size(),
+                                         &binary, &binary_sz) < 0)
+        {
+            fprintf(stderr, "document %zu did not convert: %s\n", i, strerror(errno));
+            return EXIT_FAILURE;
+        }
+
+        if (w)
+        {
+            ok = treadstone_container_writer_append(w, binary, binary_sz) == 0;
+        }
+        else
+        {
+            unsigned char header[10];
+            unsigned char* end = e::packvarint64(binary_sz, header);
+            ok = write_all(fd, header, end - header) &&
+                 write_all(fd, binary, binary_sz);
+        }
+
+        free(binary);
+    }
+
+    if (ok && w)
+    {
+        ok = treadstone_container_writer_finish(w) == 0;
+    }
+
+    if (!ok)
+    {
+        fprintf(stderr, "could not write output: %s\n", strerror(errno));
+    }
+
+    treadstone_container_writer_destroy(w);
+
+    if (fd > STDOUT_FILENO)
+    {
+        close(fd);
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -38,6 +38,114 @@ extern "C"
 {
 #endif /* __cplusplus */
 
+/* Every buffer the library allocates comes from an allocator.  The plain
+ * calls use malloc/realloc/free; the *_alloc variants and contexts created
+ * with one use the caller's allocator instead (NULL selects the default).
+ * realloc must accept a NULL ptr, as realloc(3) does.  The sizes passed to
+ * realloc and free are those last requested for the block.  Buffers returned
+ * to the caller are exactly the size reported alongside them, or for JSON
+ * text its length plus the NUL, and must be released through the same
+ * allocator with that size. */
+struct treadstone_allocator
+{
+    void* (*alloc)(void* ctx, size_t sz);
+    void* (*realloc)(void* ctx, void* ptr, size_t old_sz, size_t new_sz);
+    void (*free)(void* ctx, void* ptr, size_t sz);
+    void* ctx;
+};
+
+/* A bump arena.  Memory handed out by an arena is only reclaimed when the
+ * arena is reset or destroyed; freeing or growing the most recent allocation
+ * is done in place. */
+struct treadstone_arena;
+
+struct treadstone_arena* treadstone_arena_create(size_t chunk_sz);
+void treadstone_arena_destroy(struct treadstone_arena*);
+void treadstone_arena_reset(struct treadstone_arena*);
+/* fill in a so that it allocates from the arena */
+void treadstone_arena_allocator(struct treadstone_arena*,
+                                struct treadstone_allocator* a);
+
+/* Conversion, validation and parsing refuse values nested more deeply than
+ * this, failing with EOVERFLOW instead of growing without bound.  The limit
+ * is process-wide. */
+#define TREADSTONE_DEFAULT_MAX_DEPTH 512
+void treadstone_set_max_depth(unsigned depth);
+unsigned treadstone_get_max_depth(void);
+
+/* Statistics about the library's work, collected only while enabled; when
+ * disabled each operation pays one predictable branch.  Every thread counts
+ * into its own block without locks, and a snapshot sums the blocks, so it may
+ * miss operations still in progress.  Counts only ever grow. */
+#define TREADSTONE_STATS_BUCKETS 64
+/* bucket 0 counts zeros, bucket i values in [2^(i-1), 2^i), the last the
+ * rest */
+struct treadstone_stats_histogram
+{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t buckets[TREADSTONE_STATS_BUCKETS];
+};
+struct treadstone_stats
+{
+    uint64_t json_to_binary;
+    uint64_t json_to_binary_bytes_in;
+    uint64_t json_to_binary_bytes_out;
+    uint64_t binary_to_json;
+    uint64_t binary_to_json_bytes_in;
+    uint64_t binary_to_json_bytes_out;
+    uint64_t validate;
+    uint64_t validate_bytes;
+    /* transformer operations, the members and elements they walked to find
+     * their paths, and the bytes their rewrites moved */
+    uint64_t transforms;
+    uint64_t transform_steps;
+    uint64_t transform_bytes_copied;
+    /* output buffers grown while converting or rewriting */
+    uint64_t reallocs;
+    struct treadstone_stats_histogram json_to_binary_ns;
+    struct treadstone_stats_histogram binary_to_json_ns;
+    struct treadstone_stats_histogram transform_ns;
+    /* size of each document a transformer rewrote */
+    struct treadstone_stats_histogram rewrite_bytes;
+};
+
+void treadstone_stats_enable(int enable);
+int treadstone_stats_enabled(void);
+void treadstone_stats_snapshot(struct treadstone_stats* stats);
+
+/* Hooks called around every conversion, validation and transformer
+ * operation, for attributing latency to individual documents.  input_sz is
+ * the size of the input document, path the transformer's path or NULL, and
+ * status the operation's return value.  The hooks must stay valid until they
+ * are replaced and every operation that started under them has finished.
+ * Pass NULL to remove them.  A library configured with --disable-tracing
+ * compiles the hooks out and refuses to register any. */
+enum treadstone_trace_op
+{
+    TREADSTONE_TRACE_JSON_TO_BINARY,
+    TREADSTONE_TRACE_BINARY_TO_JSON,
+    TREADSTONE_TRACE_VALIDATE,
+    TREADSTONE_TRACE_UNSET,
+    TREADSTONE_TRACE_SET,
+    TREADSTONE_TRACE_EXTRACT,
+    TREADSTONE_TRACE_ARRAY_PREPEND,
+    TREADSTONE_TRACE_ARRAY_APPEND,
+    TREADSTONE_TRACE_NUMERIC,
+    TREADSTONE_TRACE_STRING_APPEND,
+    TREADSTONE_TRACE_ARRAY_INSERT,
+    TREADSTONE_TRACE_ARRAY_REMOVE
+};
+struct treadstone_trace_hooks
+{
+    void (*begin)(void* ctx, enum treadstone_trace_op op,
+                  size_t input_sz, const char* path);
+    void (*end)(void* ctx, enum treadstone_trace_op op,
+                size_t input_sz, const char* path, int status);
+    void* ctx;
+};
+int treadstone_set_trace_hooks(const struct treadstone_trace_hooks* hooks);
+
 int treadstone_json_to_binary(const char* json,
                               unsigned char** binary, size_t* binary_sz);
 int treadstone_json_sz_to_binary(const char* json, size_t json_sz,
@@ -45,6 +153,230 @@ int treadstone_json_sz_to_binary(const char* json, size_t json_sz,
 int treadstone_binary_to_json(const unsigned char* binary, size_t binary_sz,
                               char** json);
 int treadstone_binary_validate(const unsigned char* binary, size_t binary_sz);
+/* The exact size the conversions above would produce, found in one pass
+ * that checks the input as they would; the JSON length leaves out the NUL. */
+int treadstone_json_binary_length(const char* json, size_t json_sz, size_t* binary_sz);
+int treadstone_binary_json_length(const unsigned char* binary, size_t binary_sz, size_t* json_sz);
+/* String bytes in the binary are decoded UTF-8; see doc/binary.txt.
+ * Binaries written before that change hold each string as its escaped JSON
+ * text.  Upgrade rewrites one such binary in the current form.  It cannot
+ * tell the two forms apart and decodes whatever escapes it finds, so run it
+ * exactly once over each stored document. */
+int treadstone_binary_upgrade_strings(const unsigned char* binary, size_t binary_sz,
+                                      unsigned char** new_binary, size_t* new_binary_sz);
+int treadstone_binary_upgrade_strings_alloc(const struct treadstone_allocator* a,
+                                            const unsigned char* binary, size_t binary_sz,
+                                            unsigned char** new_binary, size_t* new_binary_sz);
+
+/* A pool of threads for the parallel conversions.  threads counts the
+ * calling thread, which works alongside the pool; 0 picks one per core.  A
+ * pool runs one call at a time and may be shared between callers. */
+struct treadstone_pool;
+
+struct treadstone_pool* treadstone_pool_create(unsigned threads);
+void treadstone_pool_destroy(struct treadstone_pool*);
+unsigned treadstone_pool_threads(const struct treadstone_pool*);
+/* Produces exactly what treadstone_json_sz_to_binary does.  The members of a
+ * large top-level array or object are split into runs that are converted on
+ * the pool; anything else, or a NULL pool, is converted on the caller. */
+int treadstone_json_sz_to_binary_parallel(struct treadstone_pool* pool,
+                                          const char* json, size_t json_sz,
+                                          unsigned char** binary, size_t* binary_sz);
+int treadstone_json_sz_to_binary_parallel_alloc(const struct treadstone_allocator* a,
+                                                struct treadstone_pool* pool,
+                                                const char* json, size_t json_sz,
+                                                unsigned char** binary, size_t* binary_sz);
+/* Convert n documents, which need not be NUL-terminated, into one buffer:
+ * document i is [offsets[i], offsets[i + 1]) of *binary, so offsets must hold
+ * n + 1 entries.  A document that is not valid JSON gets an empty range.  The
+ * batch is shared out across the pool, or converted on the caller if pool is
+ * NULL.  If nothing converts, *binary is NULL. */
+int treadstone_batch_json_to_binary(struct treadstone_pool* pool, size_t n,
+                                    const char* const* json, const size_t* json_sz,
+                                    unsigned char** binary, size_t* binary_sz,
+                                    size_t* offsets);
+int treadstone_batch_json_to_binary_alloc(const struct treadstone_allocator* a,
+                                          struct treadstone_pool* pool, size_t n,
+                                          const char* const* json, const size_t* json_sz,
+                                          unsigned char** binary, size_t* binary_sz,
+                                          size_t* offsets);
+/* The reverse, with the same layout; the JSON texts are not NUL-terminated,
+ * and *json_sz is the size of the buffer. */
+int treadstone_batch_binary_to_json(struct treadstone_pool* pool, size_t n,
+                                    const unsigned char* const* binary, const size_t* binary_sz,
+                                    char** json, size_t* json_sz,
+                                    size_t* offsets);
+int treadstone_batch_binary_to_json_alloc(const struct treadstone_allocator* a,
+                                          struct treadstone_pool* pool, size_t n,
+                                          const unsigned char* const* binary, const size_t* binary_sz,
+                                          char** json, size_t* json_sz,
+                                          size_t* offsets);
+
+/* A file of many documents, indexed by ordinal; see doc/container.txt.  The
+ * writer appends to fd, which it neither seeks nor closes, and the file is
+ * only complete once finish writes the index.  Documents must be valid. */
+#define TREADSTONE_CONTAINER_HASHES 1
+struct treadstone_container_writer;
+
+struct treadstone_container_writer* treadstone_container_writer_create(int fd, unsigned flags);
+void treadstone_container_writer_destroy(struct treadstone_container_writer*);
+int treadstone_container_writer_append(struct treadstone_container_writer*,
+                                       const unsigned char* binary, size_t binary_sz);
+int treadstone_container_writer_finish(struct treadstone_container_writer*);
+
+/* A reader maps the whole file.  Documents are views into the mapping, valid
+ * until the container is closed. */
+struct treadstone_container;
+
+struct treadstone_container* treadstone_container_open(const char* path);
+void treadstone_container_close(struct treadstone_container*);
+uint64_t treadstone_container_count(const struct treadstone_container*);
+int treadstone_container_get(const struct treadstone_container*, uint64_t ordinal,
+                             const unsigned char** binary, size_t* binary_sz);
+/* check a document against its hash, when the file has them, and validate it */
+int treadstone_container_verify(const struct treadstone_container*, uint64_t ordinal);
+
+/* Measure the shape of a corpus, one document at a time, to see which
+ * encoding changes would pay off.  Histograms bucket like the stats ones.
+ * The alternative sizes are estimates for the whole corpus: they change
+ * only the values in question and leave container lengths as they are. */
+struct treadstone_profile;
+struct treadstone_profile_summary
+{
+    uint64_t documents;
+    uint64_t binary_bytes;
+    uint64_t json_bytes;
+    uint64_t objects;
+    uint64_t arrays;
+    uint64_t strings;
+    uint64_t doubles;
+    uint64_t integers;
+    uint64_t trues;
+    uint64_t falses;
+    uint64_t nulls;
+    uint64_t negative_integers;
+    /* doubles with an integral value, and those a float holds exactly */
+    uint64_t integral_doubles;
+    uint64_t float_doubles;
+    /* string values and keys that need escaping in JSON */
+    uint64_t escaped_strings;
+    uint64_t escaped_keys;
+    /* every member's key, and each distinct key once, with their headers */
+    uint64_t keys;
+    uint64_t key_bytes;
+    uint64_t distinct_keys;
+    uint64_t distinct_key_bytes;
+    struct treadstone_stats_histogram depth;
+    struct treadstone_stats_histogram object_width;
+    struct treadstone_stats_histogram array_length;
+    struct treadstone_stats_histogram string_length;
+    struct treadstone_stats_histogram key_length;
+    struct treadstone_stats_histogram integer_bytes;
+    /* integers as zigzag varints */
+    uint64_t zigzag_bytes;
+    /* keys as a tag and varint reference into a corpus-wide dictionary,
+     * numbered most frequent first, plus the dictionary itself */
+    uint64_t key_dictionary_bytes;
+    /* doubles a float holds exactly in five bytes instead of nine */
+    uint64_t float_bytes;
+    /* all three together */
+    uint64_t combined_bytes;
+};
+
+struct treadstone_profile* treadstone_profile_create(void);
+void treadstone_profile_destroy(struct treadstone_profile*);
+/* both fail with EINVAL, counting nothing, for an invalid document */
+int treadstone_profile_binary(struct treadstone_profile*,
+                              const unsigned char* binary, size_t binary_sz);
+int treadstone_profile_json(struct treadstone_profile*,
+                            const char* json, size_t json_sz);
+int treadstone_profile_summarize(const struct treadstone_profile*,
+                                 struct treadstone_profile_summary* summary);
+
+/* A structural index built while validating: the extent, depth and key hash
+ * of every value, so that lookups skip straight to the bytes they need.  An
+ * index describes one particular document and must be rebuilt if it changes. */
+struct treadstone_index;
+
+struct treadstone_index* treadstone_index_create(void);
+struct treadstone_index* treadstone_index_create_alloc(const struct treadstone_allocator* a);
+void treadstone_index_destroy(struct treadstone_index*);
+/* validate and index in one pass; on failure the index is left empty */
+int treadstone_binary_validate_index(const unsigned char* binary, size_t binary_sz,
+                                     struct treadstone_index* idx);
+/* find path within the indexed document; the value points into binary */
+int treadstone_index_lookup(const struct treadstone_index* idx,
+                            const unsigned char* binary,
+                            const char* path,
+                            const unsigned char** value, size_t* value_sz);
+
+int treadstone_json_sz_to_binary_alloc(const struct treadstone_allocator* a,
+                                       const char* json, size_t json_sz,
+                                       unsigned char** binary, size_t* binary_sz);
+int treadstone_binary_to_json_alloc(const struct treadstone_allocator* a,
+                                    const unsigned char* binary, size_t binary_sz,
+                                    char** json);
+
+/* Receives JSON text as it is produced; return 0 to continue, or nonzero to
+ * abort the conversion, which then fails with whatever errno the sink set. */
+typedef int (*treadstone_json_sink)(void* ctx, const char* json, size_t json_sz);
+/* Convert without holding the JSON in memory: text accumulates in buf and is
+ * handed to sink each time buf fills, so buf_sz sets the chunk size.  The
+ * binary is validated first; an invalid document never reaches the sink. */
+int treadstone_binary_to_json_sink(const unsigned char* binary, size_t binary_sz,
+                                   char* buf, size_t buf_sz,
+                                   treadstone_json_sink sink, void* ctx);
+int treadstone_binary_to_json_fd(const unsigned char* binary, size_t binary_sz,
+                                 int fd);
+
+/* Formatting for the _options conversions; zeroed options, or NULL, give
+ * what treadstone_binary_to_json writes.  All of it happens as the JSON is
+ * written, sorted keys included, which reorder members without copying them. */
+enum treadstone_number_format
+{
+    /* six significant digits, as printf's %g */
+    TREADSTONE_NUMBERS_SHORT,
+    /* the fewest digits that read back as the same double, and always a
+     * double, so 1.0 prints as "1.0" rather than "1" */
+    TREADSTONE_NUMBERS_ROUNDTRIP
+};
+struct treadstone_json_options
+{
+    /* spaces per level, with each member on its own line; 0 is compact */
+    unsigned indent;
+    /* object members in byte order of their keys, equal keys as stored */
+    int sort_keys;
+    /* escape all non-ASCII text as \uXXXX; malformed UTF-8 fails */
+    int ascii_only;
+    enum treadstone_number_format numbers;
+};
+int treadstone_binary_to_json_options(const struct treadstone_json_options* opts,
+                                      const unsigned char* binary, size_t binary_sz,
+                                      char** json);
+int treadstone_binary_to_json_options_alloc(const struct treadstone_allocator* a,
+                                            const struct treadstone_json_options* opts,
+                                            const unsigned char* binary, size_t binary_sz,
+                                            char** json);
+int treadstone_binary_to_json_options_sink(const struct treadstone_json_options* opts,
+                                           const unsigned char* binary, size_t binary_sz,
+                                           char* buf, size_t buf_sz,
+                                           treadstone_json_sink sink, void* ctx);
+
+/* An incremental JSON parser.  Feed it the text in chunks of any size, then
+ * call finish to take the binary.  Only a pending number is buffered; the
+ * output is built as the input arrives.  feed fails as soon as the input
+ * cannot be JSON; after a failure the parser must be reset.  A successful
+ * finish hands over the buffer and readies the parser for the next document. */
+struct treadstone_json_parser;
+
+struct treadstone_json_parser* treadstone_json_parser_create(void);
+struct treadstone_json_parser* treadstone_json_parser_create_alloc(const struct treadstone_allocator* a);
+void treadstone_json_parser_destroy(struct treadstone_json_parser*);
+void treadstone_json_parser_reset(struct treadstone_json_parser*);
+int treadstone_json_parser_feed(struct treadstone_json_parser*,
+                                const char* json, size_t json_sz);
+int treadstone_json_parser_finish(struct treadstone_json_parser*,
+                                  unsigned char** binary, size_t* binary_sz);
 
 int treadstone_string_to_binary(const char* string, size_t string_sz,
                                 unsigned char** binary, size_t* binary_sz);
@@ -52,6 +384,15 @@ int treadstone_integer_to_binary(int64_t number,
                                  unsigned char** binary, size_t* binary_sz);
 int treadstone_double_to_binary(double number,
                                 unsigned char** binary, size_t* binary_sz);
+int treadstone_string_to_binary_alloc(const struct treadstone_allocator* a,
+                                      const char* string, size_t string_sz,
+                                      unsigned char** binary, size_t* binary_sz);
+int treadstone_integer_to_binary_alloc(const struct treadstone_allocator* a,
+                                       int64_t number,
+                                       unsigned char** binary, size_t* binary_sz);
+int treadstone_double_to_binary_alloc(const struct treadstone_allocator* a,
+                                      double number,
+                                      unsigned char** binary, size_t* binary_sz);
 
 int treadstone_binary_is_string(const unsigned char* binary, size_t binary_sz);
 size_t treadstone_binary_string_bytes(const unsigned char* binary, size_t binary_sz);
@@ -72,7 +413,24 @@ int treadstone_validate_path(const char* path);
 struct treadstone_transformer;
 
 struct treadstone_transformer* treadstone_transformer_create(const unsigned char* binary, size_t binary_sz);
+/* the transformer allocates everything, including output, through a copy of
+ * a, whose ctx must outlive it */
+struct treadstone_transformer* treadstone_transformer_create_alloc(const struct treadstone_allocator* a,
+                                                                   const unsigned char* binary, size_t binary_sz);
+/* A session that keeps all of its working memory, output included, in the
+ * arena.  The arena belongs to the session until it is destroyed. */
+struct treadstone_transformer* treadstone_transformer_create_arena(struct treadstone_arena* arena,
+                                                                   const unsigned char* binary, size_t binary_sz);
 void treadstone_transformer_destroy(struct treadstone_transformer*);
+/* start over on a new document, reusing the transformer's buffers; an arena
+ * session resets its arena, invalidating everything allocated from it */
+int treadstone_transformer_reset(struct treadstone_transformer*,
+                                 const unsigned char* binary, size_t binary_sz);
+
+/* find paths through idx, which must describe the transformer's current
+ * document, until the document next changes; idx must outlive that */
+int treadstone_transformer_use_index(struct treadstone_transformer*,
+                                     const struct treadstone_index* idx);
 
 int treadstone_transformer_output(struct treadstone_transformer*,
                                   unsigned char** binary, size_t* binary_sz);
@@ -92,6 +450,170 @@ int treadstone_transformer_array_append_value(struct treadstone_transformer*,
                                               const char* path,
                                               const unsigned char* value, size_t value_sz);
 
+/* Read-modify-write a number or string in one walk of the document.  A
+ * result of the same encoded width (always so for doubles) is written over
+ * the old one without copying the document, unless a snapshot reader still
+ * holds this version.  The value must already exist with the matching type,
+ * or the call fails with ENOENT or EINVAL; integer overflow fails with ERANGE
+ * and changes nothing.  Bitwise operations are for integers only.  result,
+ * when not NULL, receives the new value. */
+enum treadstone_numeric_op
+{
+    TREADSTONE_OP_ADD,
+    TREADSTONE_OP_MUL,
+    TREADSTONE_OP_MIN,
+    TREADSTONE_OP_MAX,
+    TREADSTONE_OP_AND,
+    TREADSTONE_OP_OR,
+    TREADSTONE_OP_XOR
+};
+int treadstone_transformer_integer_op(struct treadstone_transformer*,
+                                      const char* path,
+                                      enum treadstone_numeric_op op,
+                                      int64_t operand, int64_t* result);
+int treadstone_transformer_double_op(struct treadstone_transformer*,
+                                     const char* path,
+                                     enum treadstone_numeric_op op,
+                                     double operand, double* result);
+int treadstone_transformer_string_append(struct treadstone_transformer*,
+                                         const char* path,
+                                         const char* str, size_t str_sz);
+
+/* Edit the array at path in one walk and one rewrite.  Negative indices
+ * count from the end: inserting at -1 appends, removing at -1 takes the last
+ * element.  An index past either end fails with ENOENT, as does popping an
+ * empty array.  A popped value stays valid until the transformer's next
+ * pop, reset or destruction.  trim_to keeps the last keep elements,
+ * dropping the oldest, and does nothing to an array already that short. */
+int treadstone_transformer_array_insert_at(struct treadstone_transformer*,
+                                           const char* path, int64_t idx,
+                                           const unsigned char* value, size_t value_sz);
+int treadstone_transformer_array_remove_at(struct treadstone_transformer*,
+                                           const char* path, int64_t idx);
+int treadstone_transformer_array_pop_front(struct treadstone_transformer*,
+                                           const char* path,
+                                           const unsigned char** value, size_t* value_sz);
+int treadstone_transformer_array_pop_back(struct treadstone_transformer*,
+                                          const char* path,
+                                          const unsigned char** value, size_t* value_sz);
+int treadstone_transformer_array_trim_to(struct treadstone_transformer*,
+                                         const char* path, size_t keep);
+
+/* Turn old into new with as small a patch as it can find.  The patch is a
+ * binary document: an array of [code, path, value] operations, which setting,
+ * unsetting, prepending and appending through a transformer, in order, turn
+ * old into new byte for byte.  Unchanged members and elements cost nothing;
+ * a container whose changes would cost more than it does, or that a path
+ * cannot reach (reordered members, repeated keys, or keys holding '.', '['
+ * or ']'), is set whole.  Only the patch itself comes from the allocator;
+ * the comparison works in memory from operator new. */
+int treadstone_binary_diff(const unsigned char* old_binary, size_t old_binary_sz,
+                           const unsigned char* new_binary, size_t new_binary_sz,
+                           unsigned char** patch, size_t* patch_sz);
+int treadstone_binary_diff_alloc(const struct treadstone_allocator* a,
+                                 const unsigned char* old_binary, size_t old_binary_sz,
+                                 const unsigned char* new_binary, size_t new_binary_sz,
+                                 unsigned char** patch, size_t* patch_sz);
+/* apply a patch from treadstone_binary_diff; a patch that does not fit the
+ * document fails part way, leaving the transformer with the operations
+ * before the one that failed */
+int treadstone_transformer_apply_patch(struct treadstone_transformer*,
+                                       const unsigned char* patch, size_t patch_sz);
+/* all or nothing: new_binary is old_binary patched, or the call fails */
+int treadstone_binary_patch(const unsigned char* binary, size_t binary_sz,
+                            const unsigned char* patch, size_t patch_sz,
+                            unsigned char** new_binary, size_t* new_binary_sz);
+int treadstone_binary_patch_alloc(const struct treadstone_allocator* a,
+                                  const unsigned char* binary, size_t binary_sz,
+                                  const unsigned char* patch, size_t patch_sz,
+                                  unsigned char** new_binary, size_t* new_binary_sz);
+
+/* An immutable, reference-counted view of a transformer's current document.
+ * A transformer belongs to one thread at a time, but its snapshots may be
+ * read, retained and released from any number of threads while the
+ * transformer goes on to build the next version.  Taking a snapshot copies
+ * nothing unless the transformer lives in an arena; the transformer stops
+ * reusing a buffer while a snapshot holds it.  Extracted values and JSON are
+ * allocated as the transformer's output would be (with malloc for an arena
+ * session), and that allocator must be safe to call from the reader's
+ * thread.  The binary stays valid until the caller's reference is released. */
+struct treadstone_snapshot;
+
+struct treadstone_snapshot* treadstone_transformer_snapshot(struct treadstone_transformer*);
+void treadstone_snapshot_retain(struct treadstone_snapshot*);
+void treadstone_snapshot_release(struct treadstone_snapshot*);
+void treadstone_snapshot_binary(const struct treadstone_snapshot*,
+                                const unsigned char** binary, size_t* binary_sz);
+int treadstone_snapshot_extract_value(const struct treadstone_snapshot*,
+                                      const char* path,
+                                      unsigned char** value, size_t* value_sz);
+int treadstone_snapshot_to_json(const struct treadstone_snapshot*, char** json);
+
+/* Persistent versions of a document, for keeping many of them at once.  An
+ * edit returns a new version and leaves the old one as it was; the two share
+ * every part of the document the edit did not pass through, so each costs
+ * a few nodes for every container along its path, however wide, plus the
+ * bytes it adds, rather than a whole copy.  Edits follow the transformer's
+ * semantics, and fail with ENOENT when the path does not resolve.  Versions
+ * are immutable and reference-counted, so any thread may read, edit, retain
+ * or release them, provided the allocator is safe to call from each of those
+ * threads; output flattens a version back to the ordinary binary. */
+struct treadstone_version;
+
+struct treadstone_version* treadstone_version_create(const unsigned char* binary, size_t binary_sz);
+struct treadstone_version* treadstone_version_create_alloc(const struct treadstone_allocator* a,
+                                                           const unsigned char* binary, size_t binary_sz);
+void treadstone_version_retain(struct treadstone_version*);
+void treadstone_version_release(struct treadstone_version*);
+/* bytes output would produce */
+size_t treadstone_version_size(const struct treadstone_version*);
+int treadstone_version_output(const struct treadstone_version*,
+                              unsigned char** binary, size_t* binary_sz);
+int treadstone_version_extract_value(const struct treadstone_version*,
+                                     const char* path,
+                                     unsigned char** value, size_t* value_sz);
+struct treadstone_version* treadstone_version_unset_value(const struct treadstone_version*,
+                                                          const char* path);
+struct treadstone_version* treadstone_version_set_value(const struct treadstone_version*,
+                                                        const char* path,
+                                                        const unsigned char* value, size_t value_sz);
+struct treadstone_version* treadstone_version_array_prepend_value(const struct treadstone_version*,
+                                                                  const char* path,
+                                                                  const unsigned char* value, size_t value_sz);
+struct treadstone_version* treadstone_version_array_append_value(const struct treadstone_version*,
+                                                                 const char* path,
+                                                                 const unsigned char* value, size_t value_sz);
+
+struct treadstone_builder;
+
+struct treadstone_builder* treadstone_builder_create(void);
+struct treadstone_builder* treadstone_builder_create_alloc(const struct treadstone_allocator* a);
+void treadstone_builder_destroy(struct treadstone_builder*);
+void treadstone_builder_clear(struct treadstone_builder*);
+
+int treadstone_builder_object_begin(struct treadstone_builder*);
+int treadstone_builder_object_end(struct treadstone_builder*);
+int treadstone_builder_array_begin(struct treadstone_builder*);
+int treadstone_builder_array_end(struct treadstone_builder*);
+/* every value within an object must be preceded by its key */
+int treadstone_builder_key(struct treadstone_builder*,
+                           const char* key, size_t key_sz);
+int treadstone_builder_string(struct treadstone_builder*,
+                              const char* string, size_t string_sz);
+int treadstone_builder_integer(struct treadstone_builder*, int64_t number);
+int treadstone_builder_double(struct treadstone_builder*, double number);
+int treadstone_builder_bool(struct treadstone_builder*, int value);
+int treadstone_builder_null(struct treadstone_builder*);
+/* splice a pre-encoded (and validated) binary value */
+int treadstone_builder_binary(struct treadstone_builder*,
+                              const unsigned char* binary, size_t binary_sz);
+/* both fail until exactly one complete value has been built; the view is
+ * valid until the next call on the builder */
+int treadstone_builder_view(struct treadstone_builder*,
+                            const unsigned char** binary, size_t* binary_sz);
+int treadstone_builder_output(struct treadstone_builder*,
+                              unsigned char** binary, size_t* binary_sz);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif /* __cplusplus */
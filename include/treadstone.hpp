@@ -0,0 +1,313 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef treadstone_hpp_
+#define treadstone_hpp_
+
+// C
+#include <stdlib.h>
+#include <string.h>
+
+// STL
+#include <string>
+#include <utility>
+
+// Treadstone
+#include <treadstone.h>
+
+// Header-only C++ wrappers around the C API.  Requires C++11.
+
+namespace treadstone
+{
+
+// An owning binary document.  Values that fit in INLINE_CAPACITY bytes are
+// stored within the object itself; larger values live on the heap in a buffer
+// compatible with free(3).  Documents move cheaply, but must be copied
+// explicitly with assign().
+class document
+{
+    public:
+        static const size_t INLINE_CAPACITY = 23;
+
+    public:
+        document() : m_u(), m_sz(0), m_heap(false) {}
+        document(document&& other) noexcept;
+        ~document() throw () { if (m_heap) free(m_u.ptr); }
+
+    public:
+        document& operator = (document&& rhs) noexcept;
+        const unsigned char* data() const { return m_heap ? m_u.ptr : m_u.buf; }
+        size_t size() const { return m_sz; }
+        bool empty() const { return m_sz == 0; }
+        bool is_inline() const { return !m_heap; }
+        // copy binary_sz bytes into the document
+        int assign(const unsigned char* binary, size_t binary_sz);
+        // take ownership of a malloc'd buffer, such as those returned by the
+        // C API; the buffer is freed here if it fits inline
+        void adopt(unsigned char* binary, size_t binary_sz);
+        int from_json(const char* json, size_t json_sz);
+        int from_json(const std::string& json) { return from_json(json.data(), json.size()); }
+        int to_json(std::string* json) const;
+        int to_json(const treadstone_json_options& opts, std::string* json) const;
+        void clear();
+        void swap(document& other) noexcept;
+
+    private:
+        document(const document&) = delete;
+        document& operator = (const document&) = delete;
+
+    private:
+        union
+        {
+            unsigned char* ptr;
+            unsigned char buf[INLINE_CAPACITY];
+        } m_u;
+        size_t m_sz;
+        bool m_heap;
+};
+
+// Writes binary directly, without an intermediate JSON representation.
+// Every call returns 0 on success and -1 on misuse or allocation failure.
+class builder
+{
+    public:
+        builder() : m_b(treadstone_builder_create()) {}
+        builder(builder&& other) noexcept : m_b(other.m_b) { other.m_b = NULL; }
+        ~builder() throw () { treadstone_builder_destroy(m_b); }
+
+    public:
+        builder& operator = (builder&& rhs) noexcept;
+        bool valid() const { return m_b != NULL; }
+        void clear() { treadstone_builder_clear(m_b); }
+        int object_begin() { return treadstone_builder_object_begin(m_b); }
+        int object_end() { return treadstone_builder_object_end(m_b); }
+        int array_begin() { return treadstone_builder_array_begin(m_b); }
+        int array_end() { return treadstone_builder_array_end(m_b); }
+        int key(const char* k) { return treadstone_builder_key(m_b, k, strlen(k)); }
+        int key(const char* k, size_t k_sz) { return treadstone_builder_key(m_b, k, k_sz); }
+        int key(const std::string& k) { return treadstone_builder_key(m_b, k.data(), k.size()); }
+        int string(const char* s) { return treadstone_builder_string(m_b, s, strlen(s)); }
+        int string(const char* s, size_t s_sz) { return treadstone_builder_string(m_b, s, s_sz); }
+        int string(const std::string& s) { return treadstone_builder_string(m_b, s.data(), s.size()); }
+        int integer(int64_t x) { return treadstone_builder_integer(m_b, x); }
+        int floating(double x) { return treadstone_builder_double(m_b, x); }
+        int boolean(bool x) { return treadstone_builder_bool(m_b, x ? 1 : 0); }
+        int null() { return treadstone_builder_null(m_b); }
+        int binary(const unsigned char* b, size_t b_sz) { return treadstone_builder_binary(m_b, b, b_sz); }
+        int binary(const document& doc) { return binary(doc.data(), doc.size()); }
+        int output(document* doc);
+
+    private:
+        builder(const builder&) = delete;
+        builder& operator = (const builder&) = delete;
+
+    private:
+        treadstone_builder* m_b;
+};
+
+inline
+document :: document(document&& other) noexcept
+    : m_u(other.m_u)
+    , m_sz(other.m_sz)
+    , m_heap(other.m_heap)
+{
+    other.m_u.ptr = NULL;
+    other.m_sz = 0;
+    other.m_heap = false;
+}
+
+inline document&
+document :: operator = (document&& rhs) noexcept
+{
+    if (this != &rhs)
+    {
+        clear();
+        swap(rhs);
+    }
+
+    return *this;
+}
+
+inline int
+document :: assign(const unsigned char* binary, size_t binary_sz)
+{
+    if (binary_sz <= INLINE_CAPACITY)
+    {
+        // binary may point into this document, which clear() frees or
+        // overwrites, so copy it out first
+        unsigned char tmp[INLINE_CAPACITY];
+        memmove(tmp, binary, binary_sz);
+        clear();
+        memmove(m_u.buf, tmp, binary_sz);
+        m_sz = binary_sz;
+        return 0;
+    }
+
+    unsigned char* tmp = reinterpret_cast<unsigned char*>(malloc(binary_sz));
+
+    if (!tmp)
+    {
+        return -1;
+    }
+
+    memmove(tmp, binary, binary_sz);
+    clear();
+    m_u.ptr = tmp;
+    m_sz = binary_sz;
+    m_heap = true;
+    return 0;
+}
+
+inline void
+document :: adopt(unsigned char* binary, size_t binary_sz)
+{
+    clear();
+
+    if (binary_sz <= INLINE_CAPACITY)
+    {
+        memmove(m_u.buf, binary, binary_sz);
+        m_sz = binary_sz;
+        free(binary);
+    }
+    else
+    {
+        m_u.ptr = binary;
+        m_sz = binary_sz;
+        m_heap = true;
+    }
+}
+
+inline int
+document :: from_json(const char* json, size_t json_sz)
+{
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+
+    if (treadstone_json_sz_to_binary(json, json_sz, &binary, &binary_sz) < 0)
+    {
+        return -1;
+    }
+
+    adopt(binary, binary_sz);
+    return 0;
+}
+
+inline int
+document :: to_json(std::string* json) const
+{
+    char* tmp = NULL;
+
+    if (treadstone_binary_to_json(data(), size(), &tmp) < 0)
+    {
+        return -1;
+    }
+
+    json->assign(tmp);
+    free(tmp);
+    return 0;
+}
+
+inline int
+document :: to_json(const treadstone_json_options& opts, std::string* json) const
+{
+    char* tmp = NULL;
+
+    if (treadstone_binary_to_json_options(&opts, data(), size(), &tmp) < 0)
+    {
+        return -1;
+    }
+
+    json->assign(tmp);
+    free(tmp);
+    return 0;
+}
+
+inline void
+document :: clear()
+{
+    if (m_heap)
+    {
+        free(m_u.ptr);
+    }
+
+    m_u.ptr = NULL;
+    m_sz = 0;
+    m_heap = false;
+}
+
+inline void
+document :: swap(document& other) noexcept
+{
+    std::swap(m_u, other.m_u);
+    std::swap(m_sz, other.m_sz);
+    std::swap(m_heap, other.m_heap);
+}
+
+inline builder&
+builder :: operator = (builder&& rhs) noexcept
+{
+    if (this != &rhs)
+    {
+        treadstone_builder_destroy(m_b);
+        m_b = rhs.m_b;
+        rhs.m_b = NULL;
+    }
+
+    return *this;
+}
+
+inline int
+builder :: output(document* doc)
+{
+    const unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+
+    if (treadstone_builder_view(m_b, &binary, &binary_sz) < 0)
+    {
+        return -1;
+    }
+
+    if (binary_sz <= document::INLINE_CAPACITY)
+    {
+        return doc->assign(binary, binary_sz);
+    }
+
+    unsigned char* out = NULL;
+
+    if (treadstone_builder_output(m_b, &out, &binary_sz) < 0)
+    {
+        return -1;
+    }
+
+    doc->adopt(out, binary_sz);
+    return 0;
+}
+
+} // namespace treadstone
+
+#endif // treadstone_hpp_
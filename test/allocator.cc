@@ -0,0 +1,387 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <stdlib.h>
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+
+// STL
+#include <string>
+
+// Treadstone
+#include <treadstone.h>
+#include "test/th.h"
+
+struct counting
+{
+    counting() : allocs(0), frees(0), outstanding(0) {}
+    size_t allocs;
+    size_t frees;
+    size_t outstanding;
+};
+
+static void*
+counting_alloc(void* ctx, size_t sz)
+{
+    counting* c = static_cast<counting*>(ctx);
+    ++c->allocs;
+    c->outstanding += sz;
+    return malloc(sz);
+}
+
+static void*
+counting_realloc(void* ctx, void* ptr, size_t old_sz, size_t new_sz)
+{
+    counting* c = static_cast<counting*>(ctx);
+    ++c->allocs;
+    c->outstanding += new_sz;
+    c->outstanding -= old_sz;
+    return realloc(ptr, new_sz);
+}
+
+static void
+counting_free(void* ctx, void* ptr, size_t sz)
+{
+    counting* c = static_cast<counting*>(ctx);
+    ++c->frees;
+    c->outstanding -= sz;
+    free(ptr);
+}
+
+TEST(Allocator, Conversions)
+{
+    counting c;
+    treadstone_allocator a = {counting_alloc, counting_realloc, counting_free, &c};
+    const char* json = "{\"a\": [1, -2, 3.5, \"four\"], \"b\": {\"c\": null}}";
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_sz_to_binary_alloc(&a, json, strlen(json), &binary, &binary_sz), 0);
+    ASSERT_GT(c.allocs, 0U);
+    const size_t allocs = c.allocs;
+    char* out = NULL;
+    ASSERT_EQ(treadstone_binary_to_json_alloc(&a, binary, binary_sz, &out), 0);
+    ASSERT_EQ(std::string(out), "{\"a\":[1,-2,3.5,\"four\"],\"b\":{\"c\":null}}");
+    // measured exactly, so allocated once and never resized
+    ASSERT_EQ(c.allocs - allocs, 1U);
+    a.free(a.ctx, out, strlen(out) + 1);
+    a.free(a.ctx, binary, binary_sz);
+    ASSERT_EQ(c.frees, 2U);
+    // returned buffers are exactly the size reported with them
+    ASSERT_EQ(c.outstanding, 0U);
+    ASSERT_EQ(treadstone_json_sz_to_binary_alloc(&a, "[1,", 3, &binary, &binary_sz), -1);
+    ASSERT_TRUE(binary == NULL);
+    ASSERT_EQ(c.frees, 3U);
+}
+
+TEST(Allocator, OptionsConversions)
+{
+    const char* json = "{\"b\": 1, \"a\": [2, \"three\"]}";
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary(json, &binary, &binary_sz), 0);
+    treadstone_json_options opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.sort_keys = 1;
+
+    counting c;
+    treadstone_allocator a = {counting_alloc, counting_realloc, counting_free, &c};
+    char* out = NULL;
+    ASSERT_EQ(treadstone_binary_to_json_options_alloc(&a, &opts, binary, binary_sz, &out), 0);
+    ASSERT_EQ(std::string(out), "{\"a\":[2,\"three\"],\"b\":1}");
+    ASSERT_GT(c.allocs, 0U);
+    a.free(a.ctx, out, strlen(out) + 1);
+    ASSERT_EQ(c.outstanding, 0U);
+
+    // default options take the plain conversion, still through a
+    const size_t allocs = c.allocs;
+    ASSERT_EQ(treadstone_binary_to_json_options_alloc(&a, NULL, binary, binary_sz, &out), 0);
+    ASSERT_EQ(std::string(out), "{\"b\":1,\"a\":[2,\"three\"]}");
+    ASSERT_EQ(c.allocs - allocs, 1U);
+    a.free(a.ctx, out, strlen(out) + 1);
+    ASSERT_EQ(c.outstanding, 0U);
+    free(binary);
+}
+
+TEST(Allocator, DeepConversions)
+{
+    // deep enough that the walks' stacks leave their inline space
+    std::string json(100, '[');
+    json += std::string(100, ']');
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary(json.c_str(), &binary, &binary_sz), 0);
+    counting c;
+    treadstone_allocator a = {counting_alloc, counting_realloc, counting_free, &c};
+    char* out = NULL;
+    ASSERT_EQ(treadstone_binary_to_json_alloc(&a, binary, binary_sz, &out), 0);
+    ASSERT_EQ(std::string(out), json);
+    a.free(a.ctx, out, strlen(out) + 1);
+    free(binary);
+    ASSERT_EQ(c.outstanding, 0U);
+    // the output, and the stacks of both the sizing pass and the conversion
+    ASSERT_GE(c.allocs, 3U);
+}
+
+TEST(Allocator, Transformer)
+{
+    counting c;
+    treadstone_allocator a = {counting_alloc, counting_realloc, counting_free, &c};
+    const char* json = "{\"a\": {\"b\": [1, 2]}}";
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary(json, &binary, &binary_sz), 0);
+    treadstone_transformer* trans = treadstone_transformer_create_alloc(&a, binary, binary_sz);
+    free(binary);
+    ASSERT_TRUE(trans);
+
+    unsigned char* value = NULL;
+    size_t value_sz = 0;
+    ASSERT_EQ(treadstone_integer_to_binary_alloc(&a, 3, &value, &value_sz), 0);
+    ASSERT_EQ(treadstone_transformer_array_append_value(trans, "a.b", value, value_sz), 0);
+    ASSERT_EQ(treadstone_transformer_set_value(trans, "a.x.y", value, value_sz), 0);
+    counting_free(&c, value, value_sz);
+    ASSERT_EQ(treadstone_transformer_unset_value(trans, "a.b[0]"), 0);
+    ASSERT_EQ(treadstone_transformer_extract_value(trans, "a.b", &value, &value_sz), 0);
+    counting_free(&c, value, value_sz);
+    ASSERT_EQ(treadstone_transformer_output(trans, &value, &value_sz), 0);
+
+    char* out = NULL;
+    ASSERT_EQ(treadstone_binary_to_json(value, value_sz, &out), 0);
+    ASSERT_EQ(std::string(out), "{\"a\":{\"b\":[2,3],\"x\":{\"y\":3}}}");
+    free(out);
+    counting_free(&c, value, value_sz);
+    treadstone_transformer_destroy(trans);
+    ASSERT_EQ(c.outstanding, 0U);
+}
+
+TEST(Allocator, Builder)
+{
+    counting c;
+    treadstone_allocator a = {counting_alloc, counting_realloc, counting_free, &c};
+    treadstone_builder* builder = treadstone_builder_create_alloc(&a);
+    ASSERT_TRUE(builder);
+    ASSERT_EQ(treadstone_builder_array_begin(builder), 0);
+    ASSERT_EQ(treadstone_builder_string(builder, "x", 1), 0);
+    ASSERT_EQ(treadstone_builder_array_end(builder), 0);
+    treadstone_builder_destroy(builder);
+    ASSERT_GT(c.allocs, 1U);
+    ASSERT_EQ(c.outstanding, 0U);
+}
+
+// gives out budget allocations, then fails every one after
+struct failing
+{
+    failing(size_t b) : budget(b), outstanding(0) {}
+    size_t budget;
+    size_t outstanding;
+};
+
+static void*
+failing_alloc(void* ctx, size_t sz)
+{
+    failing* f = static_cast<failing*>(ctx);
+
+    if (f->budget == 0)
+    {
+        return NULL;
+    }
+
+    --f->budget;
+    f->outstanding += sz;
+    return malloc(sz);
+}
+
+static void*
+failing_realloc(void* ctx, void* ptr, size_t old_sz, size_t new_sz)
+{
+    failing* f = static_cast<failing*>(ctx);
+
+    if (f->budget == 0)
+    {
+        return NULL;
+    }
+
+    --f->budget;
+    f->outstanding += new_sz;
+    f->outstanding -= old_sz;
+    return realloc(ptr, new_sz);
+}
+
+static void
+failing_free(void* ctx, void* ptr, size_t sz)
+{
+    static_cast<failing*>(ctx)->outstanding -= sz;
+    free(ptr);
+}
+
+// every call either works or fails with ENOMEM; none may throw or leak
+#define ASSERT_OK_OR_ENOMEM(X) \
+    do { \
+        if ((X) < 0) \
+        { \
+            ASSERT_EQ(errno, ENOMEM); \
+        } \
+    } while (0)
+
+TEST(Allocator, FailingTransformer)
+{
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary("{\"a\": {\"b\": [1, 2, 3]}}", &binary, &binary_sz), 0);
+    unsigned char* value = NULL;
+    size_t value_sz = 0;
+    ASSERT_EQ(treadstone_integer_to_binary(7, &value, &value_sz), 0);
+    bool completed = false;
+
+    for (size_t budget = 0; !completed; ++budget)
+    {
+        failing f(budget);
+        treadstone_allocator a = {failing_alloc, failing_realloc, failing_free, &f};
+        treadstone_transformer* trans = treadstone_transformer_create_alloc(&a, binary, binary_sz);
+
+        if (!trans)
+        {
+            ASSERT_EQ(errno, ENOMEM);
+            ASSERT_EQ(f.outstanding, 0U);
+            continue;
+        }
+
+        ASSERT_OK_OR_ENOMEM(treadstone_transformer_unset_value(trans, "a.b[1]"));
+        ASSERT_OK_OR_ENOMEM(treadstone_transformer_set_value(trans, "a.c.d", value, value_sz));
+        ASSERT_OK_OR_ENOMEM(treadstone_transformer_array_append_value(trans, "a.b", value, value_sz));
+        ASSERT_OK_OR_ENOMEM(treadstone_transformer_array_insert_at(trans, "a.b", 0, value, value_sz));
+        ASSERT_OK_OR_ENOMEM(treadstone_transformer_integer_op(trans, "a.b[0]", TREADSTONE_OP_ADD, 1, NULL));
+        ASSERT_OK_OR_ENOMEM(treadstone_transformer_array_trim_to(trans, "a.b", 1));
+        unsigned char* out = NULL;
+        size_t out_sz = 0;
+        int ret = treadstone_transformer_extract_value(trans, "a.b", &out, &out_sz);
+        ASSERT_OK_OR_ENOMEM(ret);
+
+        if (ret == 0)
+        {
+            a.free(a.ctx, out, out_sz);
+        }
+
+        completed = f.budget > 0;
+        treadstone_transformer_destroy(trans);
+        ASSERT_EQ(f.outstanding, 0U);
+    }
+
+    free(value);
+    free(binary);
+}
+
+TEST(Allocator, FailingParser)
+{
+    const char* json = "{\"a\": [1, 2.5, {\"b\": [[[\"c\"]]]}], \"d\": -12}";
+    bool completed = false;
+
+    for (size_t budget = 0; !completed; ++budget)
+    {
+        failing f(budget);
+        treadstone_allocator a = {failing_alloc, failing_realloc, failing_free, &f};
+        treadstone_json_parser* parser = treadstone_json_parser_create_alloc(&a);
+
+        if (!parser)
+        {
+            ASSERT_EQ(errno, ENOMEM);
+            continue;
+        }
+
+        int ret = 0;
+
+        // a byte at a time, so that numbers are held back between calls
+        for (size_t i = 0; ret == 0 && json[i]; ++i)
+        {
+            ret = treadstone_json_parser_feed(parser, json + i, 1);
+            ASSERT_OK_OR_ENOMEM(ret);
+        }
+
+        unsigned char* binary = NULL;
+        size_t binary_sz = 0;
+
+        if (ret == 0)
+        {
+            ret = treadstone_json_parser_finish(parser, &binary, &binary_sz);
+            ASSERT_OK_OR_ENOMEM(ret);
+        }
+
+        if (ret == 0)
+        {
+            a.free(a.ctx, binary, binary_sz);
+            completed = f.budget > 0;
+        }
+
+        treadstone_json_parser_destroy(parser);
+        ASSERT_EQ(f.outstanding, 0U);
+    }
+}
+
+TEST(Allocator, FailingBuilder)
+{
+    bool completed = false;
+
+    for (size_t budget = 0; !completed; ++budget)
+    {
+        failing f(budget);
+        treadstone_allocator a = {failing_alloc, failing_realloc, failing_free, &f};
+        treadstone_builder* builder = treadstone_builder_create_alloc(&a);
+
+        if (!builder)
+        {
+            ASSERT_EQ(errno, ENOMEM);
+            continue;
+        }
+
+        // each call is only sensible if the one before it worked
+        int ret = treadstone_builder_object_begin(builder);
+        ret = ret < 0 ? ret : treadstone_builder_key(builder, "a", 1);
+        ret = ret < 0 ? ret : treadstone_builder_array_begin(builder);
+        ret = ret < 0 ? ret : treadstone_builder_array_begin(builder);
+        ret = ret < 0 ? ret : treadstone_builder_integer(builder, 1);
+        ret = ret < 0 ? ret : treadstone_builder_array_end(builder);
+        ret = ret < 0 ? ret : treadstone_builder_array_end(builder);
+        ret = ret < 0 ? ret : treadstone_builder_object_end(builder);
+        unsigned char* binary = NULL;
+        size_t binary_sz = 0;
+        ret = ret < 0 ? ret : treadstone_builder_output(builder, &binary, &binary_sz);
+        ASSERT_OK_OR_ENOMEM(ret);
+
+        if (ret == 0)
+        {
+            a.free(a.ctx, binary, binary_sz);
+            completed = f.budget > 0;
+        }
+
+        treadstone_builder_destroy(builder);
+        ASSERT_EQ(f.outstanding, 0U);
+    }
+}
@@ -0,0 +1,109 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <stdlib.h>
+#include <string.h>
+
+// STL
+#include <string>
+
+// Treadstone
+#include <treadstone.h>
+#include "test/th.h"
+#include "test/helpers.h"
+
+TEST(Arena, LastAllocationInPlace)
+{
+    treadstone_arena* arena = treadstone_arena_create(256);
+    ASSERT_TRUE(arena);
+    treadstone_allocator a;
+    treadstone_arena_allocator(arena, &a);
+
+    char* x = static_cast<char*>(a.alloc(a.ctx, 10));
+    ASSERT_TRUE(x);
+    memmove(x, "0123456789", 10);
+    char* y = static_cast<char*>(a.realloc(a.ctx, x, 10, 100));
+    ASSERT_TRUE(x == y);
+    char* z = static_cast<char*>(a.alloc(a.ctx, 16));
+    ASSERT_TRUE(z != y);
+    a.free(a.ctx, z, 16);
+    char* w = static_cast<char*>(a.alloc(a.ctx, 16));
+    ASSERT_TRUE(w == z);
+
+    // outgrow the first chunk and make sure the contents move
+    char* big = static_cast<char*>(a.realloc(a.ctx, y, 100, 1000));
+    ASSERT_TRUE(big != y);
+    ASSERT_EQ(memcmp(big, "0123456789", 10), 0);
+
+    treadstone_arena_reset(arena);
+    char* again = static_cast<char*>(a.alloc(a.ctx, 10));
+    ASSERT_TRUE(again);
+    treadstone_arena_destroy(arena);
+}
+
+TEST(Arena, TransformerSession)
+{
+    treadstone_arena* arena = treadstone_arena_create(1024);
+    ASSERT_TRUE(arena);
+    const char* docs[] = {"{\"n\": 1}", "{\"n\": 2, \"tags\": []}", "{}"};
+    const char* expected[] = {
+        "{\"n\":1,\"tags\":[\"x\",\"y\"],\"m\":{\"k\":true}}",
+        "{\"n\":2,\"tags\":[\"x\",\"y\"],\"m\":{\"k\":true}}",
+        "{\"tags\":[\"x\",\"y\"],\"m\":{\"k\":true}}",
+    };
+    treadstone_transformer* trans = NULL;
+
+    for (size_t i = 0; i < 3; ++i)
+    {
+        unsigned char* binary = NULL;
+        size_t binary_sz = 0;
+        ASSERT_EQ(treadstone_json_to_binary(docs[i], &binary, &binary_sz), 0);
+
+        if (!trans)
+        {
+            trans = treadstone_transformer_create_arena(arena, binary, binary_sz);
+            ASSERT_TRUE(trans);
+        }
+        else
+        {
+            ASSERT_EQ(treadstone_transformer_reset(trans, binary, binary_sz), 0);
+        }
+
+        free(binary);
+        ASSERT_EQ(treadstone_transformer_set_value(trans, "tags", (const unsigned char*)"\x41\x00", 2), 0);
+        ASSERT_EQ(treadstone_transformer_array_append_value(trans, "tags", (const unsigned char*)"\x42\x01x", 3), 0);
+        ASSERT_EQ(treadstone_transformer_array_append_value(trans, "tags", (const unsigned char*)"\x42\x01y", 3), 0);
+        ASSERT_EQ(treadstone_transformer_set_value(trans, "m.k", (const unsigned char*)"\x45", 1), 0);
+        ASSERT_EQ(treadstone_transformer_output(trans, &binary, &binary_sz), 0);
+        ASSERT_EQ(to_json(binary, binary_sz), expected[i]);
+    }
+
+    treadstone_transformer_destroy(trans);
+    treadstone_arena_destroy(arena);
+}
@@ -25,6 +25,13 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// POSIX
+#include <errno.h>
+#include <unistd.h>
+
+// STL
+#include <string>
+
 // Treadstone
 #include <treadstone.h>
 #include <string.h>
@@ -39,4 +46,143 @@ TEST(BinaryToJson, NullPointer)
     int res = treadstone_binary_to_json(binary, binary_sz, &json);
     ASSERT_TRUE(strcmp(json, "{}") == 0);
     ASSERT_EQ(res, 0);
+    free(json);
+}
+
+static int
+string_sink(void* ctx, const char* json, size_t json_sz)
+{
+    std::string* s = static_cast<std::string*>(ctx);
+    s->append(json, json_sz);
+    return 0;
+}
+
+static int
+failing_sink(void*, const char*, size_t)
+{
+    errno = EPIPE;
+    return -1;
+}
+
+TEST(BinaryToJson, Sink)
+{
+    const char* json = "{\"key\": \"a string that is longer than the buffer\", "
+                       "\"list\": [1, -2, 3.5, true, false, null, {}, []]}";
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary(json, &binary, &binary_sz), 0);
+    char* expected = NULL;
+    ASSERT_EQ(treadstone_binary_to_json(binary, binary_sz, &expected), 0);
+
+    for (size_t buf_sz = 1; buf_sz < 128; ++buf_sz)
+    {
+        char buf[128];
+        std::string out;
+        ASSERT_EQ(treadstone_binary_to_json_sink(binary, binary_sz, buf, buf_sz, string_sink, &out), 0);
+        ASSERT_EQ(out, std::string(expected));
+    }
+
+    char buf[16];
+    std::string out;
+    ASSERT_EQ(treadstone_binary_to_json_sink(binary, binary_sz, buf, sizeof(buf), failing_sink, NULL), -1);
+    ASSERT_EQ(errno, EPIPE);
+    ASSERT_EQ(treadstone_binary_to_json_sink(binary, binary_sz - 1, buf, sizeof(buf), string_sink, &out), -1);
+    ASSERT_EQ(errno, EINVAL);
+    ASSERT_TRUE(out.empty());
+
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    ASSERT_EQ(treadstone_binary_to_json_fd(binary, binary_sz, fds[1]), 0);
+    close(fds[1]);
+    char pipe_buf[256];
+    ssize_t amt = read(fds[0], pipe_buf, sizeof(pipe_buf));
+    close(fds[0]);
+    ASSERT_EQ(std::string(pipe_buf, amt), std::string(expected));
+    free(binary);
+    free(expected);
+}
+
+static std::string
+format(const char* json, unsigned indent, int sort_keys, int ascii_only,
+       treadstone_number_format numbers)
+{
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary(json, &binary, &binary_sz), 0);
+    treadstone_json_options opts;
+    opts.indent = indent;
+    opts.sort_keys = sort_keys;
+    opts.ascii_only = ascii_only;
+    opts.numbers = numbers;
+    char* out = NULL;
+    ASSERT_EQ(treadstone_binary_to_json_options(&opts, binary, binary_sz, &out), 0);
+    std::string ret(out);
+    free(out);
+
+    // the sink writes the same text, even in tiny pieces
+    std::string sunk;
+    char buf[3];
+    ASSERT_EQ(treadstone_binary_to_json_options_sink(&opts, binary, binary_sz,
+                                                     buf, sizeof(buf), string_sink, &sunk), 0);
+    ASSERT_EQ(sunk, ret);
+    free(binary);
+    return ret;
+}
+
+TEST(BinaryToJson, Options)
+{
+    const treadstone_number_format SHORT = TREADSTONE_NUMBERS_SHORT;
+    const treadstone_number_format ROUNDTRIP = TREADSTONE_NUMBERS_ROUNDTRIP;
+    const char* doc = "{\"b\": [1, {}, []], \"a\": {\"d\": null, \"c\": \"x\"}}";
+    ASSERT_EQ(format(doc, 0, 0, 0, SHORT),
+              "{\"b\":[1,{},[]],\"a\":{\"d\":null,\"c\":\"x\"}}");
+    ASSERT_EQ(format(doc, 0, 1, 0, SHORT),
+              "{\"a\":{\"c\":\"x\",\"d\":null},\"b\":[1,{},[]]}");
+    ASSERT_EQ(format(doc, 2, 1, 0, SHORT),
+              "{\n"
+              "  \"a\": {\n"
+              "    \"c\": \"x\",\n"
+              "    \"d\": null\n"
+              "  },\n"
+              "  \"b\": [\n"
+              "    1,\n"
+              "    {},\n"
+              "    []\n"
+              "  ]\n"
+              "}");
+    ASSERT_EQ(format("[]", 4, 0, 0, SHORT), "[]");
+    ASSERT_EQ(format("\"x\"", 4, 0, 0, SHORT), "\"x\"");
+    // prefixes sort first and equal keys keep their order
+    ASSERT_EQ(format("{\"ab\": 1, \"a\": 2, \"b\": 3, \"a\": 4}", 0, 1, 0, SHORT),
+              "{\"a\":2,\"a\":4,\"ab\":1,\"b\":3}");
+    ASSERT_EQ(format("[\"\\u00e9\\u20ac\\ud83d\\ude00\\n\", {\"\\u00e9\": true}]", 0, 0, 1, SHORT),
+              "[\"\\u00e9\\u20ac\\ud83d\\ude00\\n\",{\"\\u00e9\":true}]");
+    ASSERT_EQ(format("[0.1, 1.0, 123456789.5, -2.5e-300]", 0, 0, 0, SHORT),
+              "[0.1,1,1.23457e+08,-2.5e-300]");
+    ASSERT_EQ(format("[0.1, 1.0, 123456789.5, -2.5e-300, 7]", 0, 0, 0, ROUNDTRIP),
+              "[0.1,1.0,123456789.5,-2.5e-300,7]");
+    ASSERT_EQ(format("[0.30000000000000004]", 0, 0, 0, ROUNDTRIP),
+              "[0.30000000000000004]");
+}
+
+TEST(BinaryToJson, OptionsInvalid)
+{
+    treadstone_json_options opts;
+    opts.indent = 2;
+    opts.sort_keys = 1;
+    opts.ascii_only = 1;
+    opts.numbers = TREADSTONE_NUMBERS_ROUNDTRIP;
+    char* out = NULL;
+    const unsigned char truncated[] = {0x40, 0x06, 0x42, 0x01, 'a', 0x44};
+    ASSERT_EQ(treadstone_binary_to_json_options(&opts, truncated, sizeof(truncated), &out), -1);
+    ASSERT_TRUE(out == NULL);
+    // well-formed, but not UTF-8
+    const unsigned char latin1[] = {0x42, 0x01, 0xe9};
+    ASSERT_EQ(treadstone_binary_to_json_options(&opts, latin1, sizeof(latin1), &out), -1);
+    opts.ascii_only = 0;
+    ASSERT_EQ(treadstone_binary_to_json_options(&opts, latin1, sizeof(latin1), &out), 0);
+    free(out);
+    ASSERT_EQ(treadstone_binary_to_json_options(NULL, latin1 + 1, 0, &out), 0);
+    ASSERT_EQ(std::string(out), "{}");
+    free(out);
 }
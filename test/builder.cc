@@ -0,0 +1,197 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <string.h>
+
+// STL
+#include <string>
+#include <utility>
+
+// Treadstone
+#include <treadstone.h>
+#include <treadstone.hpp>
+#include "test/th.h"
+
+static std::string
+builder_dump(treadstone_builder* builder)
+{
+    const unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    int ret = treadstone_builder_view(builder, &binary, &binary_sz);
+    ASSERT_EQ(ret, 0);
+    char* json = NULL;
+    ret = treadstone_binary_to_json(binary, binary_sz, &json);
+    ASSERT_EQ(ret, 0);
+    std::string tmp(json);
+    free(json);
+    return tmp;
+}
+
+TEST(Builder, Scalars)
+{
+    treadstone_builder* builder = treadstone_builder_create();
+    ASSERT_TRUE(builder);
+    ASSERT_EQ(treadstone_builder_integer(builder, -42), 0);
+    ASSERT_EQ(builder_dump(builder), "-42");
+    ASSERT_EQ(treadstone_builder_integer(builder, 5), -1);
+    treadstone_builder_clear(builder);
+    ASSERT_EQ(treadstone_builder_string(builder, "hello", 5), 0);
+    ASSERT_EQ(builder_dump(builder), "\"hello\"");
+    treadstone_builder_clear(builder);
+    ASSERT_EQ(treadstone_builder_null(builder), 0);
+    ASSERT_EQ(builder_dump(builder), "null");
+    treadstone_builder_destroy(builder);
+}
+
+TEST(Builder, NestedScopes)
+{
+    treadstone_builder* builder = treadstone_builder_create();
+    ASSERT_TRUE(builder);
+    ASSERT_EQ(treadstone_builder_object_begin(builder), 0);
+    ASSERT_EQ(treadstone_builder_key(builder, "a", 1), 0);
+    ASSERT_EQ(treadstone_builder_integer(builder, 1), 0);
+    ASSERT_EQ(treadstone_builder_key(builder, "b", 1), 0);
+    ASSERT_EQ(treadstone_builder_array_begin(builder), 0);
+    ASSERT_EQ(treadstone_builder_double(builder, 3.5), 0);
+    ASSERT_EQ(treadstone_builder_bool(builder, 1), 0);
+    ASSERT_EQ(treadstone_builder_object_begin(builder), 0);
+    ASSERT_EQ(treadstone_builder_object_end(builder), 0);
+    ASSERT_EQ(treadstone_builder_array_end(builder), 0);
+    ASSERT_EQ(treadstone_builder_key(builder, "c", 1), 0);
+    ASSERT_EQ(treadstone_builder_bool(builder, 0), 0);
+    ASSERT_EQ(treadstone_builder_object_end(builder), 0);
+    ASSERT_EQ(builder_dump(builder), "{\"a\":1,\"b\":[3.5,true,{}],\"c\":false}");
+
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    unsigned char* expected = NULL;
+    size_t expected_sz = 0;
+    ASSERT_EQ(treadstone_builder_output(builder, &binary, &binary_sz), 0);
+    ASSERT_EQ(treadstone_json_to_binary("{\"a\":1,\"b\":[3.5,true,{}],\"c\":false}", &expected, &expected_sz), 0);
+    ASSERT_EQ(binary_sz, expected_sz);
+    ASSERT_EQ(memcmp(binary, expected, binary_sz), 0);
+    free(binary);
+    free(expected);
+    treadstone_builder_destroy(builder);
+}
+
+TEST(Builder, Misuse)
+{
+    treadstone_builder* builder = treadstone_builder_create();
+    ASSERT_TRUE(builder);
+    const unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_builder_view(builder, &binary, &binary_sz), -1);
+    ASSERT_EQ(treadstone_builder_key(builder, "a", 1), -1);
+    ASSERT_EQ(treadstone_builder_object_end(builder), -1);
+    ASSERT_EQ(treadstone_builder_object_begin(builder), 0);
+    ASSERT_EQ(treadstone_builder_integer(builder, 1), -1);
+    ASSERT_EQ(treadstone_builder_array_end(builder), -1);
+    ASSERT_EQ(treadstone_builder_key(builder, "a", 1), 0);
+    ASSERT_EQ(treadstone_builder_key(builder, "b", 1), -1);
+    ASSERT_EQ(treadstone_builder_object_end(builder), -1);
+    ASSERT_EQ(treadstone_builder_view(builder, &binary, &binary_sz), -1);
+    ASSERT_EQ(treadstone_builder_binary(builder, (const unsigned char*)"\x41\x05", 2), -1);
+    ASSERT_EQ(treadstone_builder_binary(builder, (const unsigned char*)"\x41\x01\x47", 3), 0);
+    ASSERT_EQ(treadstone_builder_object_end(builder), 0);
+    ASSERT_EQ(builder_dump(builder), "{\"a\":[null]}");
+    treadstone_builder_destroy(builder);
+}
+
+TEST(Document, InlineAndHeap)
+{
+    treadstone::document small;
+    ASSERT_TRUE(small.empty());
+    ASSERT_EQ(small.from_json("[1,2,3]"), 0);
+    ASSERT_TRUE(small.is_inline());
+    std::string json;
+    ASSERT_EQ(small.to_json(&json), 0);
+    ASSERT_EQ(json, "[1,2,3]");
+
+    treadstone::document large;
+    ASSERT_EQ(large.from_json("{\"key\":\"a value that is too long to store inline\"}"), 0);
+    ASSERT_FALSE(large.is_inline());
+    const unsigned char* data = large.data();
+    treadstone::document moved(std::move(large));
+    ASSERT_TRUE(large.empty());
+    ASSERT_TRUE(moved.data() == data);
+    ASSERT_EQ(moved.to_json(&json), 0);
+    ASSERT_EQ(json, "{\"key\":\"a value that is too long to store inline\"}");
+
+    moved = std::move(small);
+    ASSERT_TRUE(moved.is_inline());
+    ASSERT_EQ(moved.to_json(&json), 0);
+    ASSERT_EQ(json, "[1,2,3]");
+    ASSERT_EQ(small.from_json("not json"), -1);
+}
+
+TEST(Document, AssignFromSelf)
+{
+    treadstone::document doc;
+    ASSERT_EQ(doc.from_json("[1,2,3]"), 0);
+    ASSERT_EQ(doc.assign(doc.data(), doc.size()), 0);
+    std::string json;
+    ASSERT_EQ(doc.to_json(&json), 0);
+    ASSERT_EQ(json, "[1,2,3]");
+
+    // a small value out of a heap document moves inline
+    treadstone::document inner;
+    ASSERT_EQ(inner.from_json("[1,2]"), 0);
+    ASSERT_EQ(doc.from_json("[[1,2],\"a value that is too long to store inline\"]"), 0);
+    ASSERT_FALSE(doc.is_inline());
+    const void* at = memmem(doc.data(), doc.size(), inner.data(), inner.size());
+    ASSERT_TRUE(at != NULL);
+    ASSERT_EQ(doc.assign(static_cast<const unsigned char*>(at), inner.size()), 0);
+    ASSERT_TRUE(doc.is_inline());
+    ASSERT_EQ(doc.to_json(&json), 0);
+    ASSERT_EQ(json, "[1,2]");
+}
+
+TEST(Document, Builder)
+{
+    treadstone::document sub;
+    ASSERT_EQ(sub.from_json("{\"x\":[true,null]}"), 0);
+
+    treadstone::builder b;
+    ASSERT_TRUE(b.valid());
+    ASSERT_EQ(b.object_begin(), 0);
+    ASSERT_EQ(b.key("name"), 0);
+    ASSERT_EQ(b.string(std::string("treadstone")), 0);
+    ASSERT_EQ(b.key("sub"), 0);
+    ASSERT_EQ(b.binary(sub), 0);
+    ASSERT_EQ(b.key("pi"), 0);
+    ASSERT_EQ(b.floating(3.25), 0);
+    ASSERT_EQ(b.object_end(), 0);
+
+    treadstone::document doc;
+    ASSERT_EQ(b.output(&doc), 0);
+    std::string json;
+    ASSERT_EQ(doc.to_json(&json), 0);
+    ASSERT_EQ(json, "{\"name\":\"treadstone\",\"sub\":{\"x\":[true,null]},\"pi\":3.25}");
+}
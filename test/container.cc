@@ -0,0 +1,154 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// STL
+#include <string>
+#include <vector>
+
+// Treadstone
+#include <treadstone.h>
+#include "test/th.h"
+#include "test/helpers.h"
+
+static void
+write_container(const char* path, unsigned flags, const std::vector<std::string>& docs)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    ASSERT_GE(fd, 0);
+    treadstone_container_writer* w = treadstone_container_writer_create(fd, flags);
+    ASSERT_TRUE(w);
+
+    for (size_t i = 0; i < docs.size(); ++i)
+    {
+        ASSERT_EQ(treadstone_container_writer_append(w,
+                    reinterpret_cast<const unsigned char*>(docs[i].data()),
+                    docs[i].size()), 0);
+    }
+
+    ASSERT_EQ(treadstone_container_writer_finish(w), 0);
+    treadstone_container_writer_destroy(w);
+    close(fd);
+}
+
+static void
+corrupt(const char* path, off_t offset)
+{
+    int fd = open(path, O_RDWR);
+    ASSERT_GE(fd, 0);
+    char c;
+    ASSERT_EQ(pread(fd, &c, 1, offset), 1);
+    c ^= 0x01;
+    ASSERT_EQ(pwrite(fd, &c, 1, offset), 1);
+    close(fd);
+}
+
+TEST(Container, RoundTrip)
+{
+    char path[] = "/tmp/treadstone-container-XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    std::vector<std::string> docs;
+    docs.push_back(to_binary("{\"a\": 1}"));
+    docs.push_back(to_binary("[1, 2, 3]"));
+    docs.push_back(to_binary("\"" + std::string(300, 'x') + "\""));
+    docs.push_back(to_binary("null"));
+
+    for (unsigned flags = 0; flags <= TREADSTONE_CONTAINER_HASHES; ++flags)
+    {
+        write_container(path, flags, docs);
+        treadstone_container* c = treadstone_container_open(path);
+        ASSERT_TRUE(c);
+        ASSERT_EQ(treadstone_container_count(c), docs.size());
+
+        // in any order, without reading the documents before
+        for (size_t i = docs.size(); i > 0; --i)
+        {
+            const unsigned char* b = NULL;
+            size_t b_sz = 0;
+            ASSERT_EQ(treadstone_container_get(c, i - 1, &b, &b_sz), 0);
+            ASSERT_TRUE(std::string(reinterpret_cast<const char*>(b), b_sz) == docs[i - 1]);
+            ASSERT_EQ(treadstone_container_verify(c, i - 1), 0);
+        }
+
+        const unsigned char* b = NULL;
+        size_t b_sz = 0;
+        ASSERT_EQ(treadstone_container_get(c, docs.size(), &b, &b_sz), -1);
+        ASSERT_EQ(errno, ENOENT);
+        treadstone_container_close(c);
+    }
+
+    // an empty container is still a container
+    write_container(path, 0, std::vector<std::string>());
+    treadstone_container* c = treadstone_container_open(path);
+    ASSERT_TRUE(c);
+    ASSERT_EQ(treadstone_container_count(c), 0U);
+    treadstone_container_close(c);
+    unlink(path);
+}
+
+TEST(Container, Damage)
+{
+    char path[] = "/tmp/treadstone-container-XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    std::vector<std::string> docs;
+    docs.push_back(to_binary("{\"a\": \"bcdefg\"}"));
+    docs.push_back(to_binary("[true, false]"));
+
+    // a changed byte within a document shows up against its hash
+    write_container(path, TREADSTONE_CONTAINER_HASHES, docs);
+    corrupt(path, 16 + 1 + docs[0].size() - 2);
+    treadstone_container* c = treadstone_container_open(path);
+    ASSERT_TRUE(c);
+    ASSERT_EQ(treadstone_container_verify(c, 1), 0);
+    ASSERT_EQ(treadstone_container_verify(c, 0), -1);
+    ASSERT_EQ(errno, EINVAL);
+    treadstone_container_close(c);
+
+    // as does any damage to the header or trailer when opening
+    write_container(path, 0, docs);
+    corrupt(path, 3);
+    ASSERT_TRUE(treadstone_container_open(path) == NULL);
+    ASSERT_EQ(errno, EINVAL);
+    write_container(path, 0, docs);
+    ASSERT_EQ(truncate(path, 16 + 2 + docs[0].size() + docs[1].size()), 0);
+    ASSERT_TRUE(treadstone_container_open(path) == NULL);
+    ASSERT_EQ(errno, EINVAL);
+    unlink(path);
+}
@@ -0,0 +1,99 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+
+// STL
+#include <string>
+
+// Treadstone
+#include <treadstone.h>
+#include "test/th.h"
+
+static std::string
+nested(size_t depth)
+{
+    return std::string(depth, '[') + "1" + std::string(depth, ']');
+}
+
+TEST(Depth, Limit)
+{
+    unsigned old = treadstone_get_max_depth();
+    ASSERT_EQ(old, unsigned(TREADSTONE_DEFAULT_MAX_DEPTH));
+    treadstone_set_max_depth(8);
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+
+    ASSERT_EQ(treadstone_json_to_binary(nested(9).c_str(), &binary, &binary_sz), -1);
+    ASSERT_EQ(errno, EOVERFLOW);
+    treadstone_json_parser* parser = treadstone_json_parser_create();
+    std::string json(nested(9));
+    ASSERT_EQ(treadstone_json_parser_feed(parser, json.data(), json.size()), -1);
+    ASSERT_EQ(errno, EOVERFLOW);
+    treadstone_json_parser_destroy(parser);
+
+    // build a document deeper than the limit, then check the binary walkers
+    treadstone_set_max_depth(old);
+    ASSERT_EQ(treadstone_json_to_binary(nested(9).c_str(), &binary, &binary_sz), 0);
+    treadstone_set_max_depth(8);
+    ASSERT_EQ(treadstone_binary_validate(binary, binary_sz), -1);
+    ASSERT_EQ(errno, EOVERFLOW);
+    char* out = NULL;
+    ASSERT_EQ(treadstone_binary_to_json(binary, binary_sz, &out), -1);
+    ASSERT_EQ(errno, EOVERFLOW);
+    treadstone_transformer* trans = treadstone_transformer_create(binary, binary_sz);
+    ASSERT_TRUE(trans);
+    ASSERT_EQ(treadstone_transformer_unset_value(trans, "[0][0][0][0][0][0][0][0][0]"), -1);
+    ASSERT_EQ(errno, EOVERFLOW);
+    treadstone_transformer_destroy(trans);
+    free(binary);
+
+    treadstone_set_max_depth(old);
+}
+
+TEST(Depth, DeepDocuments)
+{
+    // far deeper than any recursive walker could go on a small stack
+    const size_t depth = 20000;
+    unsigned old = treadstone_get_max_depth();
+    treadstone_set_max_depth(depth);
+    std::string json(nested(depth));
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary(json.c_str(), &binary, &binary_sz), 0);
+    ASSERT_EQ(treadstone_binary_validate(binary, binary_sz), 0);
+    char* out = NULL;
+    ASSERT_EQ(treadstone_binary_to_json(binary, binary_sz, &out), 0);
+    ASSERT_TRUE(json == out);
+    free(out);
+    free(binary);
+    treadstone_set_max_depth(old);
+}
@@ -0,0 +1,205 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdlib.h>
+#include <string.h>
+
+// STL
+#include <string>
+
+// Treadstone
+#include <treadstone.h>
+#include "test/th.h"
+#include "test/helpers.h"
+
+// the patch from old to new, after checking that it gets there exactly
+static std::string
+round_trip(const std::string& old_json, const std::string& new_json)
+{
+    std::string o(to_binary(old_json));
+    std::string n(to_binary(new_json));
+    unsigned char* patch = NULL;
+    size_t patch_sz = 0;
+    ASSERT_EQ(treadstone_binary_diff(bytes(o), o.size(), bytes(n), n.size(), &patch, &patch_sz), 0);
+    unsigned char* patched = NULL;
+    size_t patched_sz = 0;
+    ASSERT_EQ(treadstone_binary_patch(bytes(o), o.size(), patch, patch_sz, &patched, &patched_sz), 0);
+    ASSERT_EQ(std::string(reinterpret_cast<char*>(patched), patched_sz), n);
+    std::string ret(reinterpret_cast<char*>(patch), patch_sz);
+    free(patched);
+    free(patch);
+    return ret;
+}
+
+static std::string
+patch_json(const std::string& patch)
+{
+    char* json = NULL;
+    ASSERT_EQ(treadstone_binary_to_json(bytes(patch), patch.size(), &json), 0);
+    std::string ret(json);
+    free(json);
+    return ret;
+}
+
+TEST(Diff, RoundTrip)
+{
+    const char* pairs[][2] = {
+        {"{}", "{}"},
+        {"{\"a\": 1}", "{\"a\": 2}"},
+        {"{\"a\": 1, \"b\": 2}", "{\"b\": 2}"},
+        {"{\"a\": 1}", "{\"a\": 1, \"b\": {\"c\": [1]}}"},
+        {"{\"a\": 1, \"b\": 2}", "{\"b\": 2, \"a\": 1}"},
+        {"{\"a\": {\"b\": {\"c\": 1, \"d\": 2}}}", "{\"a\": {\"b\": {\"c\": 1, \"d\": 3}}}"},
+        {"[1, 2, 3]", "[1, 2, 3, 4, 5]"},
+        {"[1, 2, 3]", "[0, 1, 2, 3]"},
+        {"[1, 2, 3, 4]", "[1, 2]"},
+        {"[1, 2, 3, 4]", "[3, 4]"},
+        {"[1, [2, 3], 4]", "[1, [2, 5], 4]"},
+        {"[1, 2]", "{\"a\": 1}"},
+        {"{\"a.b\": 1, \"c\": 2}", "{\"a.b\": 2, \"c\": 2}"},
+        {"{\"a\": 1, \"a\": 2}", "{\"a\": 1, \"a\": 3}"},
+        {"{\"a\": [{\"b\": 1}, {\"b\": 2}]}", "{\"a\": [{\"b\": 1}, {\"b\": 2, \"c\": null}]}"},
+        {"\"x\"", "5"},
+    };
+
+    for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); ++i)
+    {
+        round_trip(pairs[i][0], pairs[i][1]);
+    }
+
+    ASSERT_EQ(patch_json(round_trip("{\"a\": 1}", "{\"a\": 1}")), "[]");
+    ASSERT_EQ(patch_json(round_trip("{\"a\": {\"b\": 1, \"c\": \"long enough to keep\"}}",
+                                    "{\"a\": {\"b\": 2, \"c\": \"long enough to keep\"}}")),
+              "[[0,\"a.b\",2]]");
+    ASSERT_EQ(patch_json(round_trip("[1, 2, 3, 4, 5, 6, 7, 8]", "[0, 1, 2, 3, 4, 5, 6, 7, 8]")),
+              "[[2,\"\",0]]");
+}
+
+TEST(Diff, SmallUpdate)
+{
+    std::string big("{\"id\": 7, \"items\": [");
+
+    for (size_t i = 0; i < 5000; ++i)
+    {
+        big += i ? ", " : "";
+        big += "{\"n\": " + std::to_string(i) + ", \"tag\": \"unchanged\"}";
+    }
+
+    std::string changed(big + "], \"version\": 2}");
+    big += "], \"version\": 1}";
+    std::string patch(round_trip(big, changed));
+    ASSERT_LT(patch.size(), 32U);
+    ASSERT_GT(to_binary(big).size(), 100000U);
+}
+
+TEST(Diff, BadPatches)
+{
+    std::string doc(to_binary("{\"a\": [1]}"));
+    const char* patches[] = {
+        "{}",
+        "[[0]]",
+        "[[9, \"a\", 1]]",
+        "[[1, \"a\", 1]]",
+        "[[0, \"a\"]]",
+        "[[\"a\", 0, 1]]",
+        "[[1, \"missing\"]]",
+        "[[3, \"a\", 2], [1, \"missing\"]]",
+    };
+
+    for (size_t i = 0; i < sizeof(patches) / sizeof(patches[0]); ++i)
+    {
+        std::string patch(to_binary(patches[i]));
+        unsigned char* out = NULL;
+        size_t out_sz = 0;
+        ASSERT_EQ(treadstone_binary_patch(bytes(doc), doc.size(), bytes(patch), patch.size(), &out, &out_sz), -1);
+    }
+
+    // the transformer keeps what applied before the failure
+    std::string patch(to_binary("[[3, \"a\", 2], [1, \"missing\"]]"));
+    treadstone_transformer* trans = treadstone_transformer_create(bytes(doc), doc.size());
+    ASSERT_TRUE(trans != NULL);
+    ASSERT_EQ(treadstone_transformer_apply_patch(trans, bytes(patch), patch.size()), -1);
+    unsigned char* out = NULL;
+    size_t out_sz = 0;
+    ASSERT_EQ(treadstone_transformer_output(trans, &out, &out_sz), 0);
+    ASSERT_EQ(std::string(reinterpret_cast<char*>(out), out_sz), to_binary("{\"a\": [1, 2]}"));
+    free(out);
+    treadstone_transformer_destroy(trans);
+}
+
+struct counting
+{
+    counting() : allocs(0), outstanding(0) {}
+    size_t allocs;
+    size_t outstanding;
+};
+
+static void*
+counting_alloc(void* ctx, size_t sz)
+{
+    counting* c = static_cast<counting*>(ctx);
+    ++c->allocs;
+    c->outstanding += sz;
+    return malloc(sz);
+}
+
+static void*
+counting_realloc(void* ctx, void* ptr, size_t old_sz, size_t new_sz)
+{
+    counting* c = static_cast<counting*>(ctx);
+    ++c->allocs;
+    c->outstanding += new_sz;
+    c->outstanding -= old_sz;
+    return realloc(ptr, new_sz);
+}
+
+static void
+counting_free(void* ctx, void* ptr, size_t sz)
+{
+    static_cast<counting*>(ctx)->outstanding -= sz;
+    free(ptr);
+}
+
+TEST(Diff, Allocator)
+{
+    counting c;
+    treadstone_allocator a = {counting_alloc, counting_realloc, counting_free, &c};
+    std::string o(to_binary("{\"a\": [1, 2], \"b\": \"x\"}"));
+    std::string n(to_binary("{\"a\": [1, 2, 3], \"b\": \"y\"}"));
+    unsigned char* patch = NULL;
+    size_t patch_sz = 0;
+    ASSERT_EQ(treadstone_binary_diff_alloc(&a, bytes(o), o.size(), bytes(n), n.size(), &patch, &patch_sz), 0);
+    ASSERT_EQ(c.allocs, 1U);
+    unsigned char* patched = NULL;
+    size_t patched_sz = 0;
+    ASSERT_EQ(treadstone_binary_patch_alloc(&a, bytes(o), o.size(), patch, patch_sz, &patched, &patched_sz), 0);
+    ASSERT_EQ(std::string(reinterpret_cast<char*>(patched), patched_sz), n);
+    a.free(a.ctx, patched, patched_sz);
+    a.free(a.ctx, patch, patch_sz);
+    ASSERT_EQ(c.outstanding, 0U);
+}
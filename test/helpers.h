@@ -0,0 +1,70 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef treadstone_test_helpers_h_
+#define treadstone_test_helpers_h_
+
+// C
+#include <stdlib.h>
+
+// STL
+#include <string>
+
+// Treadstone
+#include <treadstone.h>
+#include "test/th.h"
+
+// conversions the tests share; each asserts that the conversion succeeds
+
+inline std::string
+to_binary(const std::string& json)
+{
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary(json.c_str(), &binary, &binary_sz), 0);
+    std::string ret(reinterpret_cast<char*>(binary), binary_sz);
+    free(binary);
+    return ret;
+}
+
+inline std::string
+to_json(const unsigned char* binary, size_t binary_sz)
+{
+    char* json = NULL;
+    ASSERT_EQ(treadstone_binary_to_json(binary, binary_sz, &json), 0);
+    std::string ret(json);
+    free(json);
+    return ret;
+}
+
+inline const unsigned char*
+bytes(const std::string& s)
+{
+    return reinterpret_cast<const unsigned char*>(s.data());
+}
+
+#endif // treadstone_test_helpers_h_
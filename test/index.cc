@@ -0,0 +1,213 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+
+// STL
+#include <string>
+
+// Treadstone
+#include <treadstone.h>
+#include "test/th.h"
+#include "test/helpers.h"
+
+static const char* document =
+    "{\"a\": {\"b\": [10, 20, {\"c\": \"deep\"}]}, \"d\": true, "
+    "\"e\": [], \"f\": {}, \"g\": -7}";
+
+TEST(Index, Lookup)
+{
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary(document, &binary, &binary_sz), 0);
+    treadstone_index* idx = treadstone_index_create();
+    ASSERT_TRUE(idx);
+    ASSERT_EQ(treadstone_binary_validate_index(binary, binary_sz, idx), 0);
+
+    const unsigned char* value = NULL;
+    size_t value_sz = 0;
+    ASSERT_EQ(treadstone_index_lookup(idx, binary, "a.b[2].c", &value, &value_sz), 0);
+    ASSERT_EQ(to_json(value, value_sz), "\"deep\"");
+    ASSERT_EQ(treadstone_index_lookup(idx, binary, "a.b[-3]", &value, &value_sz), 0);
+    ASSERT_EQ(to_json(value, value_sz), "10");
+    ASSERT_EQ(treadstone_index_lookup(idx, binary, "g", &value, &value_sz), 0);
+    ASSERT_EQ(to_json(value, value_sz), "-7");
+    ASSERT_EQ(treadstone_index_lookup(idx, binary, "", &value, &value_sz), 0);
+    ASSERT_EQ(value_sz, binary_sz);
+    ASSERT_EQ(treadstone_index_lookup(idx, binary, "a.x", &value, &value_sz), -1);
+    ASSERT_EQ(errno, ENOENT);
+    ASSERT_EQ(treadstone_index_lookup(idx, binary, "a.b[3]", &value, &value_sz), -1);
+    ASSERT_EQ(treadstone_index_lookup(idx, binary, "a.b.c", &value, &value_sz), -1);
+    ASSERT_EQ(treadstone_index_lookup(idx, binary, "a..b", &value, &value_sz), -1);
+    ASSERT_EQ(errno, EINVAL);
+
+    ASSERT_EQ(treadstone_binary_validate_index(binary, binary_sz - 1, idx), -1);
+    ASSERT_EQ(treadstone_index_lookup(idx, binary, "a", &value, &value_sz), -1);
+    treadstone_index_destroy(idx);
+    free(binary);
+}
+
+static std::string
+run_op(bool indexed, const char* op, const char* path)
+{
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary(document, &binary, &binary_sz), 0);
+    treadstone_index* idx = treadstone_index_create();
+    ASSERT_EQ(treadstone_binary_validate_index(binary, binary_sz, idx), 0);
+    treadstone_transformer* trans = treadstone_transformer_create(binary, binary_sz);
+    ASSERT_TRUE(trans);
+
+    if (indexed)
+    {
+        ASSERT_EQ(treadstone_transformer_use_index(trans, idx), 0);
+    }
+
+    unsigned char* value = NULL;
+    size_t value_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary("[1]", &value, &value_sz), 0);
+    int ret = -1;
+    std::string result;
+
+    if (strcmp(op, "unset") == 0)
+    {
+        ret = treadstone_transformer_unset_value(trans, path);
+    }
+    else if (strcmp(op, "set") == 0)
+    {
+        ret = treadstone_transformer_set_value(trans, path, value, value_sz);
+    }
+    else if (strcmp(op, "append") == 0)
+    {
+        ret = treadstone_transformer_array_append_value(trans, path, value, value_sz);
+    }
+    else if (strcmp(op, "extract") == 0)
+    {
+        unsigned char* out = NULL;
+        size_t out_sz = 0;
+        ret = treadstone_transformer_extract_value(trans, path, &out, &out_sz);
+
+        if (ret == 0)
+        {
+            result = to_json(out, out_sz) + " ";
+            free(out);
+        }
+    }
+
+    if (ret == 0)
+    {
+        unsigned char* out = NULL;
+        size_t out_sz = 0;
+        ASSERT_EQ(treadstone_transformer_output(trans, &out, &out_sz), 0);
+        result += to_json(out, out_sz);
+        free(out);
+    }
+    else
+    {
+        result = "<error>";
+    }
+
+    treadstone_transformer_destroy(trans);
+    treadstone_index_destroy(idx);
+    free(value);
+    free(binary);
+    return result;
+}
+
+TEST(Index, TransformerAgrees)
+{
+    const char* ops[] = {"unset", "set", "append", "extract", NULL};
+    const char* paths[] = {"", "a", "a.b", "a.b[1]", "a.b[-1].c", "a.b[5]",
+                           "a.x", "a.x.y", "d", "d.z", "e", "f.new", "g",
+                           "a[0]", NULL};
+
+    for (const char** op = ops; *op; ++op)
+    {
+        for (const char** path = paths; *path; ++path)
+        {
+            ASSERT_EQ(run_op(true, *op, *path), run_op(false, *op, *path));
+        }
+    }
+}
+
+TEST(Index, TransformerRejectsOtherDocuments)
+{
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary("[1, 2]", &binary, &binary_sz), 0);
+    treadstone_index* idx = treadstone_index_create();
+    ASSERT_EQ(treadstone_binary_validate_index(binary, binary_sz, idx), 0);
+    treadstone_transformer* trans = treadstone_transformer_create(binary, binary_sz - 1);
+    ASSERT_TRUE(trans);
+    ASSERT_EQ(treadstone_transformer_use_index(trans, idx), -1);
+    ASSERT_EQ(errno, EINVAL);
+    treadstone_transformer_destroy(trans);
+
+    // same size, different document
+    unsigned char* other = NULL;
+    size_t other_sz = 0;
+    free(binary);
+    ASSERT_EQ(treadstone_json_to_binary("[\"ab\"]", &binary, &binary_sz), 0);
+    ASSERT_EQ(treadstone_json_to_binary("{\"a\": null}", &other, &other_sz), 0);
+    ASSERT_EQ(binary_sz, other_sz);
+    ASSERT_EQ(treadstone_binary_validate_index(binary, binary_sz, idx), 0);
+    trans = treadstone_transformer_create(other, other_sz);
+    ASSERT_TRUE(trans);
+    ASSERT_EQ(treadstone_transformer_use_index(trans, idx), -1);
+    ASSERT_EQ(errno, EINVAL);
+    treadstone_transformer_destroy(trans);
+    free(other);
+    treadstone_index_destroy(idx);
+    free(binary);
+}
+
+TEST(Index, TransformerDepthLimit)
+{
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary(document, &binary, &binary_sz), 0);
+    treadstone_index* idx = treadstone_index_create();
+    ASSERT_EQ(treadstone_binary_validate_index(binary, binary_sz, idx), 0);
+    treadstone_transformer* trans = treadstone_transformer_create(binary, binary_sz);
+    ASSERT_TRUE(trans);
+    ASSERT_EQ(treadstone_transformer_use_index(trans, idx), 0);
+
+    unsigned old = treadstone_get_max_depth();
+    treadstone_set_max_depth(2);
+    ASSERT_EQ(treadstone_transformer_unset_value(trans, "a.b[2].c"), -1);
+    ASSERT_EQ(errno, EOVERFLOW);
+    treadstone_set_max_depth(old);
+    ASSERT_EQ(treadstone_transformer_unset_value(trans, "a.b[2].c"), 0);
+
+    treadstone_transformer_destroy(trans);
+    treadstone_index_destroy(idx);
+    free(binary);
+}
@@ -0,0 +1,124 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+
+// STL
+#include <string>
+
+// Treadstone
+#include <treadstone.h>
+#include "test/th.h"
+
+static const char* documents[] = {
+    "{\"a\": [1, -2, 3.5, \"four\"], \"b\": {\"c\": null}}",
+    "[true, false, null, {}, [], \"\"]",
+    "  \"esc\\\"aped \\u00e9 \\\\\"  ",
+    "[\"\\ud83d\\ude00\", \"\xc3\xa9\", \"\\n\"]",
+    "-42",
+    "1e10",
+    "{\"nested\": {\"deeper\": {\"deepest\": [[[\"x\"]]]}}}",
+    NULL
+};
+
+static std::string
+parse_in_chunks(treadstone_json_parser* parser, const char* json, size_t chunk)
+{
+    size_t json_sz = strlen(json);
+
+    for (size_t i = 0; i < json_sz; i += chunk)
+    {
+        size_t sz = json_sz - i < chunk ? json_sz - i : chunk;
+        ASSERT_EQ(treadstone_json_parser_feed(parser, json + i, sz), 0);
+    }
+
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_parser_finish(parser, &binary, &binary_sz), 0);
+    std::string tmp(reinterpret_cast<char*>(binary), binary_sz);
+    free(binary);
+    return tmp;
+}
+
+TEST(JsonParser, MatchesOneShot)
+{
+    treadstone_json_parser* parser = treadstone_json_parser_create();
+    ASSERT_TRUE(parser);
+
+    for (const char** doc = documents; *doc; ++doc)
+    {
+        unsigned char* binary = NULL;
+        size_t binary_sz = 0;
+        ASSERT_EQ(treadstone_json_to_binary(*doc, &binary, &binary_sz), 0);
+        std::string expected(reinterpret_cast<char*>(binary), binary_sz);
+        free(binary);
+
+        for (size_t chunk = 1; chunk <= strlen(*doc); ++chunk)
+        {
+            ASSERT_EQ(parse_in_chunks(parser, *doc, chunk), expected);
+        }
+    }
+
+    treadstone_json_parser_destroy(parser);
+}
+
+TEST(JsonParser, Invalid)
+{
+    treadstone_json_parser* parser = treadstone_json_parser_create();
+    ASSERT_TRUE(parser);
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+
+    ASSERT_EQ(treadstone_json_parser_feed(parser, "[1, 2", 5), 0);
+    ASSERT_EQ(treadstone_json_parser_finish(parser, &binary, &binary_sz), -1);
+    ASSERT_EQ(errno, EINVAL);
+    treadstone_json_parser_reset(parser);
+
+    ASSERT_EQ(treadstone_json_parser_feed(parser, "{\"a\" 1}", 7), -1);
+    ASSERT_EQ(treadstone_json_parser_feed(parser, "{}", 2), -1);
+    treadstone_json_parser_reset(parser);
+
+    ASSERT_EQ(treadstone_json_parser_feed(parser, "[1,]", 4), -1);
+    treadstone_json_parser_reset(parser);
+    ASSERT_EQ(treadstone_json_parser_feed(parser, "tru", 3), 0);
+    ASSERT_EQ(treadstone_json_parser_feed(parser, "x", 1), -1);
+    treadstone_json_parser_reset(parser);
+    ASSERT_EQ(treadstone_json_parser_feed(parser, "{} {}", 5), -1);
+    treadstone_json_parser_reset(parser);
+    ASSERT_EQ(treadstone_json_parser_finish(parser, &binary, &binary_sz), -1);
+    treadstone_json_parser_reset(parser);
+
+    ASSERT_EQ(treadstone_json_parser_feed(parser, "1-2", 3), 0);
+    ASSERT_EQ(treadstone_json_parser_finish(parser, &binary, &binary_sz), -1);
+    treadstone_json_parser_reset(parser);
+    ASSERT_EQ(parse_in_chunks(parser, "null", 2), std::string("\x47", 1));
+    treadstone_json_parser_destroy(parser);
+}
@@ -32,6 +32,9 @@
 // C
 #include <string.h>
 
+// STL
+#include <string>
+
 TEST(JsonToBinary, EmptyString)
 {
     const char *json = "";
@@ -98,3 +101,185 @@ TEST(JsonToBinary, EncodeAndDecode)
     free(binary);
     free(json2);
 }
+
+TEST(JsonToBinary, Truncated)
+{
+    const char *json = "[1,";
+    char unsigned *binary = NULL;
+    size_t binary_sz = 0;
+
+    int res = treadstone_json_to_binary(json, &binary, &binary_sz);
+    ASSERT_TRUE(binary == NULL);
+    ASSERT_EQ(binary_sz, 0);
+    ASSERT_NE(res, 0);
+}
+
+static std::string
+string_body(const char* json)
+{
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+
+    if (treadstone_json_to_binary(json, &binary, &binary_sz) < 0)
+    {
+        return "<error>";
+    }
+
+    ASSERT_EQ(treadstone_binary_is_string(binary, binary_sz), 0);
+    std::string tmp(treadstone_binary_string_bytes(binary, binary_sz), '\0');
+    treadstone_binary_to_string(binary, binary_sz, &tmp[0]);
+    free(binary);
+    return tmp;
+}
+
+TEST(JsonToBinary, DecodeEscapes)
+{
+    ASSERT_EQ(string_body("\"a\\nb\\t\\\"\\\\\\/\""), "a\nb\t\"\\/");
+    ASSERT_EQ(string_body("\"\\u00e9\\u20AC\""), "\xc3\xa9\xe2\x82\xac");
+    ASSERT_EQ(string_body("\"\\ud83d\\ude00\""), "\xf0\x9f\x98\x80");
+    ASSERT_EQ(string_body("\"\xf0\x9f\x98\x80 raw\""), "\xf0\x9f\x98\x80 raw");
+    // long enough for the vector loops, with escapes on either side
+    ASSERT_EQ(string_body("\"\\nabcdefghijklmnopqrstuvwxyz0123456789\\n\""),
+              "\nabcdefghijklmnopqrstuvwxyz0123456789\n");
+    // bad escapes, lone surrogates and malformed UTF-8
+    ASSERT_EQ(string_body("\"\\x\""), "<error>");
+    ASSERT_EQ(string_body("\"\\u12\""), "<error>");
+    ASSERT_EQ(string_body("\"\\ud83d\""), "<error>");
+    ASSERT_EQ(string_body("\"\\ude00\""), "<error>");
+    ASSERT_EQ(string_body("\"\xc0\xaf\""), "<error>");
+    ASSERT_EQ(string_body("\"\xed\xa0\x80\""), "<error>");
+    ASSERT_EQ(string_body("\"\xe2\x82\""), "<error>");
+}
+
+TEST(JsonToBinary, ReescapeOnOutput)
+{
+    const char* json = "{\"k\\u0065y\": \"q\\\"uote\\n\\u0001\\u00e9\"}";
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary(json, &binary, &binary_sz), 0);
+    char* out = NULL;
+    ASSERT_EQ(treadstone_binary_to_json(binary, binary_sz, &out), 0);
+    ASSERT_EQ(std::string(out), "{\"key\":\"q\\\"uote\\n\\u0001\xc3\xa9\"}");
+
+    // keys compare in their decoded form
+    treadstone_transformer* trans = treadstone_transformer_create(binary, binary_sz);
+    unsigned char* value = NULL;
+    size_t value_sz = 0;
+    ASSERT_EQ(treadstone_transformer_extract_value(trans, "key", &value, &value_sz), 0);
+    free(value);
+    treadstone_transformer_destroy(trans);
+    free(out);
+    free(binary);
+}
+
+TEST(JsonToBinary, RawControlBytes)
+{
+    // accepted as they are, and escaped on the way out
+    ASSERT_EQ(string_body("\"a\x01\tb\""), "a\x01\tb");
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary("\"a\x01\tb\"", &binary, &binary_sz), 0);
+    char* out = NULL;
+    ASSERT_EQ(treadstone_binary_to_json(binary, binary_sz, &out), 0);
+    ASSERT_EQ(std::string(out), "\"a\\u0001\\tb\"");
+    free(out);
+    free(binary);
+}
+
+static std::string
+legacy_string(const std::string& text)
+{
+    return std::string("\x42") + char(text.size()) + text;
+}
+
+TEST(JsonToBinary, UpgradeStrings)
+{
+    // as written before strings were decoded: the text between the quotes
+    std::string members = legacy_string("a") + legacy_string("x\\\"y\\u00e9") +
+                          legacy_string("k\\u0065y") + legacy_string("v") +
+                          legacy_string("b") + "\x41\x04" + legacy_string("\\n");
+    std::string legacy = std::string("\x40") + char(members.size()) + members;
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_binary_upgrade_strings(reinterpret_cast<const unsigned char*>(legacy.data()),
+                                                legacy.size(), &binary, &binary_sz), 0);
+
+    unsigned char* expected = NULL;
+    size_t expected_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary("{\"a\": \"x\\\"y\\u00e9\", \"k\\u0065y\": \"v\", \"b\": [\"\\n\"]}",
+                                        &expected, &expected_sz), 0);
+    ASSERT_EQ(binary_sz, expected_sz);
+    ASSERT_EQ(memcmp(binary, expected, binary_sz), 0);
+
+    // keys stored with escapes match their paths again
+    treadstone_transformer* trans = treadstone_transformer_create(binary, binary_sz);
+    ASSERT_TRUE(trans != NULL);
+    unsigned char* value = NULL;
+    size_t value_sz = 0;
+    ASSERT_EQ(treadstone_transformer_extract_value(trans, "key", &value, &value_sz), 0);
+    free(value);
+    treadstone_transformer_destroy(trans);
+    free(expected);
+    free(binary);
+
+    // bad escapes and truncated binaries leave nothing behind
+    std::string bad = legacy_string("\\x");
+    binary = NULL;
+    ASSERT_EQ(treadstone_binary_upgrade_strings(reinterpret_cast<const unsigned char*>(bad.data()),
+                                                bad.size(), &binary, &binary_sz), -1);
+    ASSERT_TRUE(binary == NULL);
+    ASSERT_EQ(treadstone_binary_upgrade_strings(reinterpret_cast<const unsigned char*>(legacy.data()),
+                                                legacy.size() - 1, &binary, &binary_sz), -1);
+    ASSERT_TRUE(binary == NULL);
+}
+
+static void
+check_lengths(const std::string& json)
+{
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    size_t length = 0;
+    ASSERT_EQ(treadstone_json_sz_to_binary(json.data(), json.size(), &binary, &binary_sz), 0);
+    ASSERT_EQ(treadstone_json_binary_length(json.data(), json.size(), &length), 0);
+    ASSERT_EQ(length, binary_sz);
+
+    char* out = NULL;
+    ASSERT_EQ(treadstone_binary_to_json(binary, binary_sz, &out), 0);
+    ASSERT_EQ(treadstone_binary_json_length(binary, binary_sz, &length), 0);
+    ASSERT_EQ(length, strlen(out));
+    free(out);
+    free(binary);
+}
+
+TEST(JsonToBinary, Length)
+{
+    check_lengths("0");
+    check_lengths("-1");
+    check_lengths("-9223372036854775808");
+    check_lengths("[1., .5, -2.5e300, 1e-7, 123456789]");
+    check_lengths("{\"k\\u0065y\": \"q\\\"uote\\n\\u0001\\u00e9\\ud83d\\ude00\", \"\": []}");
+    check_lengths("[true, false, null, {}, [[]], {\"a\": {\"b\": [1, {\"c\": \"d\"}]}}]");
+    check_lengths("\"" + std::string(200, 'x') + "\"");
+    check_lengths("[\"" + std::string(20000, 'y') + "\", {\"" + std::string(130, 'z') + "\": 1}]");
+
+    // past the size the conversion bounds rather than measures
+    std::string big("[");
+
+    for (size_t i = 0; big.size() < (3 << 20); ++i)
+    {
+        big += i ? ", " : "";
+        big += "{\"n\": -17, \"d\": 0.25, \"s\": \"\\u00e9\\t\\\"x\"}";
+    }
+
+    big += "]";
+    check_lengths(big);
+
+    size_t length = 0;
+    ASSERT_EQ(treadstone_json_binary_length("[1,", 3, &length), -1);
+    ASSERT_EQ(treadstone_json_binary_length("[1] x", 5, &length), -1);
+    ASSERT_EQ(treadstone_json_binary_length("\"\\ud83d\"", 8, &length), -1);
+    const unsigned char truncated[] = {0x41, 0x05, 0x44, 0x01};
+    ASSERT_EQ(treadstone_binary_json_length(truncated, sizeof(truncated), &length), -1);
+    ASSERT_EQ(treadstone_binary_json_length(NULL, 0, &length), 0);
+    ASSERT_EQ(length, 2U);
+}
@@ -0,0 +1,333 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+
+// STL
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Treadstone
+#include <treadstone.h>
+#include "test/th.h"
+
+// a top-level container large enough to be split many ways
+static std::string
+records(bool object, size_t count)
+{
+    std::string json(object ? "{" : "[");
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        char buf[160];
+
+        if (i > 0)
+        {
+            json += ", ";
+        }
+
+        if (object)
+        {
+            snprintf(buf, sizeof(buf), "\"k%zu\": ", i);
+            json += buf;
+        }
+
+        snprintf(buf, sizeof(buf),
+                 "{\"id\": %zu, \"score\": %zu.5, \"name\": \"r,\\\"%zu]\", "
+                 "\"tags\": [\"a\", {\"b\": [true, null]}], \"ok\": false}",
+                 i, i % 97, i);
+        json += buf;
+    }
+
+    json += object ? "}\n" : "]\n";
+    return json;
+}
+
+static void
+same_as_serial(treadstone_pool* pool, const std::string& json)
+{
+    unsigned char* serial = NULL;
+    size_t serial_sz = 0;
+    unsigned char* parallel = NULL;
+    size_t parallel_sz = 0;
+    int expected = treadstone_json_sz_to_binary(json.c_str(), json.size(), &serial, &serial_sz);
+    int saved = errno;
+    ASSERT_EQ(treadstone_json_sz_to_binary_parallel(pool, json.c_str(), json.size(),
+                                                    &parallel, &parallel_sz), expected);
+
+    if (expected == 0)
+    {
+        ASSERT_EQ(parallel_sz, serial_sz);
+        ASSERT_EQ(memcmp(parallel, serial, serial_sz), 0);
+    }
+    else
+    {
+        ASSERT_EQ(errno, saved);
+        ASSERT_TRUE(parallel == NULL);
+    }
+
+    free(serial);
+    free(parallel);
+}
+
+TEST(Parallel, MatchesSerial)
+{
+    treadstone_pool* pool = treadstone_pool_create(4);
+    ASSERT_TRUE(pool);
+    ASSERT_EQ(treadstone_pool_threads(pool), 4U);
+    same_as_serial(pool, records(false, 20000));
+    same_as_serial(pool, records(true, 20000));
+    // too small or not a container: converted on the caller
+    same_as_serial(pool, records(false, 3));
+    same_as_serial(pool, "\"just a string\"");
+    same_as_serial(NULL, records(false, 20000));
+    treadstone_pool_destroy(pool);
+}
+
+TEST(Parallel, Invalid)
+{
+    treadstone_pool* pool = treadstone_pool_create(4);
+    ASSERT_TRUE(pool);
+    std::string json(records(false, 20000));
+    const size_t mid = json.find(", ", json.size() / 2);
+
+    std::string broken(json);
+    broken.insert(mid, ",");
+    same_as_serial(pool, broken);
+    broken = json;
+    broken[broken.size() - 2] = '}';
+    same_as_serial(pool, broken);
+    broken = json + "1";
+    same_as_serial(pool, broken);
+    broken = json;
+    broken.erase(mid + 2, 1);
+    same_as_serial(pool, broken);
+
+    // the depth limit still applies within a run
+    unsigned old = treadstone_get_max_depth();
+    treadstone_set_max_depth(3);
+    same_as_serial(pool, json);
+    treadstone_set_max_depth(old);
+    treadstone_pool_destroy(pool);
+}
+
+TEST(Parallel, Batch)
+{
+    treadstone_pool* pool = treadstone_pool_create(4);
+    ASSERT_TRUE(pool);
+    std::string big(records(false, 2000));
+    // documents are slices of one buffer with nothing between them, so a
+    // number must not run on into the next document
+    std::string text;
+    std::vector<size_t> starts;
+    std::vector<size_t> sizes;
+
+    for (size_t i = 0; i < 5000; ++i)
+    {
+        std::string doc;
+
+        switch (i % 7)
+        {
+            case 0: doc = "12"; break;
+            case 1: doc = "-3.5e2"; break;
+            case 2: doc = "{\"a\": [1, \"two\", null]}"; break;
+            case 3: doc = i % 1000 == 3 ? big : "[true]"; break;
+            case 4: doc = "{\"bad\": }"; break;
+            case 5: doc = ""; break;
+            default: doc = "\"s\\u00e9\""; break;
+        }
+
+        starts.push_back(text.size());
+        sizes.push_back(doc.size());
+        text += doc;
+    }
+
+    std::vector<const char*> json;
+
+    for (size_t i = 0; i < starts.size(); ++i)
+    {
+        json.push_back(text.data() + starts[i]);
+    }
+
+    for (size_t with_pool = 0; with_pool < 2; ++with_pool)
+    {
+        unsigned char* binary = NULL;
+        size_t binary_sz = 0;
+        std::vector<size_t> offsets(json.size() + 1);
+        ASSERT_EQ(treadstone_batch_json_to_binary(with_pool ? pool : NULL, json.size(),
+                                                  &json[0], &sizes[0],
+                                                  &binary, &binary_sz, &offsets[0]), 0);
+        ASSERT_EQ(offsets.back(), binary_sz);
+        std::vector<const unsigned char*> docs;
+        std::vector<size_t> docs_sz;
+
+        for (size_t i = 0; i < json.size(); ++i)
+        {
+            docs.push_back(binary + offsets[i]);
+            docs_sz.push_back(offsets[i + 1] - offsets[i]);
+        }
+
+        char* out = NULL;
+        size_t out_sz = 0;
+        std::vector<size_t> out_offsets(json.size() + 1);
+        ASSERT_EQ(treadstone_batch_binary_to_json(with_pool ? pool : NULL, docs.size(),
+                                                  &docs[0], &docs_sz[0],
+                                                  &out, &out_sz, &out_offsets[0]), 0);
+        ASSERT_EQ(out_offsets.back(), out_sz);
+
+        for (size_t i = 0; i < json.size(); ++i)
+        {
+            std::string doc(json[i], sizes[i]);
+            unsigned char* expected = NULL;
+            size_t expected_sz = 0;
+
+            if (treadstone_json_sz_to_binary(doc.c_str(), doc.size(), &expected, &expected_sz) < 0)
+            {
+                expected_sz = 0;
+            }
+
+            ASSERT_EQ(offsets[i + 1] - offsets[i], expected_sz);
+
+            if (expected_sz > 0)
+            {
+                ASSERT_EQ(memcmp(binary + offsets[i], expected, expected_sz), 0);
+            }
+
+            // and back again, where the invalid documents stay empty
+            char* back = NULL;
+
+            if (expected_sz > 0)
+            {
+                ASSERT_EQ(treadstone_binary_to_json(expected, expected_sz, &back), 0);
+                ASSERT_TRUE(std::string(back) == std::string(out + out_offsets[i],
+                                                             out_offsets[i + 1] - out_offsets[i]));
+            }
+            else
+            {
+                ASSERT_EQ(out_offsets[i + 1], out_offsets[i]);
+            }
+
+            free(back);
+            free(expected);
+        }
+
+        free(out);
+        free(binary);
+    }
+
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    size_t offsets[1] = {7};
+    ASSERT_EQ(treadstone_batch_json_to_binary(pool, 0, NULL, NULL, &binary, &binary_sz, offsets), 0);
+    ASSERT_EQ(offsets[0], 0U);
+    ASSERT_TRUE(binary == NULL);
+    treadstone_pool_destroy(pool);
+}
+
+// the pool's threads allocate too
+struct counting
+{
+    counting() : allocs(0), outstanding(0) {}
+    std::atomic<size_t> allocs;
+    std::atomic<size_t> outstanding;
+};
+
+static void*
+counting_alloc(void* ctx, size_t sz)
+{
+    counting* c = static_cast<counting*>(ctx);
+    ++c->allocs;
+    c->outstanding += sz;
+    return malloc(sz);
+}
+
+static void*
+counting_realloc(void* ctx, void* ptr, size_t old_sz, size_t new_sz)
+{
+    counting* c = static_cast<counting*>(ctx);
+    ++c->allocs;
+    c->outstanding += new_sz;
+    c->outstanding -= old_sz;
+    return realloc(ptr, new_sz);
+}
+
+static void
+counting_free(void* ctx, void* ptr, size_t sz)
+{
+    static_cast<counting*>(ctx)->outstanding -= sz;
+    free(ptr);
+}
+
+TEST(Parallel, Allocator)
+{
+    treadstone_pool* pool = treadstone_pool_create(4);
+    ASSERT_TRUE(pool);
+    counting c;
+    treadstone_allocator a = {counting_alloc, counting_realloc, counting_free, &c};
+    std::string json(records(false, 20000));
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_sz_to_binary_parallel_alloc(&a, pool, json.c_str(), json.size(),
+                                                          &binary, &binary_sz), 0);
+    ASSERT_GT(c.allocs.load(), 4U);
+
+    const char* docs[] = {"[1, 2]", "{\"bad\": }", "\"x\""};
+    const size_t docs_sz[] = {6, 10, 3};
+    unsigned char* batch = NULL;
+    size_t batch_sz = 0;
+    size_t offsets[4];
+    ASSERT_EQ(treadstone_batch_json_to_binary_alloc(&a, pool, 3, docs, docs_sz,
+                                                    &batch, &batch_sz, offsets), 0);
+    const unsigned char* pieces[] = {batch + offsets[0], batch + offsets[1], batch + offsets[2]};
+    const size_t pieces_sz[] = {offsets[1] - offsets[0], offsets[2] - offsets[1], offsets[3] - offsets[2]};
+    char* text = NULL;
+    size_t text_sz = 0;
+    ASSERT_EQ(treadstone_batch_binary_to_json_alloc(&a, pool, 3, pieces, pieces_sz,
+                                                    &text, &text_sz, offsets), 0);
+    ASSERT_EQ(std::string(text, text_sz), "[1,2]\"x\"");
+
+    // every buffer goes back to the allocator it came from, at its size
+    a.free(a.ctx, text, text_sz);
+    a.free(a.ctx, batch, batch_sz);
+    a.free(a.ctx, binary, binary_sz);
+    ASSERT_EQ(c.outstanding.load(), 0U);
+
+    // and when nothing converts there is no buffer at all
+    ASSERT_EQ(treadstone_batch_json_to_binary_alloc(&a, pool, 1, docs + 1, docs_sz + 1,
+                                                    &batch, &batch_sz, offsets), 0);
+    ASSERT_TRUE(batch == NULL);
+    ASSERT_EQ(batch_sz, 0U);
+    ASSERT_EQ(c.outstanding.load(), 0U);
+    treadstone_pool_destroy(pool);
+}
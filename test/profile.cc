@@ -0,0 +1,117 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+
+// Treadstone
+#include <treadstone.h>
+#include "test/th.h"
+
+static void
+add_json(treadstone_profile* p, const char* json)
+{
+    ASSERT_EQ(treadstone_profile_json(p, json, strlen(json)), 0);
+}
+
+TEST(Profile, Shape)
+{
+    treadstone_profile* p = treadstone_profile_create();
+    ASSERT_TRUE(p != NULL);
+    add_json(p, "{\"a\": 1, \"b\": -2, \"c\": \"x\\ny\"}");
+    add_json(p, "{\"a\": [1.5, 0.1, true, null], \"b\": {}}");
+    add_json(p, "7");
+    ASSERT_EQ(treadstone_profile_json(p, "{\"a\": ", 6), -1);
+    ASSERT_EQ(errno, EINVAL);
+
+    treadstone_profile_summary s;
+    ASSERT_EQ(treadstone_profile_summarize(p, &s), 0);
+    ASSERT_EQ(s.documents, 3U);
+    ASSERT_GE(s.json_bytes, 1U);
+    ASSERT_EQ(s.objects, 3U);
+    ASSERT_EQ(s.arrays, 1U);
+    ASSERT_EQ(s.strings, 1U);
+    ASSERT_EQ(s.doubles, 2U);
+    ASSERT_EQ(s.integers, 3U);
+    ASSERT_EQ(s.trues, 1U);
+    ASSERT_EQ(s.falses, 0U);
+    ASSERT_EQ(s.nulls, 1U);
+    ASSERT_EQ(s.negative_integers, 1U);
+    ASSERT_EQ(s.integral_doubles, 0U);
+    ASSERT_EQ(s.float_doubles, 1U);
+    ASSERT_EQ(s.escaped_strings, 1U);
+    ASSERT_EQ(s.escaped_keys, 0U);
+    ASSERT_EQ(s.keys, 5U);
+    ASSERT_EQ(s.key_bytes, 15U);
+    ASSERT_EQ(s.distinct_keys, 3U);
+    ASSERT_EQ(s.distinct_key_bytes, 9U);
+
+    // depths 1, 2 and 0
+    ASSERT_EQ(s.depth.count, 3U);
+    ASSERT_EQ(s.depth.sum, 3U);
+    ASSERT_EQ(s.depth.buckets[0], 1U);
+    ASSERT_EQ(s.depth.buckets[1], 1U);
+    ASSERT_EQ(s.depth.buckets[2], 1U);
+    // widths 3, 2 and 0
+    ASSERT_EQ(s.object_width.count, 3U);
+    ASSERT_EQ(s.object_width.sum, 5U);
+    ASSERT_EQ(s.object_width.buckets[0], 1U);
+    ASSERT_EQ(s.object_width.buckets[2], 2U);
+    ASSERT_EQ(s.array_length.count, 1U);
+    ASSERT_EQ(s.array_length.buckets[3], 1U);
+    ASSERT_EQ(s.string_length.sum, 3U);
+    ASSERT_EQ(s.key_length.count, 5U);
+    // -2 takes ten bytes as it is, one as a zigzag varint
+    ASSERT_EQ(s.integer_bytes.sum, 12U);
+
+    ASSERT_EQ(s.zigzag_bytes, s.binary_bytes - 9);
+    // five one-byte references with their tags, and a nine byte dictionary
+    ASSERT_EQ(s.key_dictionary_bytes, s.binary_bytes + 4);
+    ASSERT_EQ(s.float_bytes, s.binary_bytes - 4);
+    ASSERT_EQ(s.combined_bytes, s.binary_bytes - 9);
+    treadstone_profile_destroy(p);
+}
+
+TEST(Profile, Invalid)
+{
+    treadstone_profile* p = treadstone_profile_create();
+    ASSERT_TRUE(p != NULL);
+    const unsigned char truncated[] = {0x40, 0x05, 0x42, 0x01};
+    ASSERT_EQ(treadstone_profile_binary(p, truncated, sizeof(truncated)), -1);
+    ASSERT_EQ(treadstone_profile_binary(p, NULL, 0), -1);
+
+    treadstone_profile_summary s;
+    ASSERT_EQ(treadstone_profile_summarize(p, &s), 0);
+    ASSERT_EQ(s.documents, 0U);
+    ASSERT_EQ(s.binary_bytes, 0U);
+    ASSERT_EQ(s.keys, 0U);
+    ASSERT_EQ(s.combined_bytes, 0U);
+    treadstone_profile_destroy(p);
+}
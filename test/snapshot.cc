@@ -0,0 +1,203 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdlib.h>
+#include <string.h>
+
+// STL
+#include <string>
+#include <thread>
+#include <vector>
+
+// Treadstone
+#include <treadstone.h>
+#include "test/th.h"
+
+static std::string
+snapshot_json(const treadstone_snapshot* snap)
+{
+    char* json = NULL;
+    ASSERT_EQ(treadstone_snapshot_to_json(snap, &json), 0);
+    std::string ret(json);
+    free(json);
+    return ret;
+}
+
+static std::string
+snapshot_extract(const treadstone_snapshot* snap, const char* path)
+{
+    unsigned char* value = NULL;
+    size_t value_sz = 0;
+
+    if (treadstone_snapshot_extract_value(snap, path, &value, &value_sz) < 0)
+    {
+        return "";
+    }
+
+    char* json = NULL;
+    ASSERT_EQ(treadstone_binary_to_json(value, value_sz, &json), 0);
+    std::string ret(json);
+    free(json);
+    free(value);
+    return ret;
+}
+
+static void
+set_integer(treadstone_transformer* trans, const char* path, int64_t x)
+{
+    unsigned char* value = NULL;
+    size_t value_sz = 0;
+    ASSERT_EQ(treadstone_integer_to_binary(x, &value, &value_sz), 0);
+    ASSERT_EQ(treadstone_transformer_set_value(trans, path, value, value_sz), 0);
+    free(value);
+}
+
+TEST(Snapshot, Versions)
+{
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary("{\"a\": 1}", &binary, &binary_sz), 0);
+    treadstone_transformer* trans = treadstone_transformer_create(binary, binary_sz);
+    ASSERT_TRUE(trans != NULL);
+
+    treadstone_snapshot* v1 = treadstone_transformer_snapshot(trans);
+    ASSERT_TRUE(v1 != NULL);
+    // no change in between, so the same version
+    treadstone_snapshot* again = treadstone_transformer_snapshot(trans);
+    ASSERT_TRUE(again == v1);
+    treadstone_snapshot_release(again);
+
+    // the writer moves on without disturbing the version readers hold
+    set_integer(trans, "a", 2);
+    set_integer(trans, "b", 3);
+    treadstone_snapshot* v2 = treadstone_transformer_snapshot(trans);
+    ASSERT_TRUE(v2 != NULL && v2 != v1);
+    set_integer(trans, "a", 4);
+
+    ASSERT_EQ(snapshot_json(v1), "{\"a\":1}");
+    ASSERT_EQ(snapshot_json(v2), "{\"a\":2,\"b\":3}");
+    ASSERT_EQ(snapshot_extract(v2, "b"), "3");
+    ASSERT_EQ(snapshot_extract(v1, "b"), "");
+
+    const unsigned char* v1_binary = NULL;
+    size_t v1_binary_sz = 0;
+    treadstone_snapshot_binary(v1, &v1_binary, &v1_binary_sz);
+    ASSERT_EQ(v1_binary_sz, binary_sz);
+    ASSERT_EQ(memcmp(v1_binary, binary, binary_sz), 0);
+
+    // a retained version outlives both the transformer and the first holder
+    treadstone_snapshot_retain(v2);
+    treadstone_snapshot_release(v2);
+    treadstone_transformer_destroy(trans);
+    ASSERT_EQ(snapshot_json(v2), "{\"a\":2,\"b\":3}");
+    treadstone_snapshot_release(v2);
+    treadstone_snapshot_release(v1);
+    free(binary);
+}
+
+TEST(Snapshot, Arena)
+{
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary("{\"a\": [1, 2]}", &binary, &binary_sz), 0);
+    treadstone_arena* arena = treadstone_arena_create(4096);
+    ASSERT_TRUE(arena != NULL);
+    treadstone_transformer* trans = treadstone_transformer_create_arena(arena, binary, binary_sz);
+    ASSERT_TRUE(trans != NULL);
+    treadstone_snapshot* snap = treadstone_transformer_snapshot(trans);
+    ASSERT_TRUE(snap != NULL);
+
+    // resetting the arena must not take the snapshot with it
+    ASSERT_EQ(treadstone_transformer_reset(trans, binary, binary_sz), 0);
+    set_integer(trans, "a", 5);
+    ASSERT_EQ(snapshot_extract(snap, "a[1]"), "2");
+    treadstone_transformer_destroy(trans);
+    treadstone_arena_destroy(arena);
+    ASSERT_EQ(snapshot_json(snap), "{\"a\":[1,2]}");
+    treadstone_snapshot_release(snap);
+    free(binary);
+}
+
+static void
+read_version(treadstone_snapshot* snap, int64_t expected)
+{
+    char want[32];
+    sprintf(want, "%lld", (long long)expected);
+
+    for (size_t i = 0; i < 200; ++i)
+    {
+        ASSERT_EQ(snapshot_extract(snap, "x"), want);
+        ASSERT_EQ(snapshot_json(snap), std::string("{\"x\":") + want + ",\"pad\":\"abcdefghij\"}");
+    }
+
+    treadstone_snapshot_release(snap);
+}
+
+TEST(Snapshot, Threads)
+{
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary("{\"x\": 0, \"pad\": \"abcdefghij\"}", &binary, &binary_sz), 0);
+    treadstone_transformer* trans = treadstone_transformer_create(binary, binary_sz);
+    ASSERT_TRUE(trans != NULL);
+    std::vector<std::thread*> readers;
+
+    // one writer publishes versions while every earlier one is being read
+    for (int64_t v = 0; v < 8; ++v)
+    {
+        if (v > 0)
+        {
+            set_integer(trans, "x", v * 1000);
+        }
+
+        treadstone_snapshot* snap = treadstone_transformer_snapshot(trans);
+        ASSERT_TRUE(snap != NULL);
+
+        for (size_t r = 0; r < 2; ++r)
+        {
+            treadstone_snapshot_retain(snap);
+            readers.push_back(new std::thread(read_version, snap, v * 1000));
+        }
+
+        treadstone_snapshot_release(snap);
+    }
+
+    for (size_t i = 0; i < 100; ++i)
+    {
+        set_integer(trans, "x", i);
+    }
+
+    for (size_t i = 0; i < readers.size(); ++i)
+    {
+        readers[i]->join();
+        delete readers[i];
+    }
+
+    treadstone_transformer_destroy(trans);
+    free(binary);
+}
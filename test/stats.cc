@@ -0,0 +1,213 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdlib.h>
+#include <string.h>
+
+// STL
+#include <string>
+#include <thread>
+
+// Treadstone
+#include <treadstone.h>
+#include "test/th.h"
+
+static void
+convert_once(const char* json)
+{
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary(json, &binary, &binary_sz), 0);
+    ASSERT_EQ(treadstone_binary_validate(binary, binary_sz), 0);
+    char* back = NULL;
+    ASSERT_EQ(treadstone_binary_to_json(binary, binary_sz, &back), 0);
+    free(back);
+    free(binary);
+}
+
+static uint64_t
+bucket_total(const treadstone_stats_histogram* h)
+{
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < TREADSTONE_STATS_BUCKETS; ++i)
+    {
+        total += h->buckets[i];
+    }
+
+    return total;
+}
+
+TEST(Stats, Conversions)
+{
+    const char* json = "{\"a\": [1, 2.5, \"three\"], \"b\": {\"c\": null}}";
+    treadstone_stats before;
+    treadstone_stats after;
+    treadstone_stats_enable(1);
+    ASSERT_TRUE(treadstone_stats_enabled());
+    treadstone_stats_snapshot(&before);
+    convert_once(json);
+    treadstone_stats_snapshot(&after);
+    ASSERT_EQ(after.json_to_binary - before.json_to_binary, 1U);
+    ASSERT_EQ(after.json_to_binary_bytes_in - before.json_to_binary_bytes_in, strlen(json));
+    ASSERT_GE(after.json_to_binary_bytes_out, before.json_to_binary_bytes_out + 1);
+    ASSERT_EQ(after.binary_to_json - before.binary_to_json, 1U);
+    ASSERT_EQ(after.binary_to_json_bytes_in - before.binary_to_json_bytes_in,
+              after.json_to_binary_bytes_out - before.json_to_binary_bytes_out);
+    ASSERT_GE(after.binary_to_json_bytes_out, before.binary_to_json_bytes_out + 1);
+    ASSERT_EQ(after.validate - before.validate, 1U);
+    ASSERT_EQ(after.json_to_binary_ns.count - before.json_to_binary_ns.count, 1U);
+    ASSERT_EQ(after.binary_to_json_ns.count - before.binary_to_json_ns.count, 1U);
+    ASSERT_EQ(bucket_total(&after.json_to_binary_ns), after.json_to_binary_ns.count);
+    treadstone_stats_enable(0);
+}
+
+static int
+counting_sink(void* ctx, const char*, size_t json_sz)
+{
+    *static_cast<size_t*>(ctx) += json_sz;
+    return 0;
+}
+
+TEST(Stats, SinkBytesOut)
+{
+    // a string too long for the buffer goes to the sink unbuffered
+    std::string json("[\"" + std::string(1000, 'x') + "\", 1]");
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary(json.c_str(), &binary, &binary_sz), 0);
+    treadstone_stats before;
+    treadstone_stats after;
+    treadstone_stats_enable(1);
+    treadstone_stats_snapshot(&before);
+    char buf[64];
+    size_t out = 0;
+    ASSERT_EQ(treadstone_binary_to_json_sink(binary, binary_sz, buf, sizeof(buf), counting_sink, &out), 0);
+    treadstone_stats_snapshot(&after);
+    treadstone_stats_enable(0);
+    ASSERT_EQ(out, json.size() - 1);
+    ASSERT_EQ(after.binary_to_json_bytes_out - before.binary_to_json_bytes_out, out);
+    ASSERT_EQ(after.validate - before.validate, 0U);
+    free(binary);
+}
+
+TEST(Stats, Transforms)
+{
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary("{\"a\": 1, \"b\": 2, \"c\": [1, 2]}", &binary, &binary_sz), 0);
+    treadstone_transformer* trans = treadstone_transformer_create(binary, binary_sz);
+    ASSERT_TRUE(trans != NULL);
+    unsigned char* value = NULL;
+    size_t value_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary("true", &value, &value_sz), 0);
+
+    treadstone_stats before;
+    treadstone_stats after;
+    treadstone_stats_enable(1);
+    treadstone_stats_snapshot(&before);
+    ASSERT_EQ(treadstone_transformer_set_value(trans, "c", value, value_sz), 0);
+    ASSERT_EQ(treadstone_transformer_unset_value(trans, "a"), 0);
+    treadstone_stats_snapshot(&after);
+    treadstone_stats_enable(0);
+
+    ASSERT_EQ(after.transforms - before.transforms, 2U);
+    ASSERT_GE(after.transform_steps, before.transform_steps + 2);
+    ASSERT_GE(after.transform_bytes_copied, before.transform_bytes_copied + 1);
+    ASSERT_EQ(after.transform_ns.count - before.transform_ns.count, 2U);
+    ASSERT_EQ(after.rewrite_bytes.count - before.rewrite_bytes.count, 2U);
+    ASSERT_GE(after.rewrite_bytes.sum, before.rewrite_bytes.sum + 2);
+
+    treadstone_transformer_destroy(trans);
+    free(value);
+    free(binary);
+}
+
+TEST(Stats, Threads)
+{
+    treadstone_stats before;
+    treadstone_stats after;
+    treadstone_stats_enable(1);
+    treadstone_stats_snapshot(&before);
+    std::thread t1(convert_once, "[1, 2, 3]");
+    t1.join();
+    // a second thread may take over the first one's counters
+    std::thread t2(convert_once, "[4, 5, 6]");
+    t2.join();
+    convert_once("[7, 8, 9]");
+    treadstone_stats_snapshot(&after);
+    treadstone_stats_enable(0);
+    ASSERT_EQ(after.json_to_binary - before.json_to_binary, 3U);
+    ASSERT_EQ(after.binary_to_json - before.binary_to_json, 3U);
+    ASSERT_EQ(after.json_to_binary_bytes_in - before.json_to_binary_bytes_in, 27U);
+}
+
+TEST(Stats, NoReallocs)
+{
+    // numbers and escapes that grow and shrink the most in either direction
+    std::string json("[");
+
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        json += i ? "," : "";
+        json += i % 2 ? "-1" : "1.";
+    }
+
+    json += ",\"\\u00e9\\u0001\\n\"]";
+    // and one large enough to be measured rather than bounded
+    std::string big("[");
+
+    while (big.size() < (2 << 20))
+    {
+        big += "-1,1.,\"\\u00e9\\u0001\\n\",";
+    }
+
+    big += "{}]";
+    treadstone_stats before;
+    treadstone_stats after;
+    treadstone_stats_enable(1);
+    treadstone_stats_snapshot(&before);
+    convert_once(json.c_str());
+    convert_once(big.c_str());
+    treadstone_stats_snapshot(&after);
+    treadstone_stats_enable(0);
+    ASSERT_EQ(after.json_to_binary - before.json_to_binary, 2U);
+    ASSERT_EQ(after.reallocs, before.reallocs);
+}
+
+TEST(Stats, Disabled)
+{
+    treadstone_stats before;
+    treadstone_stats after;
+    treadstone_stats_enable(0);
+    ASSERT_TRUE(!treadstone_stats_enabled());
+    treadstone_stats_snapshot(&before);
+    convert_once("{\"x\": [true, false]}");
+    treadstone_stats_snapshot(&after);
+    ASSERT_TRUE(memcmp(&before, &after, sizeof(before)) == 0);
+}
@@ -0,0 +1,224 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdlib.h>
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+
+// STL
+#include <string>
+#include <vector>
+
+// Treadstone
+#include <treadstone.h>
+#include "test/th.h"
+
+struct span
+{
+    span() : op(), input_sz(), path(), status(), ended() {}
+    treadstone_trace_op op;
+    size_t input_sz;
+    std::string path;
+    int status;
+    bool ended;
+};
+
+static void
+trace_begin(void* ctx, treadstone_trace_op op, size_t input_sz, const char* path)
+{
+    std::vector<span>* spans = static_cast<std::vector<span>*>(ctx);
+    spans->push_back(span());
+    spans->back().op = op;
+    spans->back().input_sz = input_sz;
+    spans->back().path = path ? path : "";
+}
+
+static void
+trace_end(void* ctx, treadstone_trace_op op, size_t input_sz, const char* path, int status)
+{
+    std::vector<span>* spans = static_cast<std::vector<span>*>(ctx);
+
+    // spans nest, so the innermost open one is ending
+    for (size_t i = spans->size(); i > 0; --i)
+    {
+        span* s = &(*spans)[i - 1];
+
+        if (!s->ended)
+        {
+            ASSERT_EQ(int(s->op), int(op));
+            ASSERT_EQ(s->input_sz, input_sz);
+            ASSERT_EQ(s->path, std::string(path ? path : ""));
+            s->status = status;
+            s->ended = true;
+            // as logging might; the caller must not see it
+            errno = EIO;
+            return;
+        }
+    }
+
+    ASSERT_TRUE(false);
+}
+
+// false when the library was built with the hooks compiled out
+static bool
+install(std::vector<span>* spans, treadstone_trace_hooks* hooks)
+{
+    hooks->begin = trace_begin;
+    hooks->end = trace_end;
+    hooks->ctx = spans;
+
+    if (treadstone_set_trace_hooks(hooks) < 0)
+    {
+        ASSERT_EQ(errno, ENOTSUP);
+        return false;
+    }
+
+    return true;
+}
+
+TEST(Trace, Conversions)
+{
+    std::vector<span> spans;
+    treadstone_trace_hooks hooks;
+
+    if (!install(&spans, &hooks))
+    {
+        return;
+    }
+
+    const char* json = "{\"a\": [1, 2, 3]}";
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary(json, &binary, &binary_sz), 0);
+    ASSERT_EQ(treadstone_binary_validate(binary, binary_sz), 0);
+    char* back = NULL;
+    ASSERT_EQ(treadstone_binary_to_json(binary, binary_sz, &back), 0);
+    free(binary);
+    ASSERT_EQ(treadstone_json_to_binary("{\"a\": ", &binary, &binary_sz), -1);
+    ASSERT_EQ(treadstone_set_trace_hooks(NULL), 0);
+    ASSERT_EQ(treadstone_json_to_binary(json, &binary, &binary_sz), 0);
+
+    ASSERT_EQ(spans.size(), 4U);
+    ASSERT_EQ(int(spans[0].op), int(TREADSTONE_TRACE_JSON_TO_BINARY));
+    ASSERT_EQ(spans[0].input_sz, strlen(json));
+    ASSERT_EQ(spans[0].status, 0);
+    ASSERT_EQ(int(spans[1].op), int(TREADSTONE_TRACE_VALIDATE));
+    ASSERT_EQ(spans[1].input_sz, binary_sz);
+    ASSERT_EQ(int(spans[2].op), int(TREADSTONE_TRACE_BINARY_TO_JSON));
+    ASSERT_EQ(spans[2].input_sz, binary_sz);
+    ASSERT_EQ(int(spans[3].op), int(TREADSTONE_TRACE_JSON_TO_BINARY));
+    ASSERT_EQ(spans[3].status, -1);
+
+    for (size_t i = 0; i < spans.size(); ++i)
+    {
+        ASSERT_TRUE(spans[i].ended);
+        ASSERT_EQ(spans[i].path, "");
+    }
+
+    free(back);
+    free(binary);
+}
+
+static int
+discard_sink(void*, const char*, size_t)
+{
+    return 0;
+}
+
+TEST(Trace, NoNestedValidate)
+{
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary("{\"a\": [1, 2, 3]}", &binary, &binary_sz), 0);
+    std::vector<span> spans;
+    treadstone_trace_hooks hooks;
+
+    if (!install(&spans, &hooks))
+    {
+        free(binary);
+        return;
+    }
+
+    // checks made on the caller's behalf are not spans of their own
+    char buf[16];
+    ASSERT_EQ(treadstone_binary_to_json_sink(binary, binary_sz, buf, sizeof(buf), discard_sink, NULL), 0);
+    treadstone_version* v = treadstone_version_create(binary, binary_sz);
+    ASSERT_TRUE(v != NULL);
+    ASSERT_EQ(treadstone_set_trace_hooks(NULL), 0);
+
+    ASSERT_EQ(spans.size(), 1U);
+    ASSERT_EQ(int(spans[0].op), int(TREADSTONE_TRACE_BINARY_TO_JSON));
+    ASSERT_EQ(spans[0].status, 0);
+
+    treadstone_version_release(v);
+    free(binary);
+}
+
+TEST(Trace, Transforms)
+{
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary("{\"a\": {\"b\": [1]}}", &binary, &binary_sz), 0);
+    treadstone_transformer* trans = treadstone_transformer_create(binary, binary_sz);
+    ASSERT_TRUE(trans != NULL);
+    unsigned char* value = NULL;
+    size_t value_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary("2", &value, &value_sz), 0);
+
+    std::vector<span> spans;
+    treadstone_trace_hooks hooks;
+
+    if (!install(&spans, &hooks))
+    {
+        treadstone_transformer_destroy(trans);
+        free(value);
+        free(binary);
+        return;
+    }
+
+    ASSERT_EQ(treadstone_transformer_array_append_value(trans, "a.b", value, value_sz), 0);
+    ASSERT_EQ(treadstone_transformer_unset_value(trans, "a.missing"), -1);
+    ASSERT_EQ(errno, EINVAL);
+    ASSERT_EQ(treadstone_set_trace_hooks(NULL), 0);
+
+    ASSERT_EQ(spans.size(), 2U);
+    ASSERT_EQ(int(spans[0].op), int(TREADSTONE_TRACE_ARRAY_APPEND));
+    ASSERT_EQ(spans[0].input_sz, binary_sz);
+    ASSERT_EQ(spans[0].path, "a.b");
+    ASSERT_EQ(spans[0].status, 0);
+    ASSERT_EQ(int(spans[1].op), int(TREADSTONE_TRACE_UNSET));
+    ASSERT_GE(spans[1].input_sz, binary_sz + 1);
+    ASSERT_EQ(spans[1].path, "a.missing");
+    ASSERT_EQ(spans[1].status, -1);
+
+    treadstone_transformer_destroy(trans);
+    free(value);
+    free(binary);
+}
@@ -25,6 +25,13 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// C
+#include <stdint.h>
+#include <stdlib.h>
+
+// POSIX
+#include <errno.h>
+
 // STL
 #include <string>
 
@@ -336,4 +343,139 @@ TEST(Transforms, Extract)
     ASSERT_EQ(transformer_dump(trans), "{\"foo\":5}");
     ASSERT_EQ(treadstone_transformer_extract_value(trans, ""), "{\"foo\":5}");
     ASSERT_EQ(treadstone_transformer_extract_value(trans, "foo"), "5");
+    treadstone_transformer_destroy(trans);
+}
+
+TEST(Transforms, Numeric)
+{
+    treadstone_transformer* trans = json_to_transformer("{\"n\": 5, \"d\": 1.5, \"s\": \"x\"}");
+    ASSERT_TRUE(trans);
+    int64_t i = 0;
+    double d = 0;
+    ASSERT_EQ(treadstone_transformer_integer_op(trans, "n", TREADSTONE_OP_ADD, 3, &i), 0);
+    ASSERT_EQ(i, 8);
+    ASSERT_EQ(treadstone_transformer_integer_op(trans, "n", TREADSTONE_OP_MUL, 1000, NULL), 0);
+    ASSERT_EQ(treadstone_transformer_integer_op(trans, "n", TREADSTONE_OP_MIN, -2, NULL), 0);
+    ASSERT_EQ(treadstone_transformer_integer_op(trans, "n", TREADSTONE_OP_XOR, 3, &i), 0);
+    ASSERT_EQ(i, -3);
+    ASSERT_EQ(treadstone_transformer_integer_op(trans, "n", TREADSTONE_OP_MAX, 7, NULL), 0);
+    ASSERT_EQ(treadstone_transformer_integer_op(trans, "n", TREADSTONE_OP_OR, 8, NULL), 0);
+    ASSERT_EQ(treadstone_transformer_integer_op(trans, "n", TREADSTONE_OP_AND, 13, NULL), 0);
+    ASSERT_EQ(treadstone_transformer_double_op(trans, "d", TREADSTONE_OP_MUL, 3, &d), 0);
+    // exactly 4.5, without an == on doubles
+    ASSERT_LE(d, 4.5);
+    ASSERT_GE(d, 4.5);
+    ASSERT_EQ(treadstone_transformer_string_append(trans, "s", "yz", 2), 0);
+    ASSERT_EQ(transformer_dump(trans), "{\"n\":13,\"d\":4.5,\"s\":\"xyz\"}");
+
+    // failures leave the document alone
+    ASSERT_EQ(treadstone_transformer_integer_op(trans, "n", TREADSTONE_OP_MUL, INT64_MAX, NULL), -1);
+    ASSERT_EQ(errno, ERANGE);
+    ASSERT_EQ(treadstone_transformer_integer_op(trans, "d", TREADSTONE_OP_ADD, 1, NULL), -1);
+    ASSERT_EQ(errno, EINVAL);
+    ASSERT_EQ(treadstone_transformer_double_op(trans, "d", TREADSTONE_OP_AND, 1, NULL), -1);
+    ASSERT_EQ(errno, EINVAL);
+    ASSERT_EQ(treadstone_transformer_integer_op(trans, "missing", TREADSTONE_OP_ADD, 1, NULL), -1);
+    ASSERT_EQ(errno, ENOENT);
+    ASSERT_EQ(treadstone_transformer_string_append(trans, "n", "a", 1), -1);
+    ASSERT_EQ(transformer_dump(trans), "{\"n\":13,\"d\":4.5,\"s\":\"xyz\"}");
+    treadstone_transformer_destroy(trans);
+}
+
+TEST(Transforms, NumericInPlace)
+{
+    treadstone_transformer* trans = json_to_transformer("{\"hits\": 100, \"avg\": 0.5}");
+    ASSERT_TRUE(trans);
+    treadstone_stats before;
+    treadstone_stats after;
+    treadstone_stats_enable(1);
+    treadstone_stats_snapshot(&before);
+
+    // 100 through 127 fit the same one-byte varint
+    for (int x = 0; x < 27; ++x)
+    {
+        ASSERT_EQ(treadstone_transformer_integer_op(trans, "hits", TREADSTONE_OP_ADD, 1, NULL), 0);
+        ASSERT_EQ(treadstone_transformer_double_op(trans, "avg", TREADSTONE_OP_ADD, 1, NULL), 0);
+    }
+
+    treadstone_stats_snapshot(&after);
+    ASSERT_EQ(after.transform_bytes_copied, before.transform_bytes_copied);
+
+    // a reader's version is never written over
+    treadstone_snapshot* snap = treadstone_transformer_snapshot(trans);
+    ASSERT_TRUE(snap != NULL);
+    ASSERT_EQ(treadstone_transformer_double_op(trans, "avg", TREADSTONE_OP_ADD, 1, NULL), 0);
+    treadstone_stats_snapshot(&before);
+    ASSERT_GT(before.transform_bytes_copied, after.transform_bytes_copied);
+    char* json = NULL;
+    ASSERT_EQ(treadstone_snapshot_to_json(snap, &json), 0);
+    ASSERT_EQ(std::string(json), "{\"hits\":127,\"avg\":27.5}");
+    free(json);
+    treadstone_snapshot_release(snap);
+
+    // and the width changing takes the ordinary rewrite
+    ASSERT_EQ(treadstone_transformer_integer_op(trans, "hits", TREADSTONE_OP_ADD, 1000, NULL), 0);
+    treadstone_stats_enable(0);
+    ASSERT_EQ(transformer_dump(trans), "{\"hits\":1127,\"avg\":28.5}");
+    treadstone_transformer_destroy(trans);
+}
+
+TEST(Transforms, ArrayEdits)
+{
+    treadstone_transformer* trans = json_to_transformer("{\"q\": [1, 2, 3], \"o\": {}}");
+    ASSERT_TRUE(trans);
+    unsigned char* value = NULL;
+    size_t value_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary("\"x\"", &value, &value_sz), 0);
+
+    ASSERT_EQ(treadstone_transformer_array_insert_at(trans, "q", 1, value, value_sz), 0);
+    ASSERT_EQ(treadstone_transformer_array_insert_at(trans, "q", -1, value, value_sz), 0);
+    ASSERT_EQ(treadstone_transformer_array_insert_at(trans, "q", 0, value, value_sz), 0);
+    ASSERT_EQ(transformer_dump(trans), "{\"q\":[\"x\",1,\"x\",2,3,\"x\"],\"o\":{}}");
+    ASSERT_EQ(treadstone_transformer_array_remove_at(trans, "q", 2), 0);
+    ASSERT_EQ(treadstone_transformer_array_remove_at(trans, "q", -2), 0);
+    ASSERT_EQ(transformer_dump(trans), "{\"q\":[\"x\",1,2,\"x\"],\"o\":{}}");
+
+    const unsigned char* popped = NULL;
+    size_t popped_sz = 0;
+    ASSERT_EQ(treadstone_transformer_array_pop_front(trans, "q", &popped, &popped_sz), 0);
+    ASSERT_EQ(std::string(reinterpret_cast<const char*>(popped), popped_sz),
+              std::string(reinterpret_cast<const char*>(value), value_sz));
+    ASSERT_EQ(treadstone_transformer_array_pop_back(trans, "q", &popped, &popped_sz), 0);
+    ASSERT_EQ(treadstone_transformer_array_pop_back(trans, "q", &popped, &popped_sz), 0);
+    ASSERT_EQ(treadstone_binary_is_integer(popped, popped_sz), 0);
+    ASSERT_EQ(treadstone_binary_to_integer(popped, popped_sz), 2);
+    ASSERT_EQ(transformer_dump(trans), "{\"q\":[1],\"o\":{}}");
+
+    // a rolling window of the last three
+    for (int i = 0; i < 10; ++i)
+    {
+        ASSERT_EQ(treadstone_transformer_array_insert_at(trans, "q", -1, value, value_sz), 0);
+        ASSERT_EQ(treadstone_transformer_array_trim_to(trans, "q", 3), 0);
+    }
+
+    ASSERT_EQ(transformer_dump(trans), "{\"q\":[\"x\",\"x\",\"x\"],\"o\":{}}");
+    ASSERT_EQ(treadstone_transformer_array_trim_to(trans, "q", 5), 0);
+    ASSERT_EQ(treadstone_transformer_array_trim_to(trans, "q", 0), 0);
+    ASSERT_EQ(transformer_dump(trans), "{\"q\":[],\"o\":{}}");
+
+    // misses change nothing
+    ASSERT_EQ(treadstone_transformer_array_pop_front(trans, "q", &popped, &popped_sz), -1);
+    ASSERT_EQ(errno, ENOENT);
+    ASSERT_EQ(treadstone_transformer_array_insert_at(trans, "q", 1, value, value_sz), -1);
+    ASSERT_EQ(errno, ENOENT);
+    ASSERT_EQ(treadstone_transformer_array_insert_at(trans, "q", -2, value, value_sz), -1);
+    ASSERT_EQ(errno, ENOENT);
+    ASSERT_EQ(treadstone_transformer_array_remove_at(trans, "q", 0), -1);
+    ASSERT_EQ(errno, ENOENT);
+    ASSERT_EQ(treadstone_transformer_array_remove_at(trans, "q", -1), -1);
+    ASSERT_EQ(errno, ENOENT);
+    ASSERT_EQ(treadstone_transformer_array_remove_at(trans, "o", 0), -1);
+    ASSERT_EQ(errno, EINVAL);
+    ASSERT_EQ(treadstone_transformer_array_trim_to(trans, "missing", 1), -1);
+    ASSERT_EQ(errno, ENOENT);
+    ASSERT_EQ(transformer_dump(trans), "{\"q\":[],\"o\":{}}");
+
+    free(value);
+    treadstone_transformer_destroy(trans);
 }
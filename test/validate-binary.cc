@@ -25,6 +25,12 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// C
+#include <stdlib.h>
+
+// STL
+#include <string>
+
 // Treadstone
 #include <treadstone.h>
 #include "test/th.h"
@@ -37,3 +43,44 @@ TEST(ValidateBinary, NullPointer)
     int res = treadstone_binary_validate(binary, binary_sz);
     ASSERT_NE(res, 0);
 }
+
+TEST(ValidateBinary, ConstantsInContainers)
+{
+    const unsigned char* binary = reinterpret_cast<const unsigned char*>("\x41\x03\x45\x46\x47");
+    int res = treadstone_binary_validate(binary, 5);
+    ASSERT_EQ(res, 0);
+}
+
+TEST(ValidateBinary, EveryPrefixIsInvalid)
+{
+    std::string json("{\"a\": [1, -2, 3.5, \"four\", {\"b\": {}}], \"c\": [true, false, null]}");
+    // deeper than the validator's inline stack
+    json = std::string(100, '[') + json + std::string(100, ']');
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_json_to_binary(json.c_str(), &binary, &binary_sz), 0);
+    ASSERT_EQ(treadstone_binary_validate(binary, binary_sz), 0);
+
+    for (size_t i = 0; i < binary_sz; ++i)
+    {
+        ASSERT_NE(treadstone_binary_validate(binary, i), 0);
+    }
+
+    free(binary);
+}
+
+TEST(ValidateBinary, Malformed)
+{
+    // object whose key is an integer
+    const unsigned char* binary = reinterpret_cast<const unsigned char*>("\x40\x03\x44\x01\x47");
+    ASSERT_NE(treadstone_binary_validate(binary, 5), 0);
+    // string claiming an enormous length
+    binary = reinterpret_cast<const unsigned char*>("\x42\xff\xff\xff\xff\xff\xff\xff\xff\x7f");
+    ASSERT_NE(treadstone_binary_validate(binary, 10), 0);
+    // trailing bytes after the value
+    binary = reinterpret_cast<const unsigned char*>("\x41\x00\x47");
+    ASSERT_NE(treadstone_binary_validate(binary, 3), 0);
+    // unknown type
+    binary = reinterpret_cast<const unsigned char*>("\x41\x01\x48");
+    ASSERT_NE(treadstone_binary_validate(binary, 3), 0);
+}
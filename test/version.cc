@@ -0,0 +1,364 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// STL
+#include <string>
+#include <vector>
+
+// Treadstone
+#include <treadstone.h>
+#include "test/th.h"
+#include "test/helpers.h"
+
+static std::string
+version_json(const treadstone_version* v)
+{
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_version_output(v, &binary, &binary_sz), 0);
+    ASSERT_EQ(binary_sz, treadstone_version_size(v));
+    char* json = NULL;
+    ASSERT_EQ(treadstone_binary_to_json(binary, binary_sz, &json), 0);
+    std::string ret(json);
+    free(json);
+    free(binary);
+    return ret;
+}
+
+// a is what v allocates through, if not malloc
+static std::string
+version_extract(const treadstone_version* v, const char* path,
+                const treadstone_allocator* a = NULL)
+{
+    unsigned char* value = NULL;
+    size_t value_sz = 0;
+
+    if (treadstone_version_extract_value(v, path, &value, &value_sz) < 0)
+    {
+        return "";
+    }
+
+    char* json = NULL;
+    ASSERT_EQ(treadstone_binary_to_json(value, value_sz, &json), 0);
+    std::string ret(json);
+    free(json);
+
+    if (a)
+    {
+        a->free(a->ctx, value, value_sz);
+    }
+    else
+    {
+        free(value);
+    }
+
+    return ret;
+}
+
+TEST(Version, Edits)
+{
+    std::string base(to_binary("{\"a\": {\"b\": [1, 2]}, \"c\": \"x\"}"));
+    std::string three(to_binary("3"));
+    treadstone_version* v0 = treadstone_version_create(bytes(base), base.size());
+    ASSERT_TRUE(v0 != NULL);
+    treadstone_version* v1 = treadstone_version_array_append_value(v0, "a.b", bytes(three), three.size());
+    ASSERT_TRUE(v1 != NULL);
+    treadstone_version* v2 = treadstone_version_array_prepend_value(v1, "a.b", bytes(three), three.size());
+    ASSERT_TRUE(v2 != NULL);
+    treadstone_version* v3 = treadstone_version_set_value(v2, "d.e.f", bytes(three), three.size());
+    ASSERT_TRUE(v3 != NULL);
+    treadstone_version* v4 = treadstone_version_unset_value(v3, "a.b[1]");
+    ASSERT_TRUE(v4 != NULL);
+    treadstone_version* v5 = treadstone_version_unset_value(v4, "c");
+    ASSERT_TRUE(v5 != NULL);
+
+    // every version stays as it was built
+    ASSERT_EQ(version_json(v0), "{\"a\":{\"b\":[1,2]},\"c\":\"x\"}");
+    ASSERT_EQ(version_json(v1), "{\"a\":{\"b\":[1,2,3]},\"c\":\"x\"}");
+    ASSERT_EQ(version_json(v2), "{\"a\":{\"b\":[3,1,2,3]},\"c\":\"x\"}");
+    ASSERT_EQ(version_json(v3), "{\"a\":{\"b\":[3,1,2,3]},\"c\":\"x\",\"d\":{\"e\":{\"f\":3}}}");
+    ASSERT_EQ(version_json(v4), "{\"a\":{\"b\":[3,2,3]},\"c\":\"x\",\"d\":{\"e\":{\"f\":3}}}");
+    ASSERT_EQ(version_json(v5), "{\"a\":{\"b\":[3,2,3]},\"d\":{\"e\":{\"f\":3}}}");
+
+    // through edited containers, and into the bytes beneath them
+    ASSERT_EQ(version_extract(v5, "a.b[-1]"), "3");
+    ASSERT_EQ(version_extract(v5, "d.e"), "{\"f\":3}");
+    ASSERT_EQ(version_extract(v0, "a.b[1]"), "2");
+    ASSERT_EQ(version_extract(v5, "c"), "");
+    ASSERT_EQ(version_extract(v5, ""), version_json(v5));
+
+    // misses leave no version behind
+    ASSERT_TRUE(treadstone_version_unset_value(v5, "c") == NULL);
+    ASSERT_EQ(errno, ENOENT);
+    ASSERT_TRUE(treadstone_version_array_append_value(v5, "d", bytes(three), three.size()) == NULL);
+    ASSERT_TRUE(treadstone_version_set_value(v5, "a.b[7]", bytes(three), three.size()) == NULL);
+    ASSERT_TRUE(treadstone_version_set_value(v5, "a.b.c", bytes(three), three.size()) == NULL);
+
+    treadstone_version* root = treadstone_version_unset_value(v5, "");
+    ASSERT_TRUE(root != NULL);
+    ASSERT_EQ(version_json(root), "{}");
+    treadstone_version_release(root);
+
+    treadstone_version* vs[] = { v0, v1, v2, v3, v4, v5 };
+
+    for (size_t i = 0; i < sizeof(vs) / sizeof(vs[0]); ++i)
+    {
+        treadstone_version_release(vs[i]);
+    }
+}
+
+TEST(Version, MatchesTransformer)
+{
+    std::string base(to_binary("{\"k\": [], \"o\": {\"x\": 1, \"y\": [true, null]}}"));
+    treadstone_version* v = treadstone_version_create(bytes(base), base.size());
+    ASSERT_TRUE(v != NULL);
+    treadstone_transformer* trans = treadstone_transformer_create(bytes(base), base.size());
+    ASSERT_TRUE(trans != NULL);
+    const char* paths[] = { "k", "o.x", "o.y", "o.y[0]", "o.z", "n.m", "k[-1]", "o" };
+    const size_t paths_sz = sizeof(paths) / sizeof(paths[0]);
+
+    for (unsigned i = 0; i < 400; ++i)
+    {
+        char json[32];
+        sprintf(json, "%u", i * 7919);
+        std::string value(to_binary(json));
+        const char* path = paths[(i * 5) % paths_sz];
+        treadstone_version* next = NULL;
+        int ret = -1;
+
+        switch (i % 4)
+        {
+            case 0:
+                next = treadstone_version_set_value(v, path, bytes(value), value.size());
+                ret = treadstone_transformer_set_value(trans, path, bytes(value), value.size());
+                break;
+            case 1:
+                next = treadstone_version_unset_value(v, path);
+                ret = treadstone_transformer_unset_value(trans, path);
+                break;
+            case 2:
+                next = treadstone_version_array_prepend_value(v, path, bytes(value), value.size());
+                ret = treadstone_transformer_array_prepend_value(trans, path, bytes(value), value.size());
+                break;
+            default:
+                next = treadstone_version_array_append_value(v, path, bytes(value), value.size());
+                ret = treadstone_transformer_array_append_value(trans, path, bytes(value), value.size());
+                break;
+        }
+
+        ASSERT_EQ(next != NULL, ret == 0);
+
+        if (next)
+        {
+            treadstone_version_release(v);
+            v = next;
+        }
+
+        // the array went away with its parent; bring it back
+        if (i % 50 == 49)
+        {
+            std::string arr(to_binary("[1]"));
+            next = treadstone_version_set_value(v, "k", bytes(arr), arr.size());
+            ASSERT_TRUE(next != NULL);
+            ASSERT_EQ(treadstone_transformer_set_value(trans, "k", bytes(arr), arr.size()), 0);
+            treadstone_version_release(v);
+            v = next;
+        }
+
+        unsigned char* binary = NULL;
+        size_t binary_sz = 0;
+        ASSERT_EQ(treadstone_transformer_output(trans, &binary, &binary_sz), 0);
+        unsigned char* flat = NULL;
+        size_t flat_sz = 0;
+        ASSERT_EQ(treadstone_version_output(v, &flat, &flat_sz), 0);
+        ASSERT_EQ(flat_sz, binary_sz);
+        ASSERT_EQ(memcmp(flat, binary, binary_sz), 0);
+        free(flat);
+        free(binary);
+    }
+
+    treadstone_transformer_destroy(trans);
+    treadstone_version_release(v);
+}
+
+struct counting
+{
+    counting() : allocs(0), outstanding(0) {}
+    size_t allocs;
+    size_t outstanding;
+};
+
+static void*
+counting_alloc(void* ctx, size_t sz)
+{
+    counting* c = static_cast<counting*>(ctx);
+    ++c->allocs;
+    c->outstanding += sz;
+    return malloc(sz);
+}
+
+static void*
+counting_realloc(void* ctx, void* ptr, size_t old_sz, size_t new_sz)
+{
+    counting* c = static_cast<counting*>(ctx);
+    ++c->allocs;
+    c->outstanding += new_sz;
+    c->outstanding -= old_sz;
+    return realloc(ptr, new_sz);
+}
+
+static void
+counting_free(void* ctx, void* ptr, size_t sz)
+{
+    static_cast<counting*>(ctx)->outstanding -= sz;
+    free(ptr);
+}
+
+TEST(Version, Sharing)
+{
+    // a wide document with one small, hot member
+    std::string json("{\"hot\": {\"n\": 0}, \"cold\": [");
+
+    for (size_t i = 0; i < 2000; ++i)
+    {
+        json += i ? ",\"padding padding\"" : "\"padding padding\"";
+    }
+
+    json += "]}";
+    std::string base(to_binary(json.c_str()));
+    counting c;
+    treadstone_allocator a;
+    a.alloc = counting_alloc;
+    a.realloc = counting_realloc;
+    a.free = counting_free;
+    a.ctx = &c;
+
+    treadstone_version* v = treadstone_version_create_alloc(&a, bytes(base), base.size());
+    ASSERT_TRUE(v != NULL);
+    std::vector<treadstone_version*> versions(1, v);
+    const size_t first = c.outstanding;
+
+    for (size_t i = 1; i <= 50; ++i)
+    {
+        std::string value(to_binary(std::to_string(i).c_str()));
+        v = treadstone_version_set_value(v, "hot.n", bytes(value), value.size());
+        ASSERT_TRUE(v != NULL);
+        versions.push_back(v);
+    }
+
+    // fifty versions in far less than a second copy of the document
+    ASSERT_LT(c.outstanding - first, base.size() / 2);
+    ASSERT_EQ(version_extract(versions[17], "hot.n", &a), "17");
+    ASSERT_EQ(version_extract(versions[0], "cold[1999]", &a), "\"padding padding\"");
+    ASSERT_EQ(version_extract(versions[50], "cold[-1]", &a), "\"padding padding\"");
+
+    // the base outlives the versions built on it only as long as they do
+    for (size_t i = 0; i < versions.size(); ++i)
+    {
+        treadstone_version_release(versions[i]);
+    }
+
+    ASSERT_EQ(c.outstanding, 0U);
+}
+
+TEST(Version, WideEdit)
+{
+    std::string json("{\"hot\": {\"n\": 0}, \"cold\": [");
+
+    for (size_t i = 0; i < 100000; ++i)
+    {
+        json += (i ? "," : "") + std::to_string(i);
+    }
+
+    json += "]}";
+    std::string base(to_binary(json.c_str()));
+    std::string value(to_binary("\"edited\""));
+    counting c;
+    treadstone_allocator a;
+    a.alloc = counting_alloc;
+    a.realloc = counting_realloc;
+    a.free = counting_free;
+    a.ctx = &c;
+
+    treadstone_version* v0 = treadstone_version_create_alloc(&a, bytes(base), base.size());
+    ASSERT_TRUE(v0 != NULL);
+    const size_t allocs = c.allocs;
+    const size_t outstanding = c.outstanding;
+
+    // the array splits around the member, not into a node per element
+    treadstone_version* v1 = treadstone_version_set_value(v0, "cold[5]", bytes(value), value.size());
+    ASSERT_TRUE(v1 != NULL);
+    ASSERT_LT(c.allocs - allocs, 32U);
+    ASSERT_LT(c.outstanding - outstanding, 2048U);
+
+    // and again inside the runs the first edit left behind
+    treadstone_version* v2 = treadstone_version_unset_value(v1, "cold[-2]");
+    ASSERT_TRUE(v2 != NULL);
+    treadstone_version* v3 = treadstone_version_set_value(v2, "cold[3]", bytes(value), value.size());
+    ASSERT_TRUE(v3 != NULL);
+    ASSERT_LT(c.allocs - allocs, 96U);
+    ASSERT_LT(c.outstanding - outstanding, 6144U);
+
+    ASSERT_EQ(version_extract(v3, "cold[3]", &a), "\"edited\"");
+    ASSERT_EQ(version_extract(v3, "cold[4]", &a), "4");
+    ASSERT_EQ(version_extract(v3, "cold[5]", &a), "\"edited\"");
+    ASSERT_EQ(version_extract(v3, "cold[6]", &a), "6");
+    ASSERT_EQ(version_extract(v3, "cold[-1]", &a), "99999");
+    ASSERT_EQ(version_extract(v3, "cold[-2]", &a), "99997");
+    ASSERT_EQ(version_extract(v3, "hot.n", &a), "0");
+    ASSERT_EQ(version_extract(v0, "cold[5]", &a), "5");
+
+    // flattening gives what the transformer makes of the same edits
+    treadstone_transformer* trans = treadstone_transformer_create(bytes(base), base.size());
+    ASSERT_TRUE(trans != NULL);
+    ASSERT_EQ(treadstone_transformer_set_value(trans, "cold[5]", bytes(value), value.size()), 0);
+    ASSERT_EQ(treadstone_transformer_unset_value(trans, "cold[-2]"), 0);
+    ASSERT_EQ(treadstone_transformer_set_value(trans, "cold[3]", bytes(value), value.size()), 0);
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+    ASSERT_EQ(treadstone_transformer_output(trans, &binary, &binary_sz), 0);
+    unsigned char* flat = NULL;
+    size_t flat_sz = 0;
+    ASSERT_EQ(treadstone_version_output(v3, &flat, &flat_sz), 0);
+    ASSERT_EQ(flat_sz, binary_sz);
+    ASSERT_EQ(memcmp(flat, binary, binary_sz), 0);
+    a.free(a.ctx, flat, flat_sz);
+    free(binary);
+    treadstone_transformer_destroy(trans);
+
+    treadstone_version_release(v3);
+    treadstone_version_release(v2);
+    treadstone_version_release(v1);
+    treadstone_version_release(v0);
+    ASSERT_EQ(c.outstanding, 0U);
+}
@@ -0,0 +1,168 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef treadstone_allocator_h_
+#define treadstone_allocator_h_
+
+// C
+#include <stdlib.h>
+
+// POSIX
+#include <errno.h>
+
+// STL
+#include <new>
+
+// Treadstone
+#include <treadstone.h>
+#include "namespace.h"
+
+BEGIN_TREADSTONE_NAMESPACE
+
+// malloc/realloc/free
+extern const treadstone_allocator default_allocator;
+
+inline const treadstone_allocator*
+allocator_or_default(const treadstone_allocator* a)
+{
+    return a ? a : &default_allocator;
+}
+
+inline void*
+allocate(const treadstone_allocator* a, size_t sz)
+{
+    void* ptr = a->alloc(a->ctx, sz);
+
+    if (!ptr)
+    {
+        errno = ENOMEM;
+    }
+
+    return ptr;
+}
+
+inline void*
+reallocate(const treadstone_allocator* a, void* ptr, size_t old_sz, size_t new_sz)
+{
+    void* tmp = a->realloc(a->ctx, ptr, old_sz, new_sz);
+
+    if (!tmp)
+    {
+        errno = ENOMEM;
+    }
+
+    return tmp;
+}
+
+inline void
+deallocate(const treadstone_allocator* a, void* ptr, size_t sz)
+{
+    if (ptr)
+    {
+        a->free(a->ctx, ptr, sz);
+    }
+}
+
+// Give a buffer that is about to be handed to the caller exactly sz of its
+// cap bytes, so that the size reported with it is the size to free.  On
+// failure the buffer is freed and *ptr is NULL.
+template <typename T>
+inline bool
+shrink_to_fit(const treadstone_allocator* a, T** ptr, size_t cap, size_t sz)
+{
+    if (cap == sz)
+    {
+        return true;
+    }
+
+    void* tmp = reallocate(a, *ptr, cap, sz);
+
+    if (!tmp)
+    {
+        deallocate(a, *ptr, cap);
+        *ptr = NULL;
+        return false;
+    }
+
+    *ptr = static_cast<T*>(tmp);
+    return true;
+}
+
+// Adapts a treadstone_allocator for use with STL containers.  The allocator
+// must outlive the container.
+template <typename T>
+class stl_allocator
+{
+    public:
+        typedef T value_type;
+
+    public:
+        explicit stl_allocator(const treadstone_allocator* a) : m_a(a) {}
+        template <typename U>
+        stl_allocator(const stl_allocator<U>& other) : m_a(other.get()) {}
+
+    public:
+        T* allocate(size_t n);
+        void deallocate(T* p, size_t n) { treadstone::deallocate(m_a, p, n * sizeof(T)); }
+        const treadstone_allocator* get() const { return m_a; }
+
+    private:
+        const treadstone_allocator* m_a;
+};
+
+template <typename T>
+T*
+stl_allocator<T> :: allocate(size_t n)
+{
+    void* ptr = treadstone::allocate(m_a, n * sizeof(T));
+
+    if (!ptr)
+    {
+        throw std::bad_alloc();
+    }
+
+    return static_cast<T*>(ptr);
+}
+
+template <typename T, typename U>
+bool
+operator == (const stl_allocator<T>& lhs, const stl_allocator<U>& rhs)
+{
+    return lhs.get() == rhs.get();
+}
+
+template <typename T, typename U>
+bool
+operator != (const stl_allocator<T>& lhs, const stl_allocator<U>& rhs)
+{
+    return lhs.get() != rhs.get();
+}
+
+END_TREADSTONE_NAMESPACE
+
+#endif // treadstone_allocator_h_
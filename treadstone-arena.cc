@@ -0,0 +1,264 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// STL
+#include <new>
+
+// Treadstone
+#include <treadstone.h>
+#include "visibility.h"
+
+// A bump allocator.  Allocations are carved sequentially out of a chain of
+// chunks and are only returned in bulk by reset().  Freeing or reallocating
+// the most recent allocation adjusts it in place, so short-lived scratch
+// space that is released in LIFO order does not consume the chunk.
+struct treadstone_arena
+{
+    treadstone_arena(size_t chunk_sz);
+    ~treadstone_arena() throw ();
+    void* alloc(size_t sz);
+    void* realloc(void* ptr, size_t old_sz, size_t new_sz);
+    void free(void* ptr, size_t sz);
+    void reset();
+
+    private:
+        struct chunk
+        {
+            chunk* prev;
+            size_t cap;
+            size_t used;
+        };
+
+        static const size_t ALIGN = 16;
+        static size_t round(size_t sz) { return (sz + ALIGN - 1) & ~(ALIGN - 1); }
+        static unsigned char* base(chunk* c)
+        { return reinterpret_cast<unsigned char*>(c) + round(sizeof(chunk)); }
+        bool grow(size_t sz);
+        void release(chunk* c);
+
+        treadstone_arena(const treadstone_arena&);
+        treadstone_arena& operator = (const treadstone_arena&);
+
+        size_t m_chunk_sz;
+        chunk* m_head;
+        unsigned char* m_last;
+};
+
+treadstone_arena :: treadstone_arena(size_t chunk_sz)
+    : m_chunk_sz(chunk_sz > 0 ? chunk_sz : 4096)
+    , m_head(NULL)
+    , m_last(NULL)
+{
+}
+
+treadstone_arena :: ~treadstone_arena() throw ()
+{
+    release(m_head);
+}
+
+void*
+treadstone_arena :: alloc(size_t sz)
+{
+    sz = round(sz > 0 ? sz : 1);
+
+    if ((!m_head || m_head->used + sz > m_head->cap) && !grow(sz))
+    {
+        return NULL;
+    }
+
+    m_last = base(m_head) + m_head->used;
+    m_head->used += sz;
+    return m_last;
+}
+
+void*
+treadstone_arena :: realloc(void* ptr, size_t old_sz, size_t new_sz)
+{
+    if (!ptr)
+    {
+        return alloc(new_sz);
+    }
+
+    if (new_sz <= old_sz)
+    {
+        return ptr;
+    }
+
+    // grow the last allocation in place when the chunk has room for it
+    if (ptr == m_last &&
+        m_last + round(new_sz) <= base(m_head) + m_head->cap)
+    {
+        m_head->used = m_last + round(new_sz) - base(m_head);
+        return ptr;
+    }
+
+    void* tmp = alloc(new_sz);
+
+    if (tmp)
+    {
+        memmove(tmp, ptr, old_sz);
+    }
+
+    return tmp;
+}
+
+void
+treadstone_arena :: free(void* ptr, size_t)
+{
+    if (ptr && ptr == m_last)
+    {
+        m_head->used = m_last - base(m_head);
+        m_last = NULL;
+    }
+}
+
+void
+treadstone_arena :: reset()
+{
+    m_last = NULL;
+
+    if (!m_head)
+    {
+        return;
+    }
+
+    // coalesce so that a steady workload settles into a single chunk
+    if (m_head->prev)
+    {
+        size_t total = 0;
+
+        for (chunk* c = m_head; c; c = c->prev)
+        {
+            total += c->cap;
+        }
+
+        release(m_head);
+        m_head = NULL;
+        grow(total);
+    }
+
+    if (m_head)
+    {
+        m_head->used = 0;
+    }
+}
+
+bool
+treadstone_arena :: grow(size_t sz)
+{
+    size_t cap = m_chunk_sz;
+
+    if (m_head && cap < m_head->cap * 2)
+    {
+        cap = m_head->cap * 2;
+    }
+
+    if (cap < sz)
+    {
+        cap = sz;
+    }
+
+    cap = round(cap);
+    chunk* c = static_cast<chunk*>(malloc(round(sizeof(chunk)) + cap));
+
+    if (!c)
+    {
+        return false;
+    }
+
+    c->prev = m_head;
+    c->cap = cap;
+    c->used = 0;
+    m_head = c;
+    return true;
+}
+
+void
+treadstone_arena :: release(chunk* c)
+{
+    while (c)
+    {
+        chunk* prev = c->prev;
+        ::free(c);
+        c = prev;
+    }
+}
+
+static void*
+arena_alloc(void* ctx, size_t sz)
+{
+    return static_cast<treadstone_arena*>(ctx)->alloc(sz);
+}
+
+static void*
+arena_realloc(void* ctx, void* ptr, size_t old_sz, size_t new_sz)
+{
+    return static_cast<treadstone_arena*>(ctx)->realloc(ptr, old_sz, new_sz);
+}
+
+static void
+arena_free(void* ctx, void* ptr, size_t sz)
+{
+    static_cast<treadstone_arena*>(ctx)->free(ptr, sz);
+}
+
+TREADSTONE_API struct treadstone_arena*
+treadstone_arena_create(size_t chunk_sz)
+{
+    return new (std::nothrow) treadstone_arena(chunk_sz);
+}
+
+TREADSTONE_API void
+treadstone_arena_destroy(struct treadstone_arena* arena)
+{
+    if (arena)
+    {
+        delete arena;
+    }
+}
+
+TREADSTONE_API void
+treadstone_arena_reset(struct treadstone_arena* arena)
+{
+    arena->reset();
+}
+
+TREADSTONE_API void
+treadstone_arena_allocator(struct treadstone_arena* arena,
+                           struct treadstone_allocator* a)
+{
+    a->alloc = arena_alloc;
+    a->realloc = arena_realloc;
+    a->free = arena_free;
+    a->ctx = arena;
+}
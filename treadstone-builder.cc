@@ -0,0 +1,453 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <assert.h>
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+
+// STL
+#include <new>
+#include <vector>
+
+// e
+#include <e/endian.h>
+#include <e/varint.h>
+
+// Treadstone
+#include <treadstone.h>
+#include "namespace.h"
+#include "visibility.h"
+#include "treadstone-allocator.h"
+#include "treadstone-index.h"
+#include "treadstone-internal.h"
+#include "treadstone-types.h"
+
+struct TREADSTONE_LOCAL treadstone_builder
+{
+    treadstone_builder(const treadstone_allocator* a);
+    ~treadstone_builder() throw ();
+    const treadstone_allocator* allocator() const { return &m_allocator; }
+    void clear();
+    int begin(unsigned char type);
+    int end(unsigned char type);
+    int key(const char* key, size_t key_sz);
+    int raw(const unsigned char* value, size_t value_sz);
+    int string(const char* string, size_t string_sz);
+    int integer(int64_t number);
+    int dbl(double number);
+    int constant(unsigned char c);
+    int view(const unsigned char** binary, size_t* binary_sz);
+    int output(unsigned char** binary, size_t* binary_sz);
+
+    private:
+        struct scope
+        {
+            scope(unsigned char t, size_t s)
+                : type(t), start(s), expect_key(t == BINARY_OBJECT) {}
+
+            unsigned char type;
+            size_t start;
+            bool expect_key;
+        };
+
+        typedef std::vector<scope, treadstone::stl_allocator<scope> > scope_vector;
+
+        treadstone_builder(const treadstone_builder&);
+        treadstone_builder& operator = (const treadstone_builder&);
+
+        bool value_allowed() const;
+        void value_written();
+        bool complete() const;
+
+        const treadstone_allocator m_allocator;
+        unsigned char* m_binary;
+        size_t m_binary_sz;
+        size_t m_binary_cap;
+        scope_vector m_scopes;
+        bool m_done;
+};
+
+treadstone_builder :: treadstone_builder(const treadstone_allocator* a)
+    : m_allocator(*a)
+    , m_binary(NULL)
+    , m_binary_sz(0)
+    , m_binary_cap(0)
+    , m_scopes(treadstone::stl_allocator<scope>(&m_allocator))
+    , m_done(false)
+{
+}
+
+treadstone_builder :: ~treadstone_builder() throw ()
+{
+    treadstone::deallocate(&m_allocator, m_binary, m_binary_cap);
+}
+
+void
+treadstone_builder :: clear()
+{
+    m_binary_sz = 0;
+    m_scopes.clear();
+    m_done = false;
+}
+
+int
+treadstone_builder :: begin(unsigned char type)
+{
+    if (!value_allowed())
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    try
+    {
+        m_scopes.push_back(scope(type, m_binary_sz));
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+treadstone_builder :: end(unsigned char type)
+{
+    if (m_scopes.empty() ||
+        m_scopes.back().type != type ||
+        (type == BINARY_OBJECT && !m_scopes.back().expect_key))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!treadstone::j2b_prepend_header(type, m_scopes.back().start,
+                                        &m_binary, &m_binary_sz, &m_binary_cap,
+                                        &m_allocator))
+    {
+        return -1;
+    }
+
+    m_scopes.pop_back();
+    value_written();
+    return 0;
+}
+
+int
+treadstone_builder :: key(const char* k, size_t k_sz)
+{
+    if (m_scopes.empty() ||
+        m_scopes.back().type != BINARY_OBJECT ||
+        !m_scopes.back().expect_key)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t sz = 1 + e::varint_length(k_sz) + k_sz;
+
+    if (!treadstone::j2b_make_room_for(sz, &m_binary, &m_binary_sz, &m_binary_cap, &m_allocator))
+    {
+        return -1;
+    }
+
+    unsigned char* ptr = m_binary + m_binary_sz;
+    ptr = e::pack8be(BINARY_STRING, ptr);
+    ptr = e::packvarint64(k_sz, ptr);
+    memmove(ptr, k, k_sz);
+    m_binary_sz += sz;
+    m_scopes.back().expect_key = false;
+    return 0;
+}
+
+int
+treadstone_builder :: raw(const unsigned char* value, size_t value_sz)
+{
+    if (!value_allowed())
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!treadstone::j2b_make_room_for(value_sz, &m_binary, &m_binary_sz, &m_binary_cap, &m_allocator))
+    {
+        return -1;
+    }
+
+    memmove(m_binary + m_binary_sz, value, value_sz);
+    m_binary_sz += value_sz;
+    value_written();
+    return 0;
+}
+
+int
+treadstone_builder :: string(const char* s, size_t s_sz)
+{
+    if (!value_allowed())
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t sz = 1 + e::varint_length(s_sz) + s_sz;
+
+    if (!treadstone::j2b_make_room_for(sz, &m_binary, &m_binary_sz, &m_binary_cap, &m_allocator))
+    {
+        return -1;
+    }
+
+    unsigned char* ptr = m_binary + m_binary_sz;
+    ptr = e::pack8be(BINARY_STRING, ptr);
+    ptr = e::packvarint64(s_sz, ptr);
+    memmove(ptr, s, s_sz);
+    m_binary_sz += sz;
+    value_written();
+    return 0;
+}
+
+int
+treadstone_builder :: integer(int64_t number)
+{
+    unsigned char buf[11];
+    unsigned char* ptr = buf;
+    ptr = e::pack8be(BINARY_INTEGER, ptr);
+    ptr = e::packvarint64(number, ptr);
+    return raw(buf, ptr - buf);
+}
+
+int
+treadstone_builder :: dbl(double number)
+{
+    unsigned char buf[9];
+    unsigned char* ptr = buf;
+    ptr = e::pack8be(BINARY_DOUBLE, ptr);
+    ptr = e::packdoublebe(number, ptr);
+    return raw(buf, ptr - buf);
+}
+
+int
+treadstone_builder :: constant(unsigned char c)
+{
+    return raw(&c, 1);
+}
+
+int
+treadstone_builder :: view(const unsigned char** binary, size_t* binary_sz)
+{
+    if (!complete())
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *binary = m_binary;
+    *binary_sz = m_binary_sz;
+    return 0;
+}
+
+int
+treadstone_builder :: output(unsigned char** binary, size_t* binary_sz)
+{
+    if (!complete())
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *binary = reinterpret_cast<unsigned char*>(treadstone::allocate(&m_allocator, sizeof(unsigned char) * m_binary_sz));
+
+    if (!*binary)
+    {
+        return -1;
+    }
+
+    *binary_sz = m_binary_sz;
+    memmove(*binary, m_binary, m_binary_sz);
+    return 0;
+}
+
+bool
+treadstone_builder :: value_allowed() const
+{
+    if (m_scopes.empty())
+    {
+        return !m_done;
+    }
+
+    return m_scopes.back().type != BINARY_OBJECT || !m_scopes.back().expect_key;
+}
+
+void
+treadstone_builder :: value_written()
+{
+    if (m_scopes.empty())
+    {
+        m_done = true;
+    }
+    else if (m_scopes.back().type == BINARY_OBJECT)
+    {
+        m_scopes.back().expect_key = true;
+    }
+}
+
+bool
+treadstone_builder :: complete() const
+{
+    return m_done && m_scopes.empty();
+}
+
+TREADSTONE_API struct treadstone_builder*
+treadstone_builder_create()
+{
+    return treadstone_builder_create_alloc(NULL);
+}
+
+TREADSTONE_API struct treadstone_builder*
+treadstone_builder_create_alloc(const treadstone_allocator* a)
+{
+    a = treadstone::allocator_or_default(a);
+    void* mem = treadstone::allocate(a, sizeof(treadstone_builder));
+
+    if (!mem)
+    {
+        return NULL;
+    }
+
+    return new (mem) treadstone_builder(a);
+}
+
+TREADSTONE_API void
+treadstone_builder_destroy(struct treadstone_builder* builder)
+{
+    if (builder)
+    {
+        treadstone_allocator a = *builder->allocator();
+        builder->~treadstone_builder();
+        treadstone::deallocate(&a, builder, sizeof(treadstone_builder));
+    }
+}
+
+TREADSTONE_API void
+treadstone_builder_clear(struct treadstone_builder* builder)
+{
+    builder->clear();
+}
+
+TREADSTONE_API int
+treadstone_builder_object_begin(struct treadstone_builder* builder)
+{
+    return builder->begin(BINARY_OBJECT);
+}
+
+TREADSTONE_API int
+treadstone_builder_object_end(struct treadstone_builder* builder)
+{
+    return builder->end(BINARY_OBJECT);
+}
+
+TREADSTONE_API int
+treadstone_builder_array_begin(struct treadstone_builder* builder)
+{
+    return builder->begin(BINARY_ARRAY);
+}
+
+TREADSTONE_API int
+treadstone_builder_array_end(struct treadstone_builder* builder)
+{
+    return builder->end(BINARY_ARRAY);
+}
+
+TREADSTONE_API int
+treadstone_builder_key(struct treadstone_builder* builder,
+                       const char* key, size_t key_sz)
+{
+    return builder->key(key, key_sz);
+}
+
+TREADSTONE_API int
+treadstone_builder_string(struct treadstone_builder* builder,
+                          const char* string, size_t string_sz)
+{
+    return builder->string(string, string_sz);
+}
+
+TREADSTONE_API int
+treadstone_builder_integer(struct treadstone_builder* builder, int64_t number)
+{
+    return builder->integer(number);
+}
+
+TREADSTONE_API int
+treadstone_builder_double(struct treadstone_builder* builder, double number)
+{
+    return builder->dbl(number);
+}
+
+TREADSTONE_API int
+treadstone_builder_bool(struct treadstone_builder* builder, int value)
+{
+    return builder->constant(value ? BINARY_TRUE : BINARY_FALSE);
+}
+
+TREADSTONE_API int
+treadstone_builder_null(struct treadstone_builder* builder)
+{
+    return builder->constant(BINARY_NULL);
+}
+
+TREADSTONE_API int
+treadstone_builder_binary(struct treadstone_builder* builder,
+                          const unsigned char* binary, size_t binary_sz)
+{
+    if (!treadstone::binary_valid(binary, binary_sz))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return builder->raw(binary, binary_sz);
+}
+
+TREADSTONE_API int
+treadstone_builder_view(struct treadstone_builder* builder,
+                        const unsigned char** binary, size_t* binary_sz)
+{
+    return builder->view(binary, binary_sz);
+}
+
+TREADSTONE_API int
+treadstone_builder_output(struct treadstone_builder* builder,
+                          unsigned char** binary, size_t* binary_sz)
+{
+    return builder->output(binary, binary_sz);
+}
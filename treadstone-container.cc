@@ -0,0 +1,473 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// STL
+#include <new>
+#include <vector>
+
+// e
+#include <e/endian.h>
+#include <e/varint.h>
+
+// Treadstone
+#include <treadstone.h>
+#include "namespace.h"
+#include "visibility.h"
+#include "treadstone-index.h"
+#include "treadstone-varint.h"
+
+// See doc/container.txt for the layout.
+
+BEGIN_TREADSTONE_NAMESPACE
+
+static const char CONTAINER_MAGIC[8] = {'t', 'r', 'e', 'a', 'd', 's', 't', 'n'};
+static const uint32_t CONTAINER_VERSION = 1;
+static const size_t CONTAINER_HEADER_SZ = 16;
+static const size_t CONTAINER_TRAILER_SZ = 32;
+static const size_t CONTAINER_BUFFER_SZ = 1 << 20;
+
+static uint64_t
+container_hash(const unsigned char* data, size_t data_sz)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < data_sz; ++i)
+    {
+        h ^= data[i];
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+static size_t
+container_entry_sz(uint32_t flags)
+{
+    return flags & TREADSTONE_CONTAINER_HASHES ? 16 : 8;
+}
+
+static bool
+write_all(int fd, const unsigned char* data, size_t data_sz)
+{
+    while (data_sz > 0)
+    {
+        ssize_t amt = write(fd, data, data_sz);
+
+        if (amt < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (amt < 0)
+        {
+            return false;
+        }
+
+        data += amt;
+        data_sz -= amt;
+    }
+
+    return true;
+}
+
+END_TREADSTONE_NAMESPACE
+
+struct treadstone_container_writer
+{
+    treadstone_container_writer(int f, uint32_t fl)
+        : fd(f), flags(fl), offset(0), buf(), index(), failed(false) {}
+
+    bool append(const unsigned char* data, size_t data_sz);
+    bool flush();
+
+    const int fd;
+    const uint32_t flags;
+    // of the next byte to be appended, from the start of the file
+    uint64_t offset;
+    std::vector<unsigned char> buf;
+    // offset, or offset and hash, for each document
+    std::vector<uint64_t> index;
+    // a write failed, so the file is not worth finishing
+    bool failed;
+
+    private:
+        treadstone_container_writer(const treadstone_container_writer&);
+        treadstone_container_writer& operator = (const treadstone_container_writer&);
+};
+
+bool
+treadstone_container_writer :: append(const unsigned char* data, size_t data_sz)
+{
+    if (buf.size() + data_sz > treadstone::CONTAINER_BUFFER_SZ && !flush())
+    {
+        return false;
+    }
+
+    if (data_sz > treadstone::CONTAINER_BUFFER_SZ)
+    {
+        if (!treadstone::write_all(fd, data, data_sz))
+        {
+            failed = true;
+            return false;
+        }
+    }
+    else
+    {
+        buf.insert(buf.end(), data, data + data_sz);
+    }
+
+    offset += data_sz;
+    return true;
+}
+
+bool
+treadstone_container_writer :: flush()
+{
+    if (!treadstone::write_all(fd, buf.data(), buf.size()))
+    {
+        failed = true;
+        return false;
+    }
+
+    buf.clear();
+    return true;
+}
+
+struct treadstone_container
+{
+    treadstone_container()
+        : base(NULL), size(0), flags(0), count(0), index_offset(0) {}
+
+    const unsigned char* base;
+    size_t size;
+    uint32_t flags;
+    uint64_t count;
+    uint64_t index_offset;
+
+    private:
+        treadstone_container(const treadstone_container&);
+        treadstone_container& operator = (const treadstone_container&);
+};
+
+TREADSTONE_API struct treadstone_container_writer*
+treadstone_container_writer_create(int fd, unsigned flags)
+{
+    if ((flags & ~unsigned(TREADSTONE_CONTAINER_HASHES)) != 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    treadstone_container_writer* w = new (std::nothrow) treadstone_container_writer(fd, flags);
+
+    if (!w)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    unsigned char header[treadstone::CONTAINER_HEADER_SZ];
+    memmove(header, treadstone::CONTAINER_MAGIC, 8);
+    unsigned char* ptr = e::pack32be(treadstone::CONTAINER_VERSION, header + 8);
+    e::pack32be(flags, ptr);
+
+    try
+    {
+        w->buf.reserve(treadstone::CONTAINER_BUFFER_SZ);
+        w->append(header, sizeof(header));
+    }
+    catch (std::bad_alloc&)
+    {
+        delete w;
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return w;
+}
+
+TREADSTONE_API void
+treadstone_container_writer_destroy(struct treadstone_container_writer* w)
+{
+    delete w;
+}
+
+TREADSTONE_API int
+treadstone_container_writer_append(struct treadstone_container_writer* w,
+                                   const unsigned char* binary, size_t binary_sz)
+{
+    if (binary_sz == 0 || w->failed)
+    {
+        errno = w->failed ? EIO : EINVAL;
+        return -1;
+    }
+
+    unsigned char header[10];
+    unsigned char* end = e::packvarint64(binary_sz, header);
+
+    try
+    {
+        w->index.push_back(w->offset);
+
+        if (w->flags & TREADSTONE_CONTAINER_HASHES)
+        {
+            w->index.push_back(treadstone::container_hash(binary, binary_sz));
+        }
+
+        if (!w->append(header, end - header) ||
+            !w->append(binary, binary_sz))
+        {
+            return -1;
+        }
+    }
+    catch (std::bad_alloc&)
+    {
+        w->failed = true;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    return 0;
+}
+
+TREADSTONE_API int
+treadstone_container_writer_finish(struct treadstone_container_writer* w)
+{
+    if (w->failed)
+    {
+        errno = EIO;
+        return -1;
+    }
+
+    const uint64_t index_offset = w->offset;
+    const size_t entry_sz = treadstone::container_entry_sz(w->flags);
+    const uint64_t count = w->index.size() * 8 / entry_sz;
+    unsigned char tmp[treadstone::CONTAINER_TRAILER_SZ];
+
+    try
+    {
+        for (size_t i = 0; i < w->index.size(); ++i)
+        {
+            e::pack64be(w->index[i], tmp);
+
+            if (!w->append(tmp, 8))
+            {
+                return -1;
+            }
+        }
+
+        unsigned char* ptr = tmp;
+        ptr = e::pack64be(index_offset, ptr);
+        ptr = e::pack64be(count, ptr);
+        ptr = e::pack32be(w->flags, ptr);
+        ptr = e::pack32be(0, ptr);
+        memmove(ptr, treadstone::CONTAINER_MAGIC, 8);
+
+        if (!w->append(tmp, sizeof(tmp)) || !w->flush())
+        {
+            return -1;
+        }
+    }
+    catch (std::bad_alloc&)
+    {
+        w->failed = true;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    return 0;
+}
+
+TREADSTONE_API struct treadstone_container*
+treadstone_container_open(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) < 0)
+    {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return NULL;
+    }
+
+    const size_t size = st.st_size;
+
+    if (!S_ISREG(st.st_mode) ||
+        size < treadstone::CONTAINER_HEADER_SZ + treadstone::CONTAINER_TRAILER_SZ)
+    {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    int saved = errno;
+    close(fd);
+
+    if (map == MAP_FAILED)
+    {
+        errno = saved;
+        return NULL;
+    }
+
+    const unsigned char* base = static_cast<const unsigned char*>(map);
+    const unsigned char* trailer = base + size - treadstone::CONTAINER_TRAILER_SZ;
+    uint32_t version;
+    uint32_t flags;
+    uint64_t index_offset;
+    uint64_t count;
+    uint32_t trailer_flags;
+    e::unpack32be(base + 8, &version);
+    e::unpack32be(base + 12, &flags);
+    e::unpack64be(trailer, &index_offset);
+    e::unpack64be(trailer + 8, &count);
+    e::unpack32be(trailer + 16, &trailer_flags);
+    const size_t entry_sz = treadstone::container_entry_sz(flags);
+    const uint64_t index_limit = size - treadstone::CONTAINER_TRAILER_SZ;
+
+    if (memcmp(base, treadstone::CONTAINER_MAGIC, 8) != 0 ||
+        memcmp(trailer + 24, treadstone::CONTAINER_MAGIC, 8) != 0 ||
+        version != treadstone::CONTAINER_VERSION ||
+        flags != trailer_flags ||
+        (flags & ~uint32_t(TREADSTONE_CONTAINER_HASHES)) != 0 ||
+        index_offset < treadstone::CONTAINER_HEADER_SZ ||
+        index_offset > index_limit ||
+        count != (index_limit - index_offset) / entry_sz ||
+        (index_limit - index_offset) % entry_sz != 0)
+    {
+        munmap(map, size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    treadstone_container* c = new (std::nothrow) treadstone_container();
+
+    if (!c)
+    {
+        munmap(map, size);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    c->base = base;
+    c->size = size;
+    c->flags = flags;
+    c->count = count;
+    c->index_offset = index_offset;
+    return c;
+}
+
+TREADSTONE_API void
+treadstone_container_close(struct treadstone_container* c)
+{
+    if (c)
+    {
+        munmap(const_cast<unsigned char*>(c->base), c->size);
+        delete c;
+    }
+}
+
+TREADSTONE_API uint64_t
+treadstone_container_count(const struct treadstone_container* c)
+{
+    return c->count;
+}
+
+TREADSTONE_API int
+treadstone_container_get(const struct treadstone_container* c, uint64_t ordinal,
+                         const unsigned char** binary, size_t* binary_sz)
+{
+    if (ordinal >= c->count)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+
+    const size_t entry_sz = treadstone::container_entry_sz(c->flags);
+    uint64_t offset;
+    e::unpack64be(c->base + c->index_offset + ordinal * entry_sz, &offset);
+    const unsigned char* limit = c->base + c->index_offset;
+    uint64_t sz;
+    const unsigned char* body = NULL;
+
+    if (offset < treadstone::CONTAINER_HEADER_SZ || offset >= c->index_offset ||
+        !(body = treadstone::varint64_decode(c->base + offset, limit, &sz)) ||
+        sz == 0 || sz > uint64_t(limit - body))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *binary = body;
+    *binary_sz = sz;
+    return 0;
+}
+
+TREADSTONE_API int
+treadstone_container_verify(const struct treadstone_container* c, uint64_t ordinal)
+{
+    const unsigned char* binary;
+    size_t binary_sz;
+
+    if (treadstone_container_get(c, ordinal, &binary, &binary_sz) < 0)
+    {
+        return -1;
+    }
+
+    if (c->flags & TREADSTONE_CONTAINER_HASHES)
+    {
+        uint64_t hash;
+        e::unpack64be(c->base + c->index_offset + ordinal * 16 + 8, &hash);
+
+        if (hash != treadstone::container_hash(binary, binary_sz))
+        {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    return treadstone::binary_valid(binary, binary_sz) ? 0 : -1;
+}
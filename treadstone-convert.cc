@@ -0,0 +1,549 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// POSIX
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// STL
+#include <vector>
+
+// e
+#include <e/varint.h>
+
+// Treadstone
+#include <treadstone.h>
+
+// Convert newline-delimited JSON or JSON text sequences (RFC 7464) to a
+// stream of binary records, each a varint length followed by the document,
+// or (with -d) convert such a stream back.  Documents are converted in
+// batches on a thread pool and written in their original order.
+
+static const size_t BATCH_DOCS = 1 << 16;
+static const size_t BATCH_BYTES = 32 << 20;
+static const char RS = 0x1e;
+
+enum format { NDJSON, JSON_SEQ, RECORDS };
+
+// The input as one window of bytes: the whole file when it can be mapped,
+// otherwise a buffer refilled from the descriptor as the window is consumed.
+class input
+{
+    public:
+        input() : m_fd(-1), m_map(NULL), m_map_sz(0), m_buf(), m_start(0), m_limit(0), m_eof(false) {}
+        ~input() throw ();
+
+    public:
+        bool open(const char* path);
+        const char* data() const { return m_map ? m_map + m_start : &m_buf[0] + m_start; }
+        size_t size() const { return m_limit - m_start; }
+        bool eof() const { return m_eof; }
+        void consume(size_t sz) { m_start += sz; }
+        // read more; false on error
+        bool fill();
+
+    private:
+        int m_fd;
+        char* m_map;
+        size_t m_map_sz;
+        std::vector<char> m_buf;
+        size_t m_start;
+        size_t m_limit;
+        bool m_eof;
+
+    private:
+        input(const input&);
+        input& operator = (const input&);
+};
+
+input :: ~input() throw ()
+{
+    if (m_map)
+    {
+        munmap(m_map, m_map_sz);
+    }
+
+    if (m_fd > STDIN_FILENO)
+    {
+        close(m_fd);
+    }
+}
+
+bool
+input :: open(const char* path)
+{
+    m_fd = path ? ::open(path, O_RDONLY) : STDIN_FILENO;
+
+    if (m_fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+
+    if (fstat(m_fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+
+        if (map != MAP_FAILED)
+        {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            m_map = static_cast<char*>(map);
+            m_map_sz = st.st_size;
+            m_limit = m_map_sz;
+            m_eof = true;
+            return true;
+        }
+    }
+
+    m_buf.resize(4 << 20);
+    return true;
+}
+
+bool
+input :: fill()
+{
+    if (m_eof)
+    {
+        return true;
+    }
+
+    // keep the unconsumed tail, and make room if it fills the buffer
+    memmove(&m_buf[0], &m_buf[0] + m_start, m_limit - m_start);
+    m_limit -= m_start;
+    m_start = 0;
+
+    if (m_limit == m_buf.size())
+    {
+        m_buf.resize(m_buf.size() * 2);
+    }
+
+    while (true)
+    {
+        ssize_t amt = read(m_fd, &m_buf[0] + m_limit, m_buf.size() - m_limit);
+
+        if (amt < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (amt < 0)
+        {
+            return false;
+        }
+
+        m_limit += amt;
+        m_eof = amt == 0;
+        return true;
+    }
+}
+
+class output
+{
+    public:
+        output(int fd) : m_fd(fd), m_buf(1 << 20), m_sz(0), m_written(0) {}
+
+    public:
+        bool append(const void* data, size_t data_sz);
+        bool flush();
+        uint64_t written() const { return m_written; }
+
+    private:
+        int m_fd;
+        std::vector<char> m_buf;
+        size_t m_sz;
+        uint64_t m_written;
+};
+
+bool
+output :: append(const void* data, size_t data_sz)
+{
+    if (m_sz + data_sz > m_buf.size() && !flush())
+    {
+        return false;
+    }
+
+    if (data_sz > m_buf.size())
+    {
+        m_buf.resize(data_sz);
+    }
+
+    memmove(&m_buf[0] + m_sz, data, data_sz);
+    m_sz += data_sz;
+    m_written += data_sz;
+    return true;
+}
+
+bool
+output :: flush()
+{
+    size_t off = 0;
+
+    while (off < m_sz)
+    {
+        ssize_t amt = write(m_fd, &m_buf[0] + off, m_sz - off);
+
+        if (amt < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (amt < 0)
+        {
+            return false;
+        }
+
+        off += amt;
+    }
+
+    m_sz = 0;
+    return true;
+}
+
+// Find the next complete document in [ptr, limit), skipping blank ones.
+// Returns the number of bytes it and its framing take, or 0 if the window
+// holds no complete document; at eof a final unterminated one counts.
+// Returns -1 for a malformed record stream.
+static ssize_t
+next_document(format fmt, const char* ptr, const char* limit, bool eof,
+              const char** doc, size_t* doc_sz)
+{
+    const char* start = ptr;
+
+    while (ptr < limit)
+    {
+        if (fmt == RECORDS)
+        {
+            uint64_t sz;
+            const char* body = e::varint64_decode(ptr, limit, &sz);
+
+            if (!body || sz > uint64_t(limit - body))
+            {
+                return eof || (!body && limit - ptr > 10) ? -1 : 0;
+            }
+
+            *doc = body;
+            *doc_sz = sz;
+            return body + sz - start;
+        }
+
+        const char sep = fmt == NDJSON ? '\n' : RS;
+        // a sequence's records start with RS, so skip over the one we are on
+        const char* text = fmt == JSON_SEQ && *ptr == RS ? ptr + 1 : ptr;
+        const char* end = static_cast<const char*>(memchr(text, sep, limit - text));
+
+        if (!end && !eof)
+        {
+            return 0;
+        }
+
+        end = end ? end : limit;
+        const char* next = fmt == NDJSON && end < limit ? end + 1 : end;
+        const char* p = text;
+
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+        {
+            ++p;
+        }
+
+        if (p < end)
+        {
+            *doc = text;
+            *doc_sz = end - text;
+            return next - start;
+        }
+
+        ptr = next;
+
+        if (ptr == limit)
+        {
+            return ptr - start;
+        }
+    }
+
+    return ptr - start;
+}
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return double(ts.tv_sec) + double(ts.tv_nsec) / 1e9;
+}
+
+static void
+usage()
+{
+    fprintf(stderr, "usage: treadstone-convert [-d] [-s] [-j threads] [-q] [input [output]]\n"
+                    "  -d  convert binary records back to JSON\n"
+                    "  -s  JSON text sequences (RFC 7464) instead of newline-delimited JSON\n"
+                    "  -j  worker threads, including the main thread (default: one per core)\n"
+                    "  -q  do not report throughput on stderr\n");
+}
+
+int
+main(int argc, char* argv[])
+{
+    bool decode = false;
+    bool seq = false;
+    bool quiet = false;
+    unsigned threads = 0;
+    int o;
+
+    while ((o = getopt(argc, argv, "dsj:qh")) != -1)
+    {
+        switch (o)
+        {
+            case 'd':
+                decode = true;
+                break;
+            case 's':
+                seq = true;
+                break;
+            case 'j':
+                threads = static_cast<unsigned>(strtoul(optarg, NULL, 10));
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            default:
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind > 2)
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    const char* in_path = optind < argc && strcmp(argv[optind], "-") != 0 ? argv[optind] : NULL;
+    const char* out_path = optind + 1 < argc && strcmp(argv[optind + 1], "-") != 0 ? argv[optind + 1] : NULL;
+    input in;
+
+    if (!in.open(in_path))
+    {
+        fprintf(stderr, "could not open %s: %s\n", in_path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    int out_fd = out_path ? open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0666) : STDOUT_FILENO;
+
+    if (out_fd < 0)
+    {
+        fprintf(stderr, "could not open %s: %s\n", out_path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    treadstone_pool* pool = treadstone_pool_create(threads);
+
+    if (!pool)
+    {
+        fprintf(stderr, "could not start threads: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    const format in_fmt = decode ? RECORDS : seq ? JSON_SEQ : NDJSON;
+    output out(out_fd);
+    std::vector<const char*> docs;
+    std::vector<size_t> sizes;
+    std::vector<size_t> offsets;
+    uint64_t bytes_in = 0;
+    uint64_t converted = 0;
+    uint64_t invalid = 0;
+    int status = EXIT_SUCCESS;
+    const double start = now();
+
+    while (status == EXIT_SUCCESS)
+    {
+        const char* ptr = in.data();
+        const char* limit = ptr + in.size();
+        size_t batch_bytes = 0;
+        docs.clear();
+        sizes.clear();
+
+        while (docs.size() < BATCH_DOCS && batch_bytes < BATCH_BYTES)
+        {
+            const char* doc;
+            size_t doc_sz = 0;
+            ssize_t used = next_document(in_fmt, ptr, limit, in.eof(), &doc, &doc_sz);
+
+            if (used < 0)
+            {
+                fprintf(stderr, "record %llu is truncated or malformed\n",
+                        static_cast<unsigned long long>(converted + docs.size() + 1));
+                status = EXIT_FAILURE;
+                break;
+            }
+
+            if (used == 0)
+            {
+                break;
+            }
+
+            ptr += used;
+            batch_bytes += used;
+
+            if (doc_sz > 0)
+            {
+                docs.push_back(doc);
+                sizes.push_back(doc_sz);
+            }
+        }
+
+        if (status != EXIT_SUCCESS)
+        {
+            break;
+        }
+
+        offsets.resize(docs.size() + 1);
+        unsigned char* result = NULL;
+        size_t result_sz = 0;
+        int ret = 0;
+
+        if (docs.empty())
+        {
+            offsets[0] = 0;
+        }
+        else if (decode)
+        {
+            char* json = NULL;
+            ret = treadstone_batch_binary_to_json(pool, docs.size(),
+                                                  reinterpret_cast<const unsigned char* const*>(&docs[0]),
+                                                  &sizes[0], &json, &result_sz, &offsets[0]);
+            result = reinterpret_cast<unsigned char*>(json);
+        }
+        else
+        {
+            ret = treadstone_batch_json_to_binary(pool, docs.size(), &docs[0], &sizes[0],
+                                                  &result, &result_sz, &offsets[0]);
+        }
+
+        if (ret < 0)
+        {
+            fprintf(stderr, "conversion failed: %s\n", strerror(errno));
+            status = EXIT_FAILURE;
+            break;
+        }
+
+        for (size_t i = 0; i < docs.size() && status == EXIT_SUCCESS; ++i)
+        {
+            const unsigned char* doc = result + offsets[i];
+            const size_t doc_sz = offsets[i + 1] - offsets[i];
+
+            if (doc_sz == 0)
+            {
+                fprintf(stderr, "document %llu is invalid\n",
+                        static_cast<unsigned long long>(converted + i + 1));
+                ++invalid;
+                continue;
+            }
+
+            bool ok = true;
+
+            if (decode)
+            {
+                ok = (!seq || out.append(&RS, 1)) &&
+                     out.append(doc, doc_sz) &&
+                     out.append("\n", 1);
+            }
+            else
+            {
+                unsigned char header[10];
+                unsigned char* end = e::packvarint64(doc_sz, header);
+                ok = out.append(header, end - header) &&
+                     out.append(doc, doc_sz);
+            }
+
+            if (!ok)
+            {
+                fprintf(stderr, "could not write output: %s\n", strerror(errno));
+                status = EXIT_FAILURE;
+            }
+        }
+
+        free(result);
+        converted += docs.size();
+        bytes_in += batch_bytes;
+        in.consume(batch_bytes);
+
+        if (docs.empty() && batch_bytes == 0)
+        {
+            if (in.eof())
+            {
+                break;
+            }
+
+            if (!in.fill())
+            {
+                fprintf(stderr, "could not read input: %s\n", strerror(errno));
+                status = EXIT_FAILURE;
+            }
+        }
+    }
+
+    if (!out.flush())
+    {
+        fprintf(stderr, "could not write output: %s\n", strerror(errno));
+        status = EXIT_FAILURE;
+    }
+
+    const double elapsed = now() - start;
+    threads = treadstone_pool_threads(pool);
+    treadstone_pool_destroy(pool);
+
+    if (out_fd > STDOUT_FILENO)
+    {
+        close(out_fd);
+    }
+
+    if (!quiet)
+    {
+        const double secs = elapsed > 0 ? elapsed : 1e-9;
+        fprintf(stderr, "%llu documents (%llu invalid) on %u threads: "
+                        "%.1f MB in, %.1f MB out in %.3f s; %.1f MB/s, %.0f documents/s\n",
+                static_cast<unsigned long long>(converted),
+                static_cast<unsigned long long>(invalid),
+                threads, double(bytes_in) / 1e6, double(out.written()) / 1e6,
+                elapsed, double(bytes_in) / 1e6 / secs, double(converted) / secs);
+    }
+
+    return invalid > 0 ? EXIT_FAILURE : status;
+}
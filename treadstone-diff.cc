@@ -0,0 +1,554 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <stdlib.h>
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+
+// STL
+#include <algorithm>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// e
+#include <e/varint.h>
+
+// Treadstone
+#include <treadstone.h>
+#include "namespace.h"
+#include "visibility.h"
+#include "treadstone-allocator.h"
+#include "treadstone-index.h"
+#include "treadstone-internal.h"
+#include "treadstone-types.h"
+#include "treadstone-varint.h"
+
+// A patch is itself a binary document: an array of operations, each an
+// array of the operation's code, its path, and the value it takes, if any.
+// Applying the operations in order through a transformer turns the old
+// document into the new one byte for byte.
+
+BEGIN_TREADSTONE_NAMESPACE
+
+namespace
+{
+
+enum patch_op_t
+{
+    PATCH_SET = 0,
+    PATCH_UNSET = 1,
+    PATCH_ARRAY_PREPEND = 2,
+    PATCH_ARRAY_APPEND = 3
+};
+
+struct value
+{
+    value() : start(NULL), limit(NULL) {}
+    value(const unsigned char* s, const unsigned char* l) : start(s), limit(l) {}
+    size_t size() const { return limit - start; }
+    unsigned char type() const { return *start; }
+    bool operator == (const value& other) const
+    { return size() == other.size() && memcmp(start, other.start, size()) == 0; }
+
+    const unsigned char* start;
+    const unsigned char* limit;
+};
+
+struct patch_op
+{
+    patch_op(patch_op_t c, const std::string& p, const value& v)
+        : code(c), path(p), val(v) {}
+    size_t payload() const;
+    size_t size() const;
+
+    patch_op_t code;
+    std::string path;
+    value val;
+};
+
+typedef std::vector<patch_op> patch_ops;
+
+} // namespace
+
+static size_t
+header_size(size_t payload)
+{
+    return 1 + e::varint_length(payload);
+}
+
+size_t
+patch_op :: payload() const
+{
+    return header_size(code) + header_size(path.size()) + path.size() + val.size();
+}
+
+size_t
+patch_op :: size() const
+{
+    return header_size(payload()) + payload();
+}
+
+static size_t
+patch_size(const patch_ops& ops, size_t from)
+{
+    size_t sz = 0;
+
+    for (size_t i = from; i < ops.size(); ++i)
+    {
+        sz += ops[i].size();
+    }
+
+    return sz;
+}
+
+// the members of a well-formed container
+static void
+members(const value& v, std::vector<value>* ms)
+{
+    uint64_t body_sz = 0;
+    const unsigned char* ptr = varint64_decode(v.start + 1, v.limit, &body_sz);
+    const unsigned char* const end = ptr + body_sz;
+
+    while (ptr < end)
+    {
+        const unsigned char* next = b2j_value_end(ptr, end);
+        ms->push_back(value(ptr, next));
+        ptr = next;
+    }
+}
+
+// a key a path can name, as the string it holds
+static bool
+path_key(const value& k, std::string* key)
+{
+    uint64_t key_sz = 0;
+    const unsigned char* str = varint64_decode(k.start + 1, k.limit, &key_sz);
+    key->assign(reinterpret_cast<const char*>(str), key_sz);
+    return !key->empty() && key->find_first_of(std::string(".[]\0", 4)) == std::string::npos;
+}
+
+static std::string
+field_path(const std::string& path, const std::string& key)
+{
+    return path.empty() ? key : path + "." + key;
+}
+
+static std::string
+index_path(const std::string& path, ssize_t idx)
+{
+    return path + "[" + std::to_string(idx) + "]";
+}
+
+static void
+diff(const value& o, const value& n, const std::string& path, patch_ops* ops);
+
+// Object edits can unset members, change them in place, and append new ones;
+// anything else, a reordering say, takes rewriting the whole object.
+static bool
+diff_object(const value& o, const value& n, const std::string& path, patch_ops* ops)
+{
+    std::vector<value> om;
+    std::vector<value> nm;
+    members(o, &om);
+    members(n, &nm);
+    std::vector<std::string> okeys(om.size() / 2);
+    std::vector<std::string> nkeys(nm.size() / 2);
+    std::unordered_map<std::string, size_t> old_at;
+    std::unordered_map<std::string, size_t> new_at;
+
+    for (size_t i = 0; i < okeys.size(); ++i)
+    {
+        // the transformer finds the first of a repeated key
+        if (!path_key(om[2 * i], &okeys[i]) || !old_at.insert(std::make_pair(okeys[i], i)).second)
+        {
+            return false;
+        }
+    }
+
+    size_t last_common = 0;
+    bool added = false;
+
+    for (size_t i = 0; i < nkeys.size(); ++i)
+    {
+        if (!path_key(nm[2 * i], &nkeys[i]) || !new_at.insert(std::make_pair(nkeys[i], i)).second)
+        {
+            return false;
+        }
+
+        std::unordered_map<std::string, size_t>::iterator it = old_at.find(nkeys[i]);
+
+        if (it == old_at.end())
+        {
+            added = true;
+        }
+        // kept members must stay in order, ahead of every new one
+        else if (added || (i > 0 && it->second < last_common))
+        {
+            return false;
+        }
+        else
+        {
+            last_common = it->second;
+        }
+    }
+
+    for (size_t i = 0; i < okeys.size(); ++i)
+    {
+        if (new_at.find(okeys[i]) == new_at.end())
+        {
+            ops->push_back(patch_op(PATCH_UNSET, field_path(path, okeys[i]), value()));
+        }
+    }
+
+    for (size_t i = 0; i < nkeys.size(); ++i)
+    {
+        std::unordered_map<std::string, size_t>::iterator it = old_at.find(nkeys[i]);
+
+        if (it != old_at.end())
+        {
+            diff(om[2 * it->second + 1], nm[2 * i + 1], field_path(path, nkeys[i]), ops);
+        }
+        else
+        {
+            ops->push_back(patch_op(PATCH_SET, field_path(path, nkeys[i]), nm[2 * i + 1]));
+        }
+    }
+
+    return true;
+}
+
+// Array edits line the old elements up with the front or the back of the new
+// ones, whichever more of them already match, diff those pairwise, and add or
+// drop the rest at the other end.
+static void
+diff_array(const value& o, const value& n, const std::string& path, patch_ops* ops)
+{
+    std::vector<value> oe;
+    std::vector<value> ne;
+    members(o, &oe);
+    members(n, &ne);
+    const size_t common = std::min(oe.size(), ne.size());
+    size_t front = 0;
+    size_t back = 0;
+
+    while (front < common && oe[front] == ne[front])
+    {
+        ++front;
+    }
+
+    while (back < common && oe[oe.size() - back - 1] == ne[ne.size() - back - 1])
+    {
+        ++back;
+    }
+
+    const bool at_back = back > front;
+    const size_t o_skip = at_back ? oe.size() - common : 0;
+    const size_t n_skip = at_back ? ne.size() - common : 0;
+
+    // drop first, so that the indices below are those of the result
+    for (size_t i = common; i < oe.size(); ++i)
+    {
+        ops->push_back(patch_op(PATCH_UNSET, index_path(path, at_back ? 0 : -1), value()));
+    }
+
+    for (size_t i = 0; i < common; ++i)
+    {
+        diff(oe[o_skip + i], ne[n_skip + i], index_path(path, i), ops);
+    }
+
+    // then add, prepending back to front
+    for (size_t i = common; i < ne.size(); ++i)
+    {
+        if (at_back)
+        {
+            ops->push_back(patch_op(PATCH_ARRAY_PREPEND, path, ne[ne.size() - i - 1]));
+        }
+        else
+        {
+            ops->push_back(patch_op(PATCH_ARRAY_APPEND, path, ne[i]));
+        }
+    }
+}
+
+static void
+diff(const value& o, const value& n, const std::string& path, patch_ops* ops)
+{
+    if (o == n)
+    {
+        return;
+    }
+
+    const size_t mark = ops->size();
+    bool edited = false;
+
+    if (o.type() == BINARY_OBJECT && n.type() == BINARY_OBJECT)
+    {
+        edited = diff_object(o, n, path, ops);
+    }
+    else if (o.type() == BINARY_ARRAY && n.type() == BINARY_ARRAY)
+    {
+        diff_array(o, n, path, ops);
+        edited = true;
+    }
+
+    patch_op set(PATCH_SET, path, n);
+
+    if (!edited || patch_size(*ops, mark) >= set.size())
+    {
+        ops->erase(ops->begin() + mark, ops->end());
+        ops->push_back(set);
+    }
+}
+
+static bool
+encode(const patch_ops& ops, const treadstone_allocator* a,
+       unsigned char** patch, size_t* patch_sz)
+{
+    const size_t payload = patch_size(ops, 0);
+    *patch_sz = header_size(payload) + payload;
+    unsigned char* out = reinterpret_cast<unsigned char*>(allocate(a, *patch_sz));
+    *patch = out;
+
+    if (!out)
+    {
+        return false;
+    }
+
+    *out = BINARY_ARRAY;
+    out = e::packvarint64(payload, out + 1);
+
+    for (size_t i = 0; i < ops.size(); ++i)
+    {
+        const patch_op& op(ops[i]);
+        *out = BINARY_ARRAY;
+        out = e::packvarint64(op.payload(), out + 1);
+        *out = BINARY_INTEGER;
+        out = e::packvarint64(op.code, out + 1);
+        *out = BINARY_STRING;
+        out = e::packvarint64(op.path.size(), out + 1);
+        memmove(out, op.path.data(), op.path.size());
+        out += op.path.size();
+
+        if (op.val.size() > 0)
+        {
+            memmove(out, op.val.start, op.val.size());
+            out += op.val.size();
+        }
+    }
+
+    return true;
+}
+
+// one operation of a validated patch
+static bool
+decode(const value& op, patch_op_t* code, std::string* path, value* val)
+{
+    std::vector<value> parts;
+    uint64_t x = 0;
+    uint64_t path_sz = 0;
+
+    if (op.type() != BINARY_ARRAY)
+    {
+        return false;
+    }
+
+    members(op, &parts);
+
+    if (parts.size() < 2 || parts.size() > 3 ||
+        parts[0].type() != BINARY_INTEGER ||
+        parts[1].type() != BINARY_STRING)
+    {
+        return false;
+    }
+
+    varint64_decode(parts[0].start + 1, parts[0].limit, &x);
+    const unsigned char* str = varint64_decode(parts[1].start + 1, parts[1].limit, &path_sz);
+    path->assign(reinterpret_cast<const char*>(str), path_sz);
+    *val = parts.size() == 3 ? parts[2] : value();
+
+    switch (x)
+    {
+        case PATCH_SET:
+        case PATCH_ARRAY_PREPEND:
+        case PATCH_ARRAY_APPEND:
+            *code = patch_op_t(x);
+            return parts.size() == 3;
+        case PATCH_UNSET:
+            *code = patch_op_t(x);
+            return parts.size() == 2;
+        default:
+            return false;
+    }
+}
+
+END_TREADSTONE_NAMESPACE
+
+TREADSTONE_API int
+treadstone_binary_diff(const unsigned char* old_binary, size_t old_binary_sz,
+                       const unsigned char* new_binary, size_t new_binary_sz,
+                       unsigned char** patch, size_t* patch_sz)
+{
+    return treadstone_binary_diff_alloc(NULL, old_binary, old_binary_sz,
+                                        new_binary, new_binary_sz, patch, patch_sz);
+}
+
+TREADSTONE_API int
+treadstone_binary_diff_alloc(const treadstone_allocator* a,
+                             const unsigned char* old_binary, size_t old_binary_sz,
+                             const unsigned char* new_binary, size_t new_binary_sz,
+                             unsigned char** patch, size_t* patch_sz)
+{
+    if (!treadstone::binary_valid(old_binary, old_binary_sz) ||
+        !treadstone::binary_valid(new_binary, new_binary_sz))
+    {
+        return -1;
+    }
+
+    try
+    {
+        treadstone::patch_ops ops;
+        treadstone::diff(treadstone::value(old_binary, old_binary + old_binary_sz),
+                         treadstone::value(new_binary, new_binary + new_binary_sz),
+                         std::string(), &ops);
+        return treadstone::encode(ops, treadstone::allocator_or_default(a), patch, patch_sz) ? 0 : -1;
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+}
+
+TREADSTONE_API int
+treadstone_transformer_apply_patch(struct treadstone_transformer* trans,
+                                   const unsigned char* patch, size_t patch_sz)
+{
+    if (!treadstone::binary_valid(patch, patch_sz))
+    {
+        return -1;
+    }
+
+    try
+    {
+        const treadstone::value whole(patch, patch + patch_sz);
+        std::vector<treadstone::value> ops;
+        std::string path;
+
+        if (whole.type() != BINARY_ARRAY)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        treadstone::members(whole, &ops);
+
+        for (size_t i = 0; i < ops.size(); ++i)
+        {
+            treadstone::patch_op_t code;
+            treadstone::value val;
+            int saved = errno;
+            errno = EINVAL;
+            int ret = -1;
+
+            if (!treadstone::decode(ops[i], &code, &path, &val))
+            {
+                return -1;
+            }
+
+            switch (code)
+            {
+                case treadstone::PATCH_SET:
+                    ret = treadstone_transformer_set_value(trans, path.c_str(), val.start, val.size());
+                    break;
+                case treadstone::PATCH_UNSET:
+                    ret = treadstone_transformer_unset_value(trans, path.c_str());
+                    break;
+                case treadstone::PATCH_ARRAY_PREPEND:
+                    ret = treadstone_transformer_array_prepend_value(trans, path.c_str(), val.start, val.size());
+                    break;
+                case treadstone::PATCH_ARRAY_APPEND:
+                    ret = treadstone_transformer_array_append_value(trans, path.c_str(), val.start, val.size());
+                    break;
+                default:
+                    break;
+            }
+
+            if (ret < 0)
+            {
+                return -1;
+            }
+
+            errno = saved;
+        }
+
+        return 0;
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+}
+
+TREADSTONE_API int
+treadstone_binary_patch(const unsigned char* binary, size_t binary_sz,
+                        const unsigned char* patch, size_t patch_sz,
+                        unsigned char** new_binary, size_t* new_binary_sz)
+{
+    return treadstone_binary_patch_alloc(NULL, binary, binary_sz, patch, patch_sz,
+                                         new_binary, new_binary_sz);
+}
+
+TREADSTONE_API int
+treadstone_binary_patch_alloc(const treadstone_allocator* a,
+                              const unsigned char* binary, size_t binary_sz,
+                              const unsigned char* patch, size_t patch_sz,
+                              unsigned char** new_binary, size_t* new_binary_sz)
+{
+    treadstone_transformer* trans = treadstone_transformer_create_alloc(a, binary, binary_sz);
+
+    if (!trans)
+    {
+        return -1;
+    }
+
+    int ret = treadstone_transformer_apply_patch(trans, patch, patch_sz);
+
+    if (ret == 0)
+    {
+        ret = treadstone_transformer_output(trans, new_binary, new_binary_sz);
+    }
+
+    treadstone_transformer_destroy(trans);
+    return ret;
+}
@@ -0,0 +1,263 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+
+// STL
+#include <new>
+
+// Treadstone
+#include <treadstone.h>
+#include "namespace.h"
+#include "visibility.h"
+#include "treadstone-allocator.h"
+#include "treadstone-index.h"
+#include "treadstone-path.h"
+#include "treadstone-types.h"
+#include "treadstone-varint.h"
+
+BEGIN_TREADSTONE_NAMESPACE
+
+static bool
+index_key_matches(const index_entry& e, const unsigned char* binary,
+                  const char* field, size_t field_sz)
+{
+    uint64_t key_sz;
+    const unsigned char* key = varint64_decode(binary + e.key_offset + 1,
+                                               binary + e.offset, &key_sz);
+    return key != NULL && key_sz == field_sz &&
+           memcmp(key, field, field_sz) == 0;
+}
+
+int
+index_find(const index_entry_vector& entries,
+           const unsigned char* binary,
+           const path& p, index_trail* trail)
+{
+    if (entries.empty())
+    {
+        return -1;
+    }
+
+    size_t i = 0;
+
+    for (size_t depth = 0; ; ++depth)
+    {
+        trail->push_back(i);
+
+        if (p.depth() <= depth)
+        {
+            return static_cast<int>(depth);
+        }
+
+        const index_entry& e(entries[i]);
+        const path::component& c(p.get(depth));
+        const size_t first = i + 1;
+        const size_t limit = i + 1 + e.descendants;
+
+        if (e.type == BINARY_OBJECT)
+        {
+            if (c.type != path::FIELD)
+            {
+                return -1;
+            }
+
+            const uint32_t h = index_key_hash(reinterpret_cast<const unsigned char*>(c.field), c.field_sz);
+            size_t j = first;
+
+            while (j < limit)
+            {
+                if (entries[j].key_hash == h &&
+                    index_key_matches(entries[j], binary, c.field, c.field_sz))
+                {
+                    break;
+                }
+
+                j += 1 + entries[j].descendants;
+            }
+
+            if (j >= limit)
+            {
+                return static_cast<int>(depth);
+            }
+
+            i = j;
+        }
+        else if (e.type == BINARY_ARRAY)
+        {
+            if (c.type != path::INDEX)
+            {
+                return -1;
+            }
+
+            size_t target = c.index;
+
+            if (c.index < 0)
+            {
+                size_t count = 0;
+
+                for (size_t j = first; j < limit; j += 1 + entries[j].descendants)
+                {
+                    ++count;
+                }
+
+                if (size_t(0 - c.index) > count)
+                {
+                    return -1;
+                }
+
+                target = count + c.index;
+            }
+
+            size_t j = first;
+
+            for (size_t n = 0; j < limit && n < target; ++n)
+            {
+                j += 1 + entries[j].descendants;
+            }
+
+            if (j >= limit)
+            {
+                return -1;
+            }
+
+            i = j;
+        }
+        else
+        {
+            return static_cast<int>(depth);
+        }
+    }
+}
+
+END_TREADSTONE_NAMESPACE
+
+TREADSTONE_API struct treadstone_index*
+treadstone_index_create()
+{
+    return treadstone_index_create_alloc(NULL);
+}
+
+TREADSTONE_API struct treadstone_index*
+treadstone_index_create_alloc(const treadstone_allocator* a)
+{
+    a = treadstone::allocator_or_default(a);
+    void* mem = treadstone::allocate(a, sizeof(treadstone_index));
+
+    if (!mem)
+    {
+        return NULL;
+    }
+
+    return new (mem) treadstone_index(a);
+}
+
+TREADSTONE_API void
+treadstone_index_destroy(struct treadstone_index* idx)
+{
+    if (idx)
+    {
+        treadstone_allocator a = idx->alloc;
+        idx->~treadstone_index();
+        treadstone::deallocate(&a, idx, sizeof(treadstone_index));
+    }
+}
+
+TREADSTONE_API int
+treadstone_binary_validate_index(const unsigned char* binary, size_t binary_sz,
+                                 struct treadstone_index* idx)
+{
+    idx->entries.clear();
+    idx->binary_sz = 0;
+    int saved = errno;
+    errno = EINVAL;
+    bool ret = false;
+
+    try
+    {
+        ret = treadstone::binary_validate(binary, binary + binary_sz, &idx->entries);
+    }
+    catch (std::bad_alloc&)
+    {
+        idx->entries.clear();
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (!ret)
+    {
+        // errno is EINVAL from above, or what the validator set
+        idx->entries.clear();
+        return -1;
+    }
+
+    errno = saved;
+    idx->binary_sz = binary_sz;
+    return 0;
+}
+
+TREADSTONE_API int
+treadstone_index_lookup(const struct treadstone_index* idx,
+                        const unsigned char* binary,
+                        const char* p,
+                        const unsigned char** value, size_t* value_sz)
+{
+    try
+    {
+        treadstone::path path(p, &idx->alloc);
+
+        if (!path.is_valid())
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        treadstone::index_trail trail((treadstone::stl_allocator<size_t>(&idx->alloc)));
+        int depth = treadstone::index_find(idx->entries, binary, path, &trail);
+
+        if (depth < 0 || trail.size() != path.depth() + 1)
+        {
+            errno = ENOENT;
+            return -1;
+        }
+
+        const treadstone::index_entry& e(idx->entries[trail.back()]);
+        *value = binary + e.offset;
+        *value_sz = e.limit - e.offset;
+        return 0;
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+}
@@ -0,0 +1,117 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef treadstone_index_h_
+#define treadstone_index_h_
+
+// C
+#include <stdint.h>
+#include <stdlib.h>
+
+// STL
+#include <vector>
+
+// Treadstone
+#include <treadstone.h>
+#include "namespace.h"
+#include "visibility.h"
+#include "treadstone-allocator.h"
+#include "treadstone-path.h"
+
+BEGIN_TREADSTONE_NAMESPACE
+
+// One entry per value, in document order.  The children of entry i start at
+// i + 1, and each child's subtree ends at child + 1 + descendants, so a walk
+// skips whole subtrees without touching the document.
+struct index_entry
+{
+    size_t offset;
+    size_t limit;
+    // start of the key for object members; offset otherwise
+    size_t key_offset;
+    uint32_t descendants;
+    uint32_t key_hash;
+    uint32_t depth;
+    unsigned char type;
+};
+
+typedef std::vector<index_entry, stl_allocator<index_entry> > index_entry_vector;
+typedef std::vector<size_t, stl_allocator<size_t> > index_trail;
+
+// FNV-1a
+inline uint32_t
+index_key_hash(const unsigned char* key, size_t key_sz)
+{
+    uint32_t h = 2166136261U;
+
+    for (size_t i = 0; i < key_sz; ++i)
+    {
+        h ^= key[i];
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+// Defined in treadstone-validate.cc.  Validates the document and, when
+// entries is non-NULL, fills it with the index.
+bool
+binary_validate(const unsigned char* ptr, const unsigned char* limit,
+                index_entry_vector* entries);
+// binary_validate for checks the library makes on its own behalf, which stay
+// out of the validate stats and traces.  On failure errno is EINVAL, or more
+// specific if the walk said so; on success it is unchanged.
+bool
+binary_valid(const unsigned char* binary, size_t binary_sz);
+
+// Follow p from the root, appending to trail the entry of every value on the
+// way.  Returns the depth reached, or -1, with the same meaning as the
+// transformer's parse.
+int
+index_find(const index_entry_vector& entries,
+           const unsigned char* binary,
+           const path& p, index_trail* trail);
+
+END_TREADSTONE_NAMESPACE
+
+struct TREADSTONE_LOCAL treadstone_index
+{
+    treadstone_index(const treadstone_allocator* a)
+        : alloc(*a), entries(treadstone::stl_allocator<treadstone::index_entry>(&alloc)), binary_sz(0) {}
+
+    const treadstone_allocator alloc;
+    treadstone::index_entry_vector entries;
+    // size of the document the index describes
+    size_t binary_sz;
+
+    private:
+        treadstone_index(const treadstone_index&);
+        treadstone_index& operator = (const treadstone_index&);
+};
+
+#endif // treadstone_index_h_
@@ -0,0 +1,113 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef treadstone_internal_h_
+#define treadstone_internal_h_
+
+// C
+#include <stdint.h>
+#include <stdlib.h>
+
+// Treadstone
+#include <treadstone.h>
+#include "namespace.h"
+
+BEGIN_TREADSTONE_NAMESPACE
+
+// Helpers shared between the translation units of the library.  All are
+// defined in treadstone.cc.
+
+// the deepest nesting any walker accepts; see treadstone_set_max_depth
+size_t
+max_depth();
+// x == y when neither is NaN, without tripping -Wfloat-equal
+bool
+same_double(double x, double y);
+
+void
+j2b_skip_whitespace(const char** ptr, const char* limit);
+bool
+j2b_make_room_for(size_t room,
+                  unsigned char** binary,
+                  size_t* binary_sz,
+                  size_t* binary_cap,
+                  const treadstone_allocator* a);
+bool
+j2b_prepend_header(unsigned char type, size_t starting_sz,
+                   unsigned char** binary, size_t* binary_sz, size_t* binary_cap,
+                   const treadstone_allocator* a);
+// members is 0 to convert one value, or the container type whose bare member
+// list [*ptr, limit) holds; see the definition
+bool
+j2b_transform(const char** ptr, const char* limit, unsigned char members,
+              unsigned char** binary, size_t* binary_sz, size_t* binary_cap,
+              const treadstone_allocator* a);
+
+// Where b2j_* put their output: a buffer grown through an allocator, or a
+// fixed buffer handed to a sink each time it fills.
+struct b2j_writer
+{
+    b2j_writer(char* j, size_t j_cap, const treadstone_allocator* alloc)
+        : json(j), json_sz(0), json_cap(j_cap), flushed(0), a(alloc), sink(NULL), sink_ctx(NULL) {}
+    b2j_writer(char* buf, size_t buf_sz, treadstone_json_sink s, void* ctx)
+        : json(buf), json_sz(0), json_cap(buf_sz), flushed(0), a(NULL), sink(s), sink_ctx(ctx) {}
+
+    bool append(const char* data, size_t data_sz);
+    bool append(char c);
+    bool flush();
+
+    char* json;
+    size_t json_sz;
+    size_t json_cap;
+    // handed to the sink so far
+    uint64_t flushed;
+    const treadstone_allocator* const a;
+    const treadstone_json_sink sink;
+    void* const sink_ctx;
+
+    private:
+        bool make_room_for(size_t room);
+        b2j_writer(const b2j_writer&);
+        b2j_writer& operator = (const b2j_writer&);
+};
+
+// convert one binary value, which it checks as it goes, through w
+bool
+b2j_transform(const unsigned char** ptr, const unsigned char* limit,
+              b2j_writer* w);
+// the length of the JSON b2j_transform would write; see the definition
+bool
+b2j_length(const unsigned char* ptr, const unsigned char* limit, bool exact,
+           uint64_t* length, const treadstone_allocator* a);
+// where the binary value at ptr ends, or NULL if it runs past limit
+const unsigned char*
+b2j_value_end(const unsigned char* ptr, const unsigned char* limit);
+
+END_TREADSTONE_NAMESPACE
+
+#endif // treadstone_internal_h_
@@ -0,0 +1,572 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <assert.h>
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+
+// STL
+#include <new>
+#include <vector>
+
+// e
+#include <e/endian.h>
+#include <e/varint.h>
+
+// Treadstone
+#include <treadstone.h>
+#include "namespace.h"
+#include "visibility.h"
+#include "treadstone-allocator.h"
+#include "treadstone-internal.h"
+#include "treadstone-pool.h"
+#include "treadstone-string.h"
+#include "treadstone-types.h"
+
+BEGIN_TREADSTONE_NAMESPACE
+
+// chunks smaller than this are not worth a trip through the pool
+static const size_t PARALLEL_MIN_CHUNK = 64 * 1024;
+
+// A run of consecutive top-level members and, once converted, their bodies.
+struct j2b_chunk
+{
+    j2b_chunk(const char* s, const char* l)
+        : start(s), limit(l), binary(NULL), binary_sz(0), binary_cap(0), err(0) {}
+
+    const char* start;
+    const char* limit;
+    unsigned char* binary;
+    size_t binary_sz;
+    size_t binary_cap;
+    int err;
+};
+
+typedef std::vector<j2b_chunk, stl_allocator<j2b_chunk> > j2b_chunk_vector;
+
+struct j2b_job
+{
+    j2b_job(const treadstone_allocator* alloc)
+        : type(0), a(alloc), chunks(stl_allocator<j2b_chunk>(alloc)) {}
+
+    unsigned char type;
+    const treadstone_allocator* a;
+    j2b_chunk_vector chunks;
+
+    private:
+        j2b_job(const j2b_job&);
+        j2b_job& operator = (const j2b_job&);
+};
+
+// Cut the members of the top-level container into runs of roughly target
+// bytes.  Only commas outside every string and nested container are
+// candidates, so each run is a complete member list; converting a run checks
+// that it really is one.  Returns false if the text is not a container, in
+// which case the caller falls back to converting it serially.
+static bool
+j2b_split(const char* ptr, const char* limit, size_t target, j2b_job* job)
+{
+    j2b_skip_whitespace(&ptr, limit);
+
+    if (ptr >= limit || (*ptr != '[' && *ptr != '{'))
+    {
+        return false;
+    }
+
+    job->type = *ptr == '{' ? BINARY_OBJECT : BINARY_ARRAY;
+    const char close = *ptr == '{' ? '}' : ']';
+    ++ptr;
+    const char* start = ptr;
+    size_t depth = 0;
+
+    while (ptr < limit)
+    {
+        switch (*ptr)
+        {
+            case '"':
+                ptr = json_string_end(ptr + 1, limit);
+
+                if (!ptr)
+                {
+                    return false;
+                }
+
+                break;
+            case '[':
+            case '{':
+                ++depth;
+                break;
+            case ']':
+            case '}':
+                if (depth == 0)
+                {
+                    if (*ptr != close)
+                    {
+                        return false;
+                    }
+
+                    job->chunks.push_back(j2b_chunk(start, ptr));
+                    ++ptr;
+                    j2b_skip_whitespace(&ptr, limit);
+                    return ptr == limit;
+                }
+
+                --depth;
+                break;
+            case ',':
+                if (depth == 0 && size_t(ptr - start) >= target)
+                {
+                    job->chunks.push_back(j2b_chunk(start, ptr));
+                    start = ptr + 1;
+                }
+
+                break;
+            default:
+                break;
+        }
+
+        ++ptr;
+    }
+
+    return false;
+}
+
+static void
+j2b_chunk_task(void* ctx, size_t idx)
+{
+    j2b_job* job = static_cast<j2b_job*>(ctx);
+    j2b_chunk* c = &job->chunks[idx];
+    // an empty run must fail to parse, not to allocate
+    size_t cap = c->limit - c->start + 1;
+    c->binary = static_cast<unsigned char*>(allocate(job->a, cap));
+
+    if (!c->binary)
+    {
+        c->err = ENOMEM;
+        return;
+    }
+
+    c->binary_cap = cap;
+    errno = EINVAL;
+    const char* ptr = c->start;
+
+    if (!j2b_transform(&ptr, c->limit, job->type,
+                       &c->binary, &c->binary_sz, &c->binary_cap, job->a))
+    {
+        c->err = errno;
+    }
+}
+
+static void
+j2b_release(j2b_job* job)
+{
+    for (size_t i = 0; i < job->chunks.size(); ++i)
+    {
+        deallocate(job->a, job->chunks[i].binary, job->chunks[i].binary_cap);
+        job->chunks[i].binary = NULL;
+    }
+}
+
+// batches are cut into tasks of at least this many bytes of input
+static const size_t BATCH_MIN_TASK = 16 * 1024;
+
+// A run of consecutive documents, converted back to back into one buffer.
+struct batch_task
+{
+    batch_task(size_t f)
+        : first(f), limit(f), buf(NULL), buf_sz(0), buf_cap(0), err(0) {}
+
+    size_t first;
+    size_t limit;
+    unsigned char* buf;
+    size_t buf_sz;
+    size_t buf_cap;
+    int err;
+};
+
+typedef std::vector<batch_task, stl_allocator<batch_task> > batch_task_vector;
+
+// A batch in either direction.  convert appends document i to the task's
+// buffer and returns false if it is invalid, with errno ENOMEM if it only
+// failed for want of memory.
+struct batch_job
+{
+    batch_job(const treadstone_allocator* alloc)
+        : json(NULL), binary(NULL), in_sz(NULL), convert(NULL),
+          offsets(NULL), a(alloc), tasks(stl_allocator<batch_task>(alloc)), out(NULL) {}
+
+    const char* const* json;
+    const unsigned char* const* binary;
+    const size_t* in_sz;
+    bool (*convert)(batch_job* job, size_t i, batch_task* t);
+    size_t* offsets;
+    const treadstone_allocator* a;
+    batch_task_vector tasks;
+    unsigned char* out;
+
+    private:
+        batch_job(const batch_job&);
+        batch_job& operator = (const batch_job&);
+};
+
+static void
+run_tasks(treadstone_pool* pool, treadstone_pool::task t, void* ctx, size_t tasks)
+{
+    if (pool)
+    {
+        pool->run(t, ctx, tasks);
+        return;
+    }
+
+    for (size_t i = 0; i < tasks; ++i)
+    {
+        t(ctx, i);
+    }
+}
+
+static bool
+batch_j2b(batch_job* job, size_t i, batch_task* t)
+{
+    const char* ptr = job->json[i];
+    return job->in_sz[i] > 0 &&
+           j2b_transform(&ptr, ptr + job->in_sz[i], 0,
+                         &t->buf, &t->buf_sz, &t->buf_cap, job->a);
+}
+
+static bool
+batch_b2j(batch_job* job, size_t i, batch_task* t)
+{
+    const unsigned char* ptr = job->binary[i];
+    b2j_writer w(reinterpret_cast<char*>(t->buf), t->buf_cap, job->a);
+    w.json_sz = t->buf_sz;
+    bool ret = job->in_sz[i] > 0 &&
+               b2j_transform(&ptr, ptr + job->in_sz[i], &w);
+    t->buf = reinterpret_cast<unsigned char*>(w.json);
+    t->buf_sz = w.json_sz;
+    t->buf_cap = w.json_cap;
+    return ret;
+}
+
+// Leaves the size of document i in offsets[i + 1]; a document that does not
+// convert gets size zero.
+static void
+batch_convert(void* ctx, size_t idx)
+{
+    batch_job* job = static_cast<batch_job*>(ctx);
+    batch_task* t = &job->tasks[idx];
+    size_t cap = 1;
+
+    for (size_t i = t->first; i < t->limit; ++i)
+    {
+        cap += job->in_sz[i] + (job->in_sz[i] >> 2);
+    }
+
+    t->buf = static_cast<unsigned char*>(allocate(job->a, cap));
+
+    if (!t->buf)
+    {
+        t->err = ENOMEM;
+        return;
+    }
+
+    t->buf_cap = cap;
+
+    for (size_t i = t->first; i < t->limit; ++i)
+    {
+        const size_t start = t->buf_sz;
+        errno = EINVAL;
+
+        if (!job->convert(job, i, t))
+        {
+            if (errno == ENOMEM)
+            {
+                t->err = ENOMEM;
+                return;
+            }
+
+            t->buf_sz = start;
+        }
+
+        job->offsets[i + 1] = t->buf_sz - start;
+    }
+}
+
+static void
+batch_copy(void* ctx, size_t idx)
+{
+    batch_job* job = static_cast<batch_job*>(ctx);
+    batch_task* t = &job->tasks[idx];
+    memmove(job->out + job->offsets[t->first], t->buf, t->buf_sz);
+    deallocate(job->a, t->buf, t->buf_cap);
+    t->buf = NULL;
+}
+
+static void
+batch_release(batch_job* job)
+{
+    for (size_t i = 0; i < job->tasks.size(); ++i)
+    {
+        deallocate(job->a, job->tasks[i].buf, job->tasks[i].buf_cap);
+        job->tasks[i].buf = NULL;
+    }
+}
+
+static int
+batch_run(treadstone_pool* pool, size_t n, batch_job* job,
+          unsigned char** out, size_t* out_sz)
+{
+    *out = NULL;
+    *out_sz = 0;
+    job->offsets[0] = 0;
+
+    if (n == 0)
+    {
+        return 0;
+    }
+
+    size_t total = 0;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        total += job->in_sz[i];
+    }
+
+    // many more tasks than threads, so that the threads which draw the small
+    // documents go on to take more tasks while others finish the large ones
+    const size_t threads = pool ? pool->threads() : 1;
+    size_t target = total / (threads * 16);
+    target = target > BATCH_MIN_TASK ? target : BATCH_MIN_TASK;
+
+    try
+    {
+        size_t bytes = 0;
+        job->tasks.push_back(batch_task(0));
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (bytes >= target)
+            {
+                job->tasks.push_back(batch_task(i));
+                bytes = 0;
+            }
+
+            bytes += job->in_sz[i];
+            job->tasks.back().limit = i + 1;
+        }
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    int saved = errno;
+    run_tasks(pool, batch_convert, job, job->tasks.size());
+
+    for (size_t i = 0; i < job->tasks.size(); ++i)
+    {
+        if (job->tasks[i].err)
+        {
+            batch_release(job);
+            errno = job->tasks[i].err;
+            return -1;
+        }
+    }
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        job->offsets[i + 1] += job->offsets[i];
+    }
+
+    // nothing to hand back if no document converted
+    if (job->offsets[n] == 0)
+    {
+        batch_release(job);
+        errno = saved;
+        return 0;
+    }
+
+    job->out = static_cast<unsigned char*>(allocate(job->a, job->offsets[n]));
+
+    if (!job->out)
+    {
+        batch_release(job);
+        return -1;
+    }
+
+    run_tasks(pool, batch_copy, job, job->tasks.size());
+    *out = job->out;
+    *out_sz = job->offsets[n];
+    errno = saved;
+    return 0;
+}
+
+END_TREADSTONE_NAMESPACE
+
+TREADSTONE_API int
+treadstone_json_sz_to_binary_parallel(struct treadstone_pool* pool,
+                                      const char* json, size_t json_sz,
+                                      unsigned char** binary, size_t* binary_sz)
+{
+    return treadstone_json_sz_to_binary_parallel_alloc(NULL, pool, json, json_sz, binary, binary_sz);
+}
+
+TREADSTONE_API int
+treadstone_json_sz_to_binary_parallel_alloc(const struct treadstone_allocator* a,
+                                            struct treadstone_pool* pool,
+                                            const char* json, size_t json_sz,
+                                            unsigned char** binary, size_t* binary_sz)
+{
+    if (!pool || pool->threads() < 2 || !json ||
+        json_sz < 2 * treadstone::PARALLEL_MIN_CHUNK)
+    {
+        return treadstone_json_sz_to_binary_alloc(a, json, json_sz, binary, binary_sz);
+    }
+
+    treadstone::j2b_job job(treadstone::allocator_or_default(a));
+    size_t target = json_sz / (pool->threads() * 8);
+    target = target > treadstone::PARALLEL_MIN_CHUNK ? target : treadstone::PARALLEL_MIN_CHUNK;
+
+    try
+    {
+        if (!treadstone::j2b_split(json, json + json_sz, target, &job) ||
+            job.chunks.size() < 2)
+        {
+            return treadstone_json_sz_to_binary_alloc(a, json, json_sz, binary, binary_sz);
+        }
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        *binary = NULL;
+        *binary_sz = 0;
+        return -1;
+    }
+
+    int saved = errno;
+    pool->run(treadstone::j2b_chunk_task, &job, job.chunks.size());
+    uint64_t body_sz = 0;
+
+    for (size_t i = 0; i < job.chunks.size(); ++i)
+    {
+        if (job.chunks[i].err)
+        {
+            treadstone::j2b_release(&job);
+            errno = job.chunks[i].err;
+            *binary = NULL;
+            *binary_sz = 0;
+            return -1;
+        }
+
+        body_sz += job.chunks[i].binary_sz;
+    }
+
+    // one header for the whole container, then every run's bodies in order
+    size_t sz = 1 + e::varint_length(body_sz) + body_sz;
+    unsigned char* out = static_cast<unsigned char*>(treadstone::allocate(job.a, sz));
+
+    if (!out)
+    {
+        treadstone::j2b_release(&job);
+        *binary = NULL;
+        *binary_sz = 0;
+        return -1;
+    }
+
+    unsigned char* ptr = e::pack8be(job.type, out);
+    ptr = e::packvarint64(body_sz, ptr);
+
+    for (size_t i = 0; i < job.chunks.size(); ++i)
+    {
+        memmove(ptr, job.chunks[i].binary, job.chunks[i].binary_sz);
+        ptr += job.chunks[i].binary_sz;
+    }
+
+    assert(ptr == out + sz);
+    treadstone::j2b_release(&job);
+    *binary = out;
+    *binary_sz = sz;
+    errno = saved;
+    return 0;
+}
+
+TREADSTONE_API int
+treadstone_batch_json_to_binary(struct treadstone_pool* pool, size_t n,
+                                const char* const* json, const size_t* json_sz,
+                                unsigned char** binary, size_t* binary_sz,
+                                size_t* offsets)
+{
+    return treadstone_batch_json_to_binary_alloc(NULL, pool, n, json, json_sz,
+                                                 binary, binary_sz, offsets);
+}
+
+TREADSTONE_API int
+treadstone_batch_json_to_binary_alloc(const struct treadstone_allocator* a,
+                                      struct treadstone_pool* pool, size_t n,
+                                      const char* const* json, const size_t* json_sz,
+                                      unsigned char** binary, size_t* binary_sz,
+                                      size_t* offsets)
+{
+    treadstone::batch_job job(treadstone::allocator_or_default(a));
+    job.json = json;
+    job.in_sz = json_sz;
+    job.convert = treadstone::batch_j2b;
+    job.offsets = offsets;
+    return treadstone::batch_run(pool, n, &job, binary, binary_sz);
+}
+
+TREADSTONE_API int
+treadstone_batch_binary_to_json(struct treadstone_pool* pool, size_t n,
+                                const unsigned char* const* binary, const size_t* binary_sz,
+                                char** json, size_t* json_sz,
+                                size_t* offsets)
+{
+    return treadstone_batch_binary_to_json_alloc(NULL, pool, n, binary, binary_sz,
+                                                 json, json_sz, offsets);
+}
+
+TREADSTONE_API int
+treadstone_batch_binary_to_json_alloc(const struct treadstone_allocator* a,
+                                      struct treadstone_pool* pool, size_t n,
+                                      const unsigned char* const* binary, const size_t* binary_sz,
+                                      char** json, size_t* json_sz,
+                                      size_t* offsets)
+{
+    treadstone::batch_job job(treadstone::allocator_or_default(a));
+    job.binary = binary;
+    job.in_sz = binary_sz;
+    job.convert = treadstone::batch_b2j;
+    job.offsets = offsets;
+    unsigned char* out = NULL;
+    int ret = treadstone::batch_run(pool, n, &job, &out, json_sz);
+    *json = reinterpret_cast<char*>(out);
+    return ret;
+}
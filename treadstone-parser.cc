@@ -0,0 +1,683 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <assert.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+
+// STL
+#include <new>
+#include <vector>
+
+// e
+#include <e/endian.h>
+#include <e/varint.h>
+
+// Treadstone
+#include <treadstone.h>
+#include "namespace.h"
+#include "visibility.h"
+#include "treadstone-allocator.h"
+#include "treadstone-internal.h"
+#include "treadstone-string.h"
+#include "treadstone-types.h"
+
+// A push parser for JSON that accepts its input in arbitrary chunks.  It
+// produces the same encoding as treadstone_json_sz_to_binary, but holds all
+// of its state explicitly so that a token may be split across chunks.  Only
+// numbers are buffered; strings and containers are written to the output as
+// they arrive and have their headers prepended when they close.  A string is
+// unescaped in place once its closing quote arrives.
+
+struct TREADSTONE_LOCAL treadstone_json_parser
+{
+    treadstone_json_parser(const treadstone_allocator* a);
+    ~treadstone_json_parser() throw ();
+    const treadstone_allocator* allocator() const { return &m_allocator; }
+    void reset();
+    int feed(const char* json, size_t json_sz);
+    int finish(unsigned char** binary, size_t* binary_sz);
+
+    private:
+        enum state
+        {
+            VALUE,          // a value must come next
+            ARRAY_FIRST,    // after '['
+            ARRAY_NEXT,     // after a value in an array
+            OBJECT_FIRST,   // after '{'
+            OBJECT_KEY,     // after ',' in an object
+            OBJECT_COLON,   // after a key
+            OBJECT_NEXT,    // after a value in an object
+            STRING,
+            STRING_ESCAPE,
+            NUMBER,
+            LITERAL,
+            DONE,
+            FAILED
+        };
+        struct scope
+        {
+            scope(unsigned char t, size_t s) : type(t), start(s) {}
+
+            unsigned char type;
+            size_t start;
+        };
+
+        typedef std::vector<scope, treadstone::stl_allocator<scope> > scope_vector;
+        typedef std::vector<char, treadstone::stl_allocator<char> > char_vector;
+
+        treadstone_json_parser(const treadstone_json_parser&);
+        treadstone_json_parser& operator = (const treadstone_json_parser&);
+
+        int consume(const char* json, size_t json_sz);
+        bool begin_value(char c);
+        bool end_value();
+        bool close(unsigned char type);
+        bool string(const char** ptr, const char* limit);
+        bool number_end();
+        bool append(const char* data, size_t data_sz);
+        bool append_byte(unsigned char c);
+        int fail(int err);
+
+        const treadstone_allocator m_allocator;
+        unsigned char* m_binary;
+        size_t m_binary_sz;
+        size_t m_binary_cap;
+        scope_vector m_scopes;
+        char_vector m_number;
+        state m_state;
+        // start of the string being parsed and whether it is a key
+        size_t m_string_start;
+        bool m_string_is_key;
+        // bytes of the current escape sequence still to come
+        unsigned m_escape;
+        // the literal being matched and how much of it has been seen
+        const char* m_literal;
+        size_t m_literal_sz;
+        size_t m_literal_off;
+        unsigned char m_literal_type;
+};
+
+treadstone_json_parser :: treadstone_json_parser(const treadstone_allocator* a)
+    : m_allocator(*a)
+    , m_binary(NULL)
+    , m_binary_sz(0)
+    , m_binary_cap(0)
+    , m_scopes(treadstone::stl_allocator<scope>(&m_allocator))
+    , m_number(treadstone::stl_allocator<char>(&m_allocator))
+    , m_state(VALUE)
+    , m_string_start(0)
+    , m_string_is_key(false)
+    , m_escape(0)
+    , m_literal(NULL)
+    , m_literal_sz(0)
+    , m_literal_off(0)
+    , m_literal_type(0)
+{
+}
+
+treadstone_json_parser :: ~treadstone_json_parser() throw ()
+{
+    treadstone::deallocate(&m_allocator, m_binary, m_binary_cap);
+}
+
+void
+treadstone_json_parser :: reset()
+{
+    m_binary_sz = 0;
+    m_scopes.clear();
+    m_number.clear();
+    m_state = VALUE;
+    m_escape = 0;
+    m_literal = NULL;
+}
+
+int
+treadstone_json_parser :: feed(const char* json, size_t json_sz)
+{
+    // scopes and pending numbers grow through m_allocator, which may fail
+    try
+    {
+        return consume(json, json_sz);
+    }
+    catch (std::bad_alloc&)
+    {
+        return fail(ENOMEM);
+    }
+}
+
+int
+treadstone_json_parser :: consume(const char* json, size_t json_sz)
+{
+    const char* ptr = json;
+    const char* const limit = json + json_sz;
+
+    while (ptr < limit)
+    {
+        const char c = *ptr;
+
+        switch (m_state)
+        {
+            case VALUE:
+            case ARRAY_FIRST:
+            case OBJECT_FIRST:
+            case OBJECT_KEY:
+            case OBJECT_COLON:
+            case ARRAY_NEXT:
+            case OBJECT_NEXT:
+            case DONE:
+                if (isspace(c))
+                {
+                    ++ptr;
+                    continue;
+                }
+                break;
+            case STRING:
+            case STRING_ESCAPE:
+                if (!string(&ptr, limit))
+                {
+                    return fail(errno);
+                }
+                continue;
+            case NUMBER:
+                if (isdigit(c) || c == '+' || c == '-' ||
+                    c == '.' || c == 'e' || c == 'E')
+                {
+                    m_number.push_back(c);
+                    ++ptr;
+                    continue;
+                }
+
+                if (!number_end())
+                {
+                    return fail(errno);
+                }
+                // the character that ended the number is handled below
+                continue;
+            case LITERAL:
+                if (c != m_literal[m_literal_off])
+                {
+                    return fail(EINVAL);
+                }
+
+                ++ptr;
+
+                if (++m_literal_off == m_literal_sz &&
+                    (!append_byte(m_literal_type) || !end_value()))
+                {
+                    return fail(errno);
+                }
+                continue;
+            case FAILED:
+            default:
+                errno = EINVAL;
+                return -1;
+        }
+
+        ++ptr;
+
+        switch (m_state)
+        {
+            case VALUE:
+                if (!begin_value(c))
+                {
+                    return fail(errno);
+                }
+                break;
+            case ARRAY_FIRST:
+                if (c == ']')
+                {
+                    if (!close(BINARY_ARRAY))
+                    {
+                        return fail(errno);
+                    }
+                }
+                else if (!begin_value(c))
+                {
+                    return fail(errno);
+                }
+                break;
+            case ARRAY_NEXT:
+                if (c == ',')
+                {
+                    m_state = VALUE;
+                }
+                else if (c != ']')
+                {
+                    return fail(EINVAL);
+                }
+                else if (!close(BINARY_ARRAY))
+                {
+                    return fail(errno);
+                }
+                break;
+            case OBJECT_FIRST:
+            case OBJECT_KEY:
+                if (c == '}' && m_state == OBJECT_FIRST)
+                {
+                    if (!close(BINARY_OBJECT))
+                    {
+                        return fail(errno);
+                    }
+                }
+                else if (c == '"')
+                {
+                    m_string_start = m_binary_sz;
+                    m_string_is_key = true;
+                    m_state = STRING;
+                }
+                else
+                {
+                    return fail(EINVAL);
+                }
+                break;
+            case OBJECT_COLON:
+                if (c != ':')
+                {
+                    return fail(EINVAL);
+                }
+
+                m_state = VALUE;
+                break;
+            case OBJECT_NEXT:
+                if (c == ',')
+                {
+                    m_state = OBJECT_KEY;
+                }
+                else if (c != '}')
+                {
+                    return fail(EINVAL);
+                }
+                else if (!close(BINARY_OBJECT))
+                {
+                    return fail(errno);
+                }
+                break;
+            case DONE:
+                return fail(EINVAL);
+            case STRING:
+            case STRING_ESCAPE:
+            case NUMBER:
+            case LITERAL:
+            case FAILED:
+            default:
+                abort();
+        }
+    }
+
+    return 0;
+}
+
+int
+treadstone_json_parser :: finish(unsigned char** binary, size_t* binary_sz)
+{
+    try
+    {
+        if (m_state == NUMBER && !number_end())
+        {
+            return fail(errno);
+        }
+    }
+    catch (std::bad_alloc&)
+    {
+        return fail(ENOMEM);
+    }
+
+    if (m_state != DONE)
+    {
+        return fail(EINVAL);
+    }
+
+    assert(m_scopes.empty());
+    *binary = reinterpret_cast<unsigned char*>(treadstone::reallocate(&m_allocator, m_binary, m_binary_cap, m_binary_sz));
+
+    if (!*binary)
+    {
+        // carry errno from failed realloc
+        return -1;
+    }
+
+    *binary_sz = m_binary_sz;
+    m_binary = NULL;
+    m_binary_cap = 0;
+    reset();
+    return 0;
+}
+
+bool
+treadstone_json_parser :: begin_value(char c)
+{
+    if ((c == '{' || c == '[') && m_scopes.size() >= treadstone::max_depth())
+    {
+        errno = EOVERFLOW;
+        return false;
+    }
+
+    switch (c)
+    {
+        case '{':
+            m_scopes.push_back(scope(BINARY_OBJECT, m_binary_sz));
+            m_state = OBJECT_FIRST;
+            return true;
+        case '[':
+            m_scopes.push_back(scope(BINARY_ARRAY, m_binary_sz));
+            m_state = ARRAY_FIRST;
+            return true;
+        case '"':
+            m_string_start = m_binary_sz;
+            m_string_is_key = false;
+            m_state = STRING;
+            return true;
+        case '+':
+        case '-':
+        case '.':
+        case '0':
+        case '1':
+        case '2':
+        case '3':
+        case '4':
+        case '5':
+        case '6':
+        case '7':
+        case '8':
+        case '9':
+        case 'e':
+        case 'E':
+            m_number.clear();
+            m_number.push_back(c);
+            m_state = NUMBER;
+            return true;
+        case 't':
+            m_literal = "true";
+            m_literal_sz = 4;
+            m_literal_type = BINARY_TRUE;
+            break;
+        case 'f':
+            m_literal = "false";
+            m_literal_sz = 5;
+            m_literal_type = BINARY_FALSE;
+            break;
+        case 'n':
+            m_literal = "null";
+            m_literal_sz = 4;
+            m_literal_type = BINARY_NULL;
+            break;
+        default:
+            errno = EINVAL;
+            return false;
+    }
+
+    m_literal_off = 1;
+    m_state = LITERAL;
+    return true;
+}
+
+bool
+treadstone_json_parser :: end_value()
+{
+    if (m_scopes.empty())
+    {
+        m_state = DONE;
+    }
+    else if (m_scopes.back().type == BINARY_ARRAY)
+    {
+        m_state = ARRAY_NEXT;
+    }
+    else
+    {
+        m_state = m_string_is_key ? OBJECT_COLON : OBJECT_NEXT;
+        m_string_is_key = false;
+    }
+
+    return true;
+}
+
+bool
+treadstone_json_parser :: close(unsigned char type)
+{
+    assert(!m_scopes.empty());
+    assert(m_scopes.back().type == type);
+    size_t start = m_scopes.back().start;
+    m_scopes.pop_back();
+
+    if (!treadstone::j2b_prepend_header(type, start, &m_binary, &m_binary_sz, &m_binary_cap, &m_allocator))
+    {
+        return false;
+    }
+
+    return end_value();
+}
+
+bool
+treadstone_json_parser :: string(const char** ptr, const char* limit)
+{
+    const char* start = *ptr;
+
+    while (*ptr < limit)
+    {
+        if (m_state == STRING_ESCAPE)
+        {
+            if (m_escape == 0)
+            {
+                // the character after the backslash
+                m_escape = **ptr == 'u' ? 4 : 0;
+            }
+            else
+            {
+                --m_escape;
+            }
+
+            ++*ptr;
+
+            if (m_escape == 0)
+            {
+                m_state = STRING;
+            }
+
+            continue;
+        }
+
+        const char* quote = static_cast<const char*>(memchr(*ptr, '"', limit - *ptr));
+        const char* stop = quote ? quote : limit;
+        const char* slash = static_cast<const char*>(memchr(*ptr, '\\', stop - *ptr));
+
+        if (slash)
+        {
+            *ptr = slash + 1;
+            m_state = STRING_ESCAPE;
+            m_escape = 0;
+            continue;
+        }
+
+        *ptr = stop;
+
+        if (quote)
+        {
+            if (!append(start, quote - start))
+            {
+                return false;
+            }
+
+            ++*ptr;
+            m_state = STRING;
+            // the body is complete, so decode it where it sits
+            size_t decoded = 0;
+
+            if (!treadstone::json_string_decode(m_binary + m_string_start,
+                                                m_binary_sz - m_string_start,
+                                                m_binary + m_string_start, &decoded))
+            {
+                errno = EINVAL;
+                return false;
+            }
+
+            m_binary_sz = m_string_start + decoded;
+            return treadstone::j2b_prepend_header(BINARY_STRING, m_string_start,
+                                                  &m_binary, &m_binary_sz, &m_binary_cap,
+                                                  &m_allocator) &&
+                   end_value();
+        }
+    }
+
+    return append(start, *ptr - start);
+}
+
+bool
+treadstone_json_parser :: number_end()
+{
+    assert(m_state == NUMBER);
+    assert(!m_number.empty());
+    bool dbl = false;
+
+    for (size_t i = 0; i < m_number.size(); ++i)
+    {
+        if (m_number[i] == '.' || m_number[i] == 'e' || m_number[i] == 'E')
+        {
+            dbl = true;
+        }
+    }
+
+    const size_t number_sz = m_number.size();
+    m_number.push_back('\0');
+    const char* tmp = &m_number[0];
+    char* end = NULL;
+    // type byte plus the longest varint
+    unsigned char buf[11];
+    unsigned char* ptr = buf;
+
+    if (dbl)
+    {
+        double x = strtod(tmp, &end);
+        ptr = e::pack8be(BINARY_DOUBLE, ptr);
+        ptr = e::packdoublebe(x, ptr);
+    }
+    else
+    {
+        long long int x = strtoll(tmp, &end, 10);
+        ptr = e::pack8be(BINARY_INTEGER, ptr);
+        ptr = e::packvarint64(x, ptr);
+    }
+
+    m_number.clear();
+
+    if (end != tmp + number_sz)
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    return append(reinterpret_cast<const char*>(buf), ptr - buf) && end_value();
+}
+
+bool
+treadstone_json_parser :: append(const char* data, size_t data_sz)
+{
+    if (data_sz == 0)
+    {
+        return true;
+    }
+
+    if (!treadstone::j2b_make_room_for(data_sz, &m_binary, &m_binary_sz, &m_binary_cap, &m_allocator))
+    {
+        return false;
+    }
+
+    memmove(m_binary + m_binary_sz, data, data_sz);
+    m_binary_sz += data_sz;
+    return true;
+}
+
+bool
+treadstone_json_parser :: append_byte(unsigned char c)
+{
+    return append(reinterpret_cast<const char*>(&c), 1);
+}
+
+int
+treadstone_json_parser :: fail(int err)
+{
+    m_state = FAILED;
+    errno = err;
+    return -1;
+}
+
+TREADSTONE_API struct treadstone_json_parser*
+treadstone_json_parser_create()
+{
+    return treadstone_json_parser_create_alloc(NULL);
+}
+
+TREADSTONE_API struct treadstone_json_parser*
+treadstone_json_parser_create_alloc(const treadstone_allocator* a)
+{
+    a = treadstone::allocator_or_default(a);
+    void* mem = treadstone::allocate(a, sizeof(treadstone_json_parser));
+
+    if (!mem)
+    {
+        return NULL;
+    }
+
+    return new (mem) treadstone_json_parser(a);
+}
+
+TREADSTONE_API void
+treadstone_json_parser_destroy(struct treadstone_json_parser* parser)
+{
+    if (parser)
+    {
+        treadstone_allocator a = *parser->allocator();
+        parser->~treadstone_json_parser();
+        treadstone::deallocate(&a, parser, sizeof(treadstone_json_parser));
+    }
+}
+
+TREADSTONE_API void
+treadstone_json_parser_reset(struct treadstone_json_parser* parser)
+{
+    parser->reset();
+}
+
+TREADSTONE_API int
+treadstone_json_parser_feed(struct treadstone_json_parser* parser,
+                            const char* json, size_t json_sz)
+{
+    return parser->feed(json, json_sz);
+}
+
+TREADSTONE_API int
+treadstone_json_parser_finish(struct treadstone_json_parser* parser,
+                              unsigned char** binary, size_t* binary_sz)
+{
+    return parser->finish(binary, binary_sz);
+}
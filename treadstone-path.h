@@ -0,0 +1,95 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef treadstone_path_h_
+#define treadstone_path_h_
+
+// C
+#include <stdlib.h>
+
+// STL
+#include <iosfwd>
+#include <vector>
+
+// Treadstone
+#include <treadstone.h>
+#include "namespace.h"
+#include "treadstone-allocator.h"
+
+BEGIN_TREADSTONE_NAMESPACE
+
+struct path
+{
+    enum component_t { FIELD, INDEX };
+    struct component
+    {
+        component() : type(FIELD), field(NULL), field_sz(0), index() {}
+        component(const char* f, size_t f_sz) : type(FIELD), field(f), field_sz(f_sz), index() {}
+        component(int i) : type(INDEX), field(NULL), field_sz(0), index(i) {}
+
+        component_t type;
+        // points into the string the path was parsed from
+        const char* field;
+        size_t field_sz;
+        int index;
+    };
+
+    path(const char* p);
+    path(const char* p, const treadstone_allocator* a);
+
+    bool is_valid() const { return m_valid; }
+    size_t depth() const { return m_components.size(); }
+    const component& get(size_t i) const { return m_components[i]; }
+
+    const component& head() const { return m_components[0]; }
+    const component& back() const { return m_components[depth()-1]; }
+
+    // Get whole path w/o back
+    path front() const;
+
+    // Get whole path w/o head
+    path tail() const;
+
+    private:
+        typedef std::vector<component, stl_allocator<component> > component_vector;
+        path(const treadstone_allocator* a)
+            : m_valid(true), m_components(stl_allocator<component>(a)) {}
+
+        void parse(const char* p);
+        friend std::ostream& operator << (std::ostream& lhs, const path& p);
+
+        bool m_valid;
+        component_vector m_components;
+};
+
+std::ostream&
+operator << (std::ostream& lhs, const path& p);
+
+END_TREADSTONE_NAMESPACE
+
+#endif // treadstone_path_h_
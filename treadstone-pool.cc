@@ -0,0 +1,214 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// POSIX
+#include <errno.h>
+
+// STL
+#include <new>
+#include <system_error>
+
+// Treadstone
+#include <treadstone.h>
+#include "visibility.h"
+#include "treadstone-pool.h"
+
+treadstone_pool :: treadstone_pool()
+    : m_run()
+    , m_mtx()
+    , m_wake()
+    , m_done()
+    , m_workers()
+    , m_shutdown(false)
+    , m_generation(0)
+    , m_pending(0)
+    , m_task(NULL)
+    , m_ctx(NULL)
+    , m_tasks(0)
+    , m_next(0)
+{
+}
+
+treadstone_pool :: ~treadstone_pool() throw ()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_shutdown = true;
+    }
+
+    m_wake.notify_all();
+
+    for (size_t i = 0; i < m_workers.size(); ++i)
+    {
+        m_workers[i].join();
+    }
+}
+
+void
+treadstone_pool :: start(unsigned threads)
+{
+    m_workers.reserve(threads > 0 ? threads - 1 : 0);
+
+    for (unsigned i = 1; i < threads; ++i)
+    {
+        m_workers.push_back(std::thread(&treadstone_pool::worker, this));
+    }
+}
+
+void
+treadstone_pool :: run(task t, void* ctx, size_t tasks)
+{
+    std::unique_lock<std::mutex> serialize(m_run);
+
+    if (m_workers.empty() || tasks <= 1)
+    {
+        for (size_t i = 0; i < tasks; ++i)
+        {
+            t(ctx, i);
+        }
+
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_task = t;
+        m_ctx = ctx;
+        m_tasks = tasks;
+        m_next.store(0, std::memory_order_relaxed);
+        m_pending = m_workers.size();
+        ++m_generation;
+    }
+
+    m_wake.notify_all();
+    work();
+    std::unique_lock<std::mutex> lock(m_mtx);
+
+    while (m_pending > 0)
+    {
+        m_done.wait(lock);
+    }
+}
+
+void
+treadstone_pool :: worker()
+{
+    uint64_t seen = 0;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+
+            while (!m_shutdown && m_generation == seen)
+            {
+                m_wake.wait(lock);
+            }
+
+            if (m_shutdown)
+            {
+                return;
+            }
+
+            seen = m_generation;
+        }
+
+        work();
+        std::unique_lock<std::mutex> lock(m_mtx);
+
+        if (--m_pending == 0)
+        {
+            m_done.notify_one();
+        }
+    }
+}
+
+void
+treadstone_pool :: work()
+{
+    while (true)
+    {
+        size_t idx = m_next.fetch_add(1, std::memory_order_relaxed);
+
+        if (idx >= m_tasks)
+        {
+            break;
+        }
+
+        m_task(m_ctx, idx);
+    }
+}
+
+TREADSTONE_API struct treadstone_pool*
+treadstone_pool_create(unsigned threads)
+{
+    if (threads == 0)
+    {
+        threads = std::thread::hardware_concurrency();
+        threads = threads > 0 ? threads : 1;
+    }
+
+    treadstone_pool* pool = new (std::nothrow) treadstone_pool();
+
+    if (!pool)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    try
+    {
+        pool->start(threads);
+    }
+    catch (std::system_error& e)
+    {
+        delete pool;
+        errno = e.code().value();
+        return NULL;
+    }
+    catch (std::bad_alloc&)
+    {
+        delete pool;
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return pool;
+}
+
+TREADSTONE_API void
+treadstone_pool_destroy(struct treadstone_pool* pool)
+{
+    delete pool;
+}
+
+TREADSTONE_API unsigned
+treadstone_pool_threads(const struct treadstone_pool* pool)
+{
+    return pool->threads();
+}
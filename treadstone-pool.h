@@ -0,0 +1,84 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef treadstone_pool_h_
+#define treadstone_pool_h_
+
+// C
+#include <stdlib.h>
+
+// STL
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Treadstone
+#include <treadstone.h>
+
+// A fixed set of threads that run one job at a time.  A job is a count of
+// independent tasks; the calling thread works alongside the pool and every
+// thread claims the next unclaimed task until none remain, so uneven tasks
+// even out without any up-front partitioning.
+struct treadstone_pool
+{
+    typedef void (*task)(void* ctx, size_t idx);
+
+    treadstone_pool();
+    ~treadstone_pool() throw ();
+
+    // spawn threads - 1 workers; throws what std::thread throws
+    void start(unsigned threads);
+    unsigned threads() const { return static_cast<unsigned>(m_workers.size() + 1); }
+    // call t(ctx, i) for every i in [0, tasks) and return once all are done
+    void run(task t, void* ctx, size_t tasks);
+
+    private:
+        void worker();
+        void work();
+
+        std::mutex m_run;
+        std::mutex m_mtx;
+        std::condition_variable m_wake;
+        std::condition_variable m_done;
+        std::vector<std::thread> m_workers;
+        bool m_shutdown;
+        uint64_t m_generation;
+        size_t m_pending;
+        task m_task;
+        void* m_ctx;
+        size_t m_tasks;
+        std::atomic<size_t> m_next;
+
+    private:
+        treadstone_pool(const treadstone_pool&);
+        treadstone_pool& operator = (const treadstone_pool&);
+};
+
+#endif // treadstone_pool_h_
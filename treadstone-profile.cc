@@ -0,0 +1,380 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// STL
+#include <vector>
+
+// e
+#include <e/varint.h>
+
+// Treadstone
+#include <treadstone.h>
+
+// Report the shape of a corpus of newline-delimited JSON, JSON text sequences
+// (RFC 7464), binary records as written by treadstone-convert, or containers,
+// and how large it would be under alternative encodings.
+
+enum format { NDJSON, JSON_SEQ, RECORDS, CONTAINER };
+
+static bool
+read_all(const char* path, std::vector<char>* data)
+{
+    int fd = path ? open(path, O_RDONLY) : STDIN_FILENO;
+
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    size_t sz = 0;
+    data->resize(1 << 20);
+
+    while (true)
+    {
+        if (sz == data->size())
+        {
+            data->resize(data->size() * 2);
+        }
+
+        ssize_t amt = read(fd, &(*data)[0] + sz, data->size() - sz);
+
+        if (amt < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (amt <= 0)
+        {
+            if (fd != STDIN_FILENO)
+            {
+                close(fd);
+            }
+
+            data->resize(sz);
+            return amt == 0;
+        }
+
+        sz += amt;
+    }
+}
+
+// each returns the number of invalid documents, or -1 on error
+static int64_t
+profile_text(treadstone_profile* p, const std::vector<char>& data, char sep)
+{
+    const char* ptr = data.empty() ? NULL : &data[0];
+    const char* const limit = ptr + data.size();
+    int64_t invalid = 0;
+
+    while (ptr < limit)
+    {
+        const char* end = static_cast<const char*>(memchr(ptr, sep, limit - ptr));
+        end = end ? end : limit;
+        const char* text = ptr;
+
+        while (text < end && (*text == ' ' || *text == '\t' ||
+                              *text == '\r' || *text == '\n'))
+        {
+            ++text;
+        }
+
+        // skip blank lines
+        if (text < end && treadstone_profile_json(p, ptr, end - ptr) < 0)
+        {
+            ++invalid;
+        }
+
+        ptr = end < limit ? end + 1 : end;
+    }
+
+    return invalid;
+}
+
+static int64_t
+profile_records(treadstone_profile* p, const std::vector<char>& data)
+{
+    const unsigned char* ptr = data.empty() ? NULL : reinterpret_cast<const unsigned char*>(&data[0]);
+    const unsigned char* const limit = ptr + data.size();
+    int64_t invalid = 0;
+
+    while (ptr < limit)
+    {
+        uint64_t sz;
+        const unsigned char* body = e::varint64_decode(ptr, limit, &sz);
+
+        if (!body || sz > uint64_t(limit - body))
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (treadstone_profile_binary(p, body, sz) < 0)
+        {
+            ++invalid;
+        }
+
+        ptr = body + sz;
+    }
+
+    return invalid;
+}
+
+static int64_t
+profile_container(treadstone_profile* p, const char* path)
+{
+    treadstone_container* c = treadstone_container_open(path);
+
+    if (!c)
+    {
+        return -1;
+    }
+
+    int64_t invalid = 0;
+
+    for (uint64_t i = 0; i < treadstone_container_count(c); ++i)
+    {
+        const unsigned char* binary;
+        size_t binary_sz;
+
+        if (treadstone_container_get(c, i, &binary, &binary_sz) < 0 ||
+            treadstone_profile_binary(p, binary, binary_sz) < 0)
+        {
+            ++invalid;
+        }
+    }
+
+    treadstone_container_close(c);
+    return invalid;
+}
+
+static double
+ratio(uint64_t x, uint64_t y)
+{
+    return y > 0 ? double(x) / double(y) : 0;
+}
+
+static void
+print_histogram(const char* name, const treadstone_stats_histogram* h)
+{
+    printf("%s: %llu, mean %.2f\n", name,
+           static_cast<unsigned long long>(h->count), ratio(h->sum, h->count));
+
+    for (size_t i = 0; i < TREADSTONE_STATS_BUCKETS; ++i)
+    {
+        if (h->buckets[i] == 0)
+        {
+            continue;
+        }
+
+        const unsigned long long lo = i == 0 ? 0 : 1ULL << (i - 1);
+        const unsigned long long hi = i == 0 ? 0 : (1ULL << (i - 1)) * 2 - 1;
+        printf("  %10llu .. %-10llu %12llu %6.2f%%\n", lo, hi,
+               static_cast<unsigned long long>(h->buckets[i]),
+               100 * ratio(h->buckets[i], h->count));
+    }
+}
+
+static void
+print_estimate(const char* name, uint64_t sz, uint64_t binary)
+{
+    printf("  %-16s %14llu %+7.2f%%\n", name,
+           static_cast<unsigned long long>(sz),
+           100 * (ratio(sz, binary) - (binary > 0 ? 1 : 0)));
+}
+
+static void
+report(const treadstone_profile_summary& s)
+{
+    const uint64_t values = s.objects + s.arrays + s.strings + s.doubles +
+                            s.integers + s.trues + s.falses + s.nulls;
+    printf("documents: %llu\n", static_cast<unsigned long long>(s.documents));
+    printf("values: %llu\n", static_cast<unsigned long long>(values));
+    printf("  objects %llu, arrays %llu, strings %llu, doubles %llu, integers %llu, "
+           "true %llu, false %llu, null %llu\n",
+           static_cast<unsigned long long>(s.objects),
+           static_cast<unsigned long long>(s.arrays),
+           static_cast<unsigned long long>(s.strings),
+           static_cast<unsigned long long>(s.doubles),
+           static_cast<unsigned long long>(s.integers),
+           static_cast<unsigned long long>(s.trues),
+           static_cast<unsigned long long>(s.falses),
+           static_cast<unsigned long long>(s.nulls));
+    printf("negative integers: %llu (%.2f%%)\n",
+           static_cast<unsigned long long>(s.negative_integers),
+           100 * ratio(s.negative_integers, s.integers));
+    printf("integral doubles: %llu, float-exact doubles: %llu\n",
+           static_cast<unsigned long long>(s.integral_doubles),
+           static_cast<unsigned long long>(s.float_doubles));
+    printf("escaped strings: %llu (%.2f%%), escaped keys: %llu (%.2f%%)\n",
+           static_cast<unsigned long long>(s.escaped_strings),
+           100 * ratio(s.escaped_strings, s.strings),
+           static_cast<unsigned long long>(s.escaped_keys),
+           100 * ratio(s.escaped_keys, s.keys));
+    printf("keys: %llu in %llu bytes; %llu distinct in %llu bytes; %.2f uses per key\n",
+           static_cast<unsigned long long>(s.keys),
+           static_cast<unsigned long long>(s.key_bytes),
+           static_cast<unsigned long long>(s.distinct_keys),
+           static_cast<unsigned long long>(s.distinct_key_bytes),
+           ratio(s.keys, s.distinct_keys));
+    print_histogram("depth", &s.depth);
+    print_histogram("object width", &s.object_width);
+    print_histogram("array length", &s.array_length);
+    print_histogram("string length", &s.string_length);
+    print_histogram("key length", &s.key_length);
+    print_histogram("integer bytes", &s.integer_bytes);
+    printf("size in bytes, against binary:\n");
+    print_estimate("json", s.json_bytes, s.binary_bytes);
+    print_estimate("binary", s.binary_bytes, s.binary_bytes);
+    print_estimate("zigzag integers", s.zigzag_bytes, s.binary_bytes);
+    print_estimate("key dictionary", s.key_dictionary_bytes, s.binary_bytes);
+    print_estimate("float doubles", s.float_bytes, s.binary_bytes);
+    print_estimate("all three", s.combined_bytes, s.binary_bytes);
+}
+
+static void
+usage()
+{
+    fprintf(stderr, "usage: treadstone-profile [-f json|seq|records|container] [input ...]\n"
+                    "  -f  input format: newline-delimited JSON (default), JSON text\n"
+                    "      sequences, treadstone-convert records, or containers\n");
+}
+
+int
+main(int argc, char* argv[])
+{
+    format fmt = NDJSON;
+    int o;
+
+    while ((o = getopt(argc, argv, "f:h")) != -1)
+    {
+        switch (o)
+        {
+            case 'f':
+                if (strcmp(optarg, "json") == 0)
+                {
+                    fmt = NDJSON;
+                }
+                else if (strcmp(optarg, "seq") == 0)
+                {
+                    fmt = JSON_SEQ;
+                }
+                else if (strcmp(optarg, "records") == 0)
+                {
+                    fmt = RECORDS;
+                }
+                else if (strcmp(optarg, "container") == 0)
+                {
+                    fmt = CONTAINER;
+                }
+                else
+                {
+                    usage();
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (fmt == CONTAINER && optind == argc)
+    {
+        fprintf(stderr, "containers must be named\n");
+        return EXIT_FAILURE;
+    }
+
+    treadstone_profile* p = treadstone_profile_create();
+
+    if (!p)
+    {
+        fprintf(stderr, "could not create a profile: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    int status = EXIT_SUCCESS;
+    std::vector<char> data;
+
+    for (int i = optind; i == optind || i < argc; ++i)
+    {
+        const char* path = i < argc && strcmp(argv[i], "-") != 0 ? argv[i] : NULL;
+        int64_t invalid = 0;
+
+        if (fmt == CONTAINER)
+        {
+            invalid = profile_container(p, path);
+        }
+        else if (!read_all(path, &data))
+        {
+            invalid = -1;
+        }
+        else
+        {
+            invalid = fmt == RECORDS ? profile_records(p, data)
+                                     : profile_text(p, data, fmt == NDJSON ? '\n' : 0x1e);
+        }
+
+        if (invalid < 0)
+        {
+            fprintf(stderr, "could not read %s: %s\n", path ? path : "stdin", strerror(errno));
+            status = EXIT_FAILURE;
+        }
+        else if (invalid > 0)
+        {
+            fprintf(stderr, "%s: %lld invalid documents\n", path ? path : "stdin",
+                    static_cast<long long>(invalid));
+            status = EXIT_FAILURE;
+        }
+    }
+
+    treadstone_profile_summary s;
+
+    if (treadstone_profile_summarize(p, &s) < 0)
+    {
+        fprintf(stderr, "could not summarize: %s\n", strerror(errno));
+        status = EXIT_FAILURE;
+    }
+    else
+    {
+        report(s);
+    }
+
+    treadstone_profile_destroy(p);
+    return status;
+}
@@ -0,0 +1,354 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+
+// STL
+#include <algorithm>
+#include <functional>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// e
+#include <e/endian.h>
+#include <e/varint.h>
+
+// Treadstone
+#include <treadstone.h>
+#include "namespace.h"
+#include "visibility.h"
+#include "treadstone-allocator.h"
+#include "treadstone-index.h"
+#include "treadstone-internal.h"
+#include "treadstone-stack.h"
+#include "treadstone-stats.h"
+#include "treadstone-string.h"
+#include "treadstone-types.h"
+#include "treadstone-varint.h"
+
+struct treadstone_profile
+{
+    treadstone_profile();
+
+    // the summary, less the estimates, which need every key's count
+    treadstone_profile_summary s;
+    std::unordered_map<std::string, uint64_t> keys;
+    // integers as they are now, and as zigzag varints
+    uint64_t integer_bytes;
+    uint64_t zigzag_bytes;
+};
+
+treadstone_profile :: treadstone_profile()
+    : s()
+    , keys()
+    , integer_bytes(0)
+    , zigzag_bytes(0)
+{
+    memset(&s, 0, sizeof(s));
+}
+
+BEGIN_TREADSTONE_NAMESPACE
+
+struct profile_frame
+{
+    const unsigned char* limit;
+    uint64_t count;
+    bool object;
+};
+
+static void
+histogram_add(treadstone_stats_histogram* h, uint64_t v)
+{
+    ++h->count;
+    h->sum += v;
+    ++h->buckets[stat_bucket(v)];
+}
+
+// Walk a validated document, which leaves little to check.
+static bool
+profile_walk(treadstone_profile* p, const unsigned char* ptr, const unsigned char* limit)
+{
+    treadstone_profile_summary* s = &p->s;
+    small_stack<profile_frame, 32> stack(&default_allocator);
+    const unsigned char* end = limit;
+    uint64_t count = 0;
+    bool object = false;
+    size_t depth = 0;
+    uint64_t sz = 0;
+
+    do
+    {
+        ++count;
+
+        if (object)
+        {
+            const unsigned char* key = varint64_decode(ptr + 1, end, &sz);
+            ++s->keys;
+            s->key_bytes += key + sz - ptr;
+            histogram_add(&s->key_length, sz);
+
+            if (json_string_plain(key, key + sz) < sz)
+            {
+                ++s->escaped_keys;
+            }
+
+            ++p->keys[std::string(reinterpret_cast<const char*>(key), sz)];
+            ptr = key + sz;
+        }
+
+        switch (*ptr)
+        {
+            case BINARY_OBJECT:
+            case BINARY_ARRAY:
+            {
+                profile_frame f = {end, count, object};
+                object = *ptr == BINARY_OBJECT;
+                ++(object ? s->objects : s->arrays);
+
+                if (!stack.push(f))
+                {
+                    return false;
+                }
+
+                ptr = varint64_decode(ptr + 1, end, &sz);
+                end = ptr + sz;
+                count = 0;
+                depth = std::max(depth, stack.size());
+                break;
+            }
+            case BINARY_STRING:
+            {
+                const unsigned char* str = varint64_decode(ptr + 1, end, &sz);
+                ++s->strings;
+                histogram_add(&s->string_length, sz);
+
+                if (json_string_plain(str, str + sz) < sz)
+                {
+                    ++s->escaped_strings;
+                }
+
+                ptr = str + sz;
+                break;
+            }
+            case BINARY_DOUBLE:
+            {
+                double d;
+                e::unpackdoublebe(ptr + 1, &d);
+                ++s->doubles;
+
+                if (isfinite(d) && same_double(floor(d), d))
+                {
+                    ++s->integral_doubles;
+                }
+
+                if (isnan(d) || same_double(double(float(d)), d))
+                {
+                    ++s->float_doubles;
+                }
+
+                ptr += sizeof(unsigned char) + sizeof(double);
+                break;
+            }
+            case BINARY_INTEGER:
+            {
+                const unsigned char* next = varint64_decode(ptr + 1, end, &sz);
+                const int64_t x = static_cast<int64_t>(sz);
+                const uint64_t zigzag = (sz << 1) ^ static_cast<uint64_t>(x >> 63);
+                ++s->integers;
+                s->negative_integers += x < 0 ? 1 : 0;
+                histogram_add(&s->integer_bytes, next - ptr - 1);
+                p->integer_bytes += next - ptr - 1;
+                p->zigzag_bytes += e::varint_length(zigzag);
+                ptr = next;
+                break;
+            }
+            case BINARY_TRUE:
+                ++s->trues;
+                ++ptr;
+                break;
+            case BINARY_FALSE:
+                ++s->falses;
+                ++ptr;
+                break;
+            case BINARY_NULL:
+                ++s->nulls;
+                ++ptr;
+                break;
+            default:
+                abort();
+        }
+
+        while (ptr == end && !stack.empty())
+        {
+            const profile_frame& f(stack.top());
+            histogram_add(object ? &s->object_width : &s->array_length, count);
+            end = f.limit;
+            count = f.count;
+            object = f.object;
+            stack.pop();
+        }
+    } while (!stack.empty());
+
+    histogram_add(&s->depth, depth);
+    return true;
+}
+
+END_TREADSTONE_NAMESPACE
+
+TREADSTONE_API treadstone_profile*
+treadstone_profile_create(void)
+{
+    treadstone_profile* p = new (std::nothrow) treadstone_profile();
+
+    if (!p)
+    {
+        errno = ENOMEM;
+    }
+
+    return p;
+}
+
+TREADSTONE_API void
+treadstone_profile_destroy(treadstone_profile* p)
+{
+    delete p;
+}
+
+TREADSTONE_API int
+treadstone_profile_binary(treadstone_profile* p,
+                          const unsigned char* binary, size_t binary_sz)
+{
+    uint64_t json_sz = 0;
+
+    // validates the document before anything is counted
+    if (binary == NULL || binary_sz == 0 ||
+        !treadstone::binary_valid(binary, binary_sz) ||
+        !treadstone::b2j_length(binary, binary + binary_sz, true, &json_sz,
+                                &treadstone::default_allocator))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    try
+    {
+        if (!treadstone::profile_walk(p, binary, binary + binary_sz))
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    ++p->s.documents;
+    p->s.binary_bytes += binary_sz;
+    p->s.json_bytes += json_sz;
+    return 0;
+}
+
+TREADSTONE_API int
+treadstone_profile_json(treadstone_profile* p,
+                        const char* json, size_t json_sz)
+{
+    unsigned char* binary = NULL;
+    size_t binary_sz = 0;
+
+    if (treadstone_json_sz_to_binary(json, json_sz, &binary, &binary_sz) < 0)
+    {
+        return -1;
+    }
+
+    int ret = treadstone_profile_binary(p, binary, binary_sz);
+    free(binary);
+    return ret;
+}
+
+TREADSTONE_API int
+treadstone_profile_summarize(const treadstone_profile* p,
+                             treadstone_profile_summary* summary)
+{
+    std::vector<uint64_t> counts;
+
+    try
+    {
+        counts.reserve(p->keys.size());
+
+        for (std::unordered_map<std::string, uint64_t>::const_iterator it = p->keys.begin();
+                it != p->keys.end(); ++it)
+        {
+            counts.push_back(it->second);
+        }
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    *summary = p->s;
+    summary->distinct_keys = p->keys.size();
+    summary->distinct_key_bytes = 0;
+
+    for (std::unordered_map<std::string, uint64_t>::const_iterator it = p->keys.begin();
+            it != p->keys.end(); ++it)
+    {
+        summary->distinct_key_bytes += 1 + e::varint_length(it->first.size()) + it->first.size();
+    }
+
+    // the most frequent keys get the shortest references
+    std::sort(counts.begin(), counts.end(), std::greater<uint64_t>());
+    uint64_t references = 0;
+
+    for (size_t i = 0; i < counts.size(); ++i)
+    {
+        references += counts[i] * (1 + e::varint_length(i));
+    }
+
+    // any of these may grow the corpus, so they are differences
+    const int64_t zigzag = int64_t(p->zigzag_bytes) - int64_t(p->integer_bytes);
+    const int64_t dictionary = int64_t(references + summary->distinct_key_bytes) - int64_t(summary->key_bytes);
+    const int64_t floats = -4 * int64_t(summary->float_doubles);
+    const int64_t binary = summary->binary_bytes;
+    summary->zigzag_bytes = binary + zigzag;
+    summary->key_dictionary_bytes = binary + dictionary;
+    summary->float_bytes = binary + floats;
+    summary->combined_bytes = binary + zigzag + dictionary + floats;
+    return 0;
+}
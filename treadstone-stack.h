@@ -0,0 +1,118 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef treadstone_stack_h_
+#define treadstone_stack_h_
+
+// C
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Treadstone
+#include <treadstone.h>
+#include "namespace.h"
+#include "treadstone-allocator.h"
+
+BEGIN_TREADSTONE_NAMESPACE
+
+// A stack for the iterative walkers.  The first N entries live inside the
+// object, so shallow documents never allocate; deeper ones spill to the
+// allocator.  T must be safe to copy with memcpy.
+template <typename T, size_t N>
+class small_stack
+{
+    public:
+        explicit small_stack(const treadstone_allocator* a)
+            : m_a(a), m_items(m_inline), m_sz(0), m_cap(N) {}
+        ~small_stack() throw ();
+
+    public:
+        bool empty() const { return m_sz == 0; }
+        size_t size() const { return m_sz; }
+        T& top() { assert(m_sz > 0); return m_items[m_sz - 1]; }
+        const T& operator [] (size_t i) const { assert(i < m_sz); return m_items[i]; }
+        // fails with ENOMEM
+        bool push(const T& t);
+        void pop() { assert(m_sz > 0); --m_sz; }
+        void clear() { m_sz = 0; }
+
+    private:
+        small_stack(const small_stack&);
+        small_stack& operator = (const small_stack&);
+
+    private:
+        const treadstone_allocator* m_a;
+        T* m_items;
+        size_t m_sz;
+        size_t m_cap;
+        T m_inline[N];
+};
+
+template <typename T, size_t N>
+small_stack<T, N> :: ~small_stack() throw ()
+{
+    if (m_items != m_inline)
+    {
+        deallocate(m_a, m_items, m_cap * sizeof(T));
+    }
+}
+
+template <typename T, size_t N>
+bool
+small_stack<T, N> :: push(const T& t)
+{
+    if (m_sz == m_cap)
+    {
+        size_t new_cap = m_cap * 2;
+        T* tmp = static_cast<T*>(allocate(m_a, new_cap * sizeof(T)));
+
+        if (!tmp)
+        {
+            return false;
+        }
+
+        memcpy(tmp, m_items, m_sz * sizeof(T));
+
+        if (m_items != m_inline)
+        {
+            deallocate(m_a, m_items, m_cap * sizeof(T));
+        }
+
+        m_items = tmp;
+        m_cap = new_cap;
+    }
+
+    m_items[m_sz] = t;
+    ++m_sz;
+    return true;
+}
+
+END_TREADSTONE_NAMESPACE
+
+#endif // treadstone_stack_h_
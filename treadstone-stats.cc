@@ -0,0 +1,227 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <string.h>
+
+// STL
+#include <atomic>
+#include <new>
+
+// Treadstone
+#include <treadstone.h>
+#include "namespace.h"
+#include "visibility.h"
+#include "treadstone-stats.h"
+
+BEGIN_TREADSTONE_NAMESPACE
+
+std::atomic<bool> stats_enabled(false);
+
+// One thread's counters.  Only the owning thread writes them, so a plain
+// load and store suffice; readers sum every block ever created.  A block
+// whose thread has exited is handed to the next thread that needs one, and
+// keeps its counts.
+struct stats_block
+{
+    stats_block() : owned(true), next(NULL)
+    {
+        for (size_t i = 0; i < STAT_COUNTERS; ++i)
+        {
+            counters[i].store(0, std::memory_order_relaxed);
+        }
+
+        for (size_t i = 0; i < STAT_HISTOGRAMS; ++i)
+        {
+            sums[i].store(0, std::memory_order_relaxed);
+
+            for (size_t b = 0; b < TREADSTONE_STATS_BUCKETS; ++b)
+            {
+                buckets[i][b].store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::atomic<uint64_t> counters[STAT_COUNTERS];
+    std::atomic<uint64_t> sums[STAT_HISTOGRAMS];
+    std::atomic<uint64_t> buckets[STAT_HISTOGRAMS][TREADSTONE_STATS_BUCKETS];
+    std::atomic<bool> owned;
+    stats_block* next;
+};
+
+static std::atomic<stats_block*> stats_blocks(NULL);
+
+static stats_block*
+stats_claim()
+{
+    for (stats_block* b = stats_blocks.load(std::memory_order_acquire); b; b = b->next)
+    {
+        bool expected = false;
+
+        if (b->owned.compare_exchange_strong(expected, true, std::memory_order_acquire))
+        {
+            return b;
+        }
+    }
+
+    stats_block* b = new (std::nothrow) stats_block();
+
+    if (!b)
+    {
+        return NULL;
+    }
+
+    b->next = stats_blocks.load(std::memory_order_relaxed);
+
+    while (!stats_blocks.compare_exchange_weak(b->next, b, std::memory_order_release))
+    {
+    }
+
+    return b;
+}
+
+struct stats_owner
+{
+    stats_owner() : block(NULL) {}
+    ~stats_owner() throw ()
+    {
+        if (block)
+        {
+            block->owned.store(false, std::memory_order_release);
+        }
+    }
+
+    stats_block* block;
+
+    private:
+        stats_owner(const stats_owner&);
+        stats_owner& operator = (const stats_owner&);
+};
+
+static thread_local stats_owner stats_mine;
+
+static stats_block*
+stats_block_for_thread()
+{
+    if (!stats_mine.block)
+    {
+        stats_mine.block = stats_claim();
+    }
+
+    return stats_mine.block;
+}
+
+static inline void
+stats_bump(std::atomic<uint64_t>* x, uint64_t v)
+{
+    x->store(x->load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+}
+
+void
+stat_add_slow(stat_counter c, uint64_t v)
+{
+    stats_block* b = stats_block_for_thread();
+
+    if (b)
+    {
+        stats_bump(&b->counters[c], v);
+    }
+}
+
+void
+stat_record_slow(stat_histogram h, uint64_t v)
+{
+    stats_block* b = stats_block_for_thread();
+
+    if (b)
+    {
+        stats_bump(&b->sums[h], v);
+        stats_bump(&b->buckets[h][stat_bucket(v)], 1);
+    }
+}
+
+END_TREADSTONE_NAMESPACE
+
+TREADSTONE_API void
+treadstone_stats_enable(int enable)
+{
+    treadstone::stats_enabled.store(enable != 0, std::memory_order_relaxed);
+}
+
+TREADSTONE_API int
+treadstone_stats_enabled()
+{
+    return treadstone::stats_enabled.load(std::memory_order_relaxed) ? 1 : 0;
+}
+
+TREADSTONE_API void
+treadstone_stats_snapshot(struct treadstone_stats* stats)
+{
+    using namespace treadstone;
+    memset(stats, 0, sizeof(*stats));
+    uint64_t* counters[STAT_COUNTERS] = {
+        &stats->json_to_binary,
+        &stats->json_to_binary_bytes_in,
+        &stats->json_to_binary_bytes_out,
+        &stats->binary_to_json,
+        &stats->binary_to_json_bytes_in,
+        &stats->binary_to_json_bytes_out,
+        &stats->validate,
+        &stats->validate_bytes,
+        &stats->transforms,
+        &stats->transform_steps,
+        &stats->transform_bytes_copied,
+        &stats->reallocs,
+    };
+    treadstone_stats_histogram* histograms[STAT_HISTOGRAMS] = {
+        &stats->json_to_binary_ns,
+        &stats->binary_to_json_ns,
+        &stats->transform_ns,
+        &stats->rewrite_bytes,
+    };
+
+    for (stats_block* b = stats_blocks.load(std::memory_order_acquire); b; b = b->next)
+    {
+        for (size_t i = 0; i < STAT_COUNTERS; ++i)
+        {
+            *counters[i] += b->counters[i].load(std::memory_order_relaxed);
+        }
+
+        for (size_t i = 0; i < STAT_HISTOGRAMS; ++i)
+        {
+            histograms[i]->sum += b->sums[i].load(std::memory_order_relaxed);
+
+            for (size_t j = 0; j < TREADSTONE_STATS_BUCKETS; ++j)
+            {
+                uint64_t n = b->buckets[i][j].load(std::memory_order_relaxed);
+                histograms[i]->buckets[j] += n;
+                histograms[i]->count += n;
+            }
+        }
+    }
+}
@@ -0,0 +1,158 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef treadstone_stats_h_
+#define treadstone_stats_h_
+
+// C
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// STL
+#include <atomic>
+
+// Treadstone
+#include <treadstone.h>
+#include "namespace.h"
+
+BEGIN_TREADSTONE_NAMESPACE
+
+// in the order of the fields of treadstone_stats
+enum stat_counter
+{
+    STAT_J2B,
+    STAT_J2B_BYTES_IN,
+    STAT_J2B_BYTES_OUT,
+    STAT_B2J,
+    STAT_B2J_BYTES_IN,
+    STAT_B2J_BYTES_OUT,
+    STAT_VALIDATE,
+    STAT_VALIDATE_BYTES,
+    STAT_TRANSFORMS,
+    STAT_TRANSFORM_STEPS,
+    STAT_TRANSFORM_BYTES_COPIED,
+    STAT_REALLOCS,
+    STAT_COUNTERS
+};
+
+enum stat_histogram
+{
+    STAT_J2B_NS,
+    STAT_B2J_NS,
+    STAT_TRANSFORM_NS,
+    STAT_REWRITE_BYTES,
+    STAT_HISTOGRAMS
+};
+
+extern std::atomic<bool> stats_enabled;
+
+// the treadstone_stats_histogram bucket that counts v
+inline size_t
+stat_bucket(uint64_t v)
+{
+    if (v == 0)
+    {
+        return 0;
+    }
+
+    size_t b = 64 - __builtin_clzll(v);
+    return b < TREADSTONE_STATS_BUCKETS ? b : TREADSTONE_STATS_BUCKETS - 1;
+}
+
+// the slow paths, taken only while stats are enabled
+void
+stat_add_slow(stat_counter c, uint64_t v);
+void
+stat_record_slow(stat_histogram h, uint64_t v);
+
+inline bool
+stats_on()
+{
+    return __builtin_expect(stats_enabled.load(std::memory_order_relaxed), 0);
+}
+
+inline void
+stat_add(stat_counter c, uint64_t v)
+{
+    if (stats_on())
+    {
+        stat_add_slow(c, v);
+    }
+}
+
+inline void
+stat_record(stat_histogram h, uint64_t v)
+{
+    if (stats_on())
+    {
+        stat_record_slow(h, v);
+    }
+}
+
+// Count one operation and, when it goes out of scope, record its latency.
+class stat_op
+{
+    public:
+        stat_op(stat_counter c, stat_histogram h)
+            : m_h(h), m_start(0)
+        {
+            if (stats_on())
+            {
+                stat_add_slow(c, 1);
+                m_start = now();
+            }
+        }
+        ~stat_op() throw ()
+        {
+            if (m_start)
+            {
+                stat_record_slow(m_h, now() - m_start);
+            }
+        }
+
+    private:
+        static uint64_t now()
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return uint64_t(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+        }
+
+    private:
+        const stat_histogram m_h;
+        uint64_t m_start;
+
+    private:
+        stat_op(const stat_op&);
+        stat_op& operator = (const stat_op&);
+};
+
+END_TREADSTONE_NAMESPACE
+
+#endif // treadstone_stats_h_
@@ -0,0 +1,549 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Treadstone
+#include "namespace.h"
+#include "treadstone-string.h"
+
+BEGIN_TREADSTONE_NAMESPACE
+
+// The vector loops below handle 16 bytes at a time and leave the tail, and
+// the byte they stopped at, to scalar code.  Without SSE2 everything is
+// scalar.
+
+static inline size_t
+first_set(unsigned mask)
+{
+    return __builtin_ctz(mask);
+}
+
+const char*
+json_string_end(const char* ptr, const char* limit)
+{
+    while (ptr < limit)
+    {
+#ifdef __SSE2__
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i slash = _mm_set1_epi8('\\');
+
+        while (limit - ptr >= 16)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+            unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                                           _mm_cmpeq_epi8(v, slash)));
+
+            if (mask)
+            {
+                ptr += first_set(mask);
+                break;
+            }
+
+            ptr += 16;
+        }
+#endif
+
+        while (ptr < limit && *ptr != '"' && *ptr != '\\')
+        {
+            ++ptr;
+        }
+
+        if (ptr >= limit)
+        {
+            return NULL;
+        }
+
+        if (*ptr == '"')
+        {
+            return ptr;
+        }
+
+        // skip the backslash and whatever it escapes
+        ptr += 2;
+    }
+
+    return NULL;
+}
+
+// the number of leading bytes that are neither '\\' nor part of a multibyte
+// UTF-8 sequence
+static inline size_t
+ascii_run(const unsigned char* ptr, const unsigned char* limit)
+{
+    const unsigned char* const start = ptr;
+
+#ifdef __SSE2__
+    const __m128i slash = _mm_set1_epi8('\\');
+
+    while (limit - ptr >= 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+        // the sign bit marks bytes >= 0x80
+        unsigned mask = _mm_movemask_epi8(_mm_or_si128(v, _mm_cmpeq_epi8(v, slash)));
+
+        if (mask)
+        {
+            return ptr - start + first_set(mask);
+        }
+
+        ptr += 16;
+    }
+#endif
+
+    while (ptr < limit && *ptr < 0x80 && *ptr != '\\')
+    {
+        ++ptr;
+    }
+
+    return ptr - start;
+}
+
+// the length of the well-formed UTF-8 sequence at ptr, or 0
+static inline size_t
+utf8_sequence(const unsigned char* ptr, const unsigned char* limit)
+{
+    const unsigned char c = ptr[0];
+    size_t sz = 0;
+    unsigned char lo = 0x80;
+    unsigned char hi = 0xbf;
+
+    if (c < 0xc2)
+    {
+        return 0;
+    }
+    else if (c < 0xe0)
+    {
+        sz = 2;
+    }
+    else if (c < 0xf0)
+    {
+        sz = 3;
+        // no overlongs, no surrogates
+        lo = c == 0xe0 ? 0xa0 : 0x80;
+        hi = c == 0xed ? 0x9f : 0xbf;
+    }
+    else if (c < 0xf5)
+    {
+        sz = 4;
+        // no overlongs, nothing past U+10FFFF
+        lo = c == 0xf0 ? 0x90 : 0x80;
+        hi = c == 0xf4 ? 0x8f : 0xbf;
+    }
+    else
+    {
+        return 0;
+    }
+
+    if (size_t(limit - ptr) < sz || ptr[1] < lo || ptr[1] > hi)
+    {
+        return 0;
+    }
+
+    for (size_t i = 2; i < sz; ++i)
+    {
+        if ((ptr[i] & 0xc0) != 0x80)
+        {
+            return 0;
+        }
+    }
+
+    return sz;
+}
+
+static inline bool
+hex4(const unsigned char* ptr, const unsigned char* limit, uint32_t* value)
+{
+    if (limit - ptr < 4)
+    {
+        return false;
+    }
+
+    uint32_t v = 0;
+
+    for (size_t i = 0; i < 4; ++i)
+    {
+        unsigned char c = ptr[i];
+        v <<= 4;
+
+        if (c >= '0' && c <= '9')
+        {
+            v |= c - '0';
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            v |= c - 'a' + 10;
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+            v |= c - 'A' + 10;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    *value = v;
+    return true;
+}
+
+static inline unsigned char*
+utf8_encode(uint32_t cp, unsigned char* out)
+{
+    if (cp < 0x80)
+    {
+        *out++ = static_cast<unsigned char>(cp);
+    }
+    else if (cp < 0x800)
+    {
+        *out++ = static_cast<unsigned char>(0xc0 | (cp >> 6));
+        *out++ = static_cast<unsigned char>(0x80 | (cp & 0x3f));
+    }
+    else if (cp < 0x10000)
+    {
+        *out++ = static_cast<unsigned char>(0xe0 | (cp >> 12));
+        *out++ = static_cast<unsigned char>(0x80 | ((cp >> 6) & 0x3f));
+        *out++ = static_cast<unsigned char>(0x80 | (cp & 0x3f));
+    }
+    else
+    {
+        *out++ = static_cast<unsigned char>(0xf0 | (cp >> 18));
+        *out++ = static_cast<unsigned char>(0x80 | ((cp >> 12) & 0x3f));
+        *out++ = static_cast<unsigned char>(0x80 | ((cp >> 6) & 0x3f));
+        *out++ = static_cast<unsigned char>(0x80 | (cp & 0x3f));
+    }
+
+    return out;
+}
+
+// decode the escape at *in, which starts just past the backslash
+static bool
+decode_escape(const unsigned char** in, const unsigned char* limit,
+              unsigned char** out)
+{
+    if (*in >= limit)
+    {
+        return false;
+    }
+
+    unsigned char c = **in;
+    ++*in;
+
+    switch (c)
+    {
+        case '"':
+        case '\\':
+        case '/':
+            **out = c;
+            break;
+        case 'b':
+            **out = '\b';
+            break;
+        case 'f':
+            **out = '\f';
+            break;
+        case 'n':
+            **out = '\n';
+            break;
+        case 'r':
+            **out = '\r';
+            break;
+        case 't':
+            **out = '\t';
+            break;
+        case 'u':
+        {
+            uint32_t cp;
+
+            if (!hex4(*in, limit, &cp))
+            {
+                return false;
+            }
+
+            *in += 4;
+
+            if (cp >= 0xdc00 && cp <= 0xdfff)
+            {
+                return false;
+            }
+
+            if (cp >= 0xd800 && cp <= 0xdbff)
+            {
+                uint32_t low;
+
+                if (limit - *in < 6 || (*in)[0] != '\\' || (*in)[1] != 'u' ||
+                    !hex4(*in + 2, limit, &low) ||
+                    low < 0xdc00 || low > 0xdfff)
+                {
+                    return false;
+                }
+
+                *in += 6;
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+            }
+
+            *out = utf8_encode(cp, *out);
+            return true;
+        }
+        default:
+            return false;
+    }
+
+    ++*out;
+    return true;
+}
+
+bool
+json_string_decode(const unsigned char* in, size_t in_sz,
+                   unsigned char* out, size_t* out_sz)
+{
+    const unsigned char* const limit = in + in_sz;
+    unsigned char* const start = out;
+
+    while (in < limit)
+    {
+        size_t run = ascii_run(in, limit);
+
+        if (out != in)
+        {
+            memmove(out, in, run);
+        }
+
+        in += run;
+        out += run;
+
+        if (in >= limit)
+        {
+            break;
+        }
+
+        if (*in == '\\')
+        {
+            ++in;
+
+            if (!decode_escape(&in, limit, &out))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            size_t sz = utf8_sequence(in, limit);
+
+            if (sz == 0)
+            {
+                return false;
+            }
+
+            memmove(out, in, sz);
+            in += sz;
+            out += sz;
+        }
+    }
+
+    *out_sz = out - start;
+    return true;
+}
+
+bool
+json_string_decoded_length(const unsigned char* in, size_t in_sz, size_t* out_sz)
+{
+    const unsigned char* const limit = in + in_sz;
+    size_t sz = 0;
+
+    while (in < limit)
+    {
+        size_t run = ascii_run(in, limit);
+        in += run;
+        sz += run;
+
+        if (in >= limit)
+        {
+            break;
+        }
+
+        if (*in == '\\')
+        {
+            // an escape decodes to at most four bytes
+            unsigned char scratch[4];
+            unsigned char* out = scratch;
+            ++in;
+
+            if (!decode_escape(&in, limit, &out))
+            {
+                return false;
+            }
+
+            sz += out - scratch;
+        }
+        else
+        {
+            size_t seq = utf8_sequence(in, limit);
+
+            if (seq == 0)
+            {
+                return false;
+            }
+
+            in += seq;
+            sz += seq;
+        }
+    }
+
+    *out_sz = sz;
+    return true;
+}
+
+size_t
+json_string_plain(const unsigned char* ptr, const unsigned char* limit)
+{
+    const unsigned char* const start = ptr;
+
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i slash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1f);
+
+    while (limit - ptr >= 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+        // max(v, 0x1f) == 0x1f exactly when v <= 0x1f
+        __m128i special = _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                       _mm_cmpeq_epi8(v, slash));
+        special = _mm_or_si128(special, _mm_cmpeq_epi8(_mm_max_epu8(v, control), control));
+        unsigned mask = _mm_movemask_epi8(special);
+
+        if (mask)
+        {
+            return ptr - start + first_set(mask);
+        }
+
+        ptr += 16;
+    }
+#endif
+
+    while (ptr < limit && *ptr >= 0x20 && *ptr != '"' && *ptr != '\\')
+    {
+        ++ptr;
+    }
+
+    return ptr - start;
+}
+
+size_t
+json_string_escape(unsigned char c, char* buf)
+{
+    static const char hex[] = "0123456789abcdef";
+    buf[0] = '\\';
+
+    switch (c)
+    {
+        case '"':
+        case '\\':
+            buf[1] = c;
+            return 2;
+        case '\b':
+            buf[1] = 'b';
+            return 2;
+        case '\f':
+            buf[1] = 'f';
+            return 2;
+        case '\n':
+            buf[1] = 'n';
+            return 2;
+        case '\r':
+            buf[1] = 'r';
+            return 2;
+        case '\t':
+            buf[1] = 't';
+            return 2;
+        default:
+            buf[1] = 'u';
+            buf[2] = '0';
+            buf[3] = '0';
+            buf[4] = hex[c >> 4];
+            buf[5] = hex[c & 0xf];
+            return 6;
+    }
+}
+
+size_t
+json_string_escape_utf8(const unsigned char* ptr, const unsigned char* limit, char* buf,
+                        size_t* buf_sz)
+{
+    static const char hex[] = "0123456789abcdef";
+    const size_t sz = utf8_sequence(ptr, limit);
+    uint32_t cp = 0;
+
+    if (sz == 0)
+    {
+        return 0;
+    }
+
+    cp = ptr[0] & (0x7f >> sz);
+
+    for (size_t i = 1; i < sz; ++i)
+    {
+        cp = (cp << 6) | (ptr[i] & 0x3f);
+    }
+
+    uint32_t units[2];
+    size_t units_sz = 1;
+    units[0] = cp;
+
+    if (cp >= 0x10000)
+    {
+        cp -= 0x10000;
+        units[0] = 0xd800 + (cp >> 10);
+        units[1] = 0xdc00 + (cp & 0x3ff);
+        units_sz = 2;
+    }
+
+    for (size_t i = 0; i < units_sz; ++i)
+    {
+        char* u = buf + 6 * i;
+        u[0] = '\\';
+        u[1] = 'u';
+        u[2] = hex[(units[i] >> 12) & 0xf];
+        u[3] = hex[(units[i] >> 8) & 0xf];
+        u[4] = hex[(units[i] >> 4) & 0xf];
+        u[5] = hex[units[i] & 0xf];
+    }
+
+    *buf_sz = 6 * units_sz;
+    return sz;
+}
+
+END_TREADSTONE_NAMESPACE
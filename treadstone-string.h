@@ -0,0 +1,77 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef treadstone_string_h_
+#define treadstone_string_h_
+
+// C
+#include <stdlib.h>
+
+// Treadstone
+#include "namespace.h"
+
+BEGIN_TREADSTONE_NAMESPACE
+
+// JSON string bodies as they appear between the quotes, and the raw UTF-8
+// the binary format stores instead.  Defined in treadstone-string.cc.
+
+// the closing quote of a string body starting at ptr, or NULL
+const char*
+json_string_end(const char* ptr, const char* limit);
+
+// Decode escapes, surrogate pairs included, and check that the result is
+// UTF-8.  Raw bytes below 0x20 pass through as they are.  out may equal in;
+// the output is never longer than the input.
+bool
+json_string_decode(const unsigned char* in, size_t in_sz,
+                   unsigned char* out, size_t* out_sz);
+
+// the length json_string_decode would produce, checking the same things
+bool
+json_string_decoded_length(const unsigned char* in, size_t in_sz, size_t* out_sz);
+
+// the number of leading bytes that may be copied into a JSON string body
+// as-is; the byte after them, if any, must be escaped
+size_t
+json_string_plain(const unsigned char* ptr, const unsigned char* limit);
+
+// write the escape sequence for c, which json_string_plain stopped at, into
+// buf; returns its length
+size_t
+json_string_escape(unsigned char c, char* buf);
+
+// write the UTF-8 sequence at ptr as one \u escape, or a surrogate pair of
+// them, into buf, which needs twelve bytes; returns the bytes of ptr it used,
+// or 0 if they are not well-formed UTF-8
+size_t
+json_string_escape_utf8(const unsigned char* ptr, const unsigned char* limit, char* buf,
+                        size_t* buf_sz);
+
+END_TREADSTONE_NAMESPACE
+
+#endif // treadstone_string_h_
@@ -0,0 +1,93 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef treadstone_trace_h_
+#define treadstone_trace_h_
+
+// C
+#include <errno.h>
+#include <stddef.h>
+
+// STL
+#include <atomic>
+
+// Treadstone
+#include <treadstone.h>
+#include "namespace.h"
+
+BEGIN_TREADSTONE_NAMESPACE
+
+extern std::atomic<const treadstone_trace_hooks*> trace_hooks;
+
+// A span from construction to destruction, reported to the registered hooks.
+// With no hooks registered this is one load and a branch; built with
+// TREADSTONE_NO_TRACING it is nothing at all.
+class trace_span
+{
+    public:
+#ifdef TREADSTONE_NO_TRACING
+        trace_span(treadstone_trace_op, size_t, const char*) {}
+        int done(int ret) { return ret; }
+#else
+        trace_span(treadstone_trace_op op, size_t input_sz, const char* path)
+            : m_hooks(trace_hooks.load(std::memory_order_acquire))
+            , m_op(op), m_input_sz(input_sz), m_path(path), m_status(-1)
+        {
+            if (__builtin_expect(m_hooks != NULL, 0) && m_hooks->begin)
+            {
+                m_hooks->begin(m_hooks->ctx, m_op, m_input_sz, m_path);
+            }
+        }
+        ~trace_span() throw ()
+        {
+            if (__builtin_expect(m_hooks != NULL, 0) && m_hooks->end)
+            {
+                // the caller reads errno after this; the hook may not
+                const int saved = errno;
+                m_hooks->end(m_hooks->ctx, m_op, m_input_sz, m_path, m_status);
+                errno = saved;
+            }
+        }
+        int done(int ret) { m_status = ret; return ret; }
+
+    private:
+        const treadstone_trace_hooks* const m_hooks;
+        const treadstone_trace_op m_op;
+        const size_t m_input_sz;
+        const char* const m_path;
+        int m_status;
+#endif
+
+    private:
+        trace_span(const trace_span&);
+        trace_span& operator = (const trace_span&);
+};
+
+END_TREADSTONE_NAMESPACE
+
+#endif // treadstone_trace_h_
@@ -0,0 +1,234 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+
+// e
+#include <e/varint.h>
+
+// Treadstone
+#include <treadstone.h>
+#include "namespace.h"
+#include "visibility.h"
+#include "treadstone-allocator.h"
+#include "treadstone-index.h"
+#include "treadstone-internal.h"
+#include "treadstone-stack.h"
+#include "treadstone-string.h"
+#include "treadstone-types.h"
+#include "treadstone-varint.h"
+
+// Binaries written before strings were decoded at ingest hold each string as
+// the escaped JSON text that sat between its quotes.  The upgrade copies such
+// a binary value by value, decoding every string, keys included, the way
+// j2b_string does, and rewriting the headers of the containers it shrinks.
+
+BEGIN_TREADSTONE_NAMESPACE
+
+// an open container: where its header went in the output, how many bytes it
+// took in the input, and where the container's parent ends
+struct upgrade_frame
+{
+    unsigned char* out;
+    size_t header_sz;
+    const unsigned char* limit;
+    unsigned char type;
+};
+
+// Copy [ptr, limit) to out, which has room for as many bytes; decoding
+// never lengthens a string, so neither does the copy.
+static bool
+upgrade_strings(const unsigned char* ptr, const unsigned char* limit,
+                unsigned char* out, size_t* out_sz)
+{
+    small_stack<upgrade_frame, 32> stack(&default_allocator);
+    const size_t max = max_depth();
+    unsigned char* const base = out;
+    // limit of the innermost open container
+    const unsigned char* end = limit;
+    uint64_t sz;
+
+    do
+    {
+        if (ptr >= end)
+        {
+            return false;
+        }
+
+        switch (*ptr)
+        {
+            case BINARY_OBJECT:
+            case BINARY_ARRAY:
+            {
+                const unsigned char* body = varint64_decode(ptr + 1, end, &sz);
+
+                if (!body || sz > uint64_t(end - body))
+                {
+                    return false;
+                }
+
+                if (stack.size() >= max)
+                {
+                    errno = EOVERFLOW;
+                    return false;
+                }
+
+                upgrade_frame f = {out, size_t(body - ptr), end, *ptr};
+
+                if (!stack.push(f))
+                {
+                    return false;
+                }
+
+                out += body - ptr;
+                ptr = body;
+                end = body + sz;
+                break;
+            }
+            case BINARY_STRING:
+            {
+                const unsigned char* body = varint64_decode(ptr + 1, end, &sz);
+
+                if (!body || sz > uint64_t(end - body))
+                {
+                    return false;
+                }
+
+                // decode into the room the text had, then pull the bytes
+                // down if the shorter length has a shorter header
+                const size_t header_sz = body - ptr;
+                size_t decoded = 0;
+
+                if (!json_string_decode(body, sz, out + header_sz, &decoded))
+                {
+                    return false;
+                }
+
+                const size_t decoded_header_sz = 1 + e::varint_length(decoded);
+                memmove(out + decoded_header_sz, out + header_sz, decoded);
+                out[0] = BINARY_STRING;
+                e::packvarint64(decoded, out + 1);
+                out += decoded_header_sz + decoded;
+                ptr = body + sz;
+                break;
+            }
+            default:
+            {
+                const unsigned char* value_end = b2j_value_end(ptr, end);
+
+                if (!value_end)
+                {
+                    return false;
+                }
+
+                memmove(out, ptr, value_end - ptr);
+                out += value_end - ptr;
+                ptr = value_end;
+                break;
+            }
+        }
+
+        while (ptr == end && !stack.empty())
+        {
+            const upgrade_frame& f(stack.top());
+            unsigned char* body = f.out + f.header_sz;
+            const size_t body_sz = out - body;
+            const size_t header_sz = 1 + e::varint_length(body_sz);
+            memmove(f.out + header_sz, body, body_sz);
+            f.out[0] = f.type;
+            e::packvarint64(body_sz, f.out + 1);
+            out = f.out + header_sz + body_sz;
+            end = f.limit;
+            stack.pop();
+        }
+    } while (!stack.empty());
+
+    *out_sz = out - base;
+    return ptr == limit;
+}
+
+END_TREADSTONE_NAMESPACE
+
+TREADSTONE_API int
+treadstone_binary_upgrade_strings(const unsigned char* binary, size_t binary_sz,
+                                  unsigned char** new_binary, size_t* new_binary_sz)
+{
+    return treadstone_binary_upgrade_strings_alloc(NULL, binary, binary_sz,
+                                                   new_binary, new_binary_sz);
+}
+
+TREADSTONE_API int
+treadstone_binary_upgrade_strings_alloc(const struct treadstone_allocator* a,
+                                        const unsigned char* binary, size_t binary_sz,
+                                        unsigned char** new_binary, size_t* new_binary_sz)
+{
+    a = treadstone::allocator_or_default(a);
+    *new_binary = NULL;
+    *new_binary_sz = 0;
+    unsigned char* out = NULL;
+
+    if (binary_sz > 0)
+    {
+        out = reinterpret_cast<unsigned char*>(treadstone::allocate(a, binary_sz));
+
+        if (!out)
+        {
+            return -1;
+        }
+    }
+
+    int saved = errno;
+    errno = EINVAL;
+    size_t out_sz = 0;
+
+    // the decoded form must be a valid document in its own right
+    if (!out ||
+        !treadstone::upgrade_strings(binary, binary + binary_sz, out, &out_sz) ||
+        !treadstone::binary_valid(out, out_sz))
+    {
+        treadstone::deallocate(a, out, binary_sz);
+        return -1;
+    }
+
+    // a one-off migration, so measuring first isn't worth a second walk
+    if (!treadstone::shrink_to_fit(a, &out, binary_sz, out_sz))
+    {
+        return -1;
+    }
+
+    errno = saved;
+    *new_binary = out;
+    *new_binary_sz = out_sz;
+    return 0;
+}
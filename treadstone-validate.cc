@@ -26,274 +26,210 @@
 // POSSIBILITY OF SUCH DAMAGE.
 
 // C
-#include <assert.h>
-#include <ctype.h>
-#include <inttypes.h>
-#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
-#include <string.h>
 
-// STL
-#include <iostream>
-#include <memory>
-#include <string>
-#include <vector>
-
-// e
-#include <e/endian.h>
-#include <e/guard.h>
-#include <e/slice.h>
-#include <e/varint.h>
+// POSIX
+#include <errno.h>
 
 // Treadstone
 #include <treadstone.h>
 #include "namespace.h"
+#include "treadstone-index.h"
+#include "treadstone-internal.h"
+#include "treadstone-stack.h"
+#include "treadstone-stats.h"
+#include "treadstone-trace.h"
 #include "treadstone-types.h"
+#include "treadstone-varint.h"
 #include "visibility.h"
 
 BEGIN_TREADSTONE_NAMESPACE
 
-//! Same as bson2json but without writing the json string
-bool
-validate_transform(const unsigned char** ptr, const unsigned char* limit);
-bool
-validate_value(const unsigned char** ptr, const unsigned char* limit);
-bool
-validate_object(const unsigned char** ptr, const unsigned char* limit);
-bool
-validate_array(const unsigned char** ptr, const unsigned char* limit);
-bool
-validate_string(const unsigned char** ptr, const unsigned char* limit);
-bool
-validate_double(const unsigned char** ptr, const unsigned char* limit);
-bool
-validate_integer(const unsigned char** ptr, const unsigned char* limit);
-bool
-validate_true(const unsigned char** ptr, const unsigned char* limit);
-bool
-validate_false(const unsigned char** ptr, const unsigned char* limit);
-bool
-validate_null(const unsigned char** ptr, const unsigned char* limit);
-
-bool
-binary_validate(const unsigned char** ptr, const unsigned char* limit)
+// Same walk as b2j but without writing the json string.  Each open container
+// pushes the limit of its parent, so the loop never recurses.
+struct validate_frame
 {
-    return validate_value(ptr, limit) &&
-           *ptr == limit;
-}
-
-bool
-validate_value(const unsigned char** ptr, const unsigned char* limit)
+    const unsigned char* limit;
+    size_t entry;
+    bool object;
+};
+
+// move *ptr past a length-prefixed body that must fit before limit
+static inline bool
+validate_length(const unsigned char** ptr, const unsigned char* limit, uint64_t* sz)
 {
-    if (*ptr >= limit)
+    const unsigned char* end = varint64_decode(*ptr + 1, limit, sz);
+
+    if (end == NULL || *sz > uint64_t(limit - end))
     {
         return false;
     }
 
-    switch (**ptr)
-    {
-        case BINARY_OBJECT:
-            return validate_object(ptr, limit);
-        case BINARY_ARRAY:
-            return validate_array(ptr, limit);
-        case BINARY_STRING:
-            return validate_string(ptr, limit);
-        case BINARY_DOUBLE:
-            return validate_double(ptr, limit);
-        case BINARY_INTEGER:
-            return validate_integer(ptr, limit);
-        case BINARY_TRUE:
-            return validate_true(ptr, limit);
-        case BINARY_FALSE:
-            return validate_false(ptr, limit);
-        case BINARY_NULL:
-            return validate_null(ptr, limit);
-        default:
-            return false;
-    }
+    *ptr = end;
+    return true;
 }
 
+// When entries is non-NULL, record an index_entry for every value seen.
 bool
-validate_object(const unsigned char** ptr, const unsigned char* limit)
+binary_validate(const unsigned char* ptr, const unsigned char* limit,
+                index_entry_vector* entries)
 {
-    if (*ptr >= limit || **ptr != BINARY_OBJECT)
-    {
-        return false;
-    }
-
+    small_stack<validate_frame, 32> stack(&default_allocator);
+    const size_t max = max_depth();
+    const unsigned char* const base = ptr;
+    // limit of the innermost open container
+    const unsigned char* end = limit;
+    bool object = false;
     uint64_t sz;
-    const unsigned char* end = e::varint64_decode(*ptr + 1, limit, &sz);
 
-    if (end == NULL || end + sz > limit)
+    do
     {
-        return false;
-    }
-
-    *ptr = end;
-    end += sz;
+        const unsigned char* const key = ptr;
+        uint32_t key_hash = 0;
 
-
-    while (*ptr < end)
-    {
-        if (!validate_string(ptr, end))
+        if (object)
         {
-            return false;
+            if (ptr >= end || *ptr != BINARY_STRING ||
+                !validate_length(&ptr, end, &sz))
+            {
+                return false;
+            }
+
+            if (entries)
+            {
+                key_hash = index_key_hash(ptr, sz);
+            }
+
+            ptr += sz;
         }
 
-        if (!validate_value(ptr, end))
+        if (ptr >= end)
         {
             return false;
         }
-    }
-
-    return *ptr == end;
-}
-
-bool
-validate_array(const unsigned char** ptr, const unsigned char* limit)
-{
-    if (*ptr >= limit || **ptr != BINARY_ARRAY)
-    {
-        return false;
-    }
-
-    uint64_t sz;
-    const unsigned char* end = e::varint64_decode(*ptr + 1, limit, &sz);
-
-    if (end == NULL || end + sz > limit)
-    {
-        return false;
-    }
 
-    *ptr = end;
+        const size_t entry = entries ? entries->size() : 0;
 
-    while (*ptr < end + sz)
-    {
-        if (!validate_value(ptr, end + sz))
+        if (entries)
         {
-            return false;
+            if (entry >= UINT32_MAX)
+            {
+                return false;
+            }
+
+            index_entry e = {size_t(ptr - base), 0, size_t(key - base), 0,
+                             key_hash, uint32_t(stack.size()), *ptr};
+            entries->push_back(e);
         }
-    }
-
-    return *ptr == end + sz;
-}
-
-bool
-validate_string(const unsigned char** ptr, const unsigned char* limit)
-{
-    if (*ptr >= limit || **ptr != BINARY_STRING)
-    {
-        return false;
-    }
 
-    uint64_t sz;
-    const unsigned char* end = e::varint64_decode(*ptr + 1, limit, &sz);
-
-
-    if(end == NULL || end + sz > limit)
-    {
-        return false;
-    }
+        switch (*ptr)
+        {
+            case BINARY_OBJECT:
+            case BINARY_ARRAY:
+            {
+                validate_frame f = {end, entry, object};
+                bool obj = *ptr == BINARY_OBJECT;
+
+                if (stack.size() >= max)
+                {
+                    errno = EOVERFLOW;
+                    return false;
+                }
+
+                if (!validate_length(&ptr, end, &sz) || !stack.push(f))
+                {
+                    return false;
+                }
+
+                end = ptr + sz;
+                object = obj;
+                break;
+            }
+            case BINARY_STRING:
+                if (!validate_length(&ptr, end, &sz))
+                {
+                    return false;
+                }
+
+                ptr += sz;
+                break;
+            case BINARY_DOUBLE:
+                if (end - ptr <= static_cast<ptrdiff_t>(sizeof(double)))
+                {
+                    return false;
+                }
+
+                ptr += sizeof(unsigned char) + sizeof(double);
+                break;
+            case BINARY_INTEGER:
+                ptr = varint64_decode(ptr + 1, end, &sz);
+
+                if (ptr == NULL)
+                {
+                    return false;
+                }
+
+                break;
+            case BINARY_TRUE:
+            case BINARY_FALSE:
+            case BINARY_NULL:
+                ++ptr;
+                break;
+            default:
+                return false;
+        }
 
-    *ptr = end + sz;
-    return true;
-}
+        // containers get their limit when they close
+        if (entries &&
+            (*entries)[entry].type != BINARY_OBJECT &&
+            (*entries)[entry].type != BINARY_ARRAY)
+        {
+            (*entries)[entry].limit = ptr - base;
+        }
 
-bool
-validate_double(const unsigned char** ptr, const unsigned char* limit)
-{
-    if (*ptr + sizeof(double) >= limit || **ptr != BINARY_DOUBLE)
-    {
-        return false;
-    }
+        while (ptr == end && !stack.empty())
+        {
+            const validate_frame& f(stack.top());
 
-    double num;
-    e::unpackdoublebe(*ptr + 1, &num);
-    char buf[40];
-    int sz = snprintf(buf, 40, "%g", num);
+            if (entries)
+            {
+                (*entries)[f.entry].limit = ptr - base;
+                (*entries)[f.entry].descendants = static_cast<uint32_t>(entries->size() - f.entry - 1);
+            }
 
-    if (sz >= 40 || sz <= 0)
-    {
-        return false;
-    }
+            end = f.limit;
+            object = f.object;
+            stack.pop();
+        }
+    } while (!stack.empty());
 
-    *ptr += sizeof(unsigned char) + sizeof(double);
-    return true;
+    return ptr == limit;
 }
 
 bool
-validate_integer(const unsigned char** ptr, const unsigned char* limit)
+binary_valid(const unsigned char* binary, size_t binary_sz)
 {
-    if (*ptr >= limit || **ptr != BINARY_INTEGER)
-    {
-        return false;
-    }
-
-    uint64_t unum;
-    const unsigned char* end = e::varint64_decode(*ptr + 1, limit, &unum);
+    int saved = errno;
+    errno = EINVAL;
 
-    if (end == NULL)
+    if (!binary_validate(binary, binary + binary_sz, NULL))
     {
         return false;
     }
 
-    int64_t num = unum;
-    char buf[40];
-    int sz = snprintf(buf, 40, "%lld", (long long)num);
-
-    if (sz >= 40 || sz <= 0)
-    {
-        return false;
-    }
-
-    *ptr = end;
+    errno = saved;
     return true;
 }
 
-bool
-validate_constant(const unsigned char** ptr, const unsigned char* limit, unsigned char c)
-{
-    if (*ptr >= limit || **ptr != c)
-    {
-        return false;
-    }
-
-    return true;
-}
-
-bool
-validate_true(const unsigned char** ptr, const unsigned char* limit)
-{
-    return validate_constant(ptr, limit, BINARY_TRUE);
-}
-
-bool
-validate_false(const unsigned char** ptr, const unsigned char* limit)
-{
-    return validate_constant(ptr, limit, BINARY_FALSE);
-}
-
-bool
-validate_null(const unsigned char** ptr, const unsigned char* limit)
-{
-    return validate_constant(ptr, limit, BINARY_NULL);
-}
-
 END_TREADSTONE_NAMESPACE
 
 TREADSTONE_API int
 treadstone_binary_validate(const unsigned char* binary, size_t binary_sz)
 {
-    const unsigned char* ptr = binary;
-    const unsigned char* limit = binary + binary_sz;
-    bool ret = treadstone::binary_validate(&ptr, limit);
-
-    if (ret)
-    {
-        return 0;
-    }
-    else
-    {
-        return -1;
-    }
+    treadstone::stat_add(treadstone::STAT_VALIDATE, 1);
+    treadstone::stat_add(treadstone::STAT_VALIDATE_BYTES, binary_sz);
+    treadstone::trace_span trace(TREADSTONE_TRACE_VALIDATE, binary_sz, NULL);
+    return trace.done(treadstone::binary_valid(binary, binary_sz) ? 0 : -1);
 }
@@ -0,0 +1,65 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef treadstone_varint_h_
+#define treadstone_varint_h_
+
+// C
+#include <stdint.h>
+
+// e
+#include <e/varint.h>
+
+// Treadstone
+#include "namespace.h"
+
+BEGIN_TREADSTONE_NAMESPACE
+
+// Lengths inside a document are almost always below 16KB, so decode one and
+// two byte varints inline and leave the rest to libe.
+inline const unsigned char*
+varint64_decode(const unsigned char* ptr, const unsigned char* limit, uint64_t* value)
+{
+    if (ptr < limit && !(ptr[0] & 0x80))
+    {
+        *value = ptr[0];
+        return ptr + 1;
+    }
+
+    if (limit - ptr >= 2 && !(ptr[1] & 0x80))
+    {
+        *value = (uint64_t(ptr[0]) & 0x7f) | (uint64_t(ptr[1]) << 7);
+        return ptr + 2;
+    }
+
+    return e::varint64_decode(ptr, limit, value);
+}
+
+END_TREADSTONE_NAMESPACE
+
+#endif // treadstone_varint_h_
@@ -0,0 +1,1040 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of libtreadstone nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <stdlib.h>
+#include <string.h>
+
+// POSIX
+#include <errno.h>
+
+// STL
+#include <atomic>
+#include <new>
+
+// e
+#include <e/varint.h>
+
+// Treadstone
+#include <treadstone.h>
+#include "namespace.h"
+#include "visibility.h"
+#include "treadstone-allocator.h"
+#include "treadstone-index.h"
+#include "treadstone-internal.h"
+#include "treadstone-path.h"
+#include "treadstone-types.h"
+#include "treadstone-varint.h"
+
+// One node of a persistent document, and the handle for the version it
+// roots.  Nodes never change once built, so a new version shares every node
+// its edit did not pass through.  A leaf is a value still in binary form,
+// either in a buffer of its own or in the buffer of the leaf it was sliced
+// from; a container is an object or array whose children are nodes, objects
+// alternating key and value.  A child may also be a run: several members
+// back to back, sliced from the leaf the container came from, so an edit
+// splits a wide container only around the member it touches.  Containers
+// only appear along edited paths.
+struct treadstone_version
+{
+    treadstone_version(const treadstone_allocator* a, unsigned char t, size_t sz)
+        : refs(1)
+        , allocator(*a)
+        , type(t)
+        , size(sz)
+        , owner(NULL)
+        , data(NULL)
+        , children(NULL)
+        , children_sz(0)
+        , run(0)
+    {
+    }
+
+    bool leaf() const { return data != NULL; }
+
+    std::atomic<size_t> refs;
+    const treadstone_allocator allocator;
+    const unsigned char type;
+    // bytes once flattened
+    const size_t size;
+    // leaves: the value, which lives in owner's buffer, or ours if NULL
+    treadstone_version* owner;
+    const unsigned char* data;
+    // containers
+    treadstone_version** children;
+    size_t children_sz;
+    // runs: how many members the bytes hold, counting keys; 0 for one value
+    size_t run;
+
+    private:
+        treadstone_version(const treadstone_version&);
+        treadstone_version& operator = (const treadstone_version&);
+};
+
+BEGIN_TREADSTONE_NAMESPACE
+
+namespace
+{
+
+enum edit_t { EDIT_SET, EDIT_UNSET, EDIT_PREPEND, EDIT_APPEND };
+
+// where a path component lands among a container's children: the child, and
+// if that child is a run, the member's bytes within it, its key's if it has
+// one, and how many of the run's members come before, counting keys
+struct version_ref
+{
+    size_t child;
+    const unsigned char* key;
+    const unsigned char* start;
+    const unsigned char* limit;
+    size_t before;
+};
+
+const unsigned char version_empty_object[2] = { BINARY_OBJECT, 0 };
+
+} // namespace
+
+static void
+version_release(treadstone_version* v)
+{
+    if (v->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+    {
+        return;
+    }
+
+    treadstone_allocator a = v->allocator;
+
+    if (v->owner)
+    {
+        version_release(v->owner);
+    }
+    else if (v->data)
+    {
+        deallocate(&a, const_cast<unsigned char*>(v->data), v->size);
+    }
+
+    for (size_t i = 0; i < v->children_sz; ++i)
+    {
+        version_release(v->children[i]);
+    }
+
+    deallocate(&a, v->children, sizeof(treadstone_version*) * v->children_sz);
+    v->~treadstone_version();
+    deallocate(&a, v, sizeof(treadstone_version));
+}
+
+static void
+version_release_members(const treadstone_allocator* a,
+                        treadstone_version** members, size_t members_sz)
+{
+    for (size_t i = 0; i < members_sz; ++i)
+    {
+        version_release(members[i]);
+    }
+
+    deallocate(a, members, sizeof(treadstone_version*) * members_sz);
+}
+
+static treadstone_version*
+version_node(const treadstone_allocator* a, unsigned char type, size_t size)
+{
+    void* mem = allocate(a, sizeof(treadstone_version));
+    return mem ? new (mem) treadstone_version(a, type, size) : NULL;
+}
+
+// a leaf holding its own copy of value
+static treadstone_version*
+version_copy(const treadstone_allocator* a, const unsigned char* value, size_t value_sz)
+{
+    if (value_sz == 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    unsigned char* buf = reinterpret_cast<unsigned char*>(allocate(a, value_sz));
+    treadstone_version* v = buf ? version_node(a, value[0], value_sz) : NULL;
+
+    if (!v)
+    {
+        deallocate(a, buf, value_sz);
+        return NULL;
+    }
+
+    memmove(buf, value, value_sz);
+    v->data = buf;
+    return v;
+}
+
+// a leaf for [start, limit), which lies within leaf's value; with run > 0,
+// the bytes are that many of leaf's members rather than one value
+static treadstone_version*
+version_slice(treadstone_version* leaf, const unsigned char* start, const unsigned char* limit,
+              size_t run = 0)
+{
+    treadstone_version* v = version_node(&leaf->allocator, run ? leaf->type : *start, limit - start);
+
+    if (!v)
+    {
+        return NULL;
+    }
+
+    v->owner = leaf->owner ? leaf->owner : leaf;
+    v->owner->refs.fetch_add(1, std::memory_order_relaxed);
+    v->data = start;
+    v->run = run;
+    return v;
+}
+
+// how many members a child stands for
+static size_t
+version_width(const treadstone_version* child)
+{
+    return child->run ? child->run : 1;
+}
+
+// takes over members, which came from a, whether or not it succeeds
+static treadstone_version*
+version_container(const treadstone_allocator* a, unsigned char type,
+                  treadstone_version** members, size_t members_sz)
+{
+    size_t payload = 0;
+
+    for (size_t i = 0; i < members_sz; ++i)
+    {
+        payload += members[i]->size;
+    }
+
+    treadstone_version* v = version_node(a, type, 1 + e::varint_length(payload) + payload);
+
+    if (!v)
+    {
+        version_release_members(a, members, members_sz);
+        return NULL;
+    }
+
+    v->children = members;
+    v->children_sz = members_sz;
+    return v;
+}
+
+// the body of the container at [start, limit), or NULL if it is malformed
+static const unsigned char*
+container_body(const unsigned char* start, const unsigned char* limit,
+               const unsigned char** body_limit)
+{
+    uint64_t body_sz;
+    const unsigned char* body = varint64_decode(start + 1, limit, &body_sz);
+
+    if (!body || body_sz > uint64_t(limit - body))
+    {
+        return NULL;
+    }
+
+    *body_limit = body + body_sz;
+    return body;
+}
+
+static bool
+key_matches(const unsigned char* key, const unsigned char* key_limit,
+            const path::component& c)
+{
+    uint64_t key_sz;
+    const unsigned char* str = varint64_decode(key + 1, key_limit, &key_sz);
+    return *key == BINARY_STRING && str &&
+           key_sz == c.field_sz && str + key_sz == key_limit &&
+           memcmp(str, c.field, key_sz) == 0;
+}
+
+// fresh references to v's children; a leaf's members become a single run.
+// Fails with EINVAL if v is not a container
+static int
+version_members(treadstone_version* v,
+                treadstone_version*** members, size_t* members_sz)
+{
+    *members = NULL;
+    *members_sz = 0;
+
+    if (v->type != BINARY_OBJECT && v->type != BINARY_ARRAY)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t count = v->children_sz;
+    const unsigned char* body = NULL;
+    const unsigned char* body_limit = NULL;
+
+    if (v->leaf())
+    {
+        body = container_body(v->data, v->data + v->size, &body_limit);
+        count = 0;
+
+        for (const unsigned char* ptr = body; ptr && ptr < body_limit; ++count)
+        {
+            ptr = b2j_value_end(ptr, body_limit);
+
+            if (!ptr)
+            {
+                body = NULL;
+            }
+        }
+
+        if (!body || (v->type == BINARY_OBJECT && count % 2 != 0))
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (count == 0)
+        {
+            return 0;
+        }
+
+        treadstone_version* r = version_slice(v, body, body_limit, count);
+        treadstone_version** m = r ? reinterpret_cast<treadstone_version**>(
+                allocate(&v->allocator, sizeof(treadstone_version*))) : NULL;
+
+        if (!m)
+        {
+            if (r)
+            {
+                version_release(r);
+            }
+
+            return -1;
+        }
+
+        m[0] = r;
+        *members = m;
+        *members_sz = 1;
+        return 0;
+    }
+
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    treadstone_version** m = reinterpret_cast<treadstone_version**>(
+            allocate(&v->allocator, sizeof(treadstone_version*) * count));
+
+    if (!m)
+    {
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        m[i] = v->children[i];
+        m[i]->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    *members = m;
+    *members_sz = count;
+    return 0;
+}
+
+// where c names one of a container's members, looking inside runs
+static bool
+version_find(unsigned char type,
+             treadstone_version* const* members, size_t members_sz,
+             const path::component& c, version_ref* ref)
+{
+    ref->key = NULL;
+    ref->start = NULL;
+    ref->limit = NULL;
+    ref->before = 0;
+
+    if (type == BINARY_OBJECT && c.type == path::FIELD)
+    {
+        for (size_t i = 0; i < members_sz; )
+        {
+            const treadstone_version* k = members[i];
+
+            if (!k->run)
+            {
+                if (i + 1 < members_sz && k->leaf() && key_matches(k->data, k->data + k->size, c))
+                {
+                    ref->child = i + 1;
+                    return true;
+                }
+
+                i += 2;
+                continue;
+            }
+
+            const unsigned char* ptr = k->data;
+            const unsigned char* end = k->data + k->size;
+
+            for (size_t before = 0; ptr && ptr < end; before += 2)
+            {
+                const unsigned char* key_limit = b2j_value_end(ptr, end);
+                const unsigned char* val_limit = key_limit ? b2j_value_end(key_limit, end) : NULL;
+
+                if (val_limit && key_matches(ptr, key_limit, c))
+                {
+                    ref->child = i;
+                    ref->key = ptr;
+                    ref->start = key_limit;
+                    ref->limit = val_limit;
+                    ref->before = before;
+                    return true;
+                }
+
+                ptr = val_limit;
+            }
+
+            ++i;
+        }
+    }
+    else if (type == BINARY_ARRAY && c.type == path::INDEX)
+    {
+        size_t count = 0;
+
+        for (size_t i = 0; i < members_sz; ++i)
+        {
+            count += version_width(members[i]);
+        }
+
+        size_t idx = 0;
+
+        if (c.index >= 0 && size_t(c.index) < count)
+        {
+            idx = c.index;
+        }
+        else if (c.index < 0 && size_t(0 - c.index) <= count)
+        {
+            idx = count - size_t(0 - c.index);
+        }
+        else
+        {
+            return false;
+        }
+
+        size_t i = 0;
+
+        while (idx >= version_width(members[i]))
+        {
+            idx -= version_width(members[i]);
+            ++i;
+        }
+
+        ref->child = i;
+
+        if (!members[i]->run)
+        {
+            return true;
+        }
+
+        const unsigned char* ptr = members[i]->data;
+        const unsigned char* end = members[i]->data + members[i]->size;
+
+        for (size_t j = 0; ptr && j < idx; ++j)
+        {
+            ptr = b2j_value_end(ptr, end);
+        }
+
+        const unsigned char* elem_limit = ptr ? b2j_value_end(ptr, end) : NULL;
+
+        if (elem_limit)
+        {
+            ref->start = ptr;
+            ref->limit = elem_limit;
+            ref->before = idx;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// narrow [*start, *limit) from a container to the member c names
+static bool
+leaf_find(const unsigned char** start, const unsigned char** limit,
+          const path::component& c)
+{
+    const unsigned char* end = NULL;
+    const unsigned char* ptr = NULL;
+
+    if ((**start != BINARY_OBJECT && **start != BINARY_ARRAY) ||
+        !(ptr = container_body(*start, *limit, &end)))
+    {
+        return false;
+    }
+
+    if (**start == BINARY_OBJECT && c.type == path::FIELD)
+    {
+        while (ptr && ptr < end)
+        {
+            const unsigned char* key_limit = b2j_value_end(ptr, end);
+            const unsigned char* val_limit = key_limit ? b2j_value_end(key_limit, end) : NULL;
+
+            if (val_limit && key_matches(ptr, key_limit, c))
+            {
+                *start = key_limit;
+                *limit = val_limit;
+                return true;
+            }
+
+            ptr = val_limit;
+        }
+    }
+    else if (**start == BINARY_ARRAY && c.type == path::INDEX)
+    {
+        size_t count = 0;
+
+        for (const unsigned char* p = ptr; p && p < end; ++count)
+        {
+            p = b2j_value_end(p, end);
+        }
+
+        size_t idx = c.index >= 0 ? size_t(c.index) : count - size_t(0 - c.index);
+
+        if ((c.index >= 0 && idx >= count) || (c.index < 0 && size_t(0 - c.index) > count))
+        {
+            return false;
+        }
+
+        for (size_t i = 0; ptr && i < idx; ++i)
+        {
+            ptr = b2j_value_end(ptr, end);
+        }
+
+        const unsigned char* elem_limit = ptr ? b2j_value_end(ptr, end) : NULL;
+
+        if (elem_limit)
+        {
+            *start = ptr;
+            *limit = elem_limit;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static unsigned char*
+version_write(const treadstone_version* v, unsigned char* out)
+{
+    if (v->leaf())
+    {
+        memmove(out, v->data, v->size);
+        return out + v->size;
+    }
+
+    size_t payload = 0;
+
+    for (size_t i = 0; i < v->children_sz; ++i)
+    {
+        payload += v->children[i]->size;
+    }
+
+    *out = v->type;
+    out = e::packvarint64(payload, out + 1);
+
+    for (size_t i = 0; i < v->children_sz; ++i)
+    {
+        out = version_write(v->children[i], out);
+    }
+
+    return out;
+}
+
+static treadstone_version*
+version_key(const treadstone_allocator* a, const path::component& c)
+{
+    unsigned char header[11];
+    header[0] = BINARY_STRING;
+    size_t header_sz = e::packvarint64(c.field_sz, header + 1) - header;
+    unsigned char* buf = reinterpret_cast<unsigned char*>(allocate(a, header_sz + c.field_sz));
+    treadstone_version* v = buf ? version_node(a, BINARY_STRING, header_sz + c.field_sz) : NULL;
+
+    if (!v)
+    {
+        deallocate(a, buf, header_sz + c.field_sz);
+        return NULL;
+    }
+
+    memmove(buf, header, header_sz);
+    memmove(buf + header_sz, c.field, c.field_sz);
+    v->data = buf;
+    return v;
+}
+
+// members with [at, at + drop) replaced by the ins_sz nodes of ins, which it
+// takes over along with members, releasing them all if it fails
+static bool
+members_splice(const treadstone_allocator* a,
+               treadstone_version*** members, size_t* members_sz,
+               size_t at, size_t drop,
+               treadstone_version** ins, size_t ins_sz)
+{
+    const size_t m_sz = *members_sz - drop + ins_sz;
+    treadstone_version** m = NULL;
+
+    if (m_sz > 0)
+    {
+        m = reinterpret_cast<treadstone_version**>(allocate(a, sizeof(treadstone_version*) * m_sz));
+    }
+
+    if (m_sz > 0 && !m)
+    {
+        version_release_members(a, *members, *members_sz);
+
+        for (size_t i = 0; i < ins_sz; ++i)
+        {
+            version_release(ins[i]);
+        }
+
+        return false;
+    }
+
+    size_t out = 0;
+
+    for (size_t i = 0; i < at; ++i)
+    {
+        m[out++] = (*members)[i];
+    }
+
+    for (size_t i = 0; i < ins_sz; ++i)
+    {
+        m[out++] = ins[i];
+    }
+
+    for (size_t i = at; i < at + drop; ++i)
+    {
+        version_release((*members)[i]);
+    }
+
+    for (size_t i = at + drop; i < *members_sz; ++i)
+    {
+        m[out++] = (*members)[i];
+    }
+
+    deallocate(a, *members, sizeof(treadstone_version*) * *members_sz);
+    *members = m;
+    *members_sz = m_sz;
+    return true;
+}
+
+// the container of members with [at, at + drop) replaced by ins; takes over
+// members and ins whether or not it succeeds
+static treadstone_version*
+version_splice(const treadstone_allocator* a, unsigned char type,
+               treadstone_version** members, size_t members_sz,
+               size_t at, size_t drop,
+               treadstone_version** ins, size_t ins_sz)
+{
+    if (!members_splice(a, &members, &members_sz, at, drop, ins, ins_sz))
+    {
+        return NULL;
+    }
+
+    return version_container(a, type, members, members_sz);
+}
+
+// split the run ref lands in so that its member, and the member's key, are
+// children of their own, and point ref->child at the member; takes over
+// members, releasing them if it fails
+static bool
+version_isolate(const treadstone_allocator* a,
+                treadstone_version*** members, size_t* members_sz,
+                version_ref* ref)
+{
+    treadstone_version* r = (*members)[ref->child];
+    const unsigned char* first = ref->key ? ref->key : ref->start;
+    const size_t after = r->run - ref->before - (ref->key ? 2 : 1);
+    treadstone_version* ins[4] = { NULL, NULL, NULL, NULL };
+    size_t ins_sz = 0;
+
+    if (ref->before > 0)
+    {
+        ins[ins_sz++] = version_slice(r, r->data, first, ref->before);
+    }
+
+    if (ref->key)
+    {
+        ins[ins_sz++] = version_slice(r, ref->key, ref->start);
+    }
+
+    const size_t member = ins_sz;
+    ins[ins_sz++] = version_slice(r, ref->start, ref->limit);
+
+    if (after > 0)
+    {
+        ins[ins_sz++] = version_slice(r, ref->limit, r->data + r->size, after);
+    }
+
+    bool ok = true;
+
+    for (size_t i = 0; i < ins_sz; ++i)
+    {
+        ok = ok && ins[i] != NULL;
+    }
+
+    if (!ok)
+    {
+        for (size_t i = 0; i < ins_sz; ++i)
+        {
+            if (ins[i])
+            {
+                version_release(ins[i]);
+            }
+        }
+
+        version_release_members(a, *members, *members_sz);
+        return false;
+    }
+
+    const size_t at = ref->child;
+    ref->child = at + member;
+    return members_splice(a, members, members_sz, at, 1, ins, ins_sz);
+}
+
+// build the version of v with path[i:] edited, copying only the containers
+// along the path; the semantics follow the transformer's
+static treadstone_version*
+version_edit(treadstone_version* v, const path& p, size_t i, edit_t op,
+             const unsigned char* value, size_t value_sz)
+{
+    const treadstone_allocator* a = &v->allocator;
+
+    if (i == p.depth() && op == EDIT_SET)
+    {
+        return version_copy(a, value, value_sz);
+    }
+    // only the root can be unset here; anything deeper is its parent's job
+    else if (i == p.depth() && op == EDIT_UNSET)
+    {
+        return version_copy(a, version_empty_object, sizeof(version_empty_object));
+    }
+
+    treadstone_version** members = NULL;
+    size_t members_sz = 0;
+
+    if (version_members(v, &members, &members_sz) < 0)
+    {
+        errno = errno == ENOMEM ? ENOMEM : ENOENT;
+        return NULL;
+    }
+
+    if (i == p.depth())
+    {
+        treadstone_version* elem = NULL;
+
+        if (v->type != BINARY_ARRAY)
+        {
+            errno = EINVAL;
+        }
+        else
+        {
+            elem = version_copy(a, value, value_sz);
+        }
+
+        if (!elem)
+        {
+            version_release_members(a, members, members_sz);
+            return NULL;
+        }
+
+        size_t at = op == EDIT_PREPEND ? 0 : members_sz;
+        return version_splice(a, v->type, members, members_sz, at, 0, &elem, 1);
+    }
+
+    const path::component& c(p.get(i));
+    const bool last = i + 1 == p.depth();
+    version_ref ref;
+    const bool found = version_find(v->type, members, members_sz, c, &ref);
+
+    if (!found && op == EDIT_SET && v->type == BINARY_OBJECT && c.type == path::FIELD)
+    {
+        // the transformer makes missing parents into empty objects
+        treadstone_version* ins[2] = { NULL, NULL };
+        ins[0] = version_key(a, c);
+
+        if (ins[0] && last)
+        {
+            ins[1] = version_copy(a, value, value_sz);
+        }
+        else if (ins[0])
+        {
+            treadstone_version* empty = version_copy(a, version_empty_object, sizeof(version_empty_object));
+            ins[1] = empty ? version_edit(empty, p, i + 1, op, value, value_sz) : NULL;
+
+            if (empty)
+            {
+                version_release(empty);
+            }
+        }
+
+        if (!ins[1])
+        {
+            if (ins[0])
+            {
+                version_release(ins[0]);
+            }
+
+            version_release_members(a, members, members_sz);
+            return NULL;
+        }
+
+        return version_splice(a, v->type, members, members_sz, members_sz, 0, ins, 2);
+    }
+    else if (!found)
+    {
+        version_release_members(a, members, members_sz);
+        errno = ENOENT;
+        return NULL;
+    }
+    else if (ref.start && !version_isolate(a, &members, &members_sz, &ref))
+    {
+        return NULL;
+    }
+
+    const size_t at = ref.child;
+
+    // an object member goes with its key
+    if (last && op == EDIT_UNSET && v->type == BINARY_OBJECT)
+    {
+        return version_splice(a, v->type, members, members_sz, at - 1, 2, NULL, 0);
+    }
+    else if (last && op == EDIT_UNSET)
+    {
+        return version_splice(a, v->type, members, members_sz, at, 1, NULL, 0);
+    }
+
+    treadstone_version* child = version_edit(members[at], p, i + 1, op, value, value_sz);
+
+    if (!child)
+    {
+        version_release_members(a, members, members_sz);
+        return NULL;
+    }
+
+    return version_splice(a, v->type, members, members_sz, at, 1, &child, 1);
+}
+
+END_TREADSTONE_NAMESPACE
+
+static treadstone_version*
+version_edit(const treadstone_version* v, const char* p, treadstone::edit_t op,
+             const unsigned char* value, size_t value_sz)
+{
+    try
+    {
+        treadstone::path path(p, &v->allocator);
+
+        if (!path.is_valid())
+        {
+            errno = EINVAL;
+            return NULL;
+        }
+
+        if (path.depth() >= treadstone::max_depth())
+        {
+            errno = EOVERFLOW;
+            return NULL;
+        }
+
+        // members are taken by reference, and the edit never changes v
+        return treadstone::version_edit(const_cast<treadstone_version*>(v),
+                                        path, 0, op, value, value_sz);
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+}
+
+TREADSTONE_API struct treadstone_version*
+treadstone_version_create(const unsigned char* binary, size_t binary_sz)
+{
+    return treadstone_version_create_alloc(NULL, binary, binary_sz);
+}
+
+TREADSTONE_API struct treadstone_version*
+treadstone_version_create_alloc(const struct treadstone_allocator* a,
+                                const unsigned char* binary, size_t binary_sz)
+{
+    if (!treadstone::binary_valid(binary, binary_sz))
+    {
+        return NULL;
+    }
+
+    return treadstone::version_copy(treadstone::allocator_or_default(a), binary, binary_sz);
+}
+
+TREADSTONE_API void
+treadstone_version_retain(struct treadstone_version* v)
+{
+    v->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+TREADSTONE_API void
+treadstone_version_release(struct treadstone_version* v)
+{
+    if (v)
+    {
+        treadstone::version_release(v);
+    }
+}
+
+TREADSTONE_API size_t
+treadstone_version_size(const struct treadstone_version* v)
+{
+    return v->size;
+}
+
+TREADSTONE_API int
+treadstone_version_output(const struct treadstone_version* v,
+                          unsigned char** binary, size_t* binary_sz)
+{
+    *binary = reinterpret_cast<unsigned char*>(treadstone::allocate(&v->allocator, v->size));
+
+    if (!*binary)
+    {
+        return -1;
+    }
+
+    *binary_sz = treadstone::version_write(v, *binary) - *binary;
+    return 0;
+}
+
+TREADSTONE_API int
+treadstone_version_extract_value(const struct treadstone_version* v,
+                                 const char* p,
+                                 unsigned char** value, size_t* value_sz)
+{
+    try
+    {
+        treadstone::path path(p, &v->allocator);
+
+        if (!path.is_valid())
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        const unsigned char* start = NULL;
+        const unsigned char* limit = NULL;
+
+        // through the edited containers, then the bytes of the leaf below
+        for (size_t i = 0; i < path.depth(); ++i)
+        {
+            if (!start && !v->leaf())
+            {
+                treadstone::version_ref ref;
+
+                if (!treadstone::version_find(v->type, v->children, v->children_sz, path.get(i), &ref))
+                {
+                    errno = ENOENT;
+                    return -1;
+                }
+
+                // a member still inside a run is read from its bytes
+                if (ref.start)
+                {
+                    start = ref.start;
+                    limit = ref.limit;
+                }
+                else
+                {
+                    v = v->children[ref.child];
+                }
+
+                continue;
+            }
+
+            if (!start)
+            {
+                start = v->data;
+                limit = v->data + v->size;
+            }
+
+            if (!treadstone::leaf_find(&start, &limit, path.get(i)))
+            {
+                errno = ENOENT;
+                return -1;
+            }
+        }
+
+        if (!start)
+        {
+            return treadstone_version_output(v, value, value_sz);
+        }
+
+        *value_sz = limit - start;
+        *value = reinterpret_cast<unsigned char*>(treadstone::allocate(&v->allocator, *value_sz));
+
+        if (!*value)
+        {
+            return -1;
+        }
+
+        memmove(*value, start, *value_sz);
+        return 0;
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+}
+
+TREADSTONE_API struct treadstone_version*
+treadstone_version_unset_value(const struct treadstone_version* v,
+                               const char* path)
+{
+    return version_edit(v, path, treadstone::EDIT_UNSET, NULL, 0);
+}
+
+TREADSTONE_API struct treadstone_version*
+treadstone_version_set_value(const struct treadstone_version* v,
+                             const char* path,
+                             const unsigned char* value, size_t value_sz)
+{
+    return version_edit(v, path, treadstone::EDIT_SET, value, value_sz);
+}
+
+TREADSTONE_API struct treadstone_version*
+treadstone_version_array_prepend_value(const struct treadstone_version* v,
+                                       const char* path,
+                                       const unsigned char* value, size_t value_sz)
+{
+    return version_edit(v, path, treadstone::EDIT_PREPEND, value, value_sz);
+}
+
+TREADSTONE_API struct treadstone_version*
+treadstone_version_array_append_value(const struct treadstone_version* v,
+                                      const char* path,
+                                      const unsigned char* value, size_t value_sz)
+{
+    return version_edit(v, path, treadstone::EDIT_APPEND, value, value_sz);
+}
@@ -29,16 +29,21 @@
 #include <assert.h>
 #include <ctype.h>
 #include <inttypes.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 // POSIX
 #include <errno.h>
+#include <unistd.h>
 
 // STL
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <memory>
+#include <new>
 #include <string>
 #include <vector>
 
@@ -52,10 +57,53 @@
 #include <treadstone.h>
 #include "namespace.h"
 #include "visibility.h"
+#include "treadstone-allocator.h"
+#include "treadstone-index.h"
+#include "treadstone-internal.h"
+#include "treadstone-path.h"
+#include "treadstone-stack.h"
+#include "treadstone-stats.h"
+#include "treadstone-trace.h"
+#include "treadstone-string.h"
 #include "treadstone-types.h"
+#include "treadstone-varint.h"
 
 BEGIN_TREADSTONE_NAMESPACE
 
+static void*
+default_alloc(void*, size_t sz)
+{
+    return malloc(sz);
+}
+
+static void*
+default_realloc(void*, void* ptr, size_t, size_t new_sz)
+{
+    return realloc(ptr, new_sz);
+}
+
+static void
+default_free(void*, void* ptr, size_t)
+{
+    free(ptr);
+}
+
+const treadstone_allocator default_allocator = {default_alloc, default_realloc, default_free, NULL};
+
+static std::atomic<unsigned> max_depth_setting(TREADSTONE_DEFAULT_MAX_DEPTH);
+
+size_t
+max_depth()
+{
+    return max_depth_setting.load(std::memory_order_relaxed);
+}
+
+bool
+same_double(double x, double y)
+{
+    return !(x < y) && !(x > y);
+}
+
 void
 j2b_skip_whitespace(const char** ptr, const char* limit)
 {
@@ -74,7 +122,8 @@ bool
 j2b_make_room_for(size_t room,
                   unsigned char** binary,
                   size_t* binary_sz,
-                  size_t* binary_cap)
+                  size_t* binary_cap,
+                  const treadstone_allocator* a)
 {
     if (*binary_sz + room <= *binary_cap)
     {
@@ -82,121 +131,32 @@ j2b_make_room_for(size_t room,
     }
 
     size_t new_cap = *binary_cap + ((*binary_cap) >> 2) + room;
-    unsigned char* tmp = reinterpret_cast<unsigned char*>(realloc(*binary, new_cap));
+    void* tmp = reallocate(a, *binary, *binary_cap, new_cap);
+    stat_add(STAT_REALLOCS, 1);
 
     if (!tmp)
     {
         return false;
     }
 
-    *binary = tmp;
+    *binary = reinterpret_cast<unsigned char*>(tmp);
     *binary_cap = new_cap;
     return true;
 }
 
-bool
-j2b_transform(const char** ptr, const char* limit,
-              unsigned char** binary, size_t* binary_sz, size_t* binary_cap);
-bool
-j2b_value(const char** ptr, const char* limit,
-          unsigned char** binary, size_t* binary_sz, size_t* binary_cap);
-bool
-j2b_object(const char** ptr, const char* limit,
-           unsigned char** binary, size_t* binary_sz, size_t* binary_cap);
-bool
-j2b_array(const char** ptr, const char* limit,
-          unsigned char** binary, size_t* binary_sz, size_t* binary_cap);
-bool
-j2b_string(const char** ptr, const char* limit,
-           unsigned char** binary, size_t* binary_sz, size_t* binary_cap);
-bool
-j2b_number(const char** ptr, const char* limit,
-           unsigned char** binary, size_t* binary_sz, size_t* binary_cap);
-bool
-j2b_true(const char** ptr, const char* limit,
-         unsigned char** binary, size_t* binary_sz, size_t* binary_cap);
-bool
-j2b_false(const char** ptr, const char* limit,
-          unsigned char** binary, size_t* binary_sz, size_t* binary_cap);
-bool
-j2b_null(const char** ptr, const char* limit,
-         unsigned char** binary, size_t* binary_sz, size_t* binary_cap);
-
 // TODO use constexpr to calculate during compile time
 const unsigned char empty_object[2] = { BINARY_OBJECT, 0 };
 
-bool
-j2b_transform(const char** ptr, const char* limit,
-              unsigned char** binary, size_t* binary_sz, size_t* binary_cap)
-{
-    assert(*limit == '\0');
-    j2b_skip_whitespace(ptr, limit);
-
-    if (!j2b_value(ptr, limit, binary, binary_sz, binary_cap))
-    {
-        return false;
-    }
-
-    j2b_skip_whitespace(ptr, limit);
-    return *ptr == limit;
-}
-
-bool
-j2b_value(const char** ptr, const char* limit,
-            unsigned char** binary, size_t* binary_sz, size_t* binary_cap)
-{
-    assert(*ptr < limit);
-    j2b_skip_whitespace(ptr, limit);
-
-    if (*ptr >= limit)
-    {
-        return false;
-    }
-
-    switch (**ptr)
-    {
-        case '{':
-            return j2b_object(ptr, limit, binary, binary_sz, binary_cap);
-        case '[':
-            return j2b_array(ptr, limit, binary, binary_sz, binary_cap);
-        case '"':
-            return j2b_string(ptr, limit, binary, binary_sz, binary_cap);
-        case '+':
-        case '-':
-        case '.':
-        case '0':
-        case '1':
-        case '2':
-        case '3':
-        case '4':
-        case '5':
-        case '6':
-        case '7':
-        case '8':
-        case '9':
-        case 'e':
-        case 'E':
-            return j2b_number(ptr, limit, binary, binary_sz, binary_cap);
-        case 't':
-            return j2b_true(ptr, limit, binary, binary_sz, binary_cap);
-        case 'f':
-            return j2b_false(ptr, limit, binary, binary_sz, binary_cap);
-        case 'n':
-            return j2b_null(ptr, limit, binary, binary_sz, binary_cap);
-        default:
-            return false;
-    }
-}
-
 bool
 j2b_prepend_header(unsigned char type, size_t starting_sz,
-                   unsigned char** binary, size_t* binary_sz, size_t* binary_cap)
+                   unsigned char** binary, size_t* binary_sz, size_t* binary_cap,
+                   const treadstone_allocator* a)
 {
     assert(starting_sz <= *binary_sz);
     uint64_t bytes = *binary_sz - starting_sz;
     size_t diff = 1 + e::varint_length(bytes);
 
-    if (!j2b_make_room_for(diff, binary, binary_sz, binary_cap))
+    if (!j2b_make_room_for(diff, binary, binary_sz, binary_cap, a))
     {
         return false;
     }
@@ -210,172 +170,104 @@ j2b_prepend_header(unsigned char type, size_t starting_sz,
 }
 
 bool
-j2b_object(const char** ptr, const char* limit,
-           unsigned char** binary, size_t* binary_sz, size_t* binary_cap)
+j2b_string(const char** ptr, const char* limit,
+           unsigned char** binary, size_t* binary_sz, size_t* binary_cap,
+           const treadstone_allocator* a)
 {
     assert(*ptr < limit);
-    assert(**ptr == '{');
-    ++*ptr;
-    bool first = true;
-    size_t start = *binary_sz;
+    assert(**ptr == '"');
+    const char* start = *ptr + 1;
+    const char* end = json_string_end(start, limit);
 
-    while (*ptr < limit)
+    if (!end)
     {
-        j2b_skip_whitespace(ptr, limit);
-
-        if (*ptr < limit && **ptr == '}')
-        {
-            ++*ptr;
-            return j2b_prepend_header(BINARY_OBJECT, start, binary, binary_sz, binary_cap);
-        }
-
-        if (!first)
-        {
-            if (*ptr >= limit || **ptr != ',')
-            {
-                return false;
-            }
-
-            ++*ptr;
-        }
+        return false;
+    }
 
-        first = false;
-        j2b_skip_whitespace(ptr, limit);
+    // decoding never lengthens the string, so reserve for the escaped form
+    // and shift the body down in the rare case its header shrinks
+    uint64_t bytes = end - start;
+    size_t header_sz = 1 + e::varint_length(bytes);
 
-        if (*ptr >= limit || **ptr != '"' ||
-            !j2b_string(ptr, limit, binary, binary_sz, binary_cap))
-        {
-            return false;
-        }
+    if (!j2b_make_room_for(header_sz + bytes, binary, binary_sz, binary_cap, a))
+    {
+        return false;
+    }
 
-        j2b_skip_whitespace(ptr, limit);
+    unsigned char* tmp = *binary + *binary_sz;
+    size_t decoded = 0;
 
-        if (*ptr >= limit || **ptr != ':')
-        {
-            return false;
-        }
+    if (!json_string_decode(reinterpret_cast<const unsigned char*>(start), bytes,
+                            tmp + header_sz, &decoded))
+    {
+        return false;
+    }
 
-        ++*ptr;
-        j2b_skip_whitespace(ptr, limit);
+    size_t decoded_header_sz = 1 + e::varint_length(decoded);
 
-        if (!j2b_value(ptr, limit, binary, binary_sz, binary_cap))
-        {
-            return false;
-        }
+    if (decoded_header_sz < header_sz)
+    {
+        memmove(tmp + decoded_header_sz, tmp + header_sz, decoded);
     }
 
-    return false;
+    tmp = e::pack8be(BINARY_STRING, tmp);
+    tmp = e::packvarint64(decoded, tmp);
+    *binary_sz += decoded_header_sz + decoded;
+    *ptr = end + 1;
+    return true;
 }
 
-bool
-j2b_array(const char** ptr, const char* limit,
-          unsigned char** binary, size_t* binary_sz, size_t* binary_cap)
+// type byte plus the longest varint
+static const size_t J2B_NUMBER_MAX = 11;
+// No JSON text encodes to more than this many times its length, plus one
+// number's worth: "-1," becomes eleven bytes and "1.," nine.
+static const size_t J2B_BOUND_FACTOR = 4;
+// beyond this, measure the document rather than allocate for the bound
+static const size_t J2B_BOUND_INPUT_MAX = 1 << 20;
+
+// number is NUL-terminated at end; out has room for a type byte and the
+// longest varint
+static bool
+j2b_parse_number(const char* number, const char* end, bool is_double,
+                 unsigned char* out, size_t* out_sz)
 {
-    assert(*ptr < limit);
-    assert(**ptr == '[');
-    ++*ptr;
-    bool first = true;
-    size_t start = *binary_sz;
+    unsigned char* ptr = out;
+    char* e = NULL;
 
-    while (*ptr < limit)
+    if (is_double)
     {
-        j2b_skip_whitespace(ptr, limit);
-
-        if (*ptr < limit && **ptr == ']')
-        {
-            ++*ptr;
-            return j2b_prepend_header(BINARY_ARRAY, start, binary, binary_sz, binary_cap);
-        }
-
-        if (!first)
-        {
-            if (*ptr >= limit || **ptr != ',')
-            {
-                return false;
-            }
+        double x = strtod(number, &e);
 
-            ++*ptr;
-        }
-
-        first = false;
-        j2b_skip_whitespace(ptr, limit);
-
-        if (!j2b_value(ptr, limit, binary, binary_sz, binary_cap))
+        if (e != end)
         {
             return false;
         }
-    }
-
-    return false;
-}
-
-bool
-j2b_string(const char** ptr, const char* limit,
-           unsigned char** binary, size_t* binary_sz, size_t* binary_cap)
-{
-    assert(*ptr < limit);
-    assert(**ptr == '"');
-    ++*ptr;
-    const char* start = *ptr;
 
-    while (*ptr < limit)
+        ptr = e::pack8be(BINARY_DOUBLE, ptr);
+        ptr = e::packdoublebe(x, ptr);
+    }
+    else
     {
-        if (**ptr == '\\')
-        {
-            if (*ptr + 1 >= limit)
-            {
-                return false;
-            }
-
-            if ((*ptr)[1] == 'u')
-            {
-                if (*ptr + 6 >= limit)
-                {
-                    return false;
-                }
+        long long int x = strtoll(number, &e, 10);
 
-                *ptr += 6;
-            }
-            else
-            {
-                *ptr += 2;
-            }
-        }
-        else if (**ptr == '"')
-        {
-            break;
-        }
-        else
+        if (e != end)
         {
-            ++*ptr;
+            return false;
         }
-    }
-
-    if (*ptr >= limit)
-    {
-        return false;
-    }
-
-    uint64_t bytes = *ptr - start;
-    uint64_t diff = 1 + e::varint_length(bytes) + bytes;
 
-    if (!j2b_make_room_for(diff, binary, binary_sz, binary_cap))
-    {
-        return false;
+        ptr = e::pack8be(BINARY_INTEGER, ptr);
+        ptr = e::packvarint64(x, ptr);
     }
 
-    unsigned char* tmp = *binary + *binary_sz;
-    tmp = e::pack8be(BINARY_STRING, tmp);
-    tmp = e::packvarint64(bytes, tmp);
-    memmove(tmp, start, bytes);
-    *binary_sz += diff;
-    ++*ptr;
+    *out_sz = ptr - out;
     return true;
 }
 
-bool
-j2b_number(const char** start, const char* limit,
-           unsigned char** binary, size_t* binary_sz, size_t* binary_cap)
+// encode the number at *start into out, which needs J2B_NUMBER_MAX bytes
+static bool
+j2b_encode_number(const char** start, const char* limit,
+                  unsigned char* out, size_t* out_sz,
+                  const treadstone_allocator* a)
 {
     const char* tmp = *start;
     const char* end = tmp;
@@ -406,51 +298,58 @@ j2b_number(const char** start, const char* limit,
     assert(tmp < end);
     assert(type == INTEGER || type == DOUBLE);
 
-    if (!j2b_make_room_for(10, binary, binary_sz, binary_cap))
+    // strtoll and strtod stop only at a byte they reject, which need not come
+    // before limit, so parse a terminated copy of the number
+    const size_t number_sz = end - tmp;
+    char small[64];
+    char* copy = small;
+
+    if (number_sz >= sizeof(small) &&
+        !(copy = static_cast<char*>(allocate(a, number_sz + 1))))
     {
         return false;
     }
 
-    if (type == INTEGER)
-    {
-        char* e = NULL;
-        long long int x = strtoll(tmp, &e, 10);
-
-        if (e != end)
-        {
-            return false;
-        }
+    memmove(copy, tmp, number_sz);
+    copy[number_sz] = '\0';
+    bool ret = j2b_parse_number(copy, copy + number_sz, type == DOUBLE,
+                                out, out_sz);
 
-        unsigned char* ptr = *binary + *binary_sz;
-        ptr = e::pack8be(BINARY_INTEGER, ptr);
-        ptr = e::packvarint64(x, ptr);
-        *binary_sz += ptr - (*binary + *binary_sz);
+    if (copy != small)
+    {
+        deallocate(a, copy, number_sz + 1);
     }
 
-    if (type == DOUBLE)
+    if (ret)
     {
-        char* e = NULL;
-        double x = strtod(tmp, &e);
+        *start = end;
+    }
 
-        if (e != end)
-        {
-            return false;
-        }
+    return ret;
+}
 
-        unsigned char* ptr = *binary + *binary_sz;
-        ptr = e::pack8be(BINARY_DOUBLE, ptr);
-        ptr = e::packdoublebe(x, ptr);
-        *binary_sz += 9;
+bool
+j2b_number(const char** start, const char* limit,
+           unsigned char** binary, size_t* binary_sz, size_t* binary_cap,
+           const treadstone_allocator* a)
+{
+    size_t sz = 0;
+
+    if (!j2b_make_room_for(J2B_NUMBER_MAX, binary, binary_sz, binary_cap, a) ||
+        !j2b_encode_number(start, limit, *binary + *binary_sz, &sz, a))
+    {
+        return false;
     }
 
-    *start = end;
+    *binary_sz += sz;
     return true;
 }
 
 bool
 j2b_constant(const char** ptr, const char* limit,
              const char* constant, size_t constant_sz, unsigned char c,
-             unsigned char** binary, size_t* binary_sz, size_t* binary_cap)
+             unsigned char** binary, size_t* binary_sz, size_t* binary_cap,
+             const treadstone_allocator* a)
 {
     if (*ptr + constant_sz > limit)
     {
@@ -462,7 +361,7 @@ j2b_constant(const char** ptr, const char* limit,
         return false;
     }
 
-    if (!j2b_make_room_for(1, binary, binary_sz, binary_cap))
+    if (!j2b_make_room_for(1, binary, binary_sz, binary_cap, a))
     {
         return false;
     }
@@ -478,245 +377,541 @@ j2b_constant(const char** ptr, const char* limit,
 
 bool
 j2b_true(const char** ptr, const char* limit,
-         unsigned char** binary, size_t* binary_sz, size_t* binary_cap)
+         unsigned char** binary, size_t* binary_sz, size_t* binary_cap,
+         const treadstone_allocator* a)
 {
-    return j2b_constant(ptr, limit, "true", 4, BINARY_TRUE, binary, binary_sz, binary_cap);
+    return j2b_constant(ptr, limit, "true", 4, BINARY_TRUE, binary, binary_sz, binary_cap, a);
 }
 
 bool
 j2b_false(const char** ptr, const char* limit,
-          unsigned char** binary, size_t* binary_sz, size_t* binary_cap)
+          unsigned char** binary, size_t* binary_sz, size_t* binary_cap,
+          const treadstone_allocator* a)
 {
-    return j2b_constant(ptr, limit, "false", 5, BINARY_FALSE, binary, binary_sz, binary_cap);
+    return j2b_constant(ptr, limit, "false", 5, BINARY_FALSE, binary, binary_sz, binary_cap, a);
 }
 
 bool
 j2b_null(const char** ptr, const char* limit,
-         unsigned char** binary, size_t* binary_sz, size_t* binary_cap)
+         unsigned char** binary, size_t* binary_sz, size_t* binary_cap,
+         const treadstone_allocator* a)
 {
-    return j2b_constant(ptr, limit, "null", 4, BINARY_NULL, binary, binary_sz, binary_cap);
+    return j2b_constant(ptr, limit, "null", 4, BINARY_NULL, binary, binary_sz, binary_cap, a);
 }
 
-bool
-b2j_make_room_for(size_t room,
-                  char** json,
-                  size_t* json_sz,
-                  size_t* json_cap)
+// An open container: its type and where its body starts in the output.
+struct j2b_frame
 {
-    if (*json_sz + room <= *json_cap)
-    {
-        return true;
-    }
-
-    size_t new_cap = *json_cap + ((*json_cap) >> 2) + room;
-    char* tmp = reinterpret_cast<char*>(realloc(*json, new_cap));
+    unsigned char type;
+    size_t start;
+};
 
-    if (!tmp)
+static bool
+j2b_key(const char** ptr, const char* limit,
+        unsigned char** binary, size_t* binary_sz, size_t* binary_cap,
+        const treadstone_allocator* a)
+{
+    if (*ptr >= limit || **ptr != '"' ||
+        !j2b_string(ptr, limit, binary, binary_sz, binary_cap, a))
     {
         return false;
     }
 
-    *json = tmp;
-    *json_cap = new_cap;
-    return true;
-}
+    j2b_skip_whitespace(ptr, limit);
 
-bool
-b2j_append_char(char c,
-                char** json,
-                size_t* json_sz,
-                size_t* json_cap)
-{
-    if (!b2j_make_room_for(1, json, json_sz, json_cap))
+    if (*ptr >= limit || **ptr != ':')
     {
         return false;
     }
 
-    (*json)[*json_sz] = c;
-    ++*json_sz;
+    ++*ptr;
     return true;
 }
 
+// Convert one JSON value, nested containers included, without recursing.
+// Each container is written body first and gets its header once it closes.
+//
+// When members is BINARY_ARRAY or BINARY_OBJECT, [ptr, limit) is instead the
+// comma-separated members of such a container without its brackets, and only
+// their encoded bodies are written; the caller supplies the header.
 bool
-b2j_transform(const unsigned char** ptr, const unsigned char* limit,
-              char** json, size_t* json_sz, size_t* json_cap);
-bool
-b2j_value(const unsigned char** ptr, const unsigned char* limit,
-          char** json, size_t* json_sz, size_t* json_cap);
-bool
-b2j_object(const unsigned char** ptr, const unsigned char* limit,
-           char** json, size_t* json_sz, size_t* json_cap);
-bool
-b2j_array(const unsigned char** ptr, const unsigned char* limit,
-          char** json, size_t* json_sz, size_t* json_cap);
-bool
-b2j_string(const unsigned char** ptr, const unsigned char* limit,
-           char** json, size_t* json_sz, size_t* json_cap);
-bool
-b2j_double(const unsigned char** ptr, const unsigned char* limit,
-           char** json, size_t* json_sz, size_t* json_cap);
-bool
-b2j_integer(const unsigned char** ptr, const unsigned char* limit,
-            char** json, size_t* json_sz, size_t* json_cap);
-bool
-b2j_true(const unsigned char** ptr, const unsigned char* limit,
-         char** json, size_t* json_sz, size_t* json_cap);
-bool
-b2j_false(const unsigned char** ptr, const unsigned char* limit,
-          char** json, size_t* json_sz, size_t* json_cap);
-bool
-b2j_null(const unsigned char** ptr, const unsigned char* limit,
-         char** json, size_t* json_sz, size_t* json_cap);
-
-bool
-b2j_transform(const unsigned char** ptr, const unsigned char* limit,
-              char** json, size_t* json_sz, size_t* json_cap)
+j2b_transform(const char** ptr, const char* limit, unsigned char members,
+              unsigned char** binary, size_t* binary_sz, size_t* binary_cap,
+              const treadstone_allocator* a)
 {
-    return b2j_value(ptr, limit, json, json_sz, json_cap) &&
-           *ptr == limit;
-}
+    small_stack<j2b_frame, 32> stack(a);
+    const size_t max = max_depth();
 
-bool
-b2j_value(const unsigned char** ptr, const unsigned char* limit,
-          char** json, size_t* json_sz, size_t* json_cap)
-{
-    if (*ptr >= limit)
+    if (members)
     {
-        return false;
-    }
+        j2b_frame f;
+        f.type = members;
+        f.start = *binary_sz;
 
-    switch (**ptr)
-    {
-        case BINARY_OBJECT:
-            return b2j_object(ptr, limit, json, json_sz, json_cap);
-        case BINARY_ARRAY:
-            return b2j_array(ptr, limit, json, json_sz, json_cap);
-        case BINARY_STRING:
-            return b2j_string(ptr, limit, json, json_sz, json_cap);
-        case BINARY_DOUBLE:
-            return b2j_double(ptr, limit, json, json_sz, json_cap);
-        case BINARY_INTEGER:
-            return b2j_integer(ptr, limit, json, json_sz, json_cap);
-        case BINARY_TRUE:
-            return b2j_true(ptr, limit, json, json_sz, json_cap);
-        case BINARY_FALSE:
-            return b2j_false(ptr, limit, json, json_sz, json_cap);
-        case BINARY_NULL:
-            return b2j_null(ptr, limit, json, json_sz, json_cap);
-        default:
+        if (!stack.push(f))
+        {
             return false;
-    }
-}
+        }
 
-bool
-b2j_object(const unsigned char** ptr, const unsigned char* limit,
-           char** json, size_t* json_sz, size_t* json_cap)
-{
-    if (*ptr >= limit || **ptr != BINARY_OBJECT)
-    {
-        return false;
+        j2b_skip_whitespace(ptr, limit);
+
+        if (members == BINARY_OBJECT &&
+            !j2b_key(ptr, limit, binary, binary_sz, binary_cap, a))
+        {
+            return false;
+        }
     }
 
-    uint64_t sz;
-    const unsigned char* end = e::varint64_decode(*ptr + 1, limit, &sz);
+    while (true)
+    {
+        j2b_skip_whitespace(ptr, limit);
+
+        if (*ptr >= limit)
+        {
+            return false;
+        }
+
+        bool opened = false;
+        bool ret = true;
+
+        switch (**ptr)
+        {
+            case '{':
+            case '[':
+            {
+                if (stack.size() >= max)
+                {
+                    errno = EOVERFLOW;
+                    return false;
+                }
+
+                j2b_frame f;
+                f.type = **ptr == '{' ? BINARY_OBJECT : BINARY_ARRAY;
+                f.start = *binary_sz;
+                ret = stack.push(f);
+                ++*ptr;
+                opened = true;
+                break;
+            }
+            case '"':
+                ret = j2b_string(ptr, limit, binary, binary_sz, binary_cap, a);
+                break;
+            case '+':
+            case '-':
+            case '.':
+            case '0':
+            case '1':
+            case '2':
+            case '3':
+            case '4':
+            case '5':
+            case '6':
+            case '7':
+            case '8':
+            case '9':
+            case 'e':
+            case 'E':
+                ret = j2b_number(ptr, limit, binary, binary_sz, binary_cap, a);
+                break;
+            case 't':
+                ret = j2b_true(ptr, limit, binary, binary_sz, binary_cap, a);
+                break;
+            case 'f':
+                ret = j2b_false(ptr, limit, binary, binary_sz, binary_cap, a);
+                break;
+            case 'n':
+                ret = j2b_null(ptr, limit, binary, binary_sz, binary_cap, a);
+                break;
+            default:
+                return false;
+        }
+
+        if (!ret)
+        {
+            return false;
+        }
+
+        // close every container that ends here, then find the next value
+        while (true)
+        {
+            j2b_skip_whitespace(ptr, limit);
+
+            if (stack.empty())
+            {
+                return *ptr == limit;
+            }
+
+            if (members && stack.size() == 1 && *ptr == limit)
+            {
+                return true;
+            }
+
+            if (*ptr >= limit)
+            {
+                return false;
+            }
+
+            const j2b_frame f = stack.top();
+            const char close = f.type == BINARY_OBJECT ? '}' : ']';
+
+            if (**ptr == close && !(members && stack.size() == 1))
+            {
+                ++*ptr;
+                stack.pop();
+                opened = false;
+
+                if (!j2b_prepend_header(f.type, f.start, binary, binary_sz, binary_cap, a))
+                {
+                    return false;
+                }
+
+                continue;
+            }
+
+            if (!opened)
+            {
+                if (**ptr != ',')
+                {
+                    return false;
+                }
+
+                ++*ptr;
+                j2b_skip_whitespace(ptr, limit);
+            }
+
+            if (f.type == BINARY_OBJECT &&
+                !j2b_key(ptr, limit, binary, binary_sz, binary_cap, a))
+            {
+                return false;
+            }
+
+            break;
+        }
+    }
+}
+
+// An open container while measuring: its type and the size of its body.
+struct j2b_length_frame
+{
+    unsigned char type;
+    uint64_t body;
+};
+
+// j2b_string reserves room for the escaped form, so raise *reserve to cover it
+static bool
+j2b_string_length(const char** ptr, const char* limit, uint64_t* sz, uint64_t* reserve)
+{
+    const char* start = *ptr + 1;
+    const char* end = json_string_end(start, limit);
+    size_t decoded = 0;
 
-    if (end == NULL || end + sz > limit)
+    if (!end ||
+        !json_string_decoded_length(reinterpret_cast<const unsigned char*>(start),
+                                    end - start, &decoded))
     {
         return false;
     }
 
-    *ptr = end;
-    end += sz;
+    const uint64_t escaped = end - start;
+    *sz = 1 + e::varint_length(decoded) + decoded;
+    *reserve = std::max(*reserve, 1 + e::varint_length(escaped) + escaped - *sz);
+    *ptr = end + 1;
+    return true;
+}
 
-    if (!b2j_append_char('{', json, json_sz, json_cap))
+static bool
+j2b_constant_length(const char** ptr, const char* limit,
+                    const char* constant, size_t constant_sz)
+{
+    if (*ptr + constant_sz > limit || memcmp(*ptr, constant, constant_sz) != 0)
     {
         return false;
     }
 
-    bool first = true;
+    *ptr += constant_sz;
+    return true;
+}
+
+// The size j2b_transform would produce for one JSON value, found by the same
+// walk without writing anything; only numbers are encoded, to a scratch
+// buffer, to learn their width.  j2b_transform reserves room for a number's
+// longest encoding and a string's escaped length before writing them, and
+// *slack is how far past the output that can reach.
+static bool
+j2b_length(const char* ptr, const char* limit, uint64_t* length, uint64_t* slack,
+           const treadstone_allocator* a)
+{
+    small_stack<j2b_length_frame, 32> stack(a);
+    const size_t max = max_depth();
+    uint64_t total = 0;
+    uint64_t reserve = 0;
 
-    while (*ptr < end)
+    while (true)
     {
+        j2b_skip_whitespace(&ptr, limit);
+
+        if (ptr >= limit)
+        {
+            return false;
+        }
+
+        bool opened = false;
+        bool ret = true;
+        uint64_t sz = 1;
 
-        if (!first)
+        switch (*ptr)
         {
-            if (!b2j_append_char(',', json, json_sz, json_cap))
+            case '{':
+            case '[':
             {
-                return false;
+                if (stack.size() >= max)
+                {
+                    errno = EOVERFLOW;
+                    return false;
+                }
+
+                j2b_length_frame f;
+                f.type = *ptr == '{' ? BINARY_OBJECT : BINARY_ARRAY;
+                f.body = 0;
+                ret = stack.push(f);
+                ++ptr;
+                opened = true;
+                break;
+            }
+            case '"':
+                ret = j2b_string_length(&ptr, limit, &sz, &reserve);
+                break;
+            case '+':
+            case '-':
+            case '.':
+            case '0':
+            case '1':
+            case '2':
+            case '3':
+            case '4':
+            case '5':
+            case '6':
+            case '7':
+            case '8':
+            case '9':
+            case 'e':
+            case 'E':
+            {
+                unsigned char scratch[J2B_NUMBER_MAX];
+                size_t scratch_sz = 0;
+                ret = j2b_encode_number(&ptr, limit, scratch, &scratch_sz, a);
+                sz = scratch_sz;
+                reserve = std::max(reserve, uint64_t(J2B_NUMBER_MAX - sz));
+                break;
             }
+            case 't':
+                ret = j2b_constant_length(&ptr, limit, "true", 4);
+                break;
+            case 'f':
+                ret = j2b_constant_length(&ptr, limit, "false", 5);
+                break;
+            case 'n':
+                ret = j2b_constant_length(&ptr, limit, "null", 4);
+                break;
+            default:
+                return false;
         }
 
-        if (!b2j_string(ptr, end, json, json_sz, json_cap))
+        if (!ret)
         {
             return false;
         }
 
-        if (!b2j_append_char(':', json, json_sz, json_cap))
+        if (!opened)
         {
-            return false;
+            (stack.empty() ? total : stack.top().body) += sz;
+        }
+
+        // close every container that ends here, then find the next value
+        while (true)
+        {
+            j2b_skip_whitespace(&ptr, limit);
+
+            if (stack.empty())
+            {
+                *length = total;
+                *slack = reserve;
+                return ptr == limit;
+            }
+
+            if (ptr >= limit)
+            {
+                return false;
+            }
+
+            const j2b_length_frame f = stack.top();
+            const char close = f.type == BINARY_OBJECT ? '}' : ']';
+
+            if (*ptr == close)
+            {
+                ++ptr;
+                stack.pop();
+                opened = false;
+                sz = 1 + e::varint_length(f.body) + f.body;
+                (stack.empty() ? total : stack.top().body) += sz;
+                continue;
+            }
+
+            if (!opened)
+            {
+                if (*ptr != ',')
+                {
+                    return false;
+                }
+
+                ++ptr;
+                j2b_skip_whitespace(&ptr, limit);
+            }
+
+            if (f.type == BINARY_OBJECT)
+            {
+                if (ptr >= limit || *ptr != '"' ||
+                    !j2b_string_length(&ptr, limit, &sz, &reserve))
+                {
+                    return false;
+                }
+
+                stack.top().body += sz;
+                j2b_skip_whitespace(&ptr, limit);
+
+                if (ptr >= limit || *ptr != ':')
+                {
+                    return false;
+                }
+
+                ++ptr;
+            }
+
+            break;
         }
+    }
+}
 
-        if (!b2j_value(ptr, end, json, json_sz, json_cap))
+bool
+b2j_writer :: append(const char* data, size_t data_sz)
+{
+    if (json_sz + data_sz > json_cap)
+    {
+        if (!make_room_for(data_sz))
         {
             return false;
         }
 
-        first = false;
+        // too big to buffer; pass it straight through
+        if (data_sz > json_cap)
+        {
+            assert(sink);
+
+            if (sink(sink_ctx, data, data_sz) != 0)
+            {
+                return false;
+            }
+
+            flushed += data_sz;
+            return true;
+        }
     }
 
-    return *ptr == end && b2j_append_char('}', json, json_sz, json_cap);
+    memmove(json + json_sz, data, data_sz);
+    json_sz += data_sz;
+    return true;
 }
 
 bool
-b2j_array(const unsigned char** ptr, const unsigned char* limit,
-          char** json, size_t* json_sz, size_t* json_cap)
+b2j_writer :: append(char c)
 {
-    if (*ptr >= limit || **ptr != BINARY_ARRAY)
+    if (json_sz == json_cap && !make_room_for(1))
     {
         return false;
     }
 
-    uint64_t sz;
-    const unsigned char* end = e::varint64_decode(*ptr + 1, limit, &sz);
+    json[json_sz] = c;
+    ++json_sz;
+    return true;
+}
 
-    if (end == NULL || end + sz > limit)
+bool
+b2j_writer :: flush()
+{
+    if (!sink || json_sz == 0)
     {
-        return false;
+        return true;
     }
 
-    *ptr = end;
+    size_t sz = json_sz;
+    json_sz = 0;
+    flushed += sz;
+    return sink(sink_ctx, json, sz) == 0;
+}
+
+bool
+b2j_writer :: make_room_for(size_t room)
+{
+    if (sink)
+    {
+        return flush();
+    }
 
-    if (!b2j_append_char('[', json, json_sz, json_cap))
+    size_t new_cap = json_cap + (json_cap >> 2) + room;
+    void* tmp = reallocate(a, json, json_cap, new_cap);
+    stat_add(STAT_REALLOCS, 1);
+
+    if (!tmp)
     {
         return false;
     }
 
-    bool first = true;
+    json = reinterpret_cast<char*>(tmp);
+    json_cap = new_cap;
+    return true;
+}
+
+// a string body, quoted and escaped
+bool
+b2j_string_body(const unsigned char* str, const unsigned char* str_limit,
+                b2j_writer* w)
+{
+    if (!w->append('"'))
+    {
+        return false;
+    }
 
-    while (*ptr < end + sz)
+    while (str < str_limit)
     {
-        if (!first)
+        size_t plain = json_string_plain(str, str_limit);
+
+        if (!w->append(reinterpret_cast<const char*>(str), plain))
+        {
+            return false;
+        }
+
+        str += plain;
+
+        if (str < str_limit)
         {
-            if (!b2j_append_char(',', json, json_sz, json_cap))
+            char buf[6];
+            size_t buf_sz = json_string_escape(*str, buf);
+
+            if (!w->append(buf, buf_sz))
             {
                 return false;
             }
-        }
 
-        if (!b2j_value(ptr, end + sz, json, json_sz, json_cap))
-        {
-            return false;
+            ++str;
         }
-
-        first = false;
     }
 
-    return *ptr == end + sz && b2j_append_char(']', json, json_sz, json_cap);
+    return w->append('"');
 }
 
 bool
 b2j_string(const unsigned char** ptr, const unsigned char* limit,
-           char** json, size_t* json_sz, size_t* json_cap)
+           b2j_writer* w)
 {
     if (*ptr >= limit || **ptr != BINARY_STRING)
     {
@@ -724,31 +919,21 @@ b2j_string(const unsigned char** ptr, const unsigned char* limit,
     }
 
     uint64_t sz;
-    const unsigned char* end = e::varint64_decode(*ptr + 1, limit, &sz);
-
-    if (end == NULL || end + sz > limit)
-    {
-        return false;
-    }
+    const unsigned char* end = varint64_decode(*ptr + 1, limit, &sz);
 
-    if (!b2j_make_room_for(sz + 2, json, json_sz, json_cap))
+    if (end == NULL || sz > uint64_t(limit - end) ||
+        !b2j_string_body(end, end + sz, w))
     {
         return false;
     }
 
-    (*json)[*json_sz] = '"';
-    ++*json_sz;
-    memmove(*json + *json_sz, end, sz);
-    *json_sz += sz;
-    (*json)[*json_sz] = '"';
-    ++*json_sz;
     *ptr = end + sz;
     return true;
 }
 
 bool
 b2j_double(const unsigned char** ptr, const unsigned char* limit,
-           char** json, size_t* json_sz, size_t* json_cap)
+           b2j_writer* w)
 {
     if (*ptr + sizeof(double) >= limit || **ptr != BINARY_DOUBLE)
     {
@@ -765,20 +950,18 @@ b2j_double(const unsigned char** ptr, const unsigned char* limit,
         return false;
     }
 
-    if (!b2j_make_room_for(sz, json, json_sz, json_cap))
+    if (!w->append(buf, sz))
     {
         return false;
     }
 
-    memmove(*json + *json_sz, buf, sz);
     *ptr += sizeof(unsigned char) + sizeof(double);
-    *json_sz += sz;
     return true;
 }
 
 bool
 b2j_integer(const unsigned char** ptr, const unsigned char* limit,
-            char** json, size_t* json_sz, size_t* json_cap)
+            b2j_writer* w)
 {
     if (*ptr >= limit || **ptr != BINARY_INTEGER)
     {
@@ -786,7 +969,7 @@ b2j_integer(const unsigned char** ptr, const unsigned char* limit,
     }
 
     uint64_t unum;
-    const unsigned char* end = e::varint64_decode(*ptr + 1, limit, &unum);
+    const unsigned char* end = varint64_decode(*ptr + 1, limit, &unum);
 
     if (end == NULL)
     {
@@ -802,951 +985,2755 @@ b2j_integer(const unsigned char** ptr, const unsigned char* limit,
         return false;
     }
 
-    if (!b2j_make_room_for(sz, json, json_sz, json_cap))
+    if (!w->append(buf, sz))
     {
         return false;
     }
 
-    memmove(*json + *json_sz, buf, sz);
     *ptr = end;
-    *json_sz += sz;
     return true;
 }
 
 bool
 b2j_constant(const unsigned char** ptr, const unsigned char* limit,
              const char* constant, size_t constant_sz, unsigned char c,
-             char** json, size_t* json_sz, size_t* json_cap)
+             b2j_writer* w)
 {
     if (*ptr >= limit || **ptr != c)
     {
         return false;
     }
 
-    if (!b2j_make_room_for(constant_sz, json, json_sz, json_cap))
+    if (!w->append(constant, constant_sz))
     {
         return false;
     }
 
-    memmove(*json + *json_sz, constant, constant_sz);
-    *json_sz += constant_sz;
     ++*ptr;
     return true;
 }
 
 bool
 b2j_true(const unsigned char** ptr, const unsigned char* limit,
-         char** json, size_t* json_sz, size_t* json_cap)
+         b2j_writer* w)
 {
-    return b2j_constant(ptr, limit, "true", 4, BINARY_TRUE, json, json_sz, json_cap);
+    return b2j_constant(ptr, limit, "true", 4, BINARY_TRUE, w);
 }
 
 bool
 b2j_false(const unsigned char** ptr, const unsigned char* limit,
-          char** json, size_t* json_sz, size_t* json_cap)
+          b2j_writer* w)
 {
-    return b2j_constant(ptr, limit, "false", 5, BINARY_FALSE, json, json_sz, json_cap);
+    return b2j_constant(ptr, limit, "false", 5, BINARY_FALSE, w);
 }
 
 bool
 b2j_null(const unsigned char** ptr, const unsigned char* limit,
-         char** json, size_t* json_sz, size_t* json_cap)
+         b2j_writer* w)
 {
-    return b2j_constant(ptr, limit, "null", 4, BINARY_NULL, json, json_sz, json_cap);
+    return b2j_constant(ptr, limit, "null", 4, BINARY_NULL, w);
 }
 
-void
-free_if_allocated_unsigned_char_star(unsigned char** x)
+// An open container: the limit of its parent, the character that closes it,
+// and whether a member has been written yet.
+struct b2j_frame
 {
-    if (*x)
-    {
-        free(*x);
-    }
-}
+    const unsigned char* limit;
+    char close;
+    bool first;
+};
 
-void
-free_if_allocated_char_star(char** x)
+// Convert one binary value, nested containers included, without recursing.
+bool
+b2j_transform(const unsigned char** ptr, const unsigned char* limit,
+              b2j_writer* w)
 {
-    if (*x)
-    {
-        free(*x);
-    }
-}
+    small_stack<b2j_frame, 32> stack(allocator_or_default(w->a));
+    const size_t max = max_depth();
+    // limit of the innermost open container
+    const unsigned char* end = limit;
 
-struct path
-{
-    enum component_t { FIELD, INDEX };
-    struct component
+    do
     {
-        component();
-        component(const std::string& f) : type(FIELD), field(f), index() {}
-        component(int i) : type(INDEX), field(), index(i) {}
+        if (!stack.empty())
+        {
+            b2j_frame& f(stack.top());
 
-        component_t type;
-        std::string field;
-        int index;
-    };
+            if (!f.first && !w->append(','))
+            {
+                return false;
+            }
 
-    path(const char* p);
+            f.first = false;
 
-    bool is_valid() const { return m_valid; }
-    size_t depth() const { return m_components.size(); }
-    const component& get(size_t i) const { return m_components[i]; }
+            if (f.close == '}' &&
+                (!b2j_string(ptr, end, w) || !w->append(':')))
+            {
+                return false;
+            }
+        }
 
-    const component& head() const { return m_components[0]; }
-    const component& back() const { return m_components[depth()-1]; }
+        if (*ptr >= end)
+        {
+            return false;
+        }
 
-    // Get whole path w/o back
-    path front() const;
+        bool ret = false;
 
-    // Get whole path w/o head
-    path tail() const;
+        switch (**ptr)
+        {
+            case BINARY_OBJECT:
+            case BINARY_ARRAY:
+            {
+                uint64_t sz;
+                const unsigned char* body = varint64_decode(*ptr + 1, end, &sz);
 
-    private:
-        path() : m_valid(true), m_components() {}
+                if (body == NULL || sz > uint64_t(end - body))
+                {
+                    return false;
+                }
 
-        void parse(const char* p);
-        friend std::ostream& operator << (std::ostream& lhs, const path& p);
+                if (stack.size() >= max)
+                {
+                    errno = EOVERFLOW;
+                    return false;
+                }
 
-        bool m_valid;
-        std::vector<component> m_components;
-};
+                b2j_frame f;
+                f.limit = end;
+                f.close = **ptr == BINARY_OBJECT ? '}' : ']';
+                f.first = true;
+                ret = stack.push(f) && w->append(**ptr == BINARY_OBJECT ? '{' : '[');
+                *ptr = body;
+                end = body + sz;
+                break;
+            }
+            case BINARY_STRING:
+                ret = b2j_string(ptr, end, w);
+                break;
+            case BINARY_DOUBLE:
+                ret = b2j_double(ptr, end, w);
+                break;
+            case BINARY_INTEGER:
+                ret = b2j_integer(ptr, end, w);
+                break;
+            case BINARY_TRUE:
+                ret = b2j_true(ptr, end, w);
+                break;
+            case BINARY_FALSE:
+                ret = b2j_false(ptr, end, w);
+                break;
+            case BINARY_NULL:
+                ret = b2j_null(ptr, end, w);
+                break;
+            default:
+                return false;
+        }
 
-path
-path::front() const
-{
-    path p;
+        if (!ret)
+        {
+            return false;
+        }
 
-    for(uint32_t i = 0; i < depth() - 1; ++i)
-    {
-        p.m_components.push_back(m_components[i]);
-    }
+        while (*ptr == end && !stack.empty())
+        {
+            if (!w->append(stack.top().close))
+            {
+                return false;
+            }
 
-    return p;
-}
+            end = stack.top().limit;
+            stack.pop();
+        }
+    } while (!stack.empty());
 
-path
-path::tail() const
+    return *ptr == limit;
+}
+
+// the longest "%g" of a double, as in "-1.23457e+308"
+static const size_t B2J_DOUBLE_MAX = 13;
+
+static uint64_t
+b2j_string_length(const unsigned char* str, const unsigned char* limit)
 {
-    path p;
+    uint64_t length = 2;
 
-    for(uint32_t i = 1; i < depth(); ++i)
+    while (str < limit)
     {
-        p.m_components.push_back(m_components[i]);
+        size_t plain = json_string_plain(str, limit);
+        length += plain;
+        str += plain;
+
+        if (str < limit)
+        {
+            char buf[6];
+            length += json_string_escape(*str, buf);
+            ++str;
+        }
     }
 
-    return p;
+    return length;
 }
 
-std::ostream&
-operator << (std::ostream& lhs, const path& p)
+static uint64_t
+b2j_integer_length(int64_t num)
 {
-    if (!p.m_valid)
+    uint64_t length = num < 0 ? 2 : 1;
+    // negate as unsigned so that INT64_MIN has a magnitude
+    uint64_t x = num < 0 ? -static_cast<uint64_t>(num) : num;
+
+    while (x >= 10)
     {
-        return lhs << "<invalid path>";
+        x /= 10;
+        ++length;
     }
 
-    for (size_t i = 0; i < p.m_components.size(); ++i)
+    return length;
+}
+
+struct b2j_length_frame
+{
+    const unsigned char* limit;
+    bool object;
+    bool first;
+};
+
+// The length of the JSON b2j_transform would write, checking the binary as
+// it goes.  Unless exact, each double counts as the longest it could print,
+// which spares formatting it and still bounds the output.
+bool
+b2j_length(const unsigned char* ptr, const unsigned char* limit, bool exact,
+           uint64_t* length, const treadstone_allocator* a)
+{
+    small_stack<b2j_length_frame, 32> stack(a);
+    const size_t max = max_depth();
+    const unsigned char* end = limit;
+    uint64_t total = 0;
+    uint64_t sz;
+
+    do
     {
-        if (i > 0)
+        if (!stack.empty())
         {
-            lhs << ", ";
+            b2j_length_frame& f(stack.top());
+            total += f.first ? 0 : 1;
+            f.first = false;
+
+            if (f.object)
+            {
+                const unsigned char* key = ptr < end && *ptr == BINARY_STRING
+                                         ? varint64_decode(ptr + 1, end, &sz) : NULL;
+
+                if (key == NULL || sz > uint64_t(end - key))
+                {
+                    return false;
+                }
+
+                total += b2j_string_length(key, key + sz) + 1;
+                ptr = key + sz;
+            }
         }
 
-        switch (p.m_components[i].type)
+        if (ptr >= end)
         {
-            case path::FIELD:
-                lhs << "FIELD:" << p.m_components[i].field;
+            return false;
+        }
+
+        switch (*ptr)
+        {
+            case BINARY_OBJECT:
+            case BINARY_ARRAY:
+            {
+                const unsigned char* body = varint64_decode(ptr + 1, end, &sz);
+
+                if (body == NULL || sz > uint64_t(end - body))
+                {
+                    return false;
+                }
+
+                if (stack.size() >= max)
+                {
+                    errno = EOVERFLOW;
+                    return false;
+                }
+
+                b2j_length_frame f = {end, *ptr == BINARY_OBJECT, true};
+
+                if (!stack.push(f))
+                {
+                    return false;
+                }
+
+                total += 2;
+                ptr = body;
+                end = body + sz;
                 break;
-            case path::INDEX:
-                lhs << "INDEX:" << p.m_components[i].index;
+            }
+            case BINARY_STRING:
+            {
+                const unsigned char* str = varint64_decode(ptr + 1, end, &sz);
+
+                if (str == NULL || sz > uint64_t(end - str))
+                {
+                    return false;
+                }
+
+                total += b2j_string_length(str, str + sz);
+                ptr = str + sz;
                 break;
-            default:
-                lhs << "<bad component>";
+            }
+            case BINARY_DOUBLE:
+            {
+                if (ptr + sizeof(double) >= end)
+                {
+                    return false;
+                }
+
+                if (exact)
+                {
+                    double num;
+                    e::unpackdoublebe(ptr + 1, &num);
+                    char buf[40];
+                    int printed = snprintf(buf, 40, "%g", num);
+
+                    if (printed >= 40 || printed <= 0)
+                    {
+                        return false;
+                    }
+
+                    total += printed;
+                }
+                else
+                {
+                    total += B2J_DOUBLE_MAX;
+                }
+
+                ptr += sizeof(unsigned char) + sizeof(double);
+                break;
+            }
+            case BINARY_INTEGER:
+                ptr = varint64_decode(ptr + 1, end, &sz);
+
+                if (ptr == NULL)
+                {
+                    return false;
+                }
+
+                total += b2j_integer_length(static_cast<int64_t>(sz));
+                break;
+            case BINARY_TRUE:
+            case BINARY_NULL:
+                total += 4;
+                ++ptr;
+                break;
+            case BINARY_FALSE:
+                total += 5;
+                ++ptr;
                 break;
+            default:
+                return false;
         }
-    }
 
-    return lhs;
-}
+        while (ptr == end && !stack.empty())
+        {
+            end = stack.top().limit;
+            stack.pop();
+        }
+    } while (!stack.empty());
 
-path :: path(const char* p)
-    : m_valid(true)
-    , m_components()
-{
-    parse(p);
+    *length = total;
+    return ptr == limit;
 }
 
-void
-path :: parse(const char* p)
+// a string body, quoted, with everything past ASCII escaped too
+static bool
+b2j_ascii_string_body(const unsigned char* str, const unsigned char* str_limit,
+                      b2j_writer* w)
 {
-    char prev = '\0';
+    if (!w->append('"'))
+    {
+        return false;
+    }
 
-    while (true)
+    while (str < str_limit)
     {
-        if (*p == '\0')
+        const unsigned char* plain = str;
+
+        while (plain < str_limit && *plain >= 0x20 && *plain < 0x80 &&
+               *plain != '"' && *plain != '\\')
         {
-            break;
+            ++plain;
         }
 
-        if (*p == '[')
+        if (!w->append(reinterpret_cast<const char*>(str), plain - str))
         {
-            if (prev != '\0' && prev != 'I' && prev != 'F')
-            {
-                m_valid = false;
-                return;
-            }
+            return false;
+        }
 
-            char* end = NULL;
-            long int x = strtol(p + 1, &end, 0);
+        str = plain;
 
-            if (p + 1 >= end || *end != ']')
-            {
-                m_valid = false;
-                return;
-            }
+        if (str >= str_limit)
+        {
+            break;
+        }
 
-            m_components.push_back(component(x));
-            assert(*end == ']');
-            ++end;
-            p = end;
-            prev = 'I';
+        char buf[12];
+        size_t buf_sz = 0;
+
+        if (*str < 0x80)
+        {
+            buf_sz = json_string_escape(*str, buf);
+            ++str;
         }
-        else if (*p == '.')
+        else
         {
-            if (prev != 'I' && prev != 'F')
+            size_t used = json_string_escape_utf8(str, str_limit, buf, &buf_sz);
+
+            if (used == 0)
             {
-                m_valid = false;
-                return;
+                return false;
             }
 
-            ++p;
-            prev = '.';
+            str += used;
         }
-        else
+
+        if (!w->append(buf, buf_sz))
         {
-            if (prev != '\0' && prev != '.')
-            {
-                m_valid = false;
-                return;
-            }
+            return false;
+        }
+    }
 
-            const char* end = p;
+    return w->append('"');
+}
 
-            while (*end != '[' && *end != ']' &&
-                   *end != '.' && *end != '\0')
-            {
-                ++end;
-            }
+// Print num per the policy into buf, which holds 40 bytes.
+static int
+b2j_format_double(double num, treadstone_number_format numbers, char* buf)
+{
+    if (numbers != TREADSTONE_NUMBERS_ROUNDTRIP)
+    {
+        return snprintf(buf, 40, "%g", num);
+    }
 
-            if (*end != '[' && *end != '.' && *end != '\0')
-            {
-                m_valid = false;
-                return;
-            }
+    int sz = 0;
 
-            m_components.push_back(component(std::string(p, end)));
-            p = end;
-            prev = 'F';
+    // the fewest digits that read back as the same double
+    for (int precision = 15; precision <= 17; ++precision)
+    {
+        sz = snprintf(buf, 40, "%.*g", precision, num);
+
+        if (sz <= 0 || sz >= 40 || same_double(strtod(buf, NULL), num))
+        {
+            break;
         }
     }
+
+    // keep it a double when it is read back
+    if (sz > 0 && sz + 2 < 40 && isfinite(num) && !strpbrk(buf, ".e"))
+    {
+        buf[sz++] = '.';
+        buf[sz++] = '0';
+        buf[sz] = '\0';
+    }
+
+    return sz;
 }
 
-END_TREADSTONE_NAMESPACE
+const unsigned char*
+b2j_value_end(const unsigned char* ptr, const unsigned char* limit)
+{
+    uint64_t sz;
 
-TREADSTONE_API int
-treadstone_json_to_binary(const char* json,
-                          unsigned char** binary, size_t* binary_sz)
+    if (ptr >= limit)
+    {
+        return NULL;
+    }
+
+    switch (*ptr)
+    {
+        case BINARY_OBJECT:
+        case BINARY_ARRAY:
+        case BINARY_STRING:
+        {
+            const unsigned char* body = varint64_decode(ptr + 1, limit, &sz);
+            return body && sz <= uint64_t(limit - body) ? body + sz : NULL;
+        }
+        case BINARY_DOUBLE:
+            return limit - ptr > static_cast<ptrdiff_t>(sizeof(double))
+                 ? ptr + sizeof(unsigned char) + sizeof(double) : NULL;
+        case BINARY_INTEGER:
+            return varint64_decode(ptr + 1, limit, &sz);
+        case BINARY_TRUE:
+        case BINARY_FALSE:
+        case BINARY_NULL:
+            return ptr + 1;
+        default:
+            return NULL;
+    }
+}
+
+// One member of an object, for sorting by key without moving values.
+struct b2j_member
 {
-    size_t json_sz = json ? strlen(json) : 0;
-    return treadstone_json_sz_to_binary(json, json_sz, binary, binary_sz);
+    const unsigned char* key;
+    size_t key_sz;
+    const unsigned char* value;
+    const unsigned char* value_end;
+};
+
+static bool
+b2j_member_less(const b2j_member& lhs, const b2j_member& rhs)
+{
+    int cmp = memcmp(lhs.key, rhs.key, std::min(lhs.key_sz, rhs.key_sz));
+    return cmp < 0 || (cmp == 0 && lhs.key_sz < rhs.key_sz);
 }
 
-TREADSTONE_API int
-treadstone_json_sz_to_binary(const char* json, size_t json_sz,
-                             unsigned char** binary, size_t* binary_sz)
+typedef std::vector<b2j_member, stl_allocator<b2j_member> > b2j_member_vector;
+
+// An open container.  Members come either straight from the body, from next
+// up to end, or, for a sorted object, from [member, members_end) of the
+// shared member vector.
+struct b2j_options_frame
 {
-    // Invalid JSON
-    if (json == NULL || strcmp(json, "") == 0)
+    const unsigned char* next;
+    const unsigned char* end;
+    size_t members_begin;
+    size_t member;
+    size_t members_end;
+    bool object;
+    bool sorted;
+    bool first;
+};
+
+// the key at ptr, and where its value starts, or NULL
+static const unsigned char*
+b2j_member_key(const unsigned char* ptr, const unsigned char* limit,
+               const unsigned char** key, size_t* key_sz)
+{
+    uint64_t sz;
+
+    if (ptr >= limit || *ptr != BINARY_STRING ||
+        !(*key = varint64_decode(ptr + 1, limit, &sz)) ||
+        sz > uint64_t(limit - *key))
     {
-        errno = EINVAL;
-        *binary = NULL;
-        *binary_sz = 0;
-        return -1;
+        return NULL;
     }
 
-    *binary = reinterpret_cast<unsigned char*>(malloc(sizeof(unsigned char) * json_sz));
-    *binary_sz = 0;
+    *key_sz = sz;
+    return *key + sz;
+}
 
-    if (!*binary)
+class b2j_formatter
+{
+    public:
+        b2j_formatter(const treadstone_json_options* opts, b2j_writer* w)
+            : m_opts(opts), m_w(w), m_a(allocator_or_default(w->a)),
+              m_stack(m_a), m_members(stl_allocator<b2j_member>(m_a)) {}
+
+    public:
+        // may throw std::bad_alloc
+        bool format(const unsigned char* ptr, const unsigned char* limit);
+
+    private:
+        bool value(const unsigned char* ptr, const unsigned char* end);
+        bool string(const unsigned char* str, const unsigned char* str_limit);
+        bool newline(size_t depth);
+        bool close();
+
+    private:
+        const treadstone_json_options* const m_opts;
+        b2j_writer* const m_w;
+        const treadstone_allocator* const m_a;
+        small_stack<b2j_options_frame, 32> m_stack;
+        b2j_member_vector m_members;
+
+    private:
+        b2j_formatter(const b2j_formatter&);
+        b2j_formatter& operator = (const b2j_formatter&);
+};
+
+bool
+b2j_formatter :: format(const unsigned char* ptr, const unsigned char* limit)
+{
+    if (!value(ptr, limit))
     {
-        *binary = NULL;
-        *binary_sz = 0;
-        // carry errno from failed malloc
-        return -1;
+        return false;
     }
 
-    int saved = errno;
-    errno = EINVAL;
-    const char* ptr = json;
-    const char* limit = json + json_sz;
-    bool ret = treadstone::j2b_transform(&ptr, limit, binary, binary_sz, &json_sz);
+    while (!m_stack.empty())
+    {
+        b2j_options_frame& f(m_stack.top());
+        const unsigned char* key = NULL;
+        size_t key_sz = 0;
+        const unsigned char* v = NULL;
+        const unsigned char* v_end = NULL;
+
+        if (f.sorted ? f.member == f.members_end : f.next == f.end)
+        {
+            if (!close())
+            {
+                return false;
+            }
+
+            continue;
+        }
+
+        if (f.sorted)
+        {
+            const b2j_member& m(m_members[f.member]);
+            key = m.key;
+            key_sz = m.key_sz;
+            v = m.value;
+            v_end = m.value_end;
+            ++f.member;
+        }
+        else
+        {
+            v = f.next;
+
+            if (f.object && !(v = b2j_member_key(v, f.end, &key, &key_sz)))
+            {
+                return false;
+            }
+
+            if (!(v_end = b2j_value_end(v, f.end)))
+            {
+                return false;
+            }
+
+            f.next = v_end;
+        }
+
+        if (!f.first && !m_w->append(','))
+        {
+            return false;
+        }
+
+        f.first = false;
+
+        if (!newline(m_stack.size()))
+        {
+            return false;
+        }
+
+        if (f.object &&
+            (!string(key, key + key_sz) || !m_w->append(':') ||
+             (m_opts->indent > 0 && !m_w->append(' '))))
+        {
+            return false;
+        }
+
+        // may push, which invalidates f
+        if (!value(v, v_end))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// write a scalar, which must fill [ptr, end), or open a container
+bool
+b2j_formatter :: value(const unsigned char* ptr, const unsigned char* end)
+{
+    if (ptr >= end)
+    {
+        return false;
+    }
+
+    uint64_t sz;
+
+    switch (*ptr)
+    {
+        case BINARY_OBJECT:
+        case BINARY_ARRAY:
+        {
+            const unsigned char* body = varint64_decode(ptr + 1, end, &sz);
+
+            if (body == NULL || sz != uint64_t(end - body))
+            {
+                return false;
+            }
+
+            if (m_stack.size() >= max_depth())
+            {
+                errno = EOVERFLOW;
+                return false;
+            }
+
+            b2j_options_frame f;
+            f.next = body;
+            f.end = end;
+            f.members_begin = f.member = f.members_end = m_members.size();
+            f.object = *ptr == BINARY_OBJECT;
+            f.sorted = f.object && m_opts->sort_keys;
+            f.first = true;
+
+            while (f.sorted && body < end)
+            {
+                b2j_member m;
+                m.value = b2j_member_key(body, end, &m.key, &m.key_sz);
+
+                if (!m.value || !(m.value_end = b2j_value_end(m.value, end)))
+                {
+                    return false;
+                }
+
+                m_members.push_back(m);
+                body = m.value_end;
+            }
+
+            if (f.sorted)
+            {
+                f.members_end = m_members.size();
+                // equal keys keep their stored order
+                std::stable_sort(m_members.begin() + f.members_begin,
+                                 m_members.end(), b2j_member_less);
+            }
+
+            return m_stack.push(f) && m_w->append(f.object ? '{' : '[');
+        }
+        case BINARY_STRING:
+        {
+            const unsigned char* str = varint64_decode(ptr + 1, end, &sz);
+            return str && sz == uint64_t(end - str) && string(str, end);
+        }
+        case BINARY_DOUBLE:
+        {
+            if (end - ptr != 1 + sizeof(double))
+            {
+                return false;
+            }
+
+            double num;
+            e::unpackdoublebe(ptr + 1, &num);
+            char buf[40];
+            int printed = b2j_format_double(num, m_opts->numbers, buf);
+            return printed > 0 && printed < 40 && m_w->append(buf, printed);
+        }
+        case BINARY_INTEGER:
+            return b2j_integer(&ptr, end, m_w) && ptr == end;
+        case BINARY_TRUE:
+            return b2j_true(&ptr, end, m_w) && ptr == end;
+        case BINARY_FALSE:
+            return b2j_false(&ptr, end, m_w) && ptr == end;
+        case BINARY_NULL:
+            return b2j_null(&ptr, end, m_w) && ptr == end;
+        default:
+            return false;
+    }
+}
+
+bool
+b2j_formatter :: string(const unsigned char* str, const unsigned char* str_limit)
+{
+    return m_opts->ascii_only ? b2j_ascii_string_body(str, str_limit, m_w)
+                              : b2j_string_body(str, str_limit, m_w);
+}
+
+bool
+b2j_formatter :: newline(size_t depth)
+{
+    static const char spaces[] = "                                ";
+    size_t indent = m_opts->indent * depth;
+
+    if (m_opts->indent == 0)
+    {
+        return true;
+    }
+
+    if (!m_w->append('\n'))
+    {
+        return false;
+    }
+
+    while (indent > 0)
+    {
+        size_t sz = std::min(indent, sizeof(spaces) - 1);
+
+        if (!m_w->append(spaces, sz))
+        {
+            return false;
+        }
+
+        indent -= sz;
+    }
+
+    return true;
+}
+
+bool
+b2j_formatter :: close()
+{
+    const b2j_options_frame f = m_stack.top();
+    m_stack.pop();
+    m_members.resize(f.members_begin);
+
+    // empty containers stay on one line
+    if (!f.first && !newline(m_stack.size()))
+    {
+        return false;
+    }
+
+    return m_w->append(f.object ? '}' : ']');
+}
+
+path
+path::front() const
+{
+    path p(m_components.get_allocator().get());
+    p.m_components.assign(m_components.begin(), m_components.end() - 1);
+    return p;
+}
+
+path
+path::tail() const
+{
+    path p(m_components.get_allocator().get());
+    p.m_components.assign(m_components.begin() + 1, m_components.end());
+    return p;
+}
+
+std::ostream&
+operator << (std::ostream& lhs, const path& p)
+{
+    if (!p.m_valid)
+    {
+        return lhs << "<invalid path>";
+    }
+
+    for (size_t i = 0; i < p.m_components.size(); ++i)
+    {
+        if (i > 0)
+        {
+            lhs << ", ";
+        }
+
+        switch (p.m_components[i].type)
+        {
+            case path::FIELD:
+                lhs << "FIELD:" << std::string(p.m_components[i].field, p.m_components[i].field_sz);
+                break;
+            case path::INDEX:
+                lhs << "INDEX:" << p.m_components[i].index;
+                break;
+            default:
+                lhs << "<bad component>";
+                break;
+        }
+    }
+
+    return lhs;
+}
+
+path :: path(const char* p)
+    : m_valid(true)
+    , m_components(stl_allocator<component>(&default_allocator))
+{
+    parse(p);
+}
+
+path :: path(const char* p, const treadstone_allocator* a)
+    : m_valid(true)
+    , m_components(stl_allocator<component>(a))
+{
+    parse(p);
+}
+
+void
+path :: parse(const char* p)
+{
+    char prev = '\0';
+
+    while (true)
+    {
+        if (*p == '\0')
+        {
+            break;
+        }
+
+        if (*p == '[')
+        {
+            if (prev != '\0' && prev != 'I' && prev != 'F')
+            {
+                m_valid = false;
+                return;
+            }
+
+            char* end = NULL;
+            long int x = strtol(p + 1, &end, 0);
+
+            if (p + 1 >= end || *end != ']')
+            {
+                m_valid = false;
+                return;
+            }
+
+            m_components.push_back(component(x));
+            assert(*end == ']');
+            ++end;
+            p = end;
+            prev = 'I';
+        }
+        else if (*p == '.')
+        {
+            if (prev != 'I' && prev != 'F')
+            {
+                m_valid = false;
+                return;
+            }
+
+            ++p;
+            prev = '.';
+        }
+        else
+        {
+            if (prev != '\0' && prev != '.')
+            {
+                m_valid = false;
+                return;
+            }
+
+            const char* end = p;
+
+            while (*end != '[' && *end != ']' &&
+                   *end != '.' && *end != '\0')
+            {
+                ++end;
+            }
+
+            if (*end != '[' && *end != '.' && *end != '\0')
+            {
+                m_valid = false;
+                return;
+            }
+
+            m_components.push_back(component(p, end - p));
+            p = end;
+            prev = 'F';
+        }
+    }
+}
+
+END_TREADSTONE_NAMESPACE
+
+TREADSTONE_API void
+treadstone_set_max_depth(unsigned depth)
+{
+    treadstone::max_depth_setting.store(depth, std::memory_order_relaxed);
+}
+
+TREADSTONE_API unsigned
+treadstone_get_max_depth()
+{
+    return treadstone::max_depth_setting.load(std::memory_order_relaxed);
+}
+
+TREADSTONE_API int
+treadstone_json_to_binary(const char* json,
+                          unsigned char** binary, size_t* binary_sz)
+{
+    size_t json_sz = json ? strlen(json) : 0;
+    return treadstone_json_sz_to_binary(json, json_sz, binary, binary_sz);
+}
+
+TREADSTONE_API int
+treadstone_json_sz_to_binary(const char* json, size_t json_sz,
+                             unsigned char** binary, size_t* binary_sz)
+{
+    return treadstone_json_sz_to_binary_alloc(NULL, json, json_sz, binary, binary_sz);
+}
+
+TREADSTONE_API int
+treadstone_json_sz_to_binary_alloc(const treadstone_allocator* a,
+                                   const char* json, size_t json_sz,
+                                   unsigned char** binary, size_t* binary_sz)
+{
+    a = treadstone::allocator_or_default(a);
+    treadstone::stat_op op(treadstone::STAT_J2B, treadstone::STAT_J2B_NS);
+    treadstone::trace_span trace(TREADSTONE_TRACE_JSON_TO_BINARY, json_sz, NULL);
+
+    // Invalid JSON
+    if (json == NULL || strcmp(json, "") == 0)
+    {
+        errno = EINVAL;
+        *binary = NULL;
+        *binary_sz = 0;
+        return -1;
+    }
+
+    int saved = errno;
+    errno = EINVAL;
+    const char* ptr = json;
+    const char* limit = json + json_sz;
+    size_t binary_cap = treadstone::J2B_BOUND_FACTOR * json_sz + treadstone::J2B_NUMBER_MAX;
+
+    // Allocate once.  Small documents take the bound, which is cheaper than
+    // parsing twice; large ones are measured first, so memory is not wasted.
+    if (json_sz > treadstone::J2B_BOUND_INPUT_MAX)
+    {
+        uint64_t length = 0;
+        uint64_t slack = 0;
+
+        if (!treadstone::j2b_length(ptr, limit, &length, &slack, a))
+        {
+            *binary = NULL;
+            *binary_sz = 0;
+            // errno set in j2b_length, or is EINVAL from above
+            return -1;
+        }
+
+        binary_cap = length + slack;
+    }
+
+    *binary = reinterpret_cast<unsigned char*>(treadstone::allocate(a, sizeof(unsigned char) * binary_cap));
+    *binary_sz = 0;
+
+    if (!*binary)
+    {
+        *binary = NULL;
+        *binary_sz = 0;
+        // carry errno from failed malloc
+        return -1;
+    }
+
+    bool ret = treadstone::j2b_transform(&ptr, limit, 0, binary, binary_sz, &binary_cap, a);
+
+    if (ret)
+    {
+        // The bound or slack is not the caller's to free.  Handing back
+        // exactly the output without this one shrink would mean parsing
+        // every document twice and giving up the reservations j2b_transform
+        // makes for strings and numbers, which costs more than the realloc.
+        if (!treadstone::shrink_to_fit(a, binary, binary_cap, *binary_sz))
+        {
+            *binary_sz = 0;
+            return -1;
+        }
+
+        treadstone::stat_add(treadstone::STAT_J2B_BYTES_IN, json_sz);
+        treadstone::stat_add(treadstone::STAT_J2B_BYTES_OUT, *binary_sz);
+        errno = saved;
+        return trace.done(0);
+    }
+    else
+    {
+        treadstone::deallocate(a, *binary, binary_cap);
+        *binary = NULL;
+        *binary_sz = 0;
+        // errno set in j2b_transform, or is EINVAL from above
+        return -1;
+    }
+}
+
+TREADSTONE_API int
+treadstone_json_binary_length(const char* json, size_t json_sz, size_t* binary_sz)
+{
+    uint64_t length = 0;
+    uint64_t slack = 0;
+
+    if (json == NULL || json_sz == 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int saved = errno;
+    errno = EINVAL;
+
+    if (!treadstone::j2b_length(json, json + json_sz, &length, &slack,
+                                &treadstone::default_allocator))
+    {
+        return -1;
+    }
+
+    *binary_sz = length;
+    errno = saved;
+    return 0;
+}
+
+TREADSTONE_API int
+treadstone_binary_to_json(const unsigned char* binary, size_t binary_sz,
+                          char** json)
+{
+    return treadstone_binary_to_json_alloc(NULL, binary, binary_sz, json);
+}
+
+TREADSTONE_API int
+treadstone_binary_to_json_alloc(const treadstone_allocator* a,
+                                const unsigned char* binary, size_t binary_sz,
+                                char** json)
+{
+    a = treadstone::allocator_or_default(a);
+    treadstone::stat_op op(treadstone::STAT_B2J, treadstone::STAT_B2J_NS);
+    treadstone::trace_span trace(TREADSTONE_TRACE_BINARY_TO_JSON, binary_sz, NULL);
+
+    if(binary == NULL || binary_sz == 0)
+    {
+        // Allow empty binary data as a valid empty json
+        *json = reinterpret_cast<char*>(treadstone::allocate(a, strlen("{}")+1));
+
+        if (!*json)
+        {
+            return -1;
+        }
+
+        strcpy(*json, "{}");
+        return trace.done(0);
+    }
+
+    int saved = errno;
+    errno = EINVAL;
+    const unsigned char* ptr = binary;
+    const unsigned char* limit = binary + binary_sz;
+    uint64_t length = 0;
+
+    // one allocation of exactly the output, sized by a pass that also
+    // rejects bad input early; doubles are formatted twice so that the
+    // buffer never needs resizing
+    if (!treadstone::b2j_length(ptr, limit, true, &length, a))
+    {
+        *json = NULL;
+        return -1;
+    }
+
+    size_t json_cap = length + 1;
+    *json = reinterpret_cast<char*>(treadstone::allocate(a, sizeof(char) * json_cap));
+
+    if (!*json)
+    {
+        *json = NULL;
+        // carry errno from failed malloc
+        return -1;
+    }
+
+    treadstone::b2j_writer w(*json, json_cap, a);
+    bool ret = treadstone::b2j_transform(&ptr, limit, &w) && w.append('\0');
+    *json = w.json;
+
+    // a no-op, as the length was exact
+    if (ret && !treadstone::shrink_to_fit(a, json, w.json_cap, w.json_sz))
+    {
+        return -1;
+    }
+
+    if (ret)
+    {
+        treadstone::stat_add(treadstone::STAT_B2J_BYTES_IN, binary_sz);
+        treadstone::stat_add(treadstone::STAT_B2J_BYTES_OUT, w.json_sz - 1);
+        errno = saved;
+        return trace.done(0);
+    }
+    else
+    {
+        treadstone::deallocate(a, *json, w.json_cap);
+        *json = NULL;
+        return -1;
+    }
+}
+
+TREADSTONE_API int
+treadstone_binary_json_length(const unsigned char* binary, size_t binary_sz, size_t* json_sz)
+{
+    uint64_t length = 0;
+
+    if (binary == NULL || binary_sz == 0)
+    {
+        // as treadstone_binary_to_json, which writes "{}"
+        *json_sz = 2;
+        return 0;
+    }
+
+    int saved = errno;
+    errno = EINVAL;
+
+    if (!treadstone::b2j_length(binary, binary + binary_sz, true, &length,
+                                &treadstone::default_allocator))
+    {
+        return -1;
+    }
+
+    *json_sz = length;
+    errno = saved;
+    return 0;
+}
+
+TREADSTONE_API int
+treadstone_binary_to_json_sink(const unsigned char* binary, size_t binary_sz,
+                               char* buf, size_t buf_sz,
+                               treadstone_json_sink sink, void* ctx)
+{
+    if (buf_sz == 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    treadstone::stat_op op(treadstone::STAT_B2J, treadstone::STAT_B2J_NS);
+    treadstone::trace_span trace(TREADSTONE_TRACE_BINARY_TO_JSON, binary_sz, NULL);
+    treadstone::b2j_writer w(buf, buf_sz, sink, ctx);
+
+    if (binary == NULL || binary_sz == 0)
+    {
+        // Allow empty binary data as a valid empty json
+        return trace.done(w.append("{}", 2) && w.flush() ? 0 : -1);
+    }
+
+    // nothing reaches the sink unless the whole document is good
+    if (!treadstone::binary_valid(binary, binary_sz))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int saved = errno;
+    errno = EINVAL;
+    const unsigned char* ptr = binary;
+    const unsigned char* limit = binary + binary_sz;
+
+    if (treadstone::b2j_transform(&ptr, limit, &w) && w.flush())
+    {
+        treadstone::stat_add(treadstone::STAT_B2J_BYTES_IN, binary_sz);
+        treadstone::stat_add(treadstone::STAT_B2J_BYTES_OUT, w.flushed);
+        errno = saved;
+        return trace.done(0);
+    }
+
+    // errno is EINVAL from above, or what the sink left
+    return -1;
+}
+
+static const treadstone_json_options default_json_options = {0, 0, 0, TREADSTONE_NUMBERS_SHORT};
+
+static bool
+json_options_default(const treadstone_json_options* opts)
+{
+    return opts->indent == 0 && !opts->sort_keys && !opts->ascii_only &&
+           opts->numbers == TREADSTONE_NUMBERS_SHORT;
+}
+
+static bool
+json_options_format(const treadstone_json_options* opts,
+                    const unsigned char* binary, size_t binary_sz,
+                    treadstone::b2j_writer* w)
+{
+    try
+    {
+        treadstone::b2j_formatter f(opts, w);
+        return f.format(binary, binary + binary_sz);
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+}
+
+TREADSTONE_API int
+treadstone_binary_to_json_options(const struct treadstone_json_options* opts,
+                                  const unsigned char* binary, size_t binary_sz,
+                                  char** json)
+{
+    return treadstone_binary_to_json_options_alloc(NULL, opts, binary, binary_sz, json);
+}
+
+TREADSTONE_API int
+treadstone_binary_to_json_options_alloc(const struct treadstone_allocator* a,
+                                        const struct treadstone_json_options* opts,
+                                        const unsigned char* binary, size_t binary_sz,
+                                        char** json)
+{
+    a = treadstone::allocator_or_default(a);
+    opts = opts ? opts : &default_json_options;
+
+    if (json_options_default(opts) || binary == NULL || binary_sz == 0)
+    {
+        return treadstone_binary_to_json_alloc(a, binary, binary_sz, json);
+    }
+
+    treadstone::stat_op op(treadstone::STAT_B2J, treadstone::STAT_B2J_NS);
+    treadstone::trace_span trace(TREADSTONE_TRACE_BINARY_TO_JSON, binary_sz, NULL);
+    // whitespace and escapes make the size hard to bound, so this may grow
+    size_t json_cap = 2 * binary_sz + 16;
+    *json = reinterpret_cast<char*>(treadstone::allocate(a, sizeof(char) * json_cap));
+
+    if (!*json)
+    {
+        // carry errno from failed malloc
+        return -1;
+    }
+
+    int saved = errno;
+    errno = EINVAL;
+    treadstone::b2j_writer w(*json, json_cap, a);
+    bool ret = json_options_format(opts, binary, binary_sz, &w) && w.append('\0');
+    *json = w.json;
+
+    if (ret && !treadstone::shrink_to_fit(a, json, w.json_cap, w.json_sz))
+    {
+        return -1;
+    }
+
+    if (ret)
+    {
+        treadstone::stat_add(treadstone::STAT_B2J_BYTES_IN, binary_sz);
+        treadstone::stat_add(treadstone::STAT_B2J_BYTES_OUT, w.json_sz - 1);
+        errno = saved;
+        return trace.done(0);
+    }
+    else
+    {
+        treadstone::deallocate(a, *json, w.json_cap);
+        *json = NULL;
+        return -1;
+    }
+}
+
+TREADSTONE_API int
+treadstone_binary_to_json_options_sink(const struct treadstone_json_options* opts,
+                                       const unsigned char* binary, size_t binary_sz,
+                                       char* buf, size_t buf_sz,
+                                       treadstone_json_sink sink, void* ctx)
+{
+    opts = opts ? opts : &default_json_options;
+
+    if (json_options_default(opts) || binary == NULL || binary_sz == 0)
+    {
+        return treadstone_binary_to_json_sink(binary, binary_sz, buf, buf_sz, sink, ctx);
+    }
+
+    if (buf_sz == 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    treadstone::stat_op op(treadstone::STAT_B2J, treadstone::STAT_B2J_NS);
+    treadstone::trace_span trace(TREADSTONE_TRACE_BINARY_TO_JSON, binary_sz, NULL);
+    treadstone::b2j_writer w(buf, buf_sz, sink, ctx);
+
+    if (!treadstone::binary_valid(binary, binary_sz))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int saved = errno;
+    errno = EINVAL;
+
+    if (json_options_format(opts, binary, binary_sz, &w) && w.flush())
+    {
+        treadstone::stat_add(treadstone::STAT_B2J_BYTES_IN, binary_sz);
+        treadstone::stat_add(treadstone::STAT_B2J_BYTES_OUT, w.flushed);
+        errno = saved;
+        return trace.done(0);
+    }
+
+    return -1;
+}
+
+static int
+fd_sink(void* ctx, const char* json, size_t json_sz)
+{
+    int fd = *static_cast<int*>(ctx);
+
+    while (json_sz > 0)
+    {
+        ssize_t ret = write(fd, json, json_sz);
+
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (ret <= 0)
+        {
+            return -1;
+        }
+
+        json += ret;
+        json_sz -= ret;
+    }
+
+    return 0;
+}
+
+TREADSTONE_API int
+treadstone_binary_to_json_fd(const unsigned char* binary, size_t binary_sz,
+                             int fd)
+{
+    char buf[4096];
+    return treadstone_binary_to_json_sink(binary, binary_sz, buf, sizeof(buf), fd_sink, &fd);
+}
+
+TREADSTONE_API int
+treadstone_string_to_binary(const char* string, size_t string_sz,
+                            unsigned char** binary, size_t* binary_sz)
+{
+    return treadstone_string_to_binary_alloc(NULL, string, string_sz, binary, binary_sz);
+}
+
+TREADSTONE_API int
+treadstone_string_to_binary_alloc(const treadstone_allocator* a,
+                                  const char* string, size_t string_sz,
+                                  unsigned char** binary, size_t* binary_sz)
+{
+    a = treadstone::allocator_or_default(a);
+    *binary_sz = string_sz + 1 + e::varint_length(string_sz);
+    *binary = reinterpret_cast<unsigned char*>(treadstone::allocate(a, sizeof(unsigned char) * *binary_sz));
+
+    if (!*binary)
+    {
+        return -1;
+    }
+
+    unsigned char* ptr = *binary;
+    ptr = e::pack8be(BINARY_STRING, ptr);
+    ptr = e::packvarint64(string_sz, ptr);
+    memmove(ptr, string, string_sz);
+    return 0;
+}
+
+TREADSTONE_API int
+treadstone_integer_to_binary(int64_t number,
+                             unsigned char** binary, size_t* binary_sz)
+{
+    return treadstone_integer_to_binary_alloc(NULL, number, binary, binary_sz);
+}
+
+TREADSTONE_API int
+treadstone_integer_to_binary_alloc(const treadstone_allocator* a,
+                                   int64_t number,
+                                   unsigned char** binary, size_t* binary_sz)
+{
+    a = treadstone::allocator_or_default(a);
+    *binary = reinterpret_cast<unsigned char*>(treadstone::allocate(a, 1 + e::varint_length(number)));
+
+    if (!*binary)
+    {
+        return -1;
+    }
+
+    unsigned char* ptr = *binary;
+    unsigned char* start = ptr;
+    ptr = e::pack8be(BINARY_INTEGER, ptr);
+    ptr = e::packvarint64(number, ptr);
+    *binary_sz = ptr - start;
+    return 0;
+}
+
+TREADSTONE_API int
+treadstone_double_to_binary(double number,
+                            unsigned char** binary, size_t* binary_sz)
+{
+    return treadstone_double_to_binary_alloc(NULL, number, binary, binary_sz);
+}
+
+TREADSTONE_API int
+treadstone_double_to_binary_alloc(const treadstone_allocator* a,
+                                  double number,
+                                  unsigned char** binary, size_t* binary_sz)
+{
+    a = treadstone::allocator_or_default(a);
+    *binary = reinterpret_cast<unsigned char*>(treadstone::allocate(a, 1 + sizeof(double)));
+
+    if (!*binary)
+    {
+        return -1;
+    }
+
+    unsigned char* ptr = *binary;
+    unsigned char* start = ptr;
+    ptr = e::pack8be(BINARY_DOUBLE, ptr);
+    ptr = e::packdoublebe(number, ptr);
+    *binary_sz = ptr - start;
+    return 0;
+}
+
+TREADSTONE_API int
+treadstone_binary_is_string(const unsigned char* binary, size_t binary_sz)
+{
+    const unsigned char* ptr = binary;
+    const unsigned char* limit = ptr + binary_sz;
+
+    if (ptr >= limit || *ptr != BINARY_STRING)
+    {
+        return -1;
+    }
+
+    uint64_t sz;
+    const unsigned char* end = treadstone::varint64_decode(ptr + 1, limit, &sz);
+    return (end != NULL && end + sz == limit) ? 0 : -1;
+}
+
+TREADSTONE_API size_t
+treadstone_binary_string_bytes(const unsigned char* binary, size_t binary_sz)
+{
+    const unsigned char* ptr = binary;
+    const unsigned char* limit = ptr + binary_sz;
+    assert (ptr < limit && *ptr == BINARY_STRING);
+    uint64_t sz;
+    const unsigned char* end = treadstone::varint64_decode(ptr + 1, limit, &sz);
+    assert(end != NULL && end + sz == limit);
+    return sz;
+}
+
+TREADSTONE_API void
+treadstone_binary_to_string(const unsigned char* binary, size_t binary_sz,
+                            char* string)
+{
+    const unsigned char* ptr = binary;
+    const unsigned char* limit = ptr + binary_sz;
+    assert (ptr < limit && *ptr == BINARY_STRING);
+    uint64_t sz;
+    const unsigned char* end = treadstone::varint64_decode(ptr + 1, limit, &sz);
+    assert(end != NULL && end + sz == limit);
+    memmove(string, end, sz);
+}
+
+TREADSTONE_API int
+treadstone_binary_is_integer(const unsigned char* binary, size_t binary_sz)
+{
+    const unsigned char* ptr = binary;
+    const unsigned char* limit = ptr + binary_sz;
+
+    if (ptr >= limit || *ptr != BINARY_INTEGER)
+    {
+        return -1;
+    }
+
+    uint64_t unum;
+    const unsigned char* end = treadstone::varint64_decode(ptr + 1, limit, &unum);
+    return end == limit ? 0 : -1;
+}
+
+TREADSTONE_API int64_t
+treadstone_binary_to_integer(const unsigned char* binary, size_t binary_sz)
+{
+    const unsigned char* ptr = binary;
+    const unsigned char* limit = ptr + binary_sz;
+    assert(ptr < limit && *ptr == BINARY_INTEGER);
+    uint64_t unum;
+    const unsigned char* end = treadstone::varint64_decode(ptr + 1, limit, &unum);
+    assert(end == limit);
+    int64_t num = unum;
+    return num;
+}
+
+TREADSTONE_API int
+treadstone_binary_is_double(const unsigned char* binary, size_t binary_sz)
+{
+    const unsigned char* ptr = binary;
+    const unsigned char* limit = ptr + binary_sz;
+    return (ptr + 1 + sizeof(double) == limit && *ptr == BINARY_DOUBLE) ? 0 : -1;
+}
 
-    if (ret)
+TREADSTONE_API double
+treadstone_binary_to_double(const unsigned char* binary, size_t binary_sz)
+{
+    const unsigned char* ptr = binary;
+    const unsigned char* limit = ptr + binary_sz;
+    assert(ptr + 1 + sizeof(double) == limit && *ptr == BINARY_DOUBLE);
+    double num;
+    e::unpackdoublebe(ptr + 1, &num);
+    return num;
+}
+
+TREADSTONE_API int
+treadstone_validate_path(const char* path)
+{
+    treadstone::path p(path);
+    return p.is_valid() ? 0 : -1;
+}
+
+// An immutable version of a transformer's document.  One reference belongs to
+// the transformer while the snapshot is its current version; the rest belong
+// to readers.  Whoever drops the last reference frees the buffer.
+struct treadstone_snapshot
+{
+    treadstone_snapshot(const treadstone_allocator* a,
+                        unsigned char* b, size_t b_sz, size_t b_cap)
+        : refs(1)
+        , allocator(*a)
+        , binary(b)
+        , binary_sz(b_sz)
+        , binary_cap(b_cap)
+    {
+    }
+
+    std::atomic<size_t> refs;
+    const treadstone_allocator allocator;
+    unsigned char* const binary;
+    const size_t binary_sz;
+    const size_t binary_cap;
+
+    private:
+        treadstone_snapshot(const treadstone_snapshot&);
+        treadstone_snapshot& operator = (const treadstone_snapshot&);
+};
+
+static void
+snapshot_destroy(treadstone_snapshot* snap, bool keep_binary)
+{
+    treadstone_allocator a = snap->allocator;
+
+    if (!keep_binary)
+    {
+        treadstone::deallocate(&a, snap->binary, snap->binary_cap);
+    }
+
+    snap->~treadstone_snapshot();
+    treadstone::deallocate(&a, snap, sizeof(treadstone_snapshot));
+}
+
+static void
+snapshot_release(treadstone_snapshot* snap)
+{
+    if (snap->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        snapshot_destroy(snap, false);
+    }
+}
+
+struct TREADSTONE_LOCAL treadstone_transformer
+{
+    treadstone_transformer(const treadstone_allocator* a,
+                           const unsigned char* binary, size_t binary_sz);
+    treadstone_transformer(treadstone_arena* arena,
+                           const unsigned char* binary, size_t binary_sz);
+    ~treadstone_transformer() throw ();
+    int output(unsigned char** binary, size_t* binary_sz);
+    int unset_value(const char* path);
+    int set_value(const char* path,
+                  const unsigned char* value, size_t value_sz);
+    int extract_value(const char* path,
+                      unsigned char** value, size_t* value_sz);
+    int array_prepend_value(const char* path,
+                            const unsigned char* value, size_t value_sz);
+    int array_append_value(const char* path,
+                           const unsigned char* value, size_t value_sz);
+    int integer_op(const char* path, treadstone_numeric_op op,
+                   int64_t operand, int64_t* result);
+    int double_op(const char* path, treadstone_numeric_op op,
+                  double operand, double* result);
+    int string_append(const char* path, const char* str, size_t str_sz);
+    int array_insert_at(const char* path, int64_t idx,
+                        const unsigned char* value, size_t value_sz);
+    int array_remove_at(const char* path, int64_t idx,
+                        const unsigned char** value, size_t* value_sz);
+    int array_trim_to(const char* path, size_t keep);
+    int reset(const unsigned char* binary, size_t binary_sz);
+    int use_index(const treadstone_index* idx);
+    treadstone_snapshot* snapshot();
+    static int extract_from(const treadstone_allocator* a,
+                            const unsigned char* binary, size_t binary_sz,
+                            const char* path,
+                            unsigned char** value, size_t* value_sz);
+    const treadstone_allocator* allocator() const { return &m_allocator; }
+    treadstone_arena* arena() const { return m_arena; }
+    bool failed() const { return m_error; }
+    size_t size() const { return m_binary_sz; }
+
+    private:
+        struct stub
+        {
+            stub(unsigned char t,
+                 const unsigned char* ds, const unsigned char* dl,
+                 const unsigned char* ss, const unsigned char* sl)
+                : type(t)
+                , del_start(ds)
+                , del_limit(dl)
+                , set_start(ss)
+                , set_limit(sl)
+            {
+            }
+
+            unsigned char type;
+            const unsigned char* del_start;
+            const unsigned char* del_limit;
+            const unsigned char* set_start;
+            const unsigned char* set_limit;
+        };
+
+        typedef std::vector<stub, treadstone::stl_allocator<stub> > stub_vector;
+
+        treadstone_transformer(const treadstone_transformer&);
+        treadstone_transformer& operator = (const treadstone_transformer&);
+
+        int set_value(const treadstone::path& path,
+                      const unsigned char* value, size_t value_sz);
+        int parse(const treadstone::path& path, stub_vector* stubs);
+        int parse_indexed(const treadstone::path& path, stub_vector* stubs);
+        static int walk(const treadstone_allocator* a,
+                        const unsigned char* binary, size_t binary_sz,
+                        const treadstone::path& path, stub_vector* stubs);
+        static int parse_object(const treadstone::path::component& c,
+                                const unsigned char** del_start,
+                                const unsigned char** del_limit,
+                                const unsigned char** set_start,
+                                const unsigned char** set_limit);
+        static int parse_array(const treadstone_allocator* a,
+                               const treadstone::path::component& c,
+                               const unsigned char** del_start,
+                               const unsigned char** del_limit,
+                               const unsigned char** set_start,
+                               const unsigned char** set_limit);
+        int replace(const stub_vector& stubs,
+                    const unsigned char* cut_start,
+                    const unsigned char* cut_limit,
+                    const unsigned char* rep_with,
+                    size_t rep_with_sz);
+        int replace(const stub_vector& stubs,
+                    const unsigned char* cut_start,
+                    const unsigned char* cut_limit,
+                    const unsigned char** rep_withs,
+                    size_t* rep_with_szs,
+                    size_t reps);
+
+        static treadstone_allocator arena_allocator(treadstone_arena* arena);
+        void thaw();
+        bool writable_in_place();
+        int locate(const char* path, unsigned char type, stub_vector* stubs);
+        int array_seek(const stub& arr, uint64_t idx, uint64_t* walked,
+                       const unsigned char** start, const unsigned char** limit);
+        int array_count(const stub& arr, uint64_t* count);
+
+        const treadstone_allocator m_allocator;
+        treadstone_arena* const m_arena;
+        unsigned char* m_binary;
+        size_t m_binary_sz;
+        size_t m_binary_cap;
+        // the previous version of the document; replace() writes into it when
+        // it can, so that a series of operations ping-pongs between two buffers
+        unsigned char* m_spare;
+        size_t m_spare_cap;
+        // describes m_binary until the first change; owned by the caller
+        const treadstone_index* m_index;
+        // the current version, if anyone asked for it; shares m_binary unless
+        // the transformer lives in an arena
+        treadstone_snapshot* m_frozen;
+        // the last value popped from an array
+        unsigned char* m_popped;
+        size_t m_popped_cap;
+        bool m_error;
+};
+
+treadstone_transformer :: treadstone_transformer(const treadstone_allocator* a,
+                                                 const unsigned char* binary, size_t binary_sz)
+    : m_allocator(*a)
+    , m_arena(NULL)
+    , m_binary()
+    , m_binary_sz()
+    , m_binary_cap()
+    , m_spare()
+    , m_spare_cap()
+    , m_index(NULL)
+    , m_frozen(NULL)
+    , m_popped()
+    , m_popped_cap()
+    , m_error(false)
+{
+    m_error = reset(binary, binary_sz) < 0;
+}
+
+treadstone_transformer :: treadstone_transformer(treadstone_arena* arena,
+                                                 const unsigned char* binary, size_t binary_sz)
+    : m_allocator(arena_allocator(arena))
+    , m_arena(arena)
+    , m_binary()
+    , m_binary_sz()
+    , m_binary_cap()
+    , m_spare()
+    , m_spare_cap()
+    , m_index(NULL)
+    , m_frozen(NULL)
+    , m_popped()
+    , m_popped_cap()
+    , m_error(false)
+{
+    m_error = reset(binary, binary_sz) < 0;
+}
+
+treadstone_transformer :: ~treadstone_transformer() throw ()
+{
+    thaw();
+    treadstone::deallocate(&m_allocator, m_popped, m_popped_cap);
+    treadstone::deallocate(&m_allocator, m_spare, m_spare_cap);
+    treadstone::deallocate(&m_allocator, m_binary, m_binary_cap);
+}
+
+int
+treadstone_transformer :: reset(const unsigned char* binary, size_t binary_sz)
+{
+    m_index = NULL;
+    thaw();
+
+    // everything from the previous document lives in the arena
+    if (m_arena)
+    {
+        treadstone_arena_reset(m_arena);
+        m_binary = NULL;
+        m_binary_cap = 0;
+        m_spare = NULL;
+        m_spare_cap = 0;
+        m_popped = NULL;
+        m_popped_cap = 0;
+    }
+
+    if (m_binary_cap < binary_sz)
+    {
+        treadstone::deallocate(&m_allocator, m_binary, m_binary_cap);
+        m_binary = reinterpret_cast<unsigned char*>(treadstone::allocate(&m_allocator, sizeof(unsigned char) * binary_sz));
+        m_binary_cap = m_binary ? binary_sz : 0;
+    }
+
+    if (!m_binary)
+    {
+        m_binary_sz = 0;
+        return -1;
+    }
+
+    memmove(m_binary, binary, binary_sz);
+    m_binary_sz = binary_sz;
+    return 0;
+}
+
+int
+treadstone_transformer :: use_index(const treadstone_index* idx)
+{
+    // the root entry spans the whole document, so it must at least agree
+    // with the document's first byte and its length
+    if (idx->entries.empty() || idx->binary_sz != m_binary_sz ||
+        idx->entries[0].offset != 0 || idx->entries[0].limit != m_binary_sz ||
+        m_binary_sz == 0 || idx->entries[0].type != m_binary[0])
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    m_index = idx;
+    return 0;
+}
+
+treadstone_allocator
+treadstone_transformer :: arena_allocator(treadstone_arena* arena)
+{
+    treadstone_allocator a;
+    treadstone_arena_allocator(arena, &a);
+    return a;
+}
+
+void
+treadstone_transformer :: thaw()
+{
+    if (!m_frozen)
+    {
+        return;
+    }
+
+    treadstone_snapshot* snap = m_frozen;
+    m_frozen = NULL;
+
+    // an arena snapshot is a copy that was never the transformer's to reuse
+    if (m_arena)
+    {
+        snapshot_release(snap);
+        return;
+    }
+
+    assert(snap->binary == m_binary);
+
+    // no reader holds the version, so its buffer comes back to us; the
+    // acquire orders their reads before our next write
+    if (snap->refs.load(std::memory_order_acquire) == 1)
+    {
+        snapshot_destroy(snap, true);
+        return;
+    }
+
+    // the readers free the buffer when they are done with it
+    snapshot_release(snap);
+    m_binary = NULL;
+    m_binary_sz = 0;
+    m_binary_cap = 0;
+}
+
+treadstone_snapshot*
+treadstone_transformer :: snapshot()
+{
+    if (!m_frozen && m_arena)
+    {
+        const treadstone_allocator* a = treadstone::allocator_or_default(NULL);
+        void* mem = treadstone::allocate(a, sizeof(treadstone_snapshot));
+        unsigned char* copy = reinterpret_cast<unsigned char*>(treadstone::allocate(a, m_binary_sz));
+
+        if (!mem || !copy)
+        {
+            treadstone::deallocate(a, mem, sizeof(treadstone_snapshot));
+            treadstone::deallocate(a, copy, m_binary_sz);
+            return NULL;
+        }
+
+        memmove(copy, m_binary, m_binary_sz);
+        m_frozen = new (mem) treadstone_snapshot(a, copy, m_binary_sz, m_binary_sz);
+    }
+    else if (!m_frozen)
+    {
+        void* mem = treadstone::allocate(&m_allocator, sizeof(treadstone_snapshot));
+
+        if (!mem)
+        {
+            return NULL;
+        }
+
+        m_frozen = new (mem) treadstone_snapshot(&m_allocator, m_binary, m_binary_sz, m_binary_cap);
+    }
+
+    m_frozen->refs.fetch_add(1, std::memory_order_relaxed);
+    return m_frozen;
+}
+
+int
+treadstone_transformer :: output(unsigned char** binary, size_t* binary_sz)
+{
+    *binary = reinterpret_cast<unsigned char*>(treadstone::allocate(&m_allocator, sizeof(unsigned char) * m_binary_sz));
+
+    if (!*binary)
+    {
+        return -1;
+    }
+
+    *binary_sz = m_binary_sz;
+    memmove(*binary, m_binary, m_binary_sz);
+    return 0;
+}
+
+int
+treadstone_transformer :: unset_value(const char* p)
+{
+    treadstone::path path(p, &m_allocator);
+
+    if (!path.is_valid())
+    {
+        return -1;
+    }
+
+    stub_vector stubs((treadstone::stl_allocator<stub>(&m_allocator)));
+
+    if (parse(path, &stubs) < 0)
+    {
+        return -1;
+    }
+
+    // if we found exactly the field we wanted
+    if (stubs.size() == path.depth() + 1)
+    {
+        return replace(stubs, stubs.back().del_start, stubs.back().del_limit, NULL, 0);
+    }
+    // we fell short
+    else
+    {
+        return -1;
+    }
+}
+
+int
+treadstone_transformer :: set_value(const char* p, const unsigned char* value, size_t value_sz)
+{
+    treadstone::path path(p, &m_allocator);
+    return set_value(path, value, value_sz);
+}
+
+int
+treadstone_transformer :: set_value(const treadstone::path& path, const unsigned char* value, size_t value_sz)
+{
+    using namespace treadstone;
+
+    if (!path.is_valid())
+    {
+        return -1;
+    }
+
+    stub_vector stubs((treadstone::stl_allocator<stub>(&m_allocator)));
+
+    if (parse(path, &stubs) < 0)
+    {
+        return -1;
+    }
+
+    // overwrite the whole value
+    if (path.depth() == 0)
+    {
+        return replace(stubs, m_binary, m_binary + m_binary_sz, value, value_sz);
+    }
+    // the item does not exist yet
+    else if (stubs.size() == path.depth())
+    {
+        const path::component& c(path.get(path.depth() - 1));
+
+        if (stubs.back().type == BINARY_OBJECT && c.type == path::FIELD)
+        {
+            unsigned char header[11];
+            header[0] = BINARY_STRING;
+            size_t header_sz = e::packvarint64(c.field_sz, header + 1) - header;
+
+            const unsigned char* rep_withs[3];
+            size_t rep_with_szs[3];
+            rep_withs[0] = header;
+            rep_withs[1] = reinterpret_cast<const unsigned char*>(c.field);
+            rep_withs[2] = value;
+            rep_with_szs[0] = header_sz;
+            rep_with_szs[1] = c.field_sz;
+            rep_with_szs[2] = value_sz;
+            return replace(stubs, stubs.back().del_limit, stubs.back().del_limit, rep_withs, rep_with_szs, 3);
+        }
+        // we don't support inserting into an array by index --- if it doesn't
+        // already exist, use push/pop
+        else
+        {
+            return -1;
+        }
+    }
+    // overwrite existing value
+    else if (stubs.size() == path.depth() + 1)
     {
-        errno = saved;
-        return 0;
+        return replace(stubs, stubs.back().set_start, stubs.back().set_limit, value, value_sz);
+    }
+    // We first have to create the parent(s) of the field
+    else if (stubs.size() < path.depth())
+    {
+        if(set_value(path.front(), empty_object, sizeof(empty_object)) == -1)
+        {
+            return -1;
+        }
+        else
+        {
+            return set_value(path, value, value_sz);
+        }
     }
+    // Something went wrong...
     else
     {
-        free(*binary);
-        *binary = NULL;
-        *binary_sz = 0;
-        // errno set in j2b_transform, or is EINVAL from above
         return -1;
     }
 }
 
-TREADSTONE_API int
-treadstone_binary_to_json(const unsigned char* binary, size_t binary_sz,
-                          char** json)
+int
+treadstone_transformer :: extract_value(const char* p,
+                                        unsigned char** value, size_t* value_sz)
 {
-    if(binary == NULL || binary_sz == 0)
+    treadstone::path path(p, &m_allocator);
+
+    if (!path.is_valid())
     {
-        // Allow empty binary data as a valid empty json
-        *json = reinterpret_cast<char*>(malloc(strlen("{}")+1));
-        strcpy(*json, "{}");
-        return 0;
+        return -1;
     }
 
-    size_t json_sz = 0;
-    size_t json_cap = binary_sz + (binary_sz >> 2);
-    *json = reinterpret_cast<char*>(malloc(sizeof(char) * json_cap));
+    stub_vector stubs((treadstone::stl_allocator<stub>(&m_allocator)));
 
-    if (!*json)
+    if (parse(path, &stubs) < 0)
     {
-        *json = NULL;
-        // carry errno from failed malloc
         return -1;
     }
 
-    int saved = errno;
-    errno = EINVAL;
-    const unsigned char* ptr = binary;
-    const unsigned char* limit = binary + binary_sz;
-    bool ret = treadstone::b2j_transform(&ptr, limit, json, &json_sz, &json_cap);
-
-    if (ret)
+    // if we found exactly the field we wanted
+    if (stubs.size() == path.depth() + 1)
     {
-        errno = saved;
+        *value_sz = stubs.back().set_limit - stubs.back().set_start;
+        *value = reinterpret_cast<unsigned char*>(treadstone::allocate(&m_allocator, *value_sz));
 
-        if (!treadstone::b2j_make_room_for(1, json, &json_sz, &json_cap))
+        if (!*value)
         {
             return -1;
         }
 
-        memset(*json + json_sz, 0, json_cap - json_sz);
+        memmove(*value, stubs.back().set_start, *value_sz);
         return 0;
     }
+    // we fell short
     else
     {
-        free(*json);
-        *json = NULL;
         return -1;
     }
 }
 
-TREADSTONE_API int
-treadstone_string_to_binary(const char* string, size_t string_sz,
-                            unsigned char** binary, size_t* binary_sz)
+int
+treadstone_transformer :: extract_from(const treadstone_allocator* a,
+                                       const unsigned char* binary, size_t binary_sz,
+                                       const char* p,
+                                       unsigned char** value, size_t* value_sz)
 {
-    *binary_sz = string_sz + 1 + e::varint_length(string_sz);
-    *binary = reinterpret_cast<unsigned char*>(malloc(sizeof(unsigned char) * *binary_sz));
+    treadstone::path path(p, a);
 
-    if (!*binary)
+    if (!path.is_valid())
     {
         return -1;
     }
 
-    unsigned char* ptr = *binary;
-    ptr = e::pack8be(BINARY_STRING, ptr);
-    ptr = e::packvarint64(string_sz, ptr);
-    memmove(ptr, string, string_sz);
-    return 0;
-}
-
-TREADSTONE_API int
-treadstone_integer_to_binary(int64_t number,
-                             unsigned char** binary, size_t* binary_sz)
-{
-    *binary = reinterpret_cast<unsigned char*>(malloc(11));
+    stub_vector stubs((treadstone::stl_allocator<stub>(a)));
 
-    if (!*binary)
+    if (walk(a, binary, binary_sz, path, &stubs) < 0 ||
+        stubs.size() != path.depth() + 1)
     {
         return -1;
     }
 
-    unsigned char* ptr = *binary;
-    unsigned char* start = ptr;
-    ptr = e::pack8be(BINARY_INTEGER, ptr);
-    ptr = e::packvarint64(number, ptr);
-    *binary_sz = ptr - start;
-    return 0;
-}
-
-TREADSTONE_API int
-treadstone_double_to_binary(double number,
-                            unsigned char** binary, size_t* binary_sz)
-{
-    *binary = reinterpret_cast<unsigned char*>(malloc(10));
+    *value_sz = stubs.back().set_limit - stubs.back().set_start;
+    *value = reinterpret_cast<unsigned char*>(treadstone::allocate(a, *value_sz));
 
-    if (!*binary)
+    if (!*value)
     {
         return -1;
     }
 
-    unsigned char* ptr = *binary;
-    unsigned char* start = ptr;
-    ptr = e::pack8be(BINARY_DOUBLE, ptr);
-    ptr = e::packdoublebe(number, ptr);
-    *binary_sz = ptr - start;
+    memmove(*value, stubs.back().set_start, *value_sz);
     return 0;
 }
 
-TREADSTONE_API int
-treadstone_binary_is_string(const unsigned char* binary, size_t binary_sz)
+int
+treadstone_transformer :: array_prepend_value(const char* p,
+                                              const unsigned char* value, size_t value_sz)
 {
-    const unsigned char* ptr = binary;
-    const unsigned char* limit = ptr + binary_sz;
+    treadstone::path path(p, &m_allocator);
 
-    if (ptr >= limit || *ptr != BINARY_STRING)
+    if (!path.is_valid())
     {
         return -1;
     }
 
-    uint64_t sz;
-    const unsigned char* end = e::varint64_decode(ptr + 1, limit, &sz);
-    return (end != NULL && end + sz == limit) ? 0 : -1;
-}
-
-TREADSTONE_API size_t
-treadstone_binary_string_bytes(const unsigned char* binary, size_t binary_sz)
-{
-    const unsigned char* ptr = binary;
-    const unsigned char* limit = ptr + binary_sz;
-    assert (ptr < limit && *ptr == BINARY_STRING);
-    uint64_t sz;
-    const unsigned char* end = e::varint64_decode(ptr + 1, limit, &sz);
-    assert(end != NULL && end + sz == limit);
-    return sz;
-}
-
-TREADSTONE_API void
-treadstone_binary_to_string(const unsigned char* binary, size_t binary_sz,
-                            char* string)
-{
-    const unsigned char* ptr = binary;
-    const unsigned char* limit = ptr + binary_sz;
-    assert (ptr < limit && *ptr == BINARY_STRING);
-    uint64_t sz;
-    const unsigned char* end = e::varint64_decode(ptr + 1, limit, &sz);
-    assert(end != NULL && end + sz == limit);
-    memmove(string, end, sz);
-}
-
-TREADSTONE_API int
-treadstone_binary_is_integer(const unsigned char* binary, size_t binary_sz)
-{
-    const unsigned char* ptr = binary;
-    const unsigned char* limit = ptr + binary_sz;
+    stub_vector stubs((treadstone::stl_allocator<stub>(&m_allocator)));
 
-    if (ptr >= limit || *ptr != BINARY_INTEGER)
+    if (parse(path, &stubs) < 0)
     {
         return -1;
     }
 
-    uint64_t unum;
-    const unsigned char* end = e::varint64_decode(ptr + 1, limit, &unum);
-    return end == limit ? 0 : -1;
-}
-
-TREADSTONE_API int64_t
-treadstone_binary_to_integer(const unsigned char* binary, size_t binary_sz)
-{
-    const unsigned char* ptr = binary;
-    const unsigned char* limit = ptr + binary_sz;
-    assert(ptr < limit && *ptr == BINARY_INTEGER);
-    uint64_t unum;
-    const unsigned char* end = e::varint64_decode(ptr + 1, limit, &unum);
-    assert(end == limit);
-    int64_t num = unum;
-    return num;
-}
+    // if we found exactly the field we wanted
+    if (stubs.size() == path.depth() + 1 && stubs.back().type == BINARY_ARRAY)
+    {
+        uint64_t arr_sz;
+        const unsigned char* end = treadstone::varint64_decode(stubs.back().set_start + 1, stubs.back().set_limit, &arr_sz);
 
-TREADSTONE_API int
-treadstone_binary_is_double(const unsigned char* binary, size_t binary_sz)
-{
-    const unsigned char* ptr = binary;
-    const unsigned char* limit = ptr + binary_sz;
-    return (ptr + 1 + sizeof(double) == limit && *ptr == BINARY_DOUBLE) ? 0 : -1;
-}
+        if (end == NULL || end + arr_sz != stubs.back().set_limit)
+        {
+            return -1;
+        }
 
-TREADSTONE_API double
-treadstone_binary_to_double(const unsigned char* binary, size_t binary_sz)
-{
-    const unsigned char* ptr = binary;
-    const unsigned char* limit = ptr + binary_sz;
-    assert(ptr + 1 + sizeof(double) == limit && *ptr == BINARY_DOUBLE);
-    double num;
-    e::unpackdoublebe(ptr + 1, &num);
-    return num;
-}
+        unsigned char header[20];
+        header[0] = BINARY_ARRAY;
+        uint64_t body_sz = value_sz + arr_sz;
+        size_t header_sz = e::packvarint64(body_sz, header + 1) - header;
 
-TREADSTONE_API int
-treadstone_validate_path(const char* path)
-{
-    treadstone::path p(path);
-    return p.is_valid() ? 0 : -1;
+        const unsigned char* rep_withs[3];
+        size_t rep_with_szs[3];
+        rep_withs[0] = header;
+        rep_withs[1] = value;
+        rep_withs[2] = end;
+        rep_with_szs[0] = header_sz;
+        rep_with_szs[1] = value_sz;
+        rep_with_szs[2] = arr_sz;
+        return replace(stubs, stubs.back().set_start, stubs.back().set_limit, rep_withs, rep_with_szs, 3);
+    }
+    // we fell short
+    else
+    {
+        return -1;
+    }
 }
 
-struct treadstone_transformer
+int
+treadstone_transformer :: array_append_value(const char* p,
+                                             const unsigned char* value, size_t value_sz)
 {
-    treadstone_transformer(const unsigned char* binary, size_t binary_sz);
-    ~treadstone_transformer() throw ();
-    int output(unsigned char** binary, size_t* binary_sz);
-    int unset_value(const char* path);
-    int set_value(const treadstone::path& path,
-                  const unsigned char* value, size_t value_sz);
-    int extract_value(const char* path,
-                      unsigned char** value, size_t* value_sz);
-    int array_prepend_value(const char* path,
-                            const unsigned char* value, size_t value_sz);
-    int array_append_value(const char* path,
-                           const unsigned char* value, size_t value_sz);
-
-    private:
-        struct stub
-        {
-            stub(unsigned char t,
-                 const unsigned char* ds, const unsigned char* dl,
-                 const unsigned char* ss, const unsigned char* sl)
-                : type(t)
-                , del_start(ds)
-                , del_limit(dl)
-                , set_start(ss)
-                , set_limit(sl)
-            {
-            }
+    treadstone::path path(p, &m_allocator);
 
-            unsigned char type;
-            const unsigned char* del_start;
-            const unsigned char* del_limit;
-            const unsigned char* set_start;
-            const unsigned char* set_limit;
-        };
+    if (!path.is_valid())
+    {
+        return -1;
+    }
 
-        treadstone_transformer(const treadstone_transformer&);
-        treadstone_transformer& operator = (const treadstone_transformer&);
+    stub_vector stubs((treadstone::stl_allocator<stub>(&m_allocator)));
 
-        int parse(const treadstone::path& path, std::vector<stub>* stubs);
-        int parse_value(const treadstone::path& path,
-                        std::vector<stub>* stubs,
-                        const unsigned char* del_start,
-                        const unsigned char* del_limit,
-                        const unsigned char* set_start,
-                        const unsigned char* set_limit,
-                        unsigned depth);
-        int parse_object(const treadstone::path& path,
-                        std::vector<stub>* stubs,
-                        const unsigned char* del_start,
-                        const unsigned char* del_limit,
-                        const unsigned char* set_start,
-                        const unsigned char* set_limit,
-                        unsigned depth);
-        int parse_array(const treadstone::path& path,
-                        std::vector<stub>* stubs,
-                        const unsigned char* del_start,
-                        const unsigned char* del_limit,
-                        const unsigned char* set_start,
-                        const unsigned char* set_limit,
-                        unsigned depth);
-        int replace(const std::vector<stub>& stubs,
-                    const unsigned char* cut_start,
-                    const unsigned char* cut_limit,
-                    const unsigned char* rep_with,
-                    size_t rep_with_sz);
-        int replace(const std::vector<stub>& stubs,
-                    const unsigned char* cut_start,
-                    const unsigned char* cut_limit,
-                    const unsigned char** rep_withs,
-                    size_t* rep_with_szs,
-                    size_t reps);
+    if (parse(path, &stubs) < 0)
+    {
+        return -1;
+    }
 
-        unsigned char* m_binary;
-        size_t m_binary_sz;
-        size_t m_binary_cap;
-        bool m_error;
-};
+    // if we found exactly the field we wanted
+    if (stubs.size() == path.depth() + 1 && stubs.back().type == BINARY_ARRAY)
+    {
+        uint64_t arr_sz;
+        const unsigned char* end = treadstone::varint64_decode(stubs.back().set_start + 1, stubs.back().set_limit, &arr_sz);
 
-treadstone_transformer :: treadstone_transformer(const unsigned char* binary, size_t binary_sz)
-    : m_binary()
-    , m_binary_sz()
-    , m_binary_cap()
-    , m_error(false)
-{
-    m_binary = reinterpret_cast<unsigned char*>(malloc(sizeof(unsigned char*) * binary_sz));
-    m_binary_sz = binary_sz;
-    m_binary_cap = binary_sz;
-    m_error = m_binary == NULL;
+        if (end == NULL || end + arr_sz != stubs.back().set_limit)
+        {
+            return -1;
+        }
+
+        unsigned char header[20];
+        header[0] = BINARY_ARRAY;
+        uint64_t body_sz = value_sz + arr_sz;
+        size_t header_sz = e::packvarint64(body_sz, header + 1) - header;
 
-    if (m_binary)
+        const unsigned char* rep_withs[3];
+        size_t rep_with_szs[3];
+        rep_withs[0] = header;
+        rep_withs[1] = end;
+        rep_withs[2] = value;
+        rep_with_szs[0] = header_sz;
+        rep_with_szs[1] = arr_sz;
+        rep_with_szs[2] = value_sz;
+        return replace(stubs, stubs.back().set_start, stubs.back().set_limit, rep_withs, rep_with_szs, 3);
+    }
+    // we fell short
+    else
     {
-        memmove(m_binary, binary, binary_sz);
+        return -1;
     }
 }
 
-treadstone_transformer :: ~treadstone_transformer() throw ()
+bool
+treadstone_transformer :: writable_in_place()
 {
-    if (m_binary)
+    if (!m_frozen)
+    {
+        return true;
+    }
+
+    // an arena snapshot is a copy, and one no reader holds can be let go
+    if (m_arena || m_frozen->refs.load(std::memory_order_acquire) == 1)
     {
-        free(m_binary);
+        thaw();
+        return true;
     }
+
+    return false;
 }
 
 int
-treadstone_transformer :: output(unsigned char** binary, size_t* binary_sz)
+treadstone_transformer :: locate(const char* p, unsigned char type, stub_vector* stubs)
 {
-    *binary = reinterpret_cast<unsigned char*>(malloc(sizeof(unsigned char) * m_binary_sz));
+    treadstone::path path(p, &m_allocator);
 
-    if (!*binary)
+    if (!path.is_valid())
     {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (parse(path, stubs) < 0 || stubs->size() != path.depth() + 1)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+
+    if (stubs->back().type != type)
+    {
+        errno = EINVAL;
         return -1;
     }
 
-    *binary_sz = m_binary_sz;
-    memmove(*binary, m_binary, m_binary_sz);
     return 0;
 }
 
+static bool
+integer_apply(treadstone_numeric_op op, int64_t x, int64_t y, int64_t* z)
+{
+    switch (op)
+    {
+        case TREADSTONE_OP_ADD:
+            if (__builtin_add_overflow(x, y, z))
+            {
+                errno = ERANGE;
+                return false;
+            }
+
+            return true;
+        case TREADSTONE_OP_MUL:
+            if (__builtin_mul_overflow(x, y, z))
+            {
+                errno = ERANGE;
+                return false;
+            }
+
+            return true;
+        case TREADSTONE_OP_MIN:
+            *z = std::min(x, y);
+            return true;
+        case TREADSTONE_OP_MAX:
+            *z = std::max(x, y);
+            return true;
+        case TREADSTONE_OP_AND:
+            *z = x & y;
+            return true;
+        case TREADSTONE_OP_OR:
+            *z = x | y;
+            return true;
+        case TREADSTONE_OP_XOR:
+            *z = x ^ y;
+            return true;
+        default:
+            errno = EINVAL;
+            return false;
+    }
+}
+
 int
-treadstone_transformer :: unset_value(const char* p)
+treadstone_transformer :: integer_op(const char* p, treadstone_numeric_op op,
+                                     int64_t operand, int64_t* result)
 {
-    treadstone::path path(p);
+    stub_vector stubs((treadstone::stl_allocator<stub>(&m_allocator)));
 
-    if (!path.is_valid())
+    if (locate(p, BINARY_INTEGER, &stubs) < 0)
     {
         return -1;
     }
 
-    std::vector<stub> stubs;
+    const stub& s(stubs.back());
+    uint64_t x = 0;
+    int64_t z = 0;
 
-    if (parse(path, &stubs) < 0)
+    if (!treadstone::varint64_decode(s.set_start + 1, s.set_limit, &x))
     {
+        errno = EINVAL;
         return -1;
     }
 
-    // if we found exactly the field we wanted
-    if (stubs.size() == path.depth() + 1)
+    if (!integer_apply(op, int64_t(x), operand, &z))
     {
-        return replace(stubs, stubs.back().del_start, stubs.back().del_limit, NULL, 0);
+        return -1;
     }
-    // we fell short
-    else
+
+    if (result)
     {
-        return -1;
+        *result = z;
+    }
+
+    // the same width leaves every length and offset, the index's included,
+    // where it was
+    if (e::varint_length(uint64_t(z)) == size_t(s.set_limit - s.set_start - 1) &&
+        writable_in_place())
+    {
+        e::packvarint64(uint64_t(z), m_binary + (s.set_start + 1 - m_binary));
+        return 0;
     }
+
+    unsigned char buf[11];
+    buf[0] = BINARY_INTEGER;
+    size_t buf_sz = e::packvarint64(uint64_t(z), buf + 1) - buf;
+    return replace(stubs, s.set_start, s.set_limit, buf, buf_sz);
 }
 
 int
-treadstone_transformer :: set_value(const treadstone::path& path, const unsigned char* value, size_t value_sz)
+treadstone_transformer :: double_op(const char* p, treadstone_numeric_op op,
+                                    double operand, double* result)
 {
-    using namespace treadstone;
+    stub_vector stubs((treadstone::stl_allocator<stub>(&m_allocator)));
 
-    if (!path.is_valid())
+    if (locate(p, BINARY_DOUBLE, &stubs) < 0)
     {
         return -1;
     }
 
-    std::vector<stub> stubs;
+    const stub& s(stubs.back());
+    double x = 0;
+    double z = 0;
 
-    if (parse(path, &stubs) < 0)
+    if (s.set_limit - s.set_start != 1 + sizeof(double))
     {
+        errno = EINVAL;
         return -1;
     }
 
-    // overwrite the whole value
-    if (path.depth() == 0)
+    e::unpackdoublebe(s.set_start + 1, &x);
+
+    switch (op)
     {
-        return replace(stubs, m_binary, m_binary + m_binary_sz, value, value_sz);
+        case TREADSTONE_OP_ADD:
+            z = x + operand;
+            break;
+        case TREADSTONE_OP_MUL:
+            z = x * operand;
+            break;
+        case TREADSTONE_OP_MIN:
+            z = std::min(x, operand);
+            break;
+        case TREADSTONE_OP_MAX:
+            z = std::max(x, operand);
+            break;
+        // the bitwise operations only apply to integers
+        case TREADSTONE_OP_AND:
+        case TREADSTONE_OP_OR:
+        case TREADSTONE_OP_XOR:
+        default:
+            errno = EINVAL;
+            return -1;
     }
-    // the item does not exist yet
-    else if (stubs.size() == path.depth())
-    {
-        const path::component& c(path.get(path.depth() - 1));
-
-        if (stubs.back().type == BINARY_OBJECT && c.type == path::FIELD)
-        {
-            unsigned char* binary;
-            size_t binary_sz;
-            e::guard g = e::makeguard(treadstone::free_if_allocated_unsigned_char_star, &binary);
-
-            if (treadstone_string_to_binary(c.field.c_str(), c.field.size(), &binary, &binary_sz) < 0)
-            {
-                return -1;
-            }
 
-            const unsigned char* rep_withs[2];
-            size_t rep_with_szs[2];
-            rep_withs[0] = binary;
-            rep_withs[1] = value;
-            rep_with_szs[0] = binary_sz;
-            rep_with_szs[1] = value_sz;
-            return replace(stubs, stubs.back().del_limit, stubs.back().del_limit, rep_withs, rep_with_szs, 2);
-        }
-        // we don't support inserting into an array by index --- if it doesn't
-        // already exist, use push/pop
-        else
-        {
-            return -1;
-        }
+    if (result)
+    {
+        *result = z;
     }
-    // overwrite existing value
-    else if (stubs.size() == path.depth() + 1)
+
+    // a double is always nine bytes
+    if (writable_in_place())
     {
-        return replace(stubs, stubs.back().set_start, stubs.back().set_limit, value, value_sz);
+        e::packdoublebe(z, m_binary + (s.set_start + 1 - m_binary));
+        return 0;
     }
-    // We first have to create the parent(s) of the field
-    else if (stubs.size() < path.depth())
+
+    unsigned char buf[1 + sizeof(double)];
+    buf[0] = BINARY_DOUBLE;
+    e::packdoublebe(z, buf + 1);
+    return replace(stubs, s.set_start, s.set_limit, buf, sizeof(buf));
+}
+
+int
+treadstone_transformer :: string_append(const char* p, const char* str, size_t str_sz)
+{
+    stub_vector stubs((treadstone::stl_allocator<stub>(&m_allocator)));
+
+    if (locate(p, BINARY_STRING, &stubs) < 0)
     {
-        if(set_value(path.front(), empty_object, sizeof(empty_object)) == -1)
-        {
-            return -1;
-        }
-        else
-        {
-            return set_value(path, value, value_sz);
-        }
+        return -1;
     }
-    // Something went wrong...
-    else
+
+    const stub& s(stubs.back());
+    uint64_t old_sz = 0;
+    const unsigned char* body = treadstone::varint64_decode(s.set_start + 1, s.set_limit, &old_sz);
+
+    if (!body)
     {
+        errno = EINVAL;
         return -1;
     }
+
+    // the old text goes straight from the current buffer to the next
+    unsigned char header[11];
+    header[0] = BINARY_STRING;
+    const unsigned char* rep_withs[3];
+    size_t rep_with_szs[3];
+    rep_withs[0] = header;
+    rep_withs[1] = body;
+    rep_withs[2] = reinterpret_cast<const unsigned char*>(str);
+    rep_with_szs[0] = e::packvarint64(old_sz + str_sz, header + 1) - header;
+    rep_with_szs[1] = old_sz;
+    rep_with_szs[2] = str_sz;
+    return replace(stubs, s.set_start, s.set_limit, rep_withs, rep_with_szs, 3);
 }
 
+// walk arr's elements, stopping at element idx; [*start, *limit) is that
+// element, or the empty range at the end if arr is shorter, and *walked is
+// how many elements came before it
 int
-treadstone_transformer :: extract_value(const char* p,
-                                        unsigned char** value, size_t* value_sz)
+treadstone_transformer :: array_seek(const stub& arr, uint64_t idx, uint64_t* walked,
+                                     const unsigned char** start, const unsigned char** limit)
 {
-    treadstone::path path(p);
+    uint64_t arr_sz = 0;
+    const unsigned char* ptr = treadstone::varint64_decode(arr.set_start + 1, arr.set_limit, &arr_sz);
 
-    if (!path.is_valid())
+    if (ptr == NULL || ptr + arr_sz != arr.set_limit)
     {
+        errno = EINVAL;
         return -1;
     }
 
-    std::vector<stub> stubs;
+    uint64_t n = 0;
 
-    if (parse(path, &stubs) < 0)
+    while (ptr && ptr < arr.set_limit && n < idx)
+    {
+        ptr = treadstone::b2j_value_end(ptr, arr.set_limit);
+        ++n;
+    }
+
+    const unsigned char* end = ptr;
+
+    if (ptr && ptr < arr.set_limit)
+    {
+        end = treadstone::b2j_value_end(ptr, arr.set_limit);
+    }
+
+    if (!ptr || !end)
     {
+        errno = EINVAL;
         return -1;
     }
 
-    // if we found exactly the field we wanted
-    if (stubs.size() == path.depth() + 1)
+    treadstone::stat_add(treadstone::STAT_TRANSFORM_STEPS, n);
+    *walked = n;
+    *start = ptr;
+    *limit = end;
+    return 0;
+}
+
+int
+treadstone_transformer :: array_count(const stub& arr, uint64_t* count)
+{
+    const unsigned char* start;
+    const unsigned char* limit;
+    return array_seek(arr, ~uint64_t(0), count, &start, &limit);
+}
+
+int
+treadstone_transformer :: array_insert_at(const char* p, int64_t idx,
+                                          const unsigned char* value, size_t value_sz)
+{
+    stub_vector stubs((treadstone::stl_allocator<stub>(&m_allocator)));
+
+    if (locate(p, BINARY_ARRAY, &stubs) < 0)
     {
-        *value_sz = stubs.back().set_limit - stubs.back().set_start;
-        *value = reinterpret_cast<unsigned char*>(malloc(*value_sz));
+        return -1;
+    }
 
-        if (!*value)
+    // the new element lands at idx; -1 is after the last one
+    if (idx < 0)
+    {
+        uint64_t count = 0;
+
+        if (array_count(stubs.back(), &count) < 0)
         {
             return -1;
         }
 
-        memmove(*value, stubs.back().set_start, *value_sz);
-        return 0;
+        idx += static_cast<int64_t>(count) + 1;
     }
-    // we fell short
-    else
+
+    uint64_t walked = 0;
+    const unsigned char* start = NULL;
+    const unsigned char* limit = NULL;
+
+    if (idx >= 0 &&
+        array_seek(stubs.back(), static_cast<uint64_t>(idx), &walked, &start, &limit) < 0)
     {
         return -1;
     }
+
+    if (idx < 0 || walked != static_cast<uint64_t>(idx))
+    {
+        errno = ENOENT;
+        return -1;
+    }
+
+    return replace(stubs, start, start, value, value_sz);
 }
 
 int
-treadstone_transformer :: array_prepend_value(const char* p,
-                                              const unsigned char* value, size_t value_sz)
+treadstone_transformer :: array_remove_at(const char* p, int64_t idx,
+                                          const unsigned char** value, size_t* value_sz)
 {
-    treadstone::path path(p);
+    stub_vector stubs((treadstone::stl_allocator<stub>(&m_allocator)));
 
-    if (!path.is_valid())
+    if (locate(p, BINARY_ARRAY, &stubs) < 0)
     {
         return -1;
     }
 
-    std::vector<stub> stubs;
+    if (idx < 0)
+    {
+        uint64_t count = 0;
 
-    if (parse(path, &stubs) < 0)
+        if (array_count(stubs.back(), &count) < 0)
+        {
+            return -1;
+        }
+
+        idx += static_cast<int64_t>(count);
+    }
+
+    uint64_t walked = 0;
+    const unsigned char* start = NULL;
+    const unsigned char* limit = NULL;
+
+    if (idx >= 0 &&
+        array_seek(stubs.back(), static_cast<uint64_t>(idx), &walked, &start, &limit) < 0)
     {
         return -1;
     }
 
-    // if we found exactly the field we wanted
-    if (stubs.size() == path.depth() + 1 && stubs.back().type == BINARY_ARRAY)
+    if (idx < 0 || walked != static_cast<uint64_t>(idx) || start == limit)
     {
-        uint64_t arr_sz;
-        const unsigned char* end = e::varint64_decode(stubs.back().set_start + 1, stubs.back().set_limit, &arr_sz);
+        errno = ENOENT;
+        return -1;
+    }
 
-        if (end == NULL || end + arr_sz != stubs.back().set_limit)
+    // the old buffer may go to a snapshot's readers, so keep our own copy
+    if (value)
+    {
+        size_t sz = limit - start;
+
+        if (m_popped_cap < sz)
         {
-            return -1;
+            unsigned char* tmp = reinterpret_cast<unsigned char*>(treadstone::allocate(&m_allocator, sz));
+
+            if (!tmp)
+            {
+                return -1;
+            }
+
+            treadstone::deallocate(&m_allocator, m_popped, m_popped_cap);
+            m_popped = tmp;
+            m_popped_cap = sz;
         }
 
-        unsigned char header[20];
-        header[0] = BINARY_ARRAY;
-        uint64_t body_sz = value_sz + arr_sz;
-        size_t header_sz = e::packvarint64(body_sz, header + 1) - header;
+        memmove(m_popped, start, sz);
+        *value = m_popped;
+        *value_sz = sz;
+    }
 
-        const unsigned char* rep_withs[3];
-        size_t rep_with_szs[3];
-        rep_withs[0] = header;
-        rep_withs[1] = value;
-        rep_withs[2] = end;
-        rep_with_szs[0] = header_sz;
-        rep_with_szs[1] = value_sz;
-        rep_with_szs[2] = arr_sz;
-        return replace(stubs, stubs.back().set_start, stubs.back().set_limit, rep_withs, rep_with_szs, 3);
+    return replace(stubs, start, limit, NULL, 0);
+}
+
+int
+treadstone_transformer :: array_trim_to(const char* p, size_t keep)
+{
+    stub_vector stubs((treadstone::stl_allocator<stub>(&m_allocator)));
+    uint64_t count = 0;
+
+    if (locate(p, BINARY_ARRAY, &stubs) < 0 ||
+        array_count(stubs.back(), &count) < 0)
+    {
+        return -1;
     }
-    // we fell short
-    else
+
+    if (count <= keep)
+    {
+        return 0;
+    }
+
+    // the oldest elements go, all in one cut
+    uint64_t walked = 0;
+    const unsigned char* first;
+    const unsigned char* cut;
+    const unsigned char* limit;
+
+    if (array_seek(stubs.back(), 0, &walked, &first, &limit) < 0 ||
+        array_seek(stubs.back(), count - keep, &walked, &cut, &limit) < 0)
     {
         return -1;
     }
+
+    return replace(stubs, first, cut, NULL, 0);
 }
 
 int
-treadstone_transformer :: array_append_value(const char* p,
-                                             const unsigned char* value, size_t value_sz)
+treadstone_transformer :: parse(const treadstone::path& path, stub_vector* stubs)
 {
-    treadstone::path path(p);
+    stubs->clear();
 
-    if (!path.is_valid())
+    if (m_index)
+    {
+        return parse_indexed(path, stubs);
+    }
+
+    return walk(&m_allocator, m_binary, m_binary_sz, path, stubs);
+}
+
+int
+treadstone_transformer :: walk(const treadstone_allocator* a,
+                               const unsigned char* binary, size_t binary_sz,
+                               const treadstone::path& path, stub_vector* stubs)
+{
+    if (path.depth() >= treadstone::max_depth())
     {
+        errno = EOVERFLOW;
         return -1;
     }
 
-    std::vector<stub> stubs;
+    const unsigned char* del_start = binary;
+    const unsigned char* del_limit = binary + binary_sz;
+    const unsigned char* set_start = del_start;
+    const unsigned char* set_limit = del_limit;
 
-    if (parse(path, &stubs) < 0)
+    // descend one component at a time, narrowing [set_start, set_limit) to
+    // the value it names
+    for (size_t depth = 0; ; ++depth)
     {
-        return -1;
-    }
+        if (set_start >= set_limit)
+        {
+            return -1;
+        }
 
-    // if we found exactly the field we wanted
-    if (stubs.size() == path.depth() + 1 && stubs.back().type == BINARY_ARRAY)
-    {
-        uint64_t arr_sz;
-        const unsigned char* end = e::varint64_decode(stubs.back().set_start + 1, stubs.back().set_limit, &arr_sz);
+        stubs->push_back(stub(*set_start, del_start, del_limit, set_start, set_limit));
 
-        if (end == NULL || end + arr_sz != stubs.back().set_limit)
+        if (path.depth() <= depth)
         {
-            return -1;
+            return static_cast<int>(depth);
         }
 
-        unsigned char header[20];
-        header[0] = BINARY_ARRAY;
-        uint64_t body_sz = value_sz + arr_sz;
-        size_t header_sz = e::packvarint64(body_sz, header + 1) - header;
+        int found = -1;
 
-        const unsigned char* rep_withs[3];
-        size_t rep_with_szs[3];
-        rep_withs[0] = header;
-        rep_withs[1] = end;
-        rep_withs[2] = value;
-        rep_with_szs[0] = header_sz;
-        rep_with_szs[1] = arr_sz;
-        rep_with_szs[2] = value_sz;
-        return replace(stubs, stubs.back().set_start, stubs.back().set_limit, rep_withs, rep_with_szs, 3);
-    }
-    // we fell short
-    else
-    {
-        return -1;
+        switch (*set_start)
+        {
+            case BINARY_OBJECT:
+                found = parse_object(path.get(depth), &del_start, &del_limit, &set_start, &set_limit);
+                break;
+            case BINARY_ARRAY:
+                found = parse_array(a, path.get(depth), &del_start, &del_limit, &set_start, &set_limit);
+                break;
+            case BINARY_STRING:
+            case BINARY_DOUBLE:
+            case BINARY_INTEGER:
+            case BINARY_TRUE:
+            case BINARY_FALSE:
+            case BINARY_NULL:
+                return static_cast<int>(depth);
+            default:
+                return -1;
+        }
+
+        if (found <= 0)
+        {
+            return found < 0 ? -1 : static_cast<int>(depth);
+        }
     }
 }
 
 int
-treadstone_transformer :: parse(const treadstone::path& path, std::vector<stub>* stubs)
+treadstone_transformer :: parse_indexed(const treadstone::path& path, stub_vector* stubs)
 {
-    stubs->clear();
-    unsigned char* start = m_binary;
-    unsigned char* limit = m_binary + m_binary_sz;
-    return parse_value(path, stubs, start, limit, start, limit, 0);
-}
+    using namespace treadstone;
 
-int
-treadstone_transformer :: parse_value(const treadstone::path& path,
-                                      std::vector<stub>* stubs,
-                                      const unsigned char* del_start,
-                                      const unsigned char* del_limit,
-                                      const unsigned char* set_start,
-                                      const unsigned char* set_limit,
-                                      unsigned depth)
-{
-    if (set_start >= set_limit)
+    if (path.depth() >= max_depth())
     {
+        errno = EOVERFLOW;
         return -1;
     }
 
-    stubs->push_back(stub(*set_start, del_start, del_limit, set_start, set_limit));
+    index_trail trail((stl_allocator<size_t>(&m_allocator)));
+    int depth = index_find(m_index->entries, m_binary, path, &trail);
 
-    if (path.depth() <= (size_t)depth)
+    for (size_t i = 0; i < trail.size(); ++i)
     {
-        return depth;
-    }
-
-    switch (*set_start)
-    {
-        case BINARY_OBJECT:
-            return parse_object(path, stubs, del_start, del_limit, set_start, set_limit, depth);
-        case BINARY_ARRAY:
-            return parse_array(path, stubs, del_start, del_limit, set_start, set_limit, depth);
-        case BINARY_STRING:
-        case BINARY_DOUBLE:
-        case BINARY_INTEGER:
-        case BINARY_TRUE:
-        case BINARY_FALSE:
-        case BINARY_NULL:
-            return depth;
-        default:
-            return -1;
+        const index_entry& e(m_index->entries[trail[i]]);
+        stubs->push_back(stub(e.type,
+                              m_binary + e.key_offset, m_binary + e.limit,
+                              m_binary + e.offset, m_binary + e.limit));
     }
 
-    return -1;
+    return depth;
 }
 
 int
-treadstone_transformer :: parse_object(const treadstone::path& path,
-                                       std::vector<stub>* stubs,
-                                       const unsigned char*,
-                                       const unsigned char*,
-                                       const unsigned char* set_start,
-                                       const unsigned char* set_limit,
-                                       unsigned depth)
+treadstone_transformer :: parse_object(const treadstone::path::component& c,
+                                       const unsigned char** del_start,
+                                       const unsigned char** del_limit,
+                                       const unsigned char** set_start_ptr,
+                                       const unsigned char** set_limit_ptr)
 {
     using namespace treadstone;
-    assert(path.depth() > depth);
-    const path::component& c = path.get(depth);
 
     if (c.type != path::FIELD)
     {
         return -1;
     }
 
+    const unsigned char* const set_start = *set_start_ptr;
+    const unsigned char* const set_limit = *set_limit_ptr;
     assert(*set_start == BINARY_OBJECT);
     assert(set_start < set_limit);
     uint64_t obj_sz;
-    const unsigned char* end = e::varint64_decode(set_start + 1, set_limit, &obj_sz);
+    const unsigned char* end = treadstone::varint64_decode(set_start + 1, set_limit, &obj_sz);
 
     if (end == NULL || end + obj_sz > set_limit)
     {
@@ -1756,16 +3743,19 @@ treadstone_transformer :: parse_object(const treadstone::path& path,
     const unsigned char* tmp = end;
     end += obj_sz;
     assert(end <= set_limit);
+    uint64_t steps = 0;
 
     while (tmp < end)
     {
+        ++steps;
+
         if (*tmp != BINARY_STRING)
         {
             return -1;
         }
 
         uint64_t key_sz = 0;
-        const unsigned char* key_sz_end = e::varint64_decode(tmp + 1, end, &key_sz);
+        const unsigned char* key_sz_end = treadstone::varint64_decode(tmp + 1, end, &key_sz);
 
         if (key_sz_end == NULL || key_sz_end + key_sz >= end)
         {
@@ -1784,7 +3774,7 @@ treadstone_transformer :: parse_object(const treadstone::path& path,
             case BINARY_OBJECT:
             case BINARY_ARRAY:
             case BINARY_STRING:
-                val_tmp = e::varint64_decode(val_start + 1, end, &val_sz);
+                val_tmp = treadstone::varint64_decode(val_start + 1, end, &val_sz);
 
                 if (val_tmp == NULL || val_tmp + val_sz > end)
                 {
@@ -1797,7 +3787,7 @@ treadstone_transformer :: parse_object(const treadstone::path& path,
                 val_sz = 9;
                 break;
             case BINARY_INTEGER:
-                val_tmp = e::varint64_decode(val_start + 1, end, &val_sz);
+                val_tmp = treadstone::varint64_decode(val_start + 1, end, &val_sz);
 
                 if (val_tmp == NULL)
                 {
@@ -1818,38 +3808,43 @@ treadstone_transformer :: parse_object(const treadstone::path& path,
         const unsigned char* const val_limit = val_start + val_sz;
         tmp = val_limit;
 
-        if (c.field.size() == key_sz &&
-            memcmp(c.field.data(), key_sz_end, key_sz) == 0)
+        if (c.field_sz == key_sz &&
+            memcmp(c.field, key_sz_end, key_sz) == 0)
         {
-            return parse_value(path, stubs, key_start, val_limit, val_start, val_limit, depth + 1);
+            stat_add(STAT_TRANSFORM_STEPS, steps);
+            *del_start = key_start;
+            *del_limit = val_limit;
+            *set_start_ptr = val_start;
+            *set_limit_ptr = val_limit;
+            return 1;
         }
     }
 
-    return depth;
+    stat_add(STAT_TRANSFORM_STEPS, steps);
+    return 0;
 }
 
 int
-treadstone_transformer :: parse_array(const treadstone::path& path,
-                                      std::vector<stub>* stubs,
-                                      const unsigned char*,
-                                      const unsigned char*,
-                                      const unsigned char* set_start,
-                                      const unsigned char* set_limit,
-                                      unsigned depth)
+treadstone_transformer :: parse_array(const treadstone_allocator* a,
+                                      const treadstone::path::component& c,
+                                      const unsigned char** del_start,
+                                      const unsigned char** del_limit,
+                                      const unsigned char** set_start_ptr,
+                                      const unsigned char** set_limit_ptr)
 {
     using namespace treadstone;
-    assert(path.depth() > depth);
-    const path::component& c = path.get(depth);
 
     if (c.type != path::INDEX)
     {
         return -1;
     }
 
+    const unsigned char* const set_start = *set_start_ptr;
+    const unsigned char* const set_limit = *set_limit_ptr;
     assert(*set_start == BINARY_ARRAY);
     assert(set_start < set_limit);
     uint64_t arr_sz;
-    const unsigned char* end = e::varint64_decode(set_start + 1, set_limit, &arr_sz);
+    const unsigned char* end = treadstone::varint64_decode(set_start + 1, set_limit, &arr_sz);
 
     if (end == NULL || end + arr_sz > set_limit)
     {
@@ -1859,7 +3854,7 @@ treadstone_transformer :: parse_array(const treadstone::path& path,
     const unsigned char* tmp = end;
     end += arr_sz;
     assert(end <= set_limit);
-    std::vector<stub> elements;
+    stub_vector elements((treadstone::stl_allocator<stub>(a)));
 
     while (tmp < end)
     {
@@ -1872,7 +3867,7 @@ treadstone_transformer :: parse_array(const treadstone::path& path,
             case BINARY_OBJECT:
             case BINARY_ARRAY:
             case BINARY_STRING:
-                elem_tmp = e::varint64_decode(elem_start + 1, end, &elem_sz);
+                elem_tmp = treadstone::varint64_decode(elem_start + 1, end, &elem_sz);
 
                 if (elem_tmp == NULL || elem_tmp + elem_sz > end)
                 {
@@ -1885,7 +3880,7 @@ treadstone_transformer :: parse_array(const treadstone::path& path,
                 elem_sz = 9;
                 break;
             case BINARY_INTEGER:
-                elem_tmp = e::varint64_decode(elem_start + 1, end, &elem_sz);
+                elem_tmp = treadstone::varint64_decode(elem_start + 1, end, &elem_sz);
 
                 if (elem_tmp == NULL)
                 {
@@ -1908,6 +3903,7 @@ treadstone_transformer :: parse_array(const treadstone::path& path,
         tmp = elem_limit;
     }
 
+    stat_add(STAT_TRANSFORM_STEPS, elements.size());
     const stub* e = NULL;
 
     if (c.index >= 0 && (size_t)c.index < elements.size())
@@ -1921,7 +3917,11 @@ treadstone_transformer :: parse_array(const treadstone::path& path,
 
     if (e)
     {
-        return parse_value(path, stubs, e->del_start, e->del_limit, e->set_start, e->set_limit, depth + 1);
+        *del_start = e->del_start;
+        *del_limit = e->del_limit;
+        *set_start_ptr = e->set_start;
+        *set_limit_ptr = e->set_limit;
+        return 1;
     }
     else
     {
@@ -1930,7 +3930,7 @@ treadstone_transformer :: parse_array(const treadstone::path& path,
 }
 
 int
-treadstone_transformer :: replace(const std::vector<stub>& stubs,
+treadstone_transformer :: replace(const stub_vector& stubs,
                                   const unsigned char* cut_start,
                                   const unsigned char* cut_limit,
                                   const unsigned char* rep_with,
@@ -1940,7 +3940,7 @@ treadstone_transformer :: replace(const std::vector<stub>& stubs,
 }
 
 int
-treadstone_transformer :: replace(const std::vector<stub>& stubs,
+treadstone_transformer :: replace(const stub_vector& stubs,
                                   const unsigned char* cut_start,
                                   const unsigned char* cut_limit,
                                   const unsigned char** rep_withs,
@@ -1954,11 +3954,25 @@ treadstone_transformer :: replace(const std::vector<stub>& stubs,
         cumul_rep += rep_with_szs[i];
     }
 
-    size_t new_binary_sz = m_binary_sz + cumul_rep + e::varint_length(cumul_rep) * (1 + stubs.size());
-    size_t new_binary_cap = new_binary_sz;
+    size_t new_binary_bound = m_binary_sz + cumul_rep + e::varint_length(cumul_rep) * (1 + stubs.size());
+    size_t new_binary_sz = 0;
+    size_t new_binary_cap = 0;
     unsigned char* new_binary = NULL;
-    e::guard g = e::makeguard(treadstone::free_if_allocated_unsigned_char_star, &new_binary);
-    new_binary = reinterpret_cast<unsigned char*>(malloc(sizeof(unsigned char) * new_binary_sz));
+
+    if (m_spare_cap >= new_binary_bound)
+    {
+        new_binary = m_spare;
+        new_binary_cap = m_spare_cap;
+    }
+    else
+    {
+        treadstone::deallocate(&m_allocator, m_spare, m_spare_cap);
+        new_binary = reinterpret_cast<unsigned char*>(treadstone::allocate(&m_allocator, sizeof(unsigned char) * new_binary_bound));
+        new_binary_cap = new_binary_bound;
+    }
+
+    m_spare = NULL;
+    m_spare_cap = 0;
 
     if (!new_binary)
     {
@@ -1969,7 +3983,7 @@ treadstone_transformer :: replace(const std::vector<stub>& stubs,
 
     // work backwards because inner varints may change in size, affecting the
     // outter varints
-    unsigned char* out = new_binary + new_binary_sz;
+    unsigned char* out = new_binary + new_binary_bound;
     size_t remnants = m_binary + m_binary_sz - cut_limit;
     out -= remnants;
     memmove(out, cut_limit, remnants);
@@ -1978,7 +3992,11 @@ treadstone_transformer :: replace(const std::vector<stub>& stubs,
     {
         size_t idx = reps - i - 1;
         out -= rep_with_szs[idx];
-        memmove(out, rep_withs[idx], rep_with_szs[idx]);
+
+        if (rep_with_szs[idx] > 0)
+        {
+            memmove(out, rep_withs[idx], rep_with_szs[idx]);
+        }
     }
 
     const unsigned char* prev = cut_start;
@@ -1994,10 +4012,12 @@ treadstone_transformer :: replace(const std::vector<stub>& stubs,
         {
             const unsigned char* varint_end = NULL;
             uint64_t varint;
-            varint_end = e::varint64_decode(s.set_start + 1, prev, &varint);
+            varint_end = treadstone::varint64_decode(s.set_start + 1, prev, &varint);
 
             if (varint_end == NULL || varint_end + varint != s.set_limit)
             {
+                m_spare = new_binary;
+                m_spare_cap = new_binary_cap;
                 return -1;
             }
 
@@ -2014,17 +4034,25 @@ treadstone_transformer :: replace(const std::vector<stub>& stubs,
         }
     }
 
-    new_binary_sz = (new_binary + new_binary_cap) - out;
+    new_binary_sz = (new_binary + new_binary_bound) - out;
     memmove(new_binary, out, new_binary_sz);
     out = NULL;
-
+    // once into place from the back, then down to the front of the buffer
+    treadstone::stat_add(treadstone::STAT_TRANSFORM_BYTES_COPIED, 2 * new_binary_sz);
+    treadstone::stat_record(treadstone::STAT_REWRITE_BYTES, new_binary_sz);
+
+    // a version a snapshot still holds cannot become the spare
+    thaw();
+    m_spare = m_binary;
+    m_spare_cap = m_binary_cap;
+    m_index = NULL;
+    m_binary = new_binary;
     m_binary_sz = new_binary_sz;
     m_binary_cap = new_binary_cap;
-    std::swap(m_binary, new_binary);
 
     if (m_binary_sz == 0)
     {
-        if (!treadstone::j2b_make_room_for(2, &m_binary, &m_binary_sz, &m_binary_cap))
+        if (!treadstone::j2b_make_room_for(2, &m_binary, &m_binary_sz, &m_binary_cap, &m_allocator))
         {
             return -1;
         }
@@ -2039,16 +4067,79 @@ treadstone_transformer :: replace(const std::vector<stub>& stubs,
 TREADSTONE_API struct treadstone_transformer*
 treadstone_transformer_create(const unsigned char* binary, size_t binary_sz)
 {
-    return new (std::nothrow) treadstone_transformer(binary, binary_sz);
+    return treadstone_transformer_create_alloc(NULL, binary, binary_sz);
+}
+
+TREADSTONE_API struct treadstone_transformer*
+treadstone_transformer_create_alloc(const treadstone_allocator* a,
+                                    const unsigned char* binary, size_t binary_sz)
+{
+    a = treadstone::allocator_or_default(a);
+    void* mem = treadstone::allocate(a, sizeof(treadstone_transformer));
+
+    if (!mem)
+    {
+        return NULL;
+    }
+
+    treadstone_transformer* trans = new (mem) treadstone_transformer(a, binary, binary_sz);
+
+    if (trans->failed())
+    {
+        treadstone_transformer_destroy(trans);
+        return NULL;
+    }
+
+    return trans;
+}
+
+TREADSTONE_API struct treadstone_transformer*
+treadstone_transformer_create_arena(struct treadstone_arena* arena,
+                                    const unsigned char* binary, size_t binary_sz)
+{
+    // the session outlives every reset of the arena, so it cannot live there
+    treadstone_transformer* trans = new (std::nothrow) treadstone_transformer(arena, binary, binary_sz);
+
+    if (trans && trans->failed())
+    {
+        treadstone_transformer_destroy(trans);
+        return NULL;
+    }
+
+    return trans;
 }
 
 TREADSTONE_API void
 treadstone_transformer_destroy(struct treadstone_transformer* trans)
 {
-    if (trans)
+    if (!trans)
+    {
+        return;
+    }
+
+    if (trans->arena())
     {
         delete trans;
+        return;
     }
+
+    treadstone_allocator a = *trans->allocator();
+    trans->~treadstone_transformer();
+    treadstone::deallocate(&a, trans, sizeof(treadstone_transformer));
+}
+
+TREADSTONE_API int
+treadstone_transformer_reset(struct treadstone_transformer* trans,
+                             const unsigned char* binary, size_t binary_sz)
+{
+    return trans->reset(binary, binary_sz);
+}
+
+TREADSTONE_API int
+treadstone_transformer_use_index(struct treadstone_transformer* trans,
+                                 const struct treadstone_index* idx)
+{
+    return trans->use_index(idx);
 }
 
 TREADSTONE_API int
@@ -2062,7 +4153,18 @@ TREADSTONE_API int
 treadstone_transformer_unset_value(struct treadstone_transformer* trans,
                                    const char* path)
 {
-    return trans->unset_value(path);
+    treadstone::stat_op op(treadstone::STAT_TRANSFORMS, treadstone::STAT_TRANSFORM_NS);
+    treadstone::trace_span trace(TREADSTONE_TRACE_UNSET, trans->size(), path);
+
+    try
+    {
+        return trace.done(trans->unset_value(path));
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
 }
 
 TREADSTONE_API int
@@ -2070,7 +4172,18 @@ treadstone_transformer_set_value(struct treadstone_transformer* trans,
                                  const char* path,
                                  const unsigned char* value, size_t value_sz)
 {
-    return trans->set_value(path, value, value_sz);
+    treadstone::stat_op op(treadstone::STAT_TRANSFORMS, treadstone::STAT_TRANSFORM_NS);
+    treadstone::trace_span trace(TREADSTONE_TRACE_SET, trans->size(), path);
+
+    try
+    {
+        return trace.done(trans->set_value(path, value, value_sz));
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
 }
 
 TREADSTONE_API int
@@ -2078,7 +4191,18 @@ treadstone_transformer_extract_value(struct treadstone_transformer* trans,
                                      const char* path,
                                      unsigned char** value, size_t* value_sz)
 {
-    return trans->extract_value(path, value, value_sz);
+    treadstone::stat_op op(treadstone::STAT_TRANSFORMS, treadstone::STAT_TRANSFORM_NS);
+    treadstone::trace_span trace(TREADSTONE_TRACE_EXTRACT, trans->size(), path);
+
+    try
+    {
+        return trace.done(trans->extract_value(path, value, value_sz));
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
 }
 
 TREADSTONE_API int
@@ -2086,7 +4210,18 @@ treadstone_transformer_array_prepend_value(struct treadstone_transformer* trans,
                                            const char* path,
                                            const unsigned char* value, size_t value_sz)
 {
-    return trans->array_prepend_value(path, value, value_sz);
+    treadstone::stat_op op(treadstone::STAT_TRANSFORMS, treadstone::STAT_TRANSFORM_NS);
+    treadstone::trace_span trace(TREADSTONE_TRACE_ARRAY_PREPEND, trans->size(), path);
+
+    try
+    {
+        return trace.done(trans->array_prepend_value(path, value, value_sz));
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
 }
 
 TREADSTONE_API int
@@ -2094,5 +4229,224 @@ treadstone_transformer_array_append_value(struct treadstone_transformer* trans,
                                           const char* path,
                                           const unsigned char* value, size_t value_sz)
 {
-    return trans->array_append_value(path, value, value_sz);
+    treadstone::stat_op op(treadstone::STAT_TRANSFORMS, treadstone::STAT_TRANSFORM_NS);
+    treadstone::trace_span trace(TREADSTONE_TRACE_ARRAY_APPEND, trans->size(), path);
+
+    try
+    {
+        return trace.done(trans->array_append_value(path, value, value_sz));
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+}
+
+TREADSTONE_API struct treadstone_snapshot*
+treadstone_transformer_snapshot(struct treadstone_transformer* trans)
+{
+    return trans->snapshot();
+}
+
+TREADSTONE_API void
+treadstone_snapshot_retain(struct treadstone_snapshot* snap)
+{
+    snap->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+TREADSTONE_API void
+treadstone_snapshot_release(struct treadstone_snapshot* snap)
+{
+    if (snap)
+    {
+        snapshot_release(snap);
+    }
+}
+
+TREADSTONE_API void
+treadstone_snapshot_binary(const struct treadstone_snapshot* snap,
+                           const unsigned char** binary, size_t* binary_sz)
+{
+    *binary = snap->binary;
+    *binary_sz = snap->binary_sz;
+}
+
+TREADSTONE_API int
+treadstone_snapshot_extract_value(const struct treadstone_snapshot* snap,
+                                  const char* path,
+                                  unsigned char** value, size_t* value_sz)
+{
+    treadstone::stat_op op(treadstone::STAT_TRANSFORMS, treadstone::STAT_TRANSFORM_NS);
+    treadstone::trace_span trace(TREADSTONE_TRACE_EXTRACT, snap->binary_sz, path);
+
+    try
+    {
+        return trace.done(treadstone_transformer::extract_from(&snap->allocator,
+                                                               snap->binary, snap->binary_sz,
+                                                               path, value, value_sz));
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+}
+
+TREADSTONE_API int
+treadstone_snapshot_to_json(const struct treadstone_snapshot* snap, char** json)
+{
+    return treadstone_binary_to_json_alloc(&snap->allocator, snap->binary, snap->binary_sz, json);
+}
+
+TREADSTONE_API int
+treadstone_transformer_integer_op(struct treadstone_transformer* trans,
+                                  const char* path,
+                                  enum treadstone_numeric_op op,
+                                  int64_t operand, int64_t* result)
+{
+    treadstone::stat_op sop(treadstone::STAT_TRANSFORMS, treadstone::STAT_TRANSFORM_NS);
+    treadstone::trace_span trace(TREADSTONE_TRACE_NUMERIC, trans->size(), path);
+
+    try
+    {
+        return trace.done(trans->integer_op(path, op, operand, result));
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+}
+
+TREADSTONE_API int
+treadstone_transformer_double_op(struct treadstone_transformer* trans,
+                                 const char* path,
+                                 enum treadstone_numeric_op op,
+                                 double operand, double* result)
+{
+    treadstone::stat_op sop(treadstone::STAT_TRANSFORMS, treadstone::STAT_TRANSFORM_NS);
+    treadstone::trace_span trace(TREADSTONE_TRACE_NUMERIC, trans->size(), path);
+
+    try
+    {
+        return trace.done(trans->double_op(path, op, operand, result));
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+}
+
+TREADSTONE_API int
+treadstone_transformer_string_append(struct treadstone_transformer* trans,
+                                     const char* path,
+                                     const char* str, size_t str_sz)
+{
+    treadstone::stat_op op(treadstone::STAT_TRANSFORMS, treadstone::STAT_TRANSFORM_NS);
+    treadstone::trace_span trace(TREADSTONE_TRACE_STRING_APPEND, trans->size(), path);
+
+    try
+    {
+        return trace.done(trans->string_append(path, str, str_sz));
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+}
+
+TREADSTONE_API int
+treadstone_transformer_array_insert_at(struct treadstone_transformer* trans,
+                                       const char* path, int64_t idx,
+                                       const unsigned char* value, size_t value_sz)
+{
+    treadstone::stat_op op(treadstone::STAT_TRANSFORMS, treadstone::STAT_TRANSFORM_NS);
+    treadstone::trace_span trace(TREADSTONE_TRACE_ARRAY_INSERT, trans->size(), path);
+
+    try
+    {
+        return trace.done(trans->array_insert_at(path, idx, value, value_sz));
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+}
+
+TREADSTONE_API int
+treadstone_transformer_array_remove_at(struct treadstone_transformer* trans,
+                                       const char* path, int64_t idx)
+{
+    treadstone::stat_op op(treadstone::STAT_TRANSFORMS, treadstone::STAT_TRANSFORM_NS);
+    treadstone::trace_span trace(TREADSTONE_TRACE_ARRAY_REMOVE, trans->size(), path);
+
+    try
+    {
+        return trace.done(trans->array_remove_at(path, idx, NULL, NULL));
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+}
+
+TREADSTONE_API int
+treadstone_transformer_array_pop_front(struct treadstone_transformer* trans,
+                                       const char* path,
+                                       const unsigned char** value, size_t* value_sz)
+{
+    treadstone::stat_op op(treadstone::STAT_TRANSFORMS, treadstone::STAT_TRANSFORM_NS);
+    treadstone::trace_span trace(TREADSTONE_TRACE_ARRAY_REMOVE, trans->size(), path);
+
+    try
+    {
+        return trace.done(trans->array_remove_at(path, 0, value, value_sz));
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+}
+
+TREADSTONE_API int
+treadstone_transformer_array_pop_back(struct treadstone_transformer* trans,
+                                      const char* path,
+                                      const unsigned char** value, size_t* value_sz)
+{
+    treadstone::stat_op op(treadstone::STAT_TRANSFORMS, treadstone::STAT_TRANSFORM_NS);
+    treadstone::trace_span trace(TREADSTONE_TRACE_ARRAY_REMOVE, trans->size(), path);
+
+    try
+    {
+        return trace.done(trans->array_remove_at(path, -1, value, value_sz));
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+}
+
+TREADSTONE_API int
+treadstone_transformer_array_trim_to(struct treadstone_transformer* trans,
+                                     const char* path, size_t keep)
+{
+    treadstone::stat_op op(treadstone::STAT_TRANSFORMS, treadstone::STAT_TRANSFORM_NS);
+    treadstone::trace_span trace(TREADSTONE_TRACE_ARRAY_REMOVE, trans->size(), path);
+
+    try
+    {
+        return trace.done(trans->array_trim_to(path, keep));
+    }
+    catch (std::bad_alloc&)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
 }